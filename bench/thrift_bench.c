@@ -0,0 +1,174 @@
+/*
+ * Microbenchmark for the varint and big-endian kernels of
+ * pg_thrift_kernels.h. Build and run with `make bench`.
+ */
+#include <postgres_fe.h>
+#include <time.h>
+
+#include "../pg_thrift_kernels.h"
+
+#define BENCH_VALUES 10000
+#define BENCH_ROUNDS 2000
+
+// the element loop pg_thrift used before the kernels
+static const uint8* scalar_decode_n(const uint8* p, const uint8* end, int64* values, int64 n) {
+  for (int64 i = 0; i < n; i++) {
+    const uint8* start = p;
+    uint64 val = 0;
+    while (p < end) {
+      val |= (uint64)(*p & 0x7f) << (7 * (p - start));
+      if (*p & 0x80) p++;
+      else break;
+    }
+    if (p >= end) return NULL;
+    p++;
+    values[i] = thrift_zigzag_decode(val);
+  }
+  return p;
+}
+
+static const uint8* scalar_skip_n(const uint8* p, const uint8* end, int64 n) {
+  for (int64 i = 0; i < n; i++) {
+    while (p < end && (*p & 0x80)) p++;
+    if (p >= end) return NULL;
+    p++;
+  }
+  return p;
+}
+
+// the big-endian int and double loads pg_thrift used before the kernels
+static int64 shift_load(const uint8* p, int len) {
+  int64 val = 0;
+  for (int i = 0; i < len; i++) {
+    val = (val << 8) + p[i];
+  }
+  return val;
+}
+
+static bool runtime_big_endian(void) {
+  uint32 i = 1;
+  char* c = (char*)&i;
+  return !(*c);
+}
+
+static void swap_bytes(char* bytes, int len) {
+  for (int i = 0; i < len / 2; i++) {
+    char tmp = bytes[i];
+    bytes[i] = bytes[len - 1 - i];
+    bytes[len - 1 - i] = tmp;
+  }
+}
+
+static void scalar_load_n(const uint8* src, void* dst, int64 n, int width, bool is_double) {
+  for (int64 i = 0; i < n; i++) {
+    if (is_double) {
+      float8 value;
+      memcpy(&value, src + i * width, width);
+      if (!runtime_big_endian()) {
+        swap_bytes((char*)&value, width);
+      }
+      ((float8*)dst)[i] = value;
+    } else if (width == 4) {
+      ((int32*)dst)[i] = shift_load(src + i * width, width);
+    } else {
+      ((int64*)dst)[i] = shift_load(src + i * width, width);
+    }
+  }
+}
+
+static int encode(uint8* out, int64 value) {
+  uint64 zigzag = ((uint64)value << 1) ^ (uint64)(value >> 63);
+  int len = 0;
+  while (zigzag >= 0x80) {
+    out[len++] = (zigzag & 0x7f) | 0x80;
+    zigzag >>= 7;
+  }
+  out[len++] = zigzag;
+  return len;
+}
+
+static double now(void) {
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void report(const char* name, double seconds) {
+  printf("  %-8s %8.2f ns/value\n", name, seconds * 1e9 / ((double)BENCH_VALUES * BENCH_ROUNDS));
+}
+
+static void run(const char* title, int64 max_value) {
+  static uint8 data[BENCH_VALUES * MAX_VARINT_LEN];
+  static int64 values[BENCH_VALUES];
+  int64 check = 0;
+  int len = 0;
+
+  srand(42);
+  for (int i = 0; i < BENCH_VALUES; i++) {
+    int64 value = (((int64)rand() << 31) | rand()) % (2 * max_value + 1) - max_value;
+    len += encode(data + len, value);
+  }
+  printf("%s (%d values, %d bytes)\n", title, BENCH_VALUES, len);
+
+  double start = now();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    check += scalar_decode_n(data, data + len, values, BENCH_VALUES) - data;
+    check += values[r % BENCH_VALUES];
+  }
+  report("decode", now() - start);
+  start = now();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    check += thrift_varint_decode_n(data, data + len, values, BENCH_VALUES) - data;
+    check += values[r % BENCH_VALUES];
+  }
+  report("kernel", now() - start);
+
+  start = now();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    check += scalar_skip_n(data, data + len, BENCH_VALUES - r % 2) - data;
+  }
+  report("skip", now() - start);
+  start = now();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    check += thrift_varint_skip_n(data, data + len, BENCH_VALUES - r % 2) - data;
+  }
+  report("kernel", now() - start);
+
+  // keeps the loops from being optimized away
+  if (check == 42) printf("\n");
+}
+
+static void run_fixed(const char* title, int width, bool is_double) {
+  static uint8 data[BENCH_VALUES * 8];
+  static uint8 values[BENCH_VALUES * 8];
+  int64 check = 0;
+
+  srand(42);
+  for (int i = 0; i < BENCH_VALUES * width; i++) {
+    data[i] = rand();
+  }
+  printf("%s (%d values, %d bytes)\n", title, BENCH_VALUES, BENCH_VALUES * width);
+
+  double start = now();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    scalar_load_n(data, values, BENCH_VALUES, width, is_double);
+    check += values[r % (BENCH_VALUES * width)];
+  }
+  report("load", now() - start);
+  start = now();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    thrift_load_be_n(data, values, BENCH_VALUES, width);
+    check += values[r % (BENCH_VALUES * width)];
+  }
+  report("kernel", now() - start);
+
+  if (check == 42) printf("\n");
+}
+
+int main(void) {
+  run("1 byte varints", 63);
+  run("mixed varints", 1 << 20);
+  run("wide varints", (int64)1 << 40);
+  run_fixed("binary i32 list", 4, false);
+  run_fixed("binary i64 list", 8, false);
+  run_fixed("binary double list", 8, true);
+  return 0;
+}
@@ -156,6 +156,133 @@ CREATE FUNCTION thrift_compact_get_map_bytea(bytea, int)
     AS 'MODULE_PATHNAME'
     LANGUAGE C STRICT IMMUTABLE;
 
+CREATE FUNCTION thrift_binary_get_list_bool(bytea, int)
+    RETURNS boolean[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_list_bool(bytea, int)
+    RETURNS boolean[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_list_int16(bytea, int)
+    RETURNS smallint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_list_int16(bytea, int)
+    RETURNS smallint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_list_int32(bytea, int)
+    RETURNS int[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_list_int32(bytea, int)
+    RETURNS int[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_list_int64(bytea, int)
+    RETURNS bigint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_list_int64(bytea, int)
+    RETURNS bigint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_list_double(bytea, int)
+    RETURNS double precision[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_list_double(bytea, int)
+    RETURNS double precision[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_list_string(bytea, int)
+    RETURNS text[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_list_string(bytea, int)
+    RETURNS text[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_each_list(bytea, int)
+    RETURNS SETOF bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_each_list(bytea, int)
+    RETURNS SETOF bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_each_map(bytea, int, OUT key bytea, OUT value bytea)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_each_map(bytea, int, OUT key bytea, OUT value bytea)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_read_framed(text, boolean)
+    RETURNS SETOF bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION thrift_binary_read_framed(text, boolean, int[])
+    RETURNS SETOF bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION thrift_compact_read_framed(text, boolean)
+    RETURNS SETOF bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION thrift_compact_read_framed(text, boolean, int[])
+    RETURNS SETOF bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
+-- like pg_read_binary_file these read server files, so only superusers and
+-- roles granted EXECUTE may call them
+REVOKE ALL ON FUNCTION thrift_binary_read_framed(text, boolean) FROM PUBLIC;
+REVOKE ALL ON FUNCTION thrift_binary_read_framed(text, boolean, int[]) FROM PUBLIC;
+REVOKE ALL ON FUNCTION thrift_compact_read_framed(text, boolean) FROM PUBLIC;
+REVOKE ALL ON FUNCTION thrift_compact_read_framed(text, boolean, int[]) FROM PUBLIC;
+
+CREATE FUNCTION thrift_binary_get_fields(bytea, int[])
+    RETURNS record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_fields(bytea, int[])
+    RETURNS record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_field_cache_stats(OUT hits bigint, OUT misses bigint)
+    RETURNS record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION thrift_field_cache_reset_stats()
+    RETURNS void
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
 
 CREATE FUNCTION parse_thrift_compact_string(bytea)
     RETURNS text
@@ -209,9 +336,21 @@ CREATE FUNCTION thrift_binary_out(thrift_binary)
     AS 'MODULE_PATHNAME'
     LANGUAGE C IMMUTABLE STRICT;
 
+CREATE FUNCTION thrift_binary_recv(internal)
+    RETURNS thrift_binary
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STABLE STRICT;
+
+CREATE FUNCTION thrift_binary_send(thrift_binary)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
 CREATE TYPE thrift_binary (
     INPUT = thrift_binary_in,
     OUTPUT = thrift_binary_out,
+    RECEIVE = thrift_binary_recv,
+    SEND = thrift_binary_send,
     LIKE = bytea
 );
 
@@ -229,3 +368,1081 @@ CREATE FUNCTION jsonb_to_thrift_binary(jsonb)
     RETURNS bytea
     AS 'MODULE_PATHNAME'
     LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION jsonb_to_thrift_compact(jsonb)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_to_compact(bytea)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_to_binary(bytea)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_to_jsonb(bytea)
+    RETURNS jsonb
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_to_jsonb(bytea)
+    RETURNS jsonb
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE TYPE thrift_indexed;
+
+CREATE FUNCTION thrift_indexed_in(cstring)
+    RETURNS thrift_indexed
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION thrift_indexed_out(thrift_indexed)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE thrift_indexed (
+    INPUT = thrift_indexed_in,
+    OUTPUT = thrift_indexed_out,
+    INTERNALLENGTH = VARIABLE,
+    ALIGNMENT = int4,
+    STORAGE = extended
+);
+
+CREATE FUNCTION thrift_binary_indexed(bytea)
+    RETURNS thrift_indexed
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_indexed(bytea)
+    RETURNS thrift_indexed
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_bytea(thrift_indexed)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_to_indexed(thrift_binary)
+    RETURNS thrift_indexed
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_to_binary(thrift_indexed)
+    RETURNS thrift_binary
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE CAST (bytea AS thrift_indexed)
+    WITH FUNCTION thrift_binary_indexed(bytea) AS ASSIGNMENT;
+
+CREATE CAST (thrift_indexed AS bytea)
+    WITH FUNCTION thrift_indexed_bytea(thrift_indexed);
+
+CREATE CAST (thrift_binary AS thrift_indexed)
+    WITH FUNCTION thrift_binary_to_indexed(thrift_binary);
+
+CREATE CAST (thrift_indexed AS thrift_binary)
+    WITH FUNCTION thrift_indexed_to_binary(thrift_indexed);
+
+CREATE FUNCTION thrift_indexed_get_bool(thrift_indexed, int)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_byte(thrift_indexed, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_double(thrift_indexed, int)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_int16(thrift_indexed, int)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_int32(thrift_indexed, int)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_int64(thrift_indexed, int)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_string(thrift_indexed, int)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_struct_bytea(thrift_indexed, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_list_bytea(thrift_indexed, int)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_set_bytea(thrift_indexed, int)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_get_map_bytea(thrift_indexed, int)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE TYPE thrift_path;
+
+CREATE FUNCTION thrift_path_in(cstring)
+    RETURNS thrift_path
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION thrift_path_out(thrift_path)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE thrift_path (
+    INPUT = thrift_path_in,
+    OUTPUT = thrift_path_out,
+    INTERNALLENGTH = VARIABLE,
+    ALIGNMENT = double,
+    STORAGE = extended
+);
+
+CREATE FUNCTION thrift_binary_get_path_bool(bytea, int[])
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_bool(bytea, thrift_path)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_byte(bytea, int[])
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_byte(bytea, thrift_path)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_double(bytea, int[])
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_double(bytea, thrift_path)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_int16(bytea, int[])
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_int16(bytea, thrift_path)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_int32(bytea, int[])
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_int32(bytea, thrift_path)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_int64(bytea, int[])
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_int64(bytea, thrift_path)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_string(bytea, int[])
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_string(bytea, thrift_path)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_struct_bytea(bytea, int[])
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_struct_bytea(bytea, thrift_path)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_list_bytea(bytea, int[])
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_list_bytea(bytea, thrift_path)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_set_bytea(bytea, int[])
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_set_bytea(bytea, thrift_path)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_map_bytea(bytea, int[])
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_get_path_map_bytea(bytea, thrift_path)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_bool(bytea, int[])
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_bool(bytea, thrift_path)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_byte(bytea, int[])
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_byte(bytea, thrift_path)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_double(bytea, int[])
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_double(bytea, thrift_path)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_int16(bytea, int[])
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_int16(bytea, thrift_path)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_int32(bytea, int[])
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_int32(bytea, thrift_path)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_int64(bytea, int[])
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_int64(bytea, thrift_path)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_string(bytea, int[])
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_string(bytea, thrift_path)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_struct_bytea(bytea, int[])
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_struct_bytea(bytea, thrift_path)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_list_bytea(bytea, int[])
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_list_bytea(bytea, thrift_path)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_set_bytea(bytea, int[])
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_set_bytea(bytea, thrift_path)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_map_bytea(bytea, int[])
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_get_path_map_bytea(bytea, thrift_path)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_bool(bytea, int, bigint)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_bool(bytea, int, text)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_byte(bytea, int, bigint)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_byte(bytea, int, text)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_double(bytea, int, bigint)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_double(bytea, int, text)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_int16(bytea, int, bigint)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_int16(bytea, int, text)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_int32(bytea, int, bigint)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_int32(bytea, int, text)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_int64(bytea, int, bigint)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_int64(bytea, int, text)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_string(bytea, int, bigint)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_string(bytea, int, text)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_struct_bytea(bytea, int, bigint)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_struct_bytea(bytea, int, text)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_list_bytea(bytea, int, bigint)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_list_bytea(bytea, int, text)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_set_bytea(bytea, int, bigint)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_set_bytea(bytea, int, text)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_map_bytea(bytea, int, bigint)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_map_get_map_bytea(bytea, int, text)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_bool(bytea, int, bigint)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_bool(bytea, int, text)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_byte(bytea, int, bigint)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_byte(bytea, int, text)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_double(bytea, int, bigint)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_double(bytea, int, text)
+    RETURNS double precision
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_int16(bytea, int, bigint)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_int16(bytea, int, text)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_int32(bytea, int, bigint)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_int32(bytea, int, text)
+    RETURNS int
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_int64(bytea, int, bigint)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_int64(bytea, int, text)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_string(bytea, int, bigint)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_string(bytea, int, text)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_struct_bytea(bytea, int, bigint)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_struct_bytea(bytea, int, text)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_list_bytea(bytea, int, bigint)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_list_bytea(bytea, int, text)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_set_bytea(bytea, int, bigint)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_set_bytea(bytea, int, text)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_map_bytea(bytea, int, bigint)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_map_get_map_bytea(bytea, int, text)
+    RETURNS bytea[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_list_contains(bytea, int, bigint)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_list_contains(bytea, int, double precision)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_list_contains(bytea, int, text)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_list_contains(bytea, int, bigint)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_list_contains(bytea, int, double precision)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_list_contains(bytea, int, text)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_validate(bytea)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_validate(bytea)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE TABLE thrift_schema (
+    name text PRIMARY KEY,
+    idl text NOT NULL
+);
+
+CREATE TABLE thrift_schema_field (
+    schema_name text NOT NULL REFERENCES thrift_schema (name) ON DELETE CASCADE,
+    struct_name text NOT NULL,
+    field_name text NOT NULL,
+    field_id smallint NOT NULL,
+    field_type text NOT NULL,
+    default_value text,
+    PRIMARY KEY (schema_name, struct_name, field_name)
+);
+
+SELECT pg_catalog.pg_extension_config_dump('thrift_schema', '');
+SELECT pg_catalog.pg_extension_config_dump('thrift_schema_field', '');
+
+CREATE FUNCTION thrift_parse_idl(text, OUT struct_name text, OUT field_name text, OUT field_id smallint, OUT field_type text, OUT default_value text)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_register_schema(text, text)
+    RETURNS integer
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION thrift_schema_path(text, text)
+    RETURNS thrift_path
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT STABLE;
+
+CREATE FUNCTION thrift_binary_get(bytea, text, text)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT STABLE;
+
+CREATE FUNCTION thrift_compact_get(bytea, text, text)
+    RETURNS text
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT STABLE;
+
+CREATE FUNCTION thrift_binary_populate_record(anyelement, bytea)
+    RETURNS anyelement
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STABLE;
+
+CREATE FUNCTION thrift_compact_populate_record(anyelement, bytea)
+    RETURNS anyelement
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STABLE;
+
+CREATE FUNCTION thrift_binary_contains(thrift_binary, thrift_binary)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_contains_jsonb(thrift_binary, jsonb)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_contains(thrift_indexed, thrift_indexed)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_contains_jsonb(thrift_indexed, jsonb)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OPERATOR @> (
+    LEFTARG = thrift_binary,
+    RIGHTARG = thrift_binary,
+    PROCEDURE = thrift_binary_contains,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR @> (
+    LEFTARG = thrift_binary,
+    RIGHTARG = jsonb,
+    PROCEDURE = thrift_binary_contains_jsonb,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR @> (
+    LEFTARG = thrift_indexed,
+    RIGHTARG = thrift_indexed,
+    PROCEDURE = thrift_indexed_contains,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR @> (
+    LEFTARG = thrift_indexed,
+    RIGHTARG = jsonb,
+    PROCEDURE = thrift_indexed_contains_jsonb,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+CREATE FUNCTION thrift_binary_gin_extract_value(thrift_binary, internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_gin_extract_query(thrift_binary, internal, int2, internal, internal, internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_gin_extract_value(thrift_indexed, internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_gin_extract_query(thrift_indexed, internal, int2, internal, internal, internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_gin_consistent(internal, int2, internal, int4, internal, internal, internal, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_gin_triconsistent(internal, int2, internal, int4, internal, internal, internal)
+    RETURNS "char"
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OPERATOR CLASS thrift_binary_ops
+    DEFAULT FOR TYPE thrift_binary USING gin AS
+    OPERATOR 7 @> (thrift_binary, jsonb),
+    OPERATOR 8 @> (thrift_binary, thrift_binary),
+    FUNCTION 1 btint4cmp(int4, int4),
+    FUNCTION 2 thrift_binary_gin_extract_value(thrift_binary, internal, internal),
+    FUNCTION 3 thrift_binary_gin_extract_query(thrift_binary, internal, int2, internal, internal, internal, internal),
+    FUNCTION 4 thrift_gin_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
+    FUNCTION 6 thrift_gin_triconsistent(internal, int2, internal, int4, internal, internal, internal),
+    STORAGE int4;
+
+CREATE OPERATOR CLASS thrift_indexed_ops
+    DEFAULT FOR TYPE thrift_indexed USING gin AS
+    OPERATOR 7 @> (thrift_indexed, jsonb),
+    OPERATOR 8 @> (thrift_indexed, thrift_indexed),
+    FUNCTION 1 btint4cmp(int4, int4),
+    FUNCTION 2 thrift_indexed_gin_extract_value(thrift_indexed, internal, internal),
+    FUNCTION 3 thrift_indexed_gin_extract_query(thrift_indexed, internal, int2, internal, internal, internal, internal),
+    FUNCTION 4 thrift_gin_consistent(internal, int2, internal, int4, internal, internal, internal, internal),
+    FUNCTION 6 thrift_gin_triconsistent(internal, int2, internal, int4, internal, internal, internal),
+    STORAGE int4;
+
+CREATE TYPE thrift_field_range;
+
+CREATE FUNCTION thrift_field_range_in(cstring)
+    RETURNS thrift_field_range
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION thrift_field_range_out(thrift_field_range)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE thrift_field_range (
+    INPUT = thrift_field_range_in,
+    OUTPUT = thrift_field_range_out,
+    INTERNALLENGTH = VARIABLE,
+    ALIGNMENT = double,
+    STORAGE = plain
+);
+
+CREATE FUNCTION thrift_field_range(int, bigint, bigint)
+    RETURNS thrift_field_range
+    AS 'MODULE_PATHNAME', 'thrift_field_range_int'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_field_range(int, double precision, double precision)
+    RETURNS thrift_field_range
+    AS 'MODULE_PATHNAME', 'thrift_field_range_double'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_in_range(thrift_binary, thrift_field_range)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_indexed_in_range(thrift_indexed, thrift_field_range)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE OPERATOR @@ (
+    LEFTARG = thrift_binary,
+    RIGHTARG = thrift_field_range,
+    PROCEDURE = thrift_binary_in_range,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+CREATE OPERATOR @@ (
+    LEFTARG = thrift_indexed,
+    RIGHTARG = thrift_field_range,
+    PROCEDURE = thrift_indexed_in_range,
+    RESTRICT = contsel,
+    JOIN = contjoinsel
+);
+
+-- BRIN was added in PostgreSQL 9.5, the fields option needs opclass
+-- options, added in PostgreSQL 13
+DO $$
+BEGIN
+    IF current_setting('server_version_num')::int >= 90500 THEN
+        EXECUTE $sql$
+            CREATE FUNCTION thrift_brin_opcinfo(internal)
+                RETURNS internal
+                AS 'MODULE_PATHNAME'
+                LANGUAGE C STRICT IMMUTABLE
+        $sql$;
+        EXECUTE $sql$
+            CREATE FUNCTION thrift_binary_brin_add_value(internal, internal, internal, internal)
+                RETURNS boolean
+                AS 'MODULE_PATHNAME'
+                LANGUAGE C STRICT IMMUTABLE
+        $sql$;
+        EXECUTE $sql$
+            CREATE FUNCTION thrift_indexed_brin_add_value(internal, internal, internal, internal)
+                RETURNS boolean
+                AS 'MODULE_PATHNAME'
+                LANGUAGE C STRICT IMMUTABLE
+        $sql$;
+        EXECUTE $sql$
+            CREATE FUNCTION thrift_brin_consistent(internal, internal, internal)
+                RETURNS boolean
+                AS 'MODULE_PATHNAME'
+                LANGUAGE C STRICT IMMUTABLE
+        $sql$;
+        EXECUTE $sql$
+            CREATE FUNCTION thrift_brin_union(internal, internal, internal)
+                RETURNS boolean
+                AS 'MODULE_PATHNAME'
+                LANGUAGE C STRICT IMMUTABLE
+        $sql$;
+        EXECUTE $sql$
+            CREATE FUNCTION thrift_brin_options(internal)
+                RETURNS void
+                AS 'MODULE_PATHNAME'
+                LANGUAGE C STRICT IMMUTABLE
+        $sql$;
+        EXECUTE $sql$
+            CREATE OPERATOR CLASS thrift_binary_minmax_ops
+                DEFAULT FOR TYPE thrift_binary USING brin AS
+                OPERATOR 1 @@ (thrift_binary, thrift_field_range),
+                FUNCTION 1 thrift_brin_opcinfo(internal),
+                FUNCTION 2 thrift_binary_brin_add_value(internal, internal, internal, internal),
+                FUNCTION 3 thrift_brin_consistent(internal, internal, internal),
+                FUNCTION 4 thrift_brin_union(internal, internal, internal),
+                STORAGE bytea
+        $sql$;
+        EXECUTE $sql$
+            CREATE OPERATOR CLASS thrift_indexed_minmax_ops
+                DEFAULT FOR TYPE thrift_indexed USING brin AS
+                OPERATOR 1 @@ (thrift_indexed, thrift_field_range),
+                FUNCTION 1 thrift_brin_opcinfo(internal),
+                FUNCTION 2 thrift_indexed_brin_add_value(internal, internal, internal, internal),
+                FUNCTION 3 thrift_brin_consistent(internal, internal, internal),
+                FUNCTION 4 thrift_brin_union(internal, internal, internal),
+                STORAGE bytea
+        $sql$;
+    END IF;
+    IF current_setting('server_version_num')::int >= 130000 THEN
+        EXECUTE 'ALTER OPERATOR FAMILY thrift_binary_minmax_ops USING brin ADD '
+            'FUNCTION 5 (thrift_binary, thrift_binary) thrift_brin_options(internal)';
+        EXECUTE 'ALTER OPERATOR FAMILY thrift_indexed_minmax_ops USING brin ADD '
+            'FUNCTION 5 (thrift_indexed, thrift_indexed) thrift_brin_options(internal)';
+    END IF;
+END
+$$;
+
+CREATE FUNCTION thrift_accessor_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+-- planner support functions were added in PostgreSQL 12
+DO $$
+DECLARE
+    accessor regprocedure;
+BEGIN
+    IF current_setting('server_version_num')::int >= 120000 THEN
+        FOR accessor IN
+            SELECT oid FROM pg_proc
+            WHERE probin = 'MODULE_PATHNAME' AND proname ~ '^thrift_(binary|compact)_get(_|$)'
+        LOOP
+            EXECUTE format('ALTER FUNCTION %s SUPPORT thrift_accessor_support', accessor);
+        END LOOP;
+    END IF;
+END
+$$;
+
+CREATE FUNCTION thrift_binary_count_present_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_count_present_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_sum_int64_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_sum_int64_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_minmax_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_minmax_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_agg_combine(bytea, bytea)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_agg_count_final(bytea)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_agg_sum_final(bytea)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_agg_minmax_final(bytea)
+    RETURNS thrift_field_range
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_histogram_trans(bytea, bytea, int, double precision, double precision, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_histogram_trans(bytea, bytea, int, double precision, double precision, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_histogram_combine(bytea, bytea)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_histogram_final(bytea)
+    RETURNS bigint[]
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_binary_approx_distinct_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_compact_approx_distinct_trans(bytea, bytea, int)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+CREATE FUNCTION thrift_approx_distinct_combine(bytea, bytea)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C STRICT IMMUTABLE;
+
+CREATE FUNCTION thrift_approx_distinct_final(bytea)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C IMMUTABLE;
+
+-- combine functions and parallel aggregation were added in PostgreSQL 9.6
+DO $$
+DECLARE
+    parallel_safe boolean := current_setting('server_version_num')::int >= 90600;
+    protocol text;
+    agg record;
+BEGIN
+    FOREACH protocol IN ARRAY ARRAY['binary', 'compact'] LOOP
+        FOR agg IN SELECT * FROM (VALUES
+            ('count_present', 'bytea, int', 'thrift_agg_count_final', 'thrift_agg_combine'),
+            ('sum_int64', 'bytea, int', 'thrift_agg_sum_final', 'thrift_agg_combine'),
+            ('minmax', 'bytea, int', 'thrift_agg_minmax_final', 'thrift_agg_combine'),
+            ('histogram', 'bytea, int, double precision, double precision, int', 'thrift_histogram_final', 'thrift_histogram_combine'),
+            ('approx_distinct', 'bytea, int', 'thrift_approx_distinct_final', 'thrift_approx_distinct_combine')
+        ) AS aggs (name, args, finalfunc, combinefunc)
+        LOOP
+            EXECUTE format('CREATE AGGREGATE thrift_%s_%s(%s) (SFUNC = thrift_%s_%s_trans, STYPE = bytea, FINALFUNC = %s%s)',
+                protocol, agg.name, agg.args, protocol, agg.name, agg.finalfunc,
+                CASE WHEN parallel_safe THEN format(', COMBINEFUNC = %s, PARALLEL = SAFE', agg.combinefunc) ELSE '' END);
+        END LOOP;
+    END LOOP;
+END
+$$;
+
+-- functions may run in parallel workers from PostgreSQL 9.6 on. The ones
+-- reading the schema registry or backend local statistics stay in the
+-- leader, registering a schema writes and stays parallel unsafe.
+DO $$
+DECLARE
+    fn record;
+BEGIN
+    IF current_setting('server_version_num')::int >= 90600 THEN
+        FOR fn IN
+            SELECT oid::regprocedure AS signature, proname FROM pg_proc
+            WHERE probin = 'MODULE_PATHNAME' AND proname <> 'thrift_register_schema'
+        LOOP
+            EXECUTE format('ALTER FUNCTION %s PARALLEL %s', fn.signature,
+                CASE WHEN fn.proname IN ('thrift_field_cache_stats', 'thrift_field_cache_reset_stats', 'thrift_schema_path',
+                                         'thrift_binary_get', 'thrift_compact_get',
+                                         'thrift_binary_populate_record', 'thrift_compact_populate_record')
+                     THEN 'RESTRICTED' ELSE 'SAFE' END);
+        END LOOP;
+    END IF;
+END
+$$;
@@ -1,11 +1,93 @@
 #include <postgres.h>
 #include <port.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ctype.h>
 #include <catalog/pg_type.h>
 #include <utils/builtins.h>
 #include <utils/array.h>
 #include <utils/lsyscache.h>
+#include <utils/numeric.h>
+#include <utils/json.h>
+#include <mb/pg_wchar.h>
 #include <utils/jsonb.h>
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <access/htup_details.h>
+#include <access/hash.h>
+#include <access/gin.h>
+#if PG_VERSION_NUM >= 90500
+#include <access/brin_internal.h>
+#include <access/brin_tuple.h>
+#endif
+#include <access/skey.h>
+#include <lib/stringinfo.h>
+#include <storage/fd.h>
+#include <utils/acl.h>
+#include <catalog/pg_authid.h>
+#include <libpq/pqformat.h>
+#include <executor/executor.h>
+#include <executor/spi.h>
+#include <catalog/pg_class.h>
+#include <catalog/pg_description.h>
+#include <catalog/indexing.h>
+#include <access/genam.h>
+#include <utils/fmgroids.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/typcache.h>
+#include <utils/inval.h>
+#include <access/xact.h>
+#include <utils/guc.h>
+#if PG_VERSION_NUM >= 120000
+#include <access/sysattr.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <catalog/pg_proc.h>
+#include <commands/explain.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/pathnodes.h>
+#include <nodes/supportnodes.h>
+#include <optimizer/cost.h>
+#include <optimizer/optimizer.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/paths.h>
+#include <optimizer/tlist.h>
+#include <parser/parsetree.h>
+#include <utils/datum.h>
+#include <utils/float.h>
+#include <utils/ruleutils.h>
+#include <utils/spccache.h>
+#include <utils/syscache.h>
+#else
+#include <access/heapam.h>
+#endif
+#if PG_VERSION_NUM >= 180000
+#include <commands/explain_format.h>
+#endif
+#if PG_VERSION_NUM >= 130000
+#include <access/detoast.h>
+#include <access/reloptions.h>
+#else
+#include <access/tuptoaster.h>
+#endif
 #include "pg_thrift.h"
+#include "pg_thrift_kernels.h"
+
+#ifndef BYTEAARRAYOID
+#define BYTEAARRAYOID 1001
+#endif
+
+#if PG_VERSION_NUM < 120000
+#define pg_pread pread
+#endif
+
+#ifndef FLOAT8_FITS_IN_INT64
+#define FLOAT8_FITS_IN_INT64(num) ((num) >= (float8)PG_INT64_MIN && (num) < -((float8)PG_INT64_MIN))
+#endif
 
 PG_MODULE_MAGIC;
 
@@ -33,6 +115,11 @@ PG_FUNCTION_INFO_V1(thrift_compact_get_list_bytea);
 PG_FUNCTION_INFO_V1(thrift_compact_get_set_bytea);
 PG_FUNCTION_INFO_V1(thrift_compact_get_map_bytea);
 
+PG_FUNCTION_INFO_V1(thrift_binary_get_fields);
+PG_FUNCTION_INFO_V1(thrift_compact_get_fields);
+PG_FUNCTION_INFO_V1(thrift_field_cache_stats);
+PG_FUNCTION_INFO_V1(thrift_field_cache_reset_stats);
+
 PG_FUNCTION_INFO_V1(parse_thrift_binary_boolean);
 PG_FUNCTION_INFO_V1(parse_thrift_binary_string);
 PG_FUNCTION_INFO_V1(parse_thrift_binary_bytes);
@@ -44,6 +131,8 @@ PG_FUNCTION_INFO_V1(parse_thrift_binary_list_bytea);
 PG_FUNCTION_INFO_V1(parse_thrift_binary_map_bytea);
 PG_FUNCTION_INFO_V1(thrift_binary_in);
 PG_FUNCTION_INFO_V1(thrift_binary_out);
+PG_FUNCTION_INFO_V1(thrift_binary_recv);
+PG_FUNCTION_INFO_V1(thrift_binary_send);
 PG_FUNCTION_INFO_V1(get_thrift_binary_type);
 PG_FUNCTION_INFO_V1(get_thrift_binary_value);
 
@@ -58,16 +147,193 @@ PG_FUNCTION_INFO_V1(parse_thrift_compact_list_bytea);
 PG_FUNCTION_INFO_V1(parse_thrift_compact_map_bytea);
 
 PG_FUNCTION_INFO_V1(jsonb_to_thrift_binary);
-//PG_FUNCTION_INFO_V1(thrift_binary_to_jsonb);
-Datum thrift_binary_to_json(int type, uint8* start, uint8* end);
-Datum jsonb_to_thrift_binary_helper(char* type, JsonbValue jbv);
+PG_FUNCTION_INFO_V1(jsonb_to_thrift_compact);
+PG_FUNCTION_INFO_V1(thrift_binary_to_compact);
+PG_FUNCTION_INFO_V1(thrift_compact_to_binary);
+
+PG_FUNCTION_INFO_V1(thrift_binary_validate);
+PG_FUNCTION_INFO_V1(thrift_compact_validate);
+
+PG_FUNCTION_INFO_V1(thrift_indexed_in);
+PG_FUNCTION_INFO_V1(thrift_indexed_out);
+PG_FUNCTION_INFO_V1(thrift_binary_indexed);
+PG_FUNCTION_INFO_V1(thrift_compact_indexed);
+PG_FUNCTION_INFO_V1(thrift_indexed_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_to_indexed);
+PG_FUNCTION_INFO_V1(thrift_indexed_to_binary);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_bool);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_byte);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_double);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_int16);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_int32);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_int64);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_string);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_struct_bytea);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_list_bytea);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_set_bytea);
+PG_FUNCTION_INFO_V1(thrift_indexed_get_map_bytea);
 
-Datum thrift_binary_decode(uint8* data, Size size, int16 field_id, int8 type_id);
-Datum thrift_compact_decode(uint8* data, Size size, int16 field_id, int8 type_id);
+PG_FUNCTION_INFO_V1(thrift_path_in);
+PG_FUNCTION_INFO_V1(thrift_path_out);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_bool);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_byte);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_double);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_int16);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_int32);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_int64);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_string);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_struct_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_list_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_set_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_get_path_map_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_bool);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_byte);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_double);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_int16);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_int32);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_int64);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_string);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_struct_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_list_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_set_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_get_path_map_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_get_list_bool);
+PG_FUNCTION_INFO_V1(thrift_compact_get_list_bool);
+PG_FUNCTION_INFO_V1(thrift_binary_get_list_int16);
+PG_FUNCTION_INFO_V1(thrift_compact_get_list_int16);
+PG_FUNCTION_INFO_V1(thrift_binary_get_list_int32);
+PG_FUNCTION_INFO_V1(thrift_compact_get_list_int32);
+PG_FUNCTION_INFO_V1(thrift_binary_get_list_int64);
+PG_FUNCTION_INFO_V1(thrift_compact_get_list_int64);
+PG_FUNCTION_INFO_V1(thrift_binary_get_list_double);
+PG_FUNCTION_INFO_V1(thrift_compact_get_list_double);
+PG_FUNCTION_INFO_V1(thrift_binary_get_list_string);
+PG_FUNCTION_INFO_V1(thrift_compact_get_list_string);
+PG_FUNCTION_INFO_V1(thrift_binary_each_list);
+PG_FUNCTION_INFO_V1(thrift_compact_each_list);
+PG_FUNCTION_INFO_V1(thrift_binary_each_map);
+PG_FUNCTION_INFO_V1(thrift_compact_each_map);
+PG_FUNCTION_INFO_V1(thrift_binary_read_framed);
+PG_FUNCTION_INFO_V1(thrift_compact_read_framed);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_bool);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_bool);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_byte);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_byte);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_double);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_double);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_int16);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_int16);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_int32);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_int32);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_int64);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_int64);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_string);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_string);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_struct_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_struct_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_list_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_list_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_set_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_set_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_map_get_map_bytea);
+PG_FUNCTION_INFO_V1(thrift_compact_map_get_map_bytea);
+PG_FUNCTION_INFO_V1(thrift_binary_list_contains);
+PG_FUNCTION_INFO_V1(thrift_compact_list_contains);
+PG_FUNCTION_INFO_V1(thrift_parse_idl);
+PG_FUNCTION_INFO_V1(thrift_register_schema);
+PG_FUNCTION_INFO_V1(thrift_schema_path);
+PG_FUNCTION_INFO_V1(thrift_binary_get);
+PG_FUNCTION_INFO_V1(thrift_compact_get);
+PG_FUNCTION_INFO_V1(thrift_binary_populate_record);
+PG_FUNCTION_INFO_V1(thrift_compact_populate_record);
+PG_FUNCTION_INFO_V1(thrift_binary_contains);
+PG_FUNCTION_INFO_V1(thrift_binary_contains_jsonb);
+PG_FUNCTION_INFO_V1(thrift_indexed_contains);
+PG_FUNCTION_INFO_V1(thrift_indexed_contains_jsonb);
+PG_FUNCTION_INFO_V1(thrift_binary_gin_extract_value);
+PG_FUNCTION_INFO_V1(thrift_binary_gin_extract_query);
+PG_FUNCTION_INFO_V1(thrift_indexed_gin_extract_value);
+PG_FUNCTION_INFO_V1(thrift_indexed_gin_extract_query);
+PG_FUNCTION_INFO_V1(thrift_gin_consistent);
+PG_FUNCTION_INFO_V1(thrift_gin_triconsistent);
+PG_FUNCTION_INFO_V1(thrift_field_range_in);
+PG_FUNCTION_INFO_V1(thrift_field_range_out);
+PG_FUNCTION_INFO_V1(thrift_field_range_int);
+PG_FUNCTION_INFO_V1(thrift_field_range_double);
+PG_FUNCTION_INFO_V1(thrift_binary_in_range);
+PG_FUNCTION_INFO_V1(thrift_indexed_in_range);
+#if PG_VERSION_NUM >= 90500
+PG_FUNCTION_INFO_V1(thrift_brin_opcinfo);
+PG_FUNCTION_INFO_V1(thrift_binary_brin_add_value);
+PG_FUNCTION_INFO_V1(thrift_indexed_brin_add_value);
+PG_FUNCTION_INFO_V1(thrift_brin_consistent);
+PG_FUNCTION_INFO_V1(thrift_brin_union);
+PG_FUNCTION_INFO_V1(thrift_brin_options);
+#endif
+PG_FUNCTION_INFO_V1(thrift_binary_count_present_trans);
+PG_FUNCTION_INFO_V1(thrift_compact_count_present_trans);
+PG_FUNCTION_INFO_V1(thrift_binary_sum_int64_trans);
+PG_FUNCTION_INFO_V1(thrift_compact_sum_int64_trans);
+PG_FUNCTION_INFO_V1(thrift_binary_minmax_trans);
+PG_FUNCTION_INFO_V1(thrift_compact_minmax_trans);
+PG_FUNCTION_INFO_V1(thrift_agg_combine);
+PG_FUNCTION_INFO_V1(thrift_agg_count_final);
+PG_FUNCTION_INFO_V1(thrift_agg_sum_final);
+PG_FUNCTION_INFO_V1(thrift_agg_minmax_final);
+PG_FUNCTION_INFO_V1(thrift_binary_histogram_trans);
+PG_FUNCTION_INFO_V1(thrift_compact_histogram_trans);
+PG_FUNCTION_INFO_V1(thrift_histogram_combine);
+PG_FUNCTION_INFO_V1(thrift_histogram_final);
+PG_FUNCTION_INFO_V1(thrift_binary_approx_distinct_trans);
+PG_FUNCTION_INFO_V1(thrift_compact_approx_distinct_trans);
+PG_FUNCTION_INFO_V1(thrift_approx_distinct_combine);
+PG_FUNCTION_INFO_V1(thrift_approx_distinct_final);
+PG_FUNCTION_INFO_V1(thrift_accessor_support);
+PG_FUNCTION_INFO_V1(thrift_binary_to_jsonb);
+PG_FUNCTION_INFO_V1(thrift_compact_to_jsonb);
+const char* thrift_binary_type_name(int8 type_id);
+uint8* binary_to_json_value(uint8* start, uint8* end, int8 type_id, StringInfo buf);
+uint8* thrift_to_jsonb_value(uint8* start, uint8* end, int8 type_id, bool compact, JsonbParseState** state);
+void thrift_jsonb_push_typed(JsonbParseState** state, int8 type_id, JsonbValue* value);
+Jsonb* thrift_struct_to_jsonb(uint8* start, uint8* end, bool compact);
+
+Datum thrift_binary_decode(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, int8 type_id);
+Datum thrift_compact_decode(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, int8 type_id);
+Datum thrift_binary_get_field(FunctionCallInfo fcinfo, int8 type_id);
+Datum thrift_compact_get_field(FunctionCallInfo fcinfo, int8 type_id);
+Datum thrift_binary_get_list(FunctionCallInfo fcinfo, int8 type_id, Oid element_type);
+Datum thrift_compact_get_list(FunctionCallInfo fcinfo, int8 type_id, Oid element_type);
+ThriftEachState* thrift_each_init(FunctionCallInfo fcinfo, bool compact, bool map, int64* len);
+bytea* thrift_each_value(ThriftEachState* state, uint8 type_id);
+Datum thrift_each_list(FunctionCallInfo fcinfo, bool compact);
+Datum thrift_each_map(FunctionCallInfo fcinfo, bool compact);
+uint8* thrift_project_struct(uint8* start, uint8* end, bool compact, int16* field_ids, int nfields, StringInfo buf);
+char* thrift_framed_path(text* arg);
+void thrift_framed_reader_close(Datum arg);
+ThriftFramedReader* thrift_framed_reader_open(FunctionCallInfo fcinfo, bool compact);
+uint8* thrift_framed_reader_map(ThriftFramedReader* reader, off_t offset, off_t len);
+bytea* thrift_framed_reader_next(ThriftFramedReader* reader);
+Datum thrift_read_framed(FunctionCallInfo fcinfo, bool compact);
+Datum thrift_indexed_get_field(FunctionCallInfo fcinfo, int8 binary_type_id, int8 compact_type_id);
+Datum thrift_binary_get_path(FunctionCallInfo fcinfo, int8 type_id);
+Datum thrift_compact_get_path(FunctionCallInfo fcinfo, int8 type_id);
 Datum parse_binary_field(uint8* start, uint8* end, int8 type_id);
+Datum parse_binary_value(uint8* start, uint8* end, int8 type_id);
 Datum parse_compact_field(uint8* start, uint8* end, int8 type_id);
 uint8* skip_binary_field(uint8* start, uint8* end, int8 type_id);
 uint8* skip_compact_field(uint8* start, uint8* end, int8 type_id);
+uint8* skip_compact_struct_field(uint8* start, uint8* end, int8 type_id);
+uint8* try_skip_binary_field(uint8* start, uint8* end, int8 type_id);
+uint8* try_skip_compact_field(uint8* start, uint8* end, int8 type_id);
+uint8* try_skip_compact_struct_field(uint8* start, uint8* end, int8 type_id);
+bool is_binary_type(uint8 type_id);
+uint8* validate_binary_value(uint8* start, uint8* end, int8 type_id, int depth);
+uint8* validate_compact_value(uint8* start, uint8* end, int8 type_id, int depth);
+bool validate_struct(uint8* start, uint8* end, bool compact);
+Datum thrift_binary_validate(PG_FUNCTION_ARGS);
+Datum thrift_compact_validate(PG_FUNCTION_ARGS);
+Datum parse_validated_binary_value(uint8* start, uint32 length, int8 type_id);
+Datum parse_validated_compact_value(uint8* start, uint32 length, int8 type_id);
 
 Datum parse_thrift_binary_boolean_internal(uint8* start, uint8* end);
 Datum parse_thrift_binary_string_internal(uint8* start, uint8* end);
@@ -88,43 +354,219 @@ Datum parse_thrift_compact_int64_internal(uint8* start, uint8* end);
 Datum parse_thrift_compact_struct_bytea_internal(uint8* start, uint8* end);
 Datum parse_thrift_compact_list_bytea_internal(uint8* start, uint8* end);
 Datum parse_thrift_compact_map_bytea_internal(uint8* start, uint8* end);
+Datum element_array(Datum* elements, int len, Oid element_type);
+Datum parse_thrift_binary_list_internal(uint8* start, uint8* end, int8 type_id, Oid element_type);
+Datum parse_thrift_compact_list_internal(uint8* start, uint8* end, int8 type_id, Oid element_type);
 
-uint8* encode_binary_bool(char* value);
-uint8* encode_binary_int16(char* value);
-uint8* encode_binary_int32(char* value);
-uint8* encode_binary_int64(char* value);
-uint8* encode_binary_double(char* value);
-uint8* encode_binary_string(char* value);
-uint8* encode_binary_byte(char* value);
+int8 jsonb_thrift_type_id(JsonbValue* name);
+void jsonb_thrift_typed_value(JsonbContainer* container, int8* type_id, JsonbValue* value);
+void jsonb_thrift_element(JsonbValue* element, int8* type_id, JsonbValue* value);
+char* jsonb_thrift_number(JsonbValue* value, const char* type);
+float8 jsonb_thrift_double(JsonbValue* value);
+uint8* thrift_buf_reserve(StringInfo buf, int len);
+void jsonb_to_thrift_binary_append(StringInfo buf, int8 type_id, JsonbValue* value);
+void thrift_buf_append_varint(StringInfo buf, int64 value);
+void thrift_buf_put_header(StringInfo buf, int offset, int reserved, const uint8* header, int len);
+void jsonb_to_thrift_compact_append(StringInfo buf, int8 type_id, JsonbValue* value);
+uint8* binary_to_compact_value(uint8* start, uint8* end, int8 type_id, StringInfo buf);
+uint8* compact_to_binary_value(uint8* start, uint8* end, int8 type_id, StringInfo buf);
 
 uint8 char_to_int8(char c);
-uint8* string_to_bytes(char* value);
 char convert_int8_to_char(uint8 value, bool first_half);
 char* bytes_to_string(uint8* start, int32 len);
-bool is_big_endian(void);
+void check_json_string(uint8* start, int32 len);
 int64 parse_int_helper(uint8* start, uint8* end, int len);
-void swap_bytes(char* bytes, int len);
 int64 parse_varint_helper(uint8* start, uint8* end, int64* len_description);
 uint8 compact_list_type_to_struct_type(uint8 element_type);
+bool is_compact_varint_type(uint8 field_type);
+int binary_fixed_width(uint8 type_id);
+uint8 compact_type_to_binary_type(uint8 field_type);
 
-bool is_big_endian() {
-  uint32 i = 1;
-  char *c = (char*)&i;
-  return !(*c);
-}
+static ThriftFieldCache* field_cache = NULL;
+static int64 field_cache_hits = 0;
+static int64 field_cache_misses = 0;
+static HTAB* record_cache = NULL;
+// registry table the cached field ids and schema plans were read from,
+// a count of its invalidations telling whether a plan is still current,
+// and a count of ended transactions telling when a mapping was last checked
+static Oid registry_relid = InvalidOid;
+static uint64 registry_generation = 0;
+static uint64 record_cache_xact = 0;
 
-void swap_bytes(char* bytes, int len) {
-  for (int i = 0; i < len/2; i++) {
-    char tmp = bytes[i];
-    bytes[i] = bytes[len - 1 - i];
-    bytes[len - 1 - i] = tmp;
-  }
-}
+void field_cache_reset_callback(void* arg);
+ThriftFieldTable* field_cache_table(Pointer key, Size size, bool compact);
+void field_table_add(ThriftFieldTable* table, int16 field_id, uint8 type_id, uint32 offset);
+ThriftFieldOffset* field_table_truncated(ThriftFieldTable* table, bool* truncated);
+ThriftFieldOffset* field_table_scan_binary(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, bool* truncated);
+ThriftFieldOffset* field_table_scan_compact(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, bool* truncated);
+ThriftFieldOffset* field_table_find(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, bool* truncated);
+Datum thrift_binary_decode_field(ThriftFieldOffset* field, uint8* data, uint8* end, int8 type_id);
+Datum thrift_compact_decode_field(ThriftFieldOffset* field, uint8* data, uint8* end, int8 type_id);
+bool thrift_datum_is_sliceable(Pointer raw);
+Datum thrift_decode_sliced(Datum datum, bool compact, int16 field_id, int8 type_id);
+ThriftFieldTable* field_cache_datum(Datum datum, bool compact, uint8** data, Size* size);
+Datum thrift_decode_datum(Datum datum, bool compact, int32 field_id, int8 type_id);
+
+int thrift_index_entry_cmp(const void* a, const void* b);
+ThriftIndexed* build_thrift_indexed(uint8* data, Size size, uint8 protocol);
+ThriftIndexEntry* thrift_indexed_find(ThriftIndexed* indexed, int16 field_id);
+bytea* thrift_indexed_payload_bytea(ThriftIndexed* indexed);
+
+int64 thrift_path_parse_int(char** p, char* str);
+ThriftPath* thrift_path_parse(char* str, ThriftSchemaResolver* resolver);
+ThriftPath* thrift_path_from_array(ArrayType* field_array);
+ThriftPath* thrift_path_argument(FunctionCallInfo fcinfo);
+bool thrift_binary_key_matches(ThriftPathStep* step, char* keys, uint8* start, uint8* end, uint8 key_type);
+bool thrift_compact_key_matches(ThriftPathStep* step, char* keys, uint8* start, uint8* end, uint8 key_type);
+bool thrift_binary_walk_path(ThriftPath* path, ThriftFieldTable* table, uint8* data, uint8* end, ThriftPathCursor* cursor);
+bool thrift_compact_walk_path(ThriftPath* path, ThriftFieldTable* table, uint8* data, uint8* end, ThriftPathCursor* cursor);
+Datum thrift_binary_path_value(ThriftPathCursor* cursor, uint8* end, int8 type_id);
+Datum thrift_compact_path_value(ThriftPathCursor* cursor, uint8* end, int8 type_id);
+ThriftPathStep thrift_map_key_argument(FunctionCallInfo fcinfo, char** keys);
+uint8* thrift_map_header(bool compact, uint8* start, uint8* end, uint8* key_type, uint8* value_type, int64* len);
+bool thrift_map_int_key(bool compact, uint8 key_type);
+uint32 thrift_map_key_hash(bool compact, uint8* start, uint8* end, uint8 key_type);
+uint32 thrift_map_step_hash(ThriftPathStep* step, char* keys);
+void thrift_map_index_build(ThriftMapIndex* index, bool compact, uint8* data, uint8* start, uint8* end, uint8 key_type, uint8 value_type, int64 len);
+ThriftMapIndex* thrift_map_index(ThriftFieldTable* table, int16 field_id);
+bool thrift_map_lookup(ThriftFieldTable* table, ThriftFieldOffset* field, uint8* data, uint8* end, ThriftPathStep* step, char* keys, ThriftPathCursor* cursor);
+Datum thrift_map_get(FunctionCallInfo fcinfo, bool compact, int8 type_id);
+bool thrift_fixed_needle(int64 value, int width, uint8* needle);
+int thrift_varint_needle(int64 value, uint8* needle);
+bool thrift_contains_fixed_scalar(const uint8* data, int64 n, int width, const uint8* needle);
+bool thrift_contains_double_scalar(const uint8* data, int64 n, float8 value);
+bool thrift_contains_varint(uint8* curr, uint8* end, int64 n, const uint8* needle, int needle_len);
+bool thrift_contains_string(bool compact, uint8* curr, uint8* end, int64 n, const char* needle, int needle_len);
+Datum thrift_list_contains(FunctionCallInfo fcinfo, bool compact);
+char* thrift_idl_peek(ThriftIdlParser* parser);
+char* thrift_idl_next(ThriftIdlParser* parser);
+bool thrift_idl_accept(ThriftIdlParser* parser, const char* token);
+void thrift_idl_expect(ThriftIdlParser* parser, const char* token);
+char* thrift_idl_name(ThriftIdlParser* parser);
+void thrift_idl_skip_block(ThriftIdlParser* parser, const char* open, const char* close);
+void thrift_idl_skip_annotations(ThriftIdlParser* parser);
+char* thrift_idl_parse_type(ThriftIdlParser* parser);
+char* thrift_idl_parse_const(ThriftIdlParser* parser);
+void thrift_idl_names_add(ThriftIdlNames* names, char* name, char* value);
+char* thrift_idl_names_find(ThriftIdlNames* names, char* name);
+void thrift_idl_parse_enum(ThriftIdlParser* parser);
+void thrift_idl_parse_struct(ThriftIdlParser* parser);
+void thrift_idl_parse(ThriftIdlParser* parser, char* idl);
+bool thrift_idl_is_base_type(char* type);
+char* thrift_idl_element_type(char* type);
+char* thrift_schema_table(FunctionCallInfo fcinfo, const char* table);
+int16 thrift_schema_resolve_field(ThriftSchemaResolver* resolver, char** p, char* str);
+void thrift_schema_resolve_element(ThriftSchemaResolver* resolver, uint8 kind, char* str);
+ThriftPath* thrift_path_prefix(ThriftPath* path, int nsteps);
+ThriftSchemaPlan* thrift_schema_plan(FunctionCallInfo fcinfo, int argno);
+Datum thrift_schema_get(FunctionCallInfo fcinfo, bool compact);
+uint8 thrift_array_element_type(Oid element_type);
+int thrift_record_column_cmp(const void* a, const void* b);
+void thrift_record_cache_reset(void);
+void thrift_registry_relcache_callback(Datum arg, Oid relid);
+void thrift_registry_watch(FunctionCallInfo fcinfo);
+void thrift_record_cache_xact_callback(XactEvent event, void* arg);
+bool thrift_record_comment_id(const char* comment, int16* field_id);
+bool* thrift_record_comment_ids(Oid relid, int natts, int16* field_ids);
+bool thrift_record_comments_changed(ThriftRecordInfo* info, Oid relid);
+ThriftRecordInfo* thrift_record_info(FunctionCallInfo fcinfo, Oid typid);
+Datum thrift_populate_struct(FunctionCallInfo fcinfo, Oid typid, bool compact, uint8* start, uint8* end, HeapTupleHeader base);
+Datum thrift_populate_value(FunctionCallInfo fcinfo, ThriftRecordColumn* column, bool compact, uint8* start, uint8* end, uint8 type_id, uint8 parsed_type_id);
+Datum thrift_populate_list(FunctionCallInfo fcinfo, ThriftRecordColumn* column, bool compact, uint8* start, uint8* end);
+Datum thrift_populate_record(FunctionCallInfo fcinfo, bool compact);
+uint8 thrift_value_kind(bool compact, ThriftPathCursor* value);
+bool thrift_members_init(ThriftMemberIterator* it, bool compact, ThriftPathCursor* value, uint8* end);
+bool thrift_members_next(ThriftMemberIterator* it, ThriftPathCursor* member, StringInfo step);
+void thrift_number_text(StringInfo buf, float8 value);
+bool thrift_scalar_text(bool compact, ThriftPathCursor* value, uint8* end, bool tag, StringInfo buf);
+void thrift_jsonb_scalar_text(JsonbValue* value, bool tag, StringInfo buf);
+bool thrift_contains_thrift(bool compact, ThriftPathCursor* value, uint8* end, bool query_compact, ThriftPathCursor* query, uint8* query_end);
+bool thrift_contains_jsonb(bool compact, ThriftPathCursor* value, uint8* end, JsonbValue* query);
+bool thrift_datum_root(Datum datum, bool indexed, bool* compact, ThriftPathCursor* root, uint8** end);
+void thrift_jsonb_root(Jsonb* jsonb, JsonbValue* root);
+uint32 thrift_gin_hash(uint32 hash, const char* data, int len);
+void thrift_gin_add_key(ThriftGinKeys* keys, uint32 hash);
+void thrift_gin_extract(bool compact, ThriftPathCursor* value, uint8* end, uint32 hash, ThriftGinKeys* keys);
+void thrift_gin_extract_jsonb(JsonbValue* query, uint32 hash, ThriftGinKeys* keys);
+Datum thrift_gin_extract_query(FunctionCallInfo fcinfo, bool indexed);
+bool thrift_value_number(bool compact, ThriftPathCursor* value, uint8* end, ThriftNumber* number);
+int thrift_number_cmp(ThriftNumber* a, ThriftNumber* b);
+bool thrift_range_above_low(ThriftFieldRange* range, ThriftNumber* number);
+bool thrift_range_below_high(ThriftFieldRange* range, ThriftNumber* number);
+void thrift_range_parse_bound(char* bound, char* str, ThriftNumber* number, bool* inf);
+void thrift_range_bound_out(StringInfo buf, ThriftNumber* number);
+Datum thrift_field_range_make(FunctionCallInfo fcinfo, bool is_double);
+bool thrift_datum_field(Datum datum, bool indexed, int16 field_id, bool* compact, ThriftPathCursor* field, uint8** end);
+Datum thrift_in_range(FunctionCallInfo fcinfo, bool indexed);
+int thrift_field_id_cmp(const void* a, const void* b);
+#if PG_VERSION_NUM >= 90500
+int thrift_brin_parse_fields(const char* value, int16* field_ids);
+void thrift_brin_validate_fields(const char* value);
+int thrift_brin_fields(FunctionCallInfo fcinfo, int16* field_ids);
+ThriftBrinField* thrift_brin_find(ThriftBrinSummary* summary, int16 field_id, int* pos);
+ThriftBrinSummary* thrift_brin_summary_add(ThriftBrinSummary* summary, int16 field_id, ThriftNumber* min, ThriftNumber* max, bool* changed);
+ThriftBrinSummary* thrift_brin_summary(BrinValues* column);
+Datum thrift_brin_add_value(FunctionCallInfo fcinfo, bool indexed);
+#endif
+bool thrift_agg_field(FunctionCallInfo fcinfo, bool compact, ThriftPathCursor* field, uint8** end);
+void* thrift_agg_state(FunctionCallInfo fcinfo, Size size);
+Datum thrift_agg_keep(FunctionCallInfo fcinfo);
+int64 thrift_agg_add(int64 a, int64 b);
+void thrift_agg_minmax_add(ThriftAggState* state, ThriftNumber* min, ThriftNumber* max);
+Datum thrift_count_present_trans(FunctionCallInfo fcinfo, bool compact);
+Datum thrift_sum_int64_trans(FunctionCallInfo fcinfo, bool compact);
+Datum thrift_minmax_trans(FunctionCallInfo fcinfo, bool compact);
+Datum thrift_histogram_trans(FunctionCallInfo fcinfo, bool compact);
+uint32 thrift_value_hash(bool compact, ThriftPathCursor* value, uint8* end);
+Datum thrift_approx_distinct_trans(FunctionCallInfo fcinfo, bool compact);
+#if PG_VERSION_NUM >= 120000
+int32 thrift_accessor_width(PlannerInfo* root, Node* node);
+void thrift_batch_accessors_reset(Datum arg, int cacheid, uint32 hashvalue);
+void thrift_batch_resolve_accessors(void);
+bool thrift_batch_field(Node* node, Index relid, ThriftBatchColumn* column);
+bool thrift_batch_collect(Node* node, ThriftBatchCollect* collect);
+bool thrift_batch_filter_clause(Expr* clause, Index relid);
+void thrift_batch_split(PlannerInfo* root, List* clauses, ThriftBatchCollect* collect, List** filters, List** quals);
+Node* thrift_batch_strip_fields(Node* node, ThriftBatchCollect* collect);
+void thrift_batch_set_rel_pathlist(PlannerInfo* root, RelOptInfo* rel, Index rti, RangeTblEntry* rte);
+Plan* thrift_batch_plan_path(PlannerInfo* root, RelOptInfo* rel, CustomPath* best_path, List* tlist, List* clauses,
+                             List* custom_plans);
+Node* thrift_batch_create_state(CustomScan* cscan);
+bool thrift_batch_is_int(Oid typid);
+int64 thrift_batch_int(Datum value, Oid typid);
+void thrift_batch_filter_init(ThriftBatchScanState* state, ThriftBatchFilter* filter, OpExpr* op);
+void thrift_batch_begin(CustomScanState* node, EState* estate, int eflags);
+bool thrift_batch_test(int cmp, StrategyNumber strategy);
+int thrift_batch_filter(ThriftBatchScanState* state, ThriftBatchFilter* filter, int* selected, int nselected);
+void thrift_batch_decode_column(ThriftBatchScanState* state, int index);
+int thrift_batch_fill(ThriftBatchScanState* state);
+void thrift_batch_decode_row(ThriftBatchScanState* state, TupleTableSlot* slot, int row, int stage, int qual);
+TupleTableSlot* thrift_batch_next(ScanState* node);
+bool thrift_batch_recheck(ScanState* node, TupleTableSlot* slot);
+TupleTableSlot* thrift_batch_exec(CustomScanState* node);
+void thrift_batch_end(CustomScanState* node);
+void thrift_batch_rescan(CustomScanState* node);
+void thrift_batch_explain(CustomScanState* node, List* ancestors, ExplainState* es);
+#endif
+void _PG_init(void);
+int16* field_ids_from_array(ArrayType* field_array, int* nfields);
+TupleDesc fields_result_desc(FunctionCallInfo fcinfo, int nfields);
+bool field_matches_column(uint8 type_id, Oid typid);
+Datum field_to_column(Datum value, uint8 type_id, Oid typid);
 
 int64 parse_int_helper(uint8* start, uint8* end, int len) {
   if (start + len > end) {
     elog(ERROR, "Invalid thrift format for int");
   }
+  if (len == INT16_LEN) {
+    return thrift_load_be16(start);
+  }
+  if (len == INT32_LEN) {
+    return thrift_load_be32(start);
+  }
+  if (len == INT64_LEN) {
+    return thrift_load_be64(start);
+  }
   int64 val = 0;
   for (int i = 0; i < len; i++) {
     val = (val << 8) + *(start + i);
@@ -133,16 +575,16 @@ int64 parse_int_helper(uint8* start, uint8* end, int len) {
 }
 
 // returns value from varint encoded zigzag int
+// a truncated varint gets a length running past end
 int64 parse_varint_helper(uint8* start, uint8* end, int64* len_length) {
-  uint8* p = start;
-  int64 val = 0;
-  while (p < end) {
-    val = (((*p) & 0x7f) << 7*(p - start)) + val;
-    if ((*p) & 0x80) p++;
-    else break;
+  uint64 val = 0;
+  int len = thrift_varint_decode(start, end, &val);
+  if (len == 0) {
+    *len_length = (start < end ? end - start : 0) + 1;
+    return 0;
   }
-  *len_length = p - start + 1;
-  return (val >> 1) ^ -(val & 1);
+  *len_length = len;
+  return thrift_zigzag_decode(val);
 }
 
 // skip field is needed in list(set, map) and struct,
@@ -194,9 +636,85 @@ uint8 compact_list_type_to_struct_type(uint8 element_type) {
   elog(ERROR, "Invalid thrift compact element type");
 }
 
+// int16, int32 and int64 values are all zigzag varints
+bool is_compact_varint_type(uint8 field_type) {
+  return field_type == PG_THRIFT_COMPACT_INT16 ||
+    field_type == PG_THRIFT_COMPACT_INT32 ||
+    field_type == PG_THRIFT_COMPACT_INT64;
+}
+
+// size of binary values stored as big-endian numbers, 0 for other types
+int binary_fixed_width(uint8 type_id) {
+  if (type_id == PG_THRIFT_BINARY_INT16) {
+    return INT16_LEN;
+  }
+
+  if (type_id == PG_THRIFT_BINARY_INT32) {
+    return INT32_LEN;
+  }
+
+  if (type_id == PG_THRIFT_BINARY_INT64) {
+    return INT64_LEN;
+  }
+
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    return DOUBLE_LEN;
+  }
+  return 0;
+}
+
+// reverse of compact_list_type_to_struct_type, struct field types
+// are mapped to the type ids used by binary protocol
+uint8 compact_type_to_binary_type(uint8 field_type) {
+  if (field_type == 1 || field_type == PG_THRIFT_COMPACT_BOOL) {
+    return PG_THRIFT_BINARY_BOOL;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_BYTE) {
+    return PG_THRIFT_BINARY_BYTE;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_DOUBLE) {
+    return PG_THRIFT_BINARY_DOUBLE;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_INT16) {
+    return PG_THRIFT_BINARY_INT16;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_INT32) {
+    return PG_THRIFT_BINARY_INT32;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_INT64) {
+    return PG_THRIFT_BINARY_INT64;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_STRING) {
+    return PG_THRIFT_BINARY_STRING;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_STRUCT) {
+    return PG_THRIFT_BINARY_STRUCT;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_MAP) {
+    return PG_THRIFT_BINARY_MAP;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_SET) {
+    return PG_THRIFT_BINARY_SET;
+  }
+
+  if (field_type == PG_THRIFT_COMPACT_LIST) {
+    return PG_THRIFT_BINARY_LIST;
+  }
+  elog(ERROR, "Invalid thrift compact field type");
+}
+
 Datum parse_thrift_binary_boolean(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_boolean_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_boolean_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_boolean_internal(uint8* start, uint8* end) {
@@ -208,12 +726,12 @@ Datum parse_thrift_binary_boolean_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_binary_string(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_bytes(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_bytes_internal(uint8* start, uint8* end) {
@@ -229,12 +747,12 @@ Datum parse_thrift_binary_bytes_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_compact_string(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_bytes(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_bytes_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_bytes_internal(uint8* start, uint8* end) {
@@ -262,30 +780,25 @@ Datum parse_thrift_binary_string_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_binary_double(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_double_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_double_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_double(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
   // binary and compact are same for double
-  return parse_thrift_binary_double_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_double_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_double_internal(uint8* start, uint8* end) {
   if (start + DOUBLE_LEN - 1 >= end) {
     elog(ERROR, "Invalid thrift format for double");
   }
-  float8 ret;
-  memcpy(&ret, start, DOUBLE_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)&ret, DOUBLE_LEN);
-  }
-  PG_RETURN_FLOAT8(ret);
+  PG_RETURN_FLOAT8(thrift_load_be_double(start));
 }
 
 Datum parse_thrift_binary_int16(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_int16_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_int16_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_int16_internal(uint8* start, uint8* end) {
@@ -294,7 +807,7 @@ Datum parse_thrift_binary_int16_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_compact_int16(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_int16_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_int16_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_int16_internal(uint8* start, uint8* end) {
@@ -304,7 +817,7 @@ Datum parse_thrift_compact_int16_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_binary_int32(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_int32_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_int32_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_int32_internal(uint8* start, uint8* end) {
@@ -313,7 +826,7 @@ Datum parse_thrift_binary_int32_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_compact_int32(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_int32_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_int32_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_int32_internal(uint8* start, uint8* end) {
@@ -323,7 +836,7 @@ Datum parse_thrift_compact_int32_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_binary_int64(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_int64_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_int64_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_int64_internal(uint8* start, uint8* end) {
@@ -332,7 +845,7 @@ Datum parse_thrift_binary_int64_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_compact_int64(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_int64_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_int64_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_int64_internal(uint8* start, uint8* end) {
@@ -360,7 +873,7 @@ Datum parse_thrift_compact_struct_bytea_internal(uint8* start, uint8* end) {
 
 Datum parse_thrift_binary_list_bytea(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_list_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_list_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_list_bytea_internal(uint8* start, uint8* end) {
@@ -370,15 +883,17 @@ Datum parse_thrift_binary_list_bytea_internal(uint8* start, uint8* end) {
   int8 element_type = *start;
   int32 len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, LIST_LEN);
   uint8* curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
-  Datum ret[THRIFT_RESULT_MAX_FIELDS];
-  bool null[THRIFT_RESULT_MAX_FIELDS], typbyval;
+  if (len < 0 || len > end - curr) {
+    elog(ERROR, "Invalid thrift binary format for list");
+  }
+  Datum* ret = palloc(len * sizeof(Datum));
+  bool typbyval;
   int16 typlen;
   char typalign;
   get_typlenbyvalalign(BYTEAOID, &typlen, &typbyval, &typalign);
   for (int i = 0; i < len; i++) {
     uint8* p = skip_binary_field(curr, end, element_type);
     ret[i] = PointerGetDatum(palloc(p - curr + VARHDRSZ));
-    null[i] = false;
     memcpy(VARDATA(ret[i]), curr, p - curr);
     SET_VARSIZE(ret[i], p - curr + VARHDRSZ);
     curr = p;
@@ -387,13 +902,13 @@ Datum parse_thrift_binary_list_bytea_internal(uint8* start, uint8* end) {
   dims[0] = len;
   lbs[0] = 1;
   PG_RETURN_POINTER(
-    construct_md_array(ret, null, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
+    construct_md_array(ret, NULL, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
   );
 }
 
 Datum parse_thrift_compact_list_bytea(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_list_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_list_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_list_bytea_internal(uint8* start, uint8* end) {
@@ -411,15 +926,17 @@ Datum parse_thrift_compact_list_bytea_internal(uint8* start, uint8* end) {
   } else {
     curr = start + PG_THRIFT_TYPE_LEN;
   }
-  Datum ret[THRIFT_RESULT_MAX_FIELDS];
-  bool null[THRIFT_RESULT_MAX_FIELDS], typbyval;
+  if (len > end - curr) {
+    elog(ERROR, "Invalid thrift compact format for list");
+  }
+  Datum* ret = palloc(len * sizeof(Datum));
+  bool typbyval;
   int16 typlen;
   char typalign;
   get_typlenbyvalalign(BYTEAOID, &typlen, &typbyval, &typalign);
   for (int i = 0; i < len; i++) {
     uint8* p = skip_compact_field(curr, end, compact_list_type_to_struct_type(type_id));
     ret[i] = PointerGetDatum(palloc(p - curr + VARHDRSZ));
-    null[i] = false;
     memcpy(VARDATA(ret[i]), curr, p - curr);
     SET_VARSIZE(ret[i], p - curr + VARHDRSZ);
     curr = p;
@@ -428,13 +945,13 @@ Datum parse_thrift_compact_list_bytea_internal(uint8* start, uint8* end) {
   dims[0] = len;
   lbs[0] = 1;
   PG_RETURN_POINTER(
-    construct_md_array(ret, null, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
+    construct_md_array(ret, NULL, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
   );
 }
 
 Datum parse_thrift_binary_map_bytea(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_binary_map_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_binary_map_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_binary_map_bytea_internal(uint8* start, uint8* end) {
@@ -443,8 +960,11 @@ Datum parse_thrift_binary_map_bytea_internal(uint8* start, uint8* end) {
   }
   int32 len = parse_int_helper(start + 2*PG_THRIFT_TYPE_LEN, end, INT32_LEN);
   uint8* curr = start + 2*PG_THRIFT_TYPE_LEN + INT32_LEN;
-  Datum ret[THRIFT_RESULT_MAX_FIELDS];
-  bool null[THRIFT_RESULT_MAX_FIELDS], typbyval;
+  if (len < 0 || len > end - curr) {
+    elog(ERROR, "Invalid thrift binary format for map");
+  }
+  Datum* ret = palloc(2 * len * sizeof(Datum));
+  bool typbyval;
   int16 typlen;
   char typalign;
   get_typlenbyvalalign(BYTEAOID, &typlen, &typbyval, &typalign);
@@ -452,7 +972,6 @@ Datum parse_thrift_binary_map_bytea_internal(uint8* start, uint8* end) {
     int type_id = (i % 2 == 0? *start : *(start + 1));
     uint8* p = skip_binary_field(curr, end, type_id);
     ret[i] = PointerGetDatum(palloc(p - curr + VARHDRSZ));
-    null[i] = false;
     memcpy(VARDATA(ret[i]), curr, p - curr);
     SET_VARSIZE(ret[i], p - curr + VARHDRSZ);
     curr = p;
@@ -461,13 +980,13 @@ Datum parse_thrift_binary_map_bytea_internal(uint8* start, uint8* end) {
   dims[0] = 2*len;
   lbs[0] = 1;
   PG_RETURN_POINTER(
-    construct_md_array(ret, null, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
+    construct_md_array(ret, NULL, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
   );
 }
 
 Datum parse_thrift_compact_map_bytea(PG_FUNCTION_ARGS) {
   bytea* data = PG_GETARG_BYTEA_P(0);
-  return parse_thrift_compact_map_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data));
+  return parse_thrift_compact_map_bytea_internal((uint8*)VARDATA(data), (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ);
 }
 
 Datum parse_thrift_compact_map_bytea_internal(uint8* start, uint8* end) {
@@ -477,8 +996,11 @@ Datum parse_thrift_compact_map_bytea_internal(uint8* start, uint8* end) {
   int64 size_len = 0;
   int32 len = parse_varint_helper(start, end, &size_len);
   uint8* curr = start + size_len;
-  Datum ret[THRIFT_RESULT_MAX_FIELDS];
-  bool null[THRIFT_RESULT_MAX_FIELDS], typbyval;
+  if (len < 0 || curr >= end || len > end - curr) {
+    elog(ERROR, "Invalid thrift compact format for map");
+  }
+  Datum* ret = palloc(2 * len * sizeof(Datum));
+  bool typbyval;
   int16 typlen;
   char typalign;
   get_typlenbyvalalign(BYTEAOID, &typlen, &typbyval, &typalign);
@@ -490,7 +1012,6 @@ Datum parse_thrift_compact_map_bytea_internal(uint8* start, uint8* end) {
     int type_id = (i % 2 == 0? key_type_id : value_type_id);
     uint8* p = skip_compact_field(curr, end, type_id);
     ret[i] = PointerGetDatum(palloc(p - curr + VARHDRSZ));
-    null[i] = false;
     memcpy(VARDATA(ret[i]), curr, p - curr);
     SET_VARSIZE(ret[i], p - curr + VARHDRSZ);
     curr = p;
@@ -499,45 +1020,158 @@ Datum parse_thrift_compact_map_bytea_internal(uint8* start, uint8* end) {
   dims[0] = 2*len;
   lbs[0] = 1;
   PG_RETURN_POINTER(
-    construct_md_array(ret, null, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
+    construct_md_array(ret, NULL, ndims, dims, lbs, BYTEAOID, typlen, typbyval, typalign)
   );
 }
 
+Datum element_array(Datum* elements, int len, Oid element_type) {
+  bool typbyval;
+  int16 typlen;
+  char typalign;
+  get_typlenbyvalalign(element_type, &typlen, &typbyval, &typalign);
+  PG_RETURN_POINTER(construct_array(elements, len, element_type, typlen, typbyval, typalign));
+}
+
+// decodes a list (set) straight into an array of element_type, without
+// copying the elements out as bytea first. type_id is the thrift type
+// the elements must have.
+Datum parse_thrift_binary_list_internal(uint8* start, uint8* end, int8 type_id, Oid element_type) {
+  if (start + PG_THRIFT_TYPE_LEN + LIST_LEN - 1 >= end) {
+    elog(ERROR, "Invalid thrift binary format for list");
+  }
+  int32 len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, LIST_LEN);
+  uint8* curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
+  if (len < 0 || len > end - curr) {
+    elog(ERROR, "Invalid thrift binary format for list");
+  }
+  if (len > 0 && *start != type_id) {
+    elog(ERROR, "Invalid thrift binary element type for list");
+  }
+  Datum* ret = palloc(len * sizeof(Datum));
+  int width = binary_fixed_width(type_id);
+  if (width > 0) {
+    // fixed width elements are converted to native order in one pass
+    if (len > (end - curr) / width) {
+      elog(ERROR, "Invalid thrift binary format for list");
+    }
+    uint8* values = palloc(len * width);
+    thrift_load_be_n(curr, values, len, width);
+    for (int i = 0; i < len; i++) {
+      if (type_id == PG_THRIFT_BINARY_INT16) {
+        ret[i] = Int16GetDatum(((int16*)values)[i]);
+      } else if (type_id == PG_THRIFT_BINARY_INT32) {
+        ret[i] = Int32GetDatum(((int32*)values)[i]);
+      } else if (type_id == PG_THRIFT_BINARY_INT64) {
+        ret[i] = Int64GetDatum(((int64*)values)[i]);
+      } else {
+        ret[i] = Float8GetDatum(((float8*)values)[i]);
+      }
+    }
+    pfree(values);
+    return element_array(ret, len, element_type);
+  }
+  for (int i = 0; i < len; i++) {
+    ret[i] = parse_binary_value(curr, end, type_id);
+    curr = skip_binary_field(curr, end, type_id);
+  }
+  return element_array(ret, len, element_type);
+}
+
+// type_id is the binary type id, compact containers use the same ids
+// for their elements
+Datum parse_thrift_compact_list_internal(uint8* start, uint8* end, int8 type_id, Oid element_type) {
+  if (start >= end) {
+    elog(ERROR, "Invalid thrift compact format for list");
+  }
+  uint8 size_type_id = *start;
+  int64 len = (size_type_id & 0xf0) >> 4;
+  uint8* curr = start + PG_THRIFT_TYPE_LEN;
+  if (len == 0xf) {
+    int64 size_len = 0;
+    len = parse_varint_helper(curr, end, &size_len);
+    curr += size_len;
+  }
+  if (len < 0 || len > end - curr) {
+    elog(ERROR, "Invalid thrift compact format for list");
+  }
+  if (len > 0 && (size_type_id & 0x0f) != type_id) {
+    elog(ERROR, "Invalid thrift compact element type for list");
+  }
+  uint8 compact_type_id = compact_list_type_to_struct_type(type_id);
+  Datum* ret = palloc(len * sizeof(Datum));
+  if (is_compact_varint_type(compact_type_id)) {
+    int64* values = palloc(len * sizeof(int64));
+    if (thrift_varint_decode_n(curr, end, values, len) == NULL) {
+      elog(ERROR, "Invalid thrift compact format for list");
+    }
+    for (int i = 0; i < len; i++) {
+      if (compact_type_id == PG_THRIFT_COMPACT_INT16) {
+        ret[i] = Int16GetDatum(values[i]);
+      } else if (compact_type_id == PG_THRIFT_COMPACT_INT32) {
+        ret[i] = Int32GetDatum(values[i]);
+      } else {
+        ret[i] = Int64GetDatum(values[i]);
+      }
+    }
+    pfree(values);
+    return element_array(ret, len, element_type);
+  }
+  for (int i = 0; i < len; i++) {
+    if (compact_type_id == PG_THRIFT_COMPACT_BOOL) {
+      // bool elements take a whole byte, 1 is true
+      if (curr >= end) {
+        elog(ERROR, "Invalid thrift compact format for bool");
+      }
+      ret[i] = BoolGetDatum(*curr == 1);
+    } else {
+      ret[i] = parse_compact_field(curr, end, compact_type_id);
+    }
+    curr = skip_compact_field(curr, end, compact_type_id);
+  }
+  return element_array(ret, len, element_type);
+}
+
+// start points to the field header
 Datum parse_binary_field(uint8* start, uint8* end, int8 type_id) {
+  return parse_binary_value(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, type_id);
+}
+
+// start points to the value right after the field header
+Datum parse_binary_value(uint8* start, uint8* end, int8 type_id) {
   if (type_id == PG_THRIFT_BINARY_BOOL) {
-    return parse_thrift_binary_boolean_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_boolean_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_BYTE || type_id == PG_THRIFT_BINARY_STRING) {
-    return parse_thrift_binary_bytes_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_bytes_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_DOUBLE) {
-    return parse_thrift_binary_double_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_double_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_INT16) {
-    return parse_thrift_binary_int16_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_int16_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_INT32) {
-    return parse_thrift_binary_int32_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_int32_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_INT64) {
-    return parse_thrift_binary_int64_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_int64_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_STRUCT) {
-    return parse_thrift_binary_struct_bytea_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_struct_bytea_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET) {
-    return parse_thrift_binary_list_bytea_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_list_bytea_internal(start, end);
   }
 
   if (type_id == PG_THRIFT_BINARY_MAP) {
-    return parse_thrift_binary_map_bytea_internal(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end);
+    return parse_thrift_binary_map_bytea_internal(start, end);
   }
   elog(ERROR, "Unsupported thrift binary type");
 }
@@ -583,14 +1217,19 @@ Datum parse_compact_field(uint8* start, uint8* end, int8 type_id) {
   elog(ERROR, "Unsupported thrift compact type");
 }
 
-// give start of data, end of data and type id,
-// return pointer after its end
-uint8* skip_binary_field(uint8* start, uint8* end, int8 field_type) {
+// give start of data, end of data and type id, return pointer after
+// its end, or NULL when the value does not end before end. For a slice
+// of a larger datum NULL means that more of the datum is needed.
+uint8* try_skip_binary_field(uint8* start, uint8* end, int8 field_type) {
   uint8* ret = 0;
   if (field_type == PG_THRIFT_BINARY_BOOL) {
     ret = start + BOOL_LEN;
   } else if (field_type == PG_THRIFT_BINARY_BYTE || field_type == PG_THRIFT_BINARY_STRING) {
+    if (start + INT32_LEN > end) return NULL;
     int32 len = parse_int_helper(start, end, INT32_LEN);
+    if (len < 0) {
+      elog(ERROR, "Invalid thrift format");
+    }
     ret = start + INT32_LEN + len;
   } else if (field_type == PG_THRIFT_BINARY_DOUBLE) {
     ret = start + DOUBLE_LEN;
@@ -603,42 +1242,71 @@ uint8* skip_binary_field(uint8* start, uint8* end, int8 field_type) {
   } else if (field_type == PG_THRIFT_BINARY_STRUCT) {
     ret = start;
     while (true) {
+      if (ret >= end) return NULL;
       if (*ret == 0) { ret += 1; break; }
+      if (ret + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN > end) return NULL;
       int8 field_type = *ret;
-      ret = skip_binary_field(ret + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, field_type);
+      ret = try_skip_binary_field(ret + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, field_type);
+      if (ret == NULL) return NULL;
     }
   } else if (field_type == PG_THRIFT_BINARY_MAP) {
+    if (start + 2*PG_THRIFT_TYPE_LEN + INT32_LEN > end) return NULL;
     int8 key_type = *start;
     int8 value_type = *(start + PG_THRIFT_TYPE_LEN);
     int32 len = parse_int_helper(start + 2*PG_THRIFT_TYPE_LEN, end, INT32_LEN);
+    if (len < 0) {
+      elog(ERROR, "Invalid thrift format");
+    }
     ret = start + 2*PG_THRIFT_TYPE_LEN + INT32_LEN;
-    for (int i = 0; i < len; i++) {
-      ret = skip_binary_field(ret, end, key_type);
-      ret = skip_binary_field(ret, end, value_type);
+    for (int i = 0; i < len && ret != NULL; i++) {
+      ret = try_skip_binary_field(ret, end, key_type);
+      if (ret != NULL) {
+        ret = try_skip_binary_field(ret, end, value_type);
+      }
     }
+    if (ret == NULL) return NULL;
   } else if (field_type == PG_THRIFT_BINARY_SET || field_type == PG_THRIFT_BINARY_LIST) {
+    if (start + PG_THRIFT_TYPE_LEN + INT32_LEN > end) return NULL;
     int32 len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, INT32_LEN);
     int8 field_type = *start;
+    if (len < 0) {
+      elog(ERROR, "Invalid thrift format");
+    }
     ret = start + PG_THRIFT_TYPE_LEN + INT32_LEN;
-    for (int i = 0; i < len; i++) {
-      ret = skip_binary_field(ret, end, field_type);
+    for (int i = 0; i < len && ret != NULL; i++) {
+      ret = try_skip_binary_field(ret, end, field_type);
     }
+    if (ret == NULL) return NULL;
+  } else {
+    elog(ERROR, "Invalid thrift format");
   }
 
   if (ret > end) {
-    elog(ERROR, "Invalid thrift format");
+    return NULL;
   }
 
   return ret;
 }
 
-uint8* skip_compact_field(uint8* start, uint8* end, int8 field_type) {
+uint8* skip_binary_field(uint8* start, uint8* end, int8 field_type) {
+  uint8* ret = try_skip_binary_field(start, end, field_type);
+  if (ret == NULL) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  return ret;
+}
+
+uint8* try_skip_compact_field(uint8* start, uint8* end, int8 field_type) {
   uint8* ret = 0;
   if (field_type == PG_THRIFT_COMPACT_BOOL) {
     ret = start + BOOL_LEN;
   } else if (field_type == PG_THRIFT_COMPACT_BYTE || field_type == PG_THRIFT_COMPACT_STRING) {
     int64 len_length = 0;
     int32 len = parse_varint_helper(start, end, &len_length);
+    if (start + len_length > end) return NULL;
+    if (len < 0) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
     ret = start + len_length + len;
   } else if (field_type == PG_THRIFT_COMPACT_DOUBLE) {
     ret = start + DOUBLE_LEN;
@@ -654,6 +1322,7 @@ uint8* skip_compact_field(uint8* start, uint8* end, int8 field_type) {
     field_type == PG_THRIFT_COMPACT_SET ||
     field_type == PG_THRIFT_COMPACT_LIST
   ) {
+    if (start + PG_THRIFT_TYPE_LEN > end) return NULL;
     uint8 len_type_id = parse_int_helper(start, end, PG_THRIFT_TYPE_LEN);
     uint32 len = (len_type_id & 0xf0) >> 4;
     uint8 type_id = len_type_id & 0x0f;
@@ -661,26 +1330,43 @@ uint8* skip_compact_field(uint8* start, uint8* end, int8 field_type) {
       int64 len_length = 0;
       len = parse_varint_helper(start + PG_THRIFT_TYPE_LEN, end, &len_length);
       ret = start + PG_THRIFT_TYPE_LEN + len_length;
+      if (ret > end) return NULL;
     } else {
       ret = start + PG_THRIFT_TYPE_LEN;
     }
-    for (int i = 0; i < len; i++) {
-      ret = skip_compact_field(ret, end, compact_list_type_to_struct_type(type_id));
+    uint8 element_type = compact_list_type_to_struct_type(type_id);
+    if (is_compact_varint_type(element_type)) {
+      ret = (uint8*)thrift_varint_skip_n(ret, end, len);
+    }
+    for (int i = 0; i < len && ret != NULL && !is_compact_varint_type(element_type); i++) {
+      ret = try_skip_compact_field(ret, end, element_type);
     }
+    if (ret == NULL) return NULL;
   } else if (field_type == PG_THRIFT_COMPACT_MAP) {
       int64 len_length = 0;
       int32 len = parse_varint_helper(start, end, &len_length);
+      if (start + len_length + PG_THRIFT_TYPE_LEN > end) return NULL;
       uint8 key_value_type_id = parse_int_helper(start + len_length, end, PG_THRIFT_TYPE_LEN);
       uint8 key_type = (key_value_type_id & 0xf0) >> 4;
       uint8 value_type = (key_value_type_id & 0x0f);
       ret = start + len_length + PG_THRIFT_TYPE_LEN;
-      for (int i = 0; i < len; i++) {
-        ret = skip_compact_field(ret, end, compact_list_type_to_struct_type(key_type));
-        ret = skip_compact_field(ret, end, compact_list_type_to_struct_type(value_type));
+      uint8 key_struct_type = compact_list_type_to_struct_type(key_type);
+      uint8 value_struct_type = compact_list_type_to_struct_type(value_type);
+      bool varint_entries = is_compact_varint_type(key_struct_type) && is_compact_varint_type(value_struct_type);
+      if (varint_entries && len > 0) {
+        ret = (uint8*)thrift_varint_skip_n(ret, end, 2 * (int64)len);
+      }
+      for (int i = 0; i < len && ret != NULL && !varint_entries; i++) {
+        ret = try_skip_compact_field(ret, end, key_struct_type);
+        if (ret != NULL) {
+          ret = try_skip_compact_field(ret, end, value_struct_type);
+        }
       }
+      if (ret == NULL) return NULL;
   } else if (field_type == PG_THRIFT_COMPACT_STRUCT) {
     ret = start;
     while (true) {
+      if (ret >= end) return NULL;
       if (*ret == 0) {
         ret += 1; break;
       }
@@ -691,565 +1377,1347 @@ uint8* skip_compact_field(uint8* start, uint8* end, int8 field_type) {
       } else {
         ret += PG_THRIFT_TYPE_LEN;
       }
-      ret = skip_compact_field(ret, end, type_id);
+      if (ret > end) return NULL;
+      ret = try_skip_compact_struct_field(ret, end, type_id);
+      if (ret == NULL) return NULL;
     }
   } else {
     elog(ERROR, "Invalid thrift compact field type");
   }
 
   if (ret > end) {
-    elog(ERROR, "Invalid thrift compact format");
+    return NULL;
   }
 
   return ret;
 }
 
-Datum thrift_binary_decode(uint8* data, Size size, int16 field_id, int8 type_id) {
-  uint8* start = data, *end = data + size;
-  while (start < end) {
-    if (start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN - 1 >= end) break;
-    int16 parsed_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
-    if (parsed_field_id == field_id) {
-      if (*start == type_id) {
-        return parse_binary_field(start, end, type_id);
+uint8* skip_compact_field(uint8* start, uint8* end, int8 field_type) {
+  uint8* ret = try_skip_compact_field(start, end, field_type);
+  if (ret == NULL) {
+    elog(ERROR, "Invalid thrift compact format");
+  }
+  return ret;
+}
+
+// bool struct fields keep their value in the type nibble (1 is true,
+// 2 is false) and have no payload, everything else is skipped normally
+uint8* try_skip_compact_struct_field(uint8* start, uint8* end, int8 field_type) {
+  if (field_type == 1 || field_type == PG_THRIFT_COMPACT_BOOL) {
+    return start;
+  }
+  return try_skip_compact_field(start, end, field_type);
+}
+
+uint8* skip_compact_struct_field(uint8* start, uint8* end, int8 field_type) {
+  if (field_type == 1 || field_type == PG_THRIFT_COMPACT_BOOL) {
+    return start;
+  }
+  return skip_compact_field(start, end, field_type);
+}
+
+// binary type ids, compact containers use them for their elements too
+bool is_binary_type(uint8 type_id) {
+  return type_id == PG_THRIFT_BINARY_BOOL ||
+    type_id == PG_THRIFT_BINARY_BYTE ||
+    type_id == PG_THRIFT_BINARY_DOUBLE ||
+    type_id == PG_THRIFT_BINARY_INT16 ||
+    type_id == PG_THRIFT_BINARY_INT32 ||
+    type_id == PG_THRIFT_BINARY_INT64 ||
+    (type_id >= PG_THRIFT_BINARY_STRING && type_id <= PG_THRIFT_BINARY_LIST);
+}
+
+/*
+ * Unlike skipping, validation never raises an error: it returns the
+ * pointer after the value, or NULL when the value is cut off, nested
+ * deeper than THRIFT_MAX_DEPTH or has an unknown type id or a negative
+ * length anywhere inside.
+ */
+uint8* validate_binary_value(uint8* start, uint8* end, int8 type_id, int depth) {
+  if (depth > THRIFT_MAX_DEPTH) return NULL;
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    return end - start >= BOOL_LEN ? start + BOOL_LEN : NULL;
+  }
+  int width = binary_fixed_width(type_id);
+  if (width > 0) {
+    return end - start >= width ? start + width : NULL;
+  }
+  if (type_id == PG_THRIFT_BINARY_BYTE || type_id == PG_THRIFT_BINARY_STRING) {
+    if (end - start < BYTE_LEN) return NULL;
+    int32 len = thrift_load_be32(start);
+    if (len < 0 || len > end - start - BYTE_LEN) return NULL;
+    return start + BYTE_LEN + len;
+  }
+  if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    uint8* curr = start;
+    while (curr < end && *curr != 0) {
+      if (end - curr < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN || !is_binary_type(*curr)) return NULL;
+      curr = validate_binary_value(curr + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, *curr, depth + 1);
+      if (curr == NULL) return NULL;
+    }
+    return curr < end ? curr + 1 : NULL;
+  }
+  if (type_id == PG_THRIFT_BINARY_MAP) {
+    if (end - start < 2*PG_THRIFT_TYPE_LEN + INT32_LEN) return NULL;
+    uint8 key_type = *start;
+    uint8 value_type = *(start + PG_THRIFT_TYPE_LEN);
+    int32 len = thrift_load_be32(start + 2*PG_THRIFT_TYPE_LEN);
+    uint8* curr = start + 2*PG_THRIFT_TYPE_LEN + INT32_LEN;
+    if (len < 0 || len > end - curr) return NULL;
+    if (len > 0 && (!is_binary_type(key_type) || !is_binary_type(value_type))) return NULL;
+    for (int32 i = 0; i < len && curr != NULL; i++) {
+      curr = validate_binary_value(curr, end, key_type, depth + 1);
+      if (curr != NULL) {
+        curr = validate_binary_value(curr, end, value_type, depth + 1);
       }
-      break;
-    } else {
-      int8 target_type_id = *start;
-      start = start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
-      start = skip_binary_field(start, end, target_type_id);
     }
+    return curr;
   }
-  elog(ERROR, "Invalid thrift format");
+  if (type_id == PG_THRIFT_BINARY_SET || type_id == PG_THRIFT_BINARY_LIST) {
+    if (end - start < PG_THRIFT_TYPE_LEN + LIST_LEN) return NULL;
+    uint8 element_type = *start;
+    int32 len = thrift_load_be32(start + PG_THRIFT_TYPE_LEN);
+    uint8* curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
+    if (len < 0 || len > end - curr) return NULL;
+    if (len > 0 && !is_binary_type(element_type)) return NULL;
+    int width = binary_fixed_width(element_type);
+    if (width > 0) {
+      return len <= (end - curr) / width ? curr + (int64)len * width : NULL;
+    }
+    for (int32 i = 0; i < len && curr != NULL; i++) {
+      curr = validate_binary_value(curr, end, element_type, depth + 1);
+    }
+    return curr;
+  }
+  return NULL;
 }
 
-Datum thrift_compact_decode(uint8* data, Size size, int16 field_id, int8 type_id) {
-  uint8* start = data, *end = data + size;
-  int16 current_field_id = 0;
-  while (start < end) {
-    if (start + PG_THRIFT_TYPE_LEN >= end) break;
-    uint8 field_type_id = parse_int_helper(start, end, PG_THRIFT_TYPE_LEN);
-    uint8 field_delta = (field_type_id >> 4) & 0x0f;
-    uint8 parsed_type_id = field_type_id & 0x0f;
-    if (field_delta != 0) {
-      current_field_id += field_delta;
-    } else {
-      current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+// type_id is a compact struct field type, container elements are mapped
+// from their binary ids first
+uint8* validate_compact_value(uint8* start, uint8* end, int8 type_id, int depth) {
+  if (depth > THRIFT_MAX_DEPTH) return NULL;
+  if (type_id == PG_THRIFT_COMPACT_BOOL) {
+    return end - start >= BOOL_LEN ? start + BOOL_LEN : NULL;
+  }
+  if (type_id == PG_THRIFT_COMPACT_DOUBLE) {
+    return end - start >= DOUBLE_LEN ? start + DOUBLE_LEN : NULL;
+  }
+  if (is_compact_varint_type(type_id)) {
+    uint64 value;
+    int len = thrift_varint_decode(start, end, &value);
+    return len > 0 ? start + len : NULL;
+  }
+  if (type_id == PG_THRIFT_COMPACT_BYTE || type_id == PG_THRIFT_COMPACT_STRING) {
+    uint64 value;
+    int len_length = thrift_varint_decode(start, end, &value);
+    if (len_length == 0) return NULL;
+    int64 len = thrift_zigzag_decode(value);
+    if (len < 0 || len > end - start - len_length) return NULL;
+    return start + len_length + len;
+  }
+  if (type_id == PG_THRIFT_COMPACT_STRUCT) {
+    uint8* curr = start;
+    while (curr < end && *curr != 0) {
+      uint8 field_type = *curr & 0x0f;
+      curr += (*curr & 0xf0) == 0 ? PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN : PG_THRIFT_TYPE_LEN;
+      if (curr > end || field_type == 0 || field_type > PG_THRIFT_COMPACT_STRUCT) return NULL;
+      if (field_type == 1 || field_type == PG_THRIFT_COMPACT_BOOL) continue;
+      curr = validate_compact_value(curr, end, field_type, depth + 1);
+      if (curr == NULL) return NULL;
     }
-    if (current_field_id == field_id) {
-      if (type_id == PG_THRIFT_COMPACT_BOOL) {
-        if (parsed_type_id == 1) {
-          PG_RETURN_BOOL(1);
-        } else if (parsed_type_id == 2) {
-          PG_RETURN_BOOL(0);
-        } else {
-          elog(ERROR, "Invalid parsed type id for compact bool");
-        }
-      }
-      if (parsed_type_id == type_id) {
-        return parse_compact_field(start + PG_THRIFT_TYPE_LEN, end, type_id);
-      }
-      break;
-    } else {
-      start += PG_THRIFT_TYPE_LEN;
-      if (field_delta == 0) {
-        start += PG_THRIFT_FIELD_LEN;
+    return curr < end ? curr + 1 : NULL;
+  }
+  if (type_id == PG_THRIFT_COMPACT_MAP) {
+    uint64 value;
+    int len_length = thrift_varint_decode(start, end, &value);
+    if (len_length == 0 || end - start < len_length + PG_THRIFT_TYPE_LEN) return NULL;
+    int64 len = thrift_zigzag_decode(value);
+    uint8 key_type = (start[len_length] & 0xf0) >> 4;
+    uint8 value_type = start[len_length] & 0x0f;
+    uint8* curr = start + len_length + PG_THRIFT_TYPE_LEN;
+    if (len < 0 || len > end - curr) return NULL;
+    if (len == 0) return curr;
+    if (!is_binary_type(key_type) || !is_binary_type(value_type)) return NULL;
+    key_type = compact_list_type_to_struct_type(key_type);
+    value_type = compact_list_type_to_struct_type(value_type);
+    for (int64 i = 0; i < len && curr != NULL; i++) {
+      curr = validate_compact_value(curr, end, key_type, depth + 1);
+      if (curr != NULL) {
+        curr = validate_compact_value(curr, end, value_type, depth + 1);
       }
-      start = skip_compact_field(start, end, parsed_type_id);
     }
+    return curr;
   }
-  elog(ERROR, "Invalid thrift compact format");
+  if (type_id == PG_THRIFT_COMPACT_SET || type_id == PG_THRIFT_COMPACT_LIST) {
+    if (start >= end) return NULL;
+    uint8 element_type = *start & 0x0f;
+    int64 len = (*start & 0xf0) >> 4;
+    uint8* curr = start + PG_THRIFT_TYPE_LEN;
+    if (len == 0xf) {
+      uint64 value;
+      int len_length = thrift_varint_decode(curr, end, &value);
+      if (len_length == 0) return NULL;
+      len = thrift_zigzag_decode(value);
+      curr += len_length;
+    }
+    if (len < 0 || len > end - curr) return NULL;
+    if (len == 0) return curr;
+    if (!is_binary_type(element_type)) return NULL;
+    element_type = compact_list_type_to_struct_type(element_type);
+    if (is_compact_varint_type(element_type)) {
+      return (uint8*)thrift_varint_skip_n(curr, end, len);
+    }
+    for (int64 i = 0; i < len && curr != NULL; i++) {
+      curr = validate_compact_value(curr, end, element_type, depth + 1);
+    }
+    return curr;
+  }
+  return NULL;
 }
 
-Datum thrift_binary_get_bool(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_BOOL);
+// a valid struct ends with its stop byte exactly at end
+bool validate_struct(uint8* start, uint8* end, bool compact) {
+  uint8* ret = compact ?
+    validate_compact_value(start, end, PG_THRIFT_COMPACT_STRUCT, 1) :
+    validate_binary_value(start, end, PG_THRIFT_BINARY_STRUCT, 1);
+  return ret == end;
 }
 
-Datum thrift_compact_get_bool(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_BOOL);
+/*
+ * NOTE: checks the whole struct bytea, e.g. for a domain:
+ * CREATE DOMAIN event AS bytea CHECK (thrift_binary_validate(VALUE))
+ */
+Datum thrift_binary_validate(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  PG_RETURN_BOOL(validate_struct(start, start + VARSIZE_ANY_EXHDR(data), false));
 }
 
-Datum thrift_binary_get_byte(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_BYTE);
+Datum thrift_compact_validate(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  PG_RETURN_BOOL(validate_struct(start, start + VARSIZE_ANY_EXHDR(data), true));
 }
 
-Datum thrift_compact_get_byte(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_BYTE);
+void field_cache_reset_callback(void* arg) {
+  if (field_cache == arg) {
+    field_cache = NULL;
+  }
 }
 
-Datum thrift_binary_get_double(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_DOUBLE);
+// key is the datum as passed to the function, before detoasting, so
+// accessors which detoast the same value separately share one table. Its
+// memory may hold another value later in the same context, so the ends of
+// the datum, or of the toast pointer, are compared too.
+ThriftFieldTable* field_cache_table(Pointer key, Size size, bool compact) {
+  Size key_len = Min(VARSIZE_ANY(key), sizeof(uint64));
+  uint64 key_head = 0;
+  uint64 key_tail = 0;
+  memcpy(&key_head, key, key_len);
+  memcpy(&key_tail, key + VARSIZE_ANY(key) - key_len, key_len);
+  if (field_cache == NULL || field_cache->context != CurrentMemoryContext) {
+    field_cache = MemoryContextAllocZero(CurrentMemoryContext, sizeof(ThriftFieldCache));
+    field_cache->context = CurrentMemoryContext;
+    field_cache->callback.func = field_cache_reset_callback;
+    field_cache->callback.arg = field_cache;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, &field_cache->callback);
+  }
+  for (int i = 0; i < THRIFT_FIELD_CACHE_SLOTS; i++) {
+    ThriftFieldTable* table = &field_cache->slots[i];
+    if (table->key == key && table->size == size && table->compact == compact &&
+        table->key_head == key_head && table->key_tail == key_tail) {
+      return table;
+    }
+  }
+  ThriftFieldTable* table = &field_cache->slots[field_cache->next_slot];
+  field_cache->next_slot = (field_cache->next_slot + 1) % THRIFT_FIELD_CACHE_SLOTS;
+  if (table->fields == NULL) {
+    table->capacity = THRIFT_FIELD_TABLE_INITIAL_SIZE;
+    table->fields = MemoryContextAlloc(field_cache->context, sizeof(ThriftFieldOffset) * table->capacity);
+  }
+  table->key = key;
+  table->size = size;
+  table->key_head = key_head;
+  table->key_tail = key_tail;
+  table->bytes = NULL;
+  table->compact = compact;
+  table->complete = false;
+  table->scan_pending = false;
+  table->scan_offset = 0;
+  table->scan_field_id = 0;
+  table->nfields = 0;
+  table->map_indexes = NULL;
+  return table;
 }
 
-Datum thrift_compact_get_double(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_DOUBLE);
+void field_table_add(ThriftFieldTable* table, int16 field_id, uint8 type_id, uint32 offset) {
+  if (table->nfields == table->capacity) {
+    table->capacity *= 2;
+    table->fields = repalloc(table->fields, sizeof(ThriftFieldOffset) * table->capacity);
+  }
+  table->fields[table->nfields].field_id = field_id;
+  table->fields[table->nfields].type_id = type_id;
+  table->fields[table->nfields].offset = offset;
+  table->nfields += 1;
 }
 
-Datum thrift_binary_get_int16(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_INT16);
+// a walk over a slice of the datum stops where the slice ends and is
+// resumed on a larger slice, on the whole datum this is a format error
+ThriftFieldOffset* field_table_truncated(ThriftFieldTable* table, bool* truncated) {
+  if (truncated == NULL) {
+    elog(ERROR, table->compact ? "Invalid thrift compact format" : "Invalid thrift format");
+  }
+  *truncated = true;
+  return NULL;
 }
 
-Datum thrift_compact_get_int16(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_INT16);
+// the field which was found last is only skipped when the walk is resumed,
+// so a lookup never pays for skipping the value it is about to decode
+ThriftFieldOffset* field_table_scan_binary(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, bool* truncated) {
+  uint8* start = data + table->scan_offset, *end = data + size;
+  bool partial = size < table->size;
+  if (table->scan_pending) {
+    start = try_skip_binary_field(start, end, table->fields[table->nfields - 1].type_id);
+    if (start == NULL) {
+      return field_table_truncated(table, truncated);
+    }
+    table->scan_offset = start - data;
+    table->scan_pending = false;
+  }
+  while (start < end && *start != 0) {
+    if (start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN > end) {
+      return field_table_truncated(table, truncated);
+    }
+    int8 type_id = *start;
+    int16 parsed_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+    start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+    field_table_add(table, parsed_field_id, type_id, start - data);
+    table->scan_offset = start - data;
+    table->scan_pending = true;
+    if (parsed_field_id == field_id) {
+      return &table->fields[table->nfields - 1];
+    }
+    start = try_skip_binary_field(start, end, type_id);
+    if (start == NULL) {
+      return field_table_truncated(table, truncated);
+    }
+    table->scan_offset = start - data;
+    table->scan_pending = false;
+  }
+  if (start >= end && partial) {
+    return field_table_truncated(table, truncated);
+  }
+  table->complete = true;
+  return NULL;
+}
+
+ThriftFieldOffset* field_table_scan_compact(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, bool* truncated) {
+  uint8* start = data + table->scan_offset, *end = data + size;
+  bool partial = size < table->size;
+  int16 current_field_id = table->scan_field_id;
+  if (table->scan_pending) {
+    start = try_skip_compact_struct_field(start, end, table->fields[table->nfields - 1].type_id);
+    if (start == NULL) {
+      return field_table_truncated(table, truncated);
+    }
+    table->scan_offset = start - data;
+    table->scan_pending = false;
+  }
+  while (start < end && *start != 0) {
+    uint8 field_delta = (*start >> 4) & 0x0f;
+    uint8 parsed_type_id = *start & 0x0f;
+    if (field_delta != 0) {
+      current_field_id += field_delta;
+      start += PG_THRIFT_TYPE_LEN;
+    } else {
+      if (start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN > end) {
+        return field_table_truncated(table, truncated);
+      }
+      current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+      start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+    }
+    field_table_add(table, current_field_id, parsed_type_id, start - data);
+    table->scan_offset = start - data;
+    table->scan_field_id = current_field_id;
+    table->scan_pending = true;
+    if (current_field_id == field_id) {
+      return &table->fields[table->nfields - 1];
+    }
+    start = try_skip_compact_struct_field(start, end, parsed_type_id);
+    if (start == NULL) {
+      return field_table_truncated(table, truncated);
+    }
+    table->scan_offset = start - data;
+    table->scan_pending = false;
+  }
+  if (start >= end && partial) {
+    return field_table_truncated(table, truncated);
+  }
+  table->complete = true;
+  return NULL;
+}
+
+// size is the number of bytes available at data, when it is less than the
+// size of the datum truncated is set if the walk needs more of it
+ThriftFieldOffset* field_table_find(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, bool* truncated) {
+  for (int i = 0; i < table->nfields; i++) {
+    if (table->fields[i].field_id == field_id) {
+      field_cache_hits += 1;
+      return &table->fields[i];
+    }
+  }
+  if (table->complete) {
+    field_cache_hits += 1;
+    return NULL;
+  }
+  field_cache_misses += 1;
+  if (table->compact) {
+    return field_table_scan_compact(table, data, size, field_id, truncated);
+  }
+  return field_table_scan_binary(table, data, size, field_id, truncated);
+}
+
+Datum thrift_binary_decode_field(ThriftFieldOffset* field, uint8* data, uint8* end, int8 type_id) {
+  if (field != NULL && field->type_id == type_id) {
+    return parse_binary_value(data + field->offset, end, type_id);
+  }
+  elog(ERROR, "Invalid thrift format");
+}
+
+Datum thrift_compact_decode_field(ThriftFieldOffset* field, uint8* data, uint8* end, int8 type_id) {
+  if (field != NULL) {
+    if (type_id == PG_THRIFT_COMPACT_BOOL) {
+      if (field->type_id == 1) {
+        PG_RETURN_BOOL(1);
+      } else if (field->type_id == 2) {
+        PG_RETURN_BOOL(0);
+      } else {
+        elog(ERROR, "Invalid parsed type id for compact bool");
+      }
+    }
+    if (field->type_id == type_id) {
+      return parse_compact_field(data + field->offset, end, type_id);
+    }
+  }
+  elog(ERROR, "Invalid thrift compact format");
+}
+
+Datum thrift_binary_decode(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, int8 type_id) {
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  return thrift_binary_decode_field(field, data, data + size, type_id);
+}
+
+Datum thrift_compact_decode(ThriftFieldTable* table, uint8* data, Size size, int16 field_id, int8 type_id) {
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  return thrift_compact_decode_field(field, data, data + size, type_id);
+}
+
+// only values stored out of line are worth fetching piecewise, a slice
+// of a value compressed inline decompresses it from the start each time
+bool thrift_datum_is_sliceable(Pointer raw) {
+  return VARATT_IS_EXTERNAL_ONDISK(raw);
+}
+
+/*
+ * Fetch the datum in growing slices from its start until the requested
+ * field and its whole value are inside the slice, so fields near the
+ * start of large toasted structs are decoded without detoasting all of
+ * it. Fields further in than a fraction of the value are read from one
+ * full detoast. The field offset cache is keyed by the toast pointer,
+ * offsets stay valid from one slice to the next as all slices start at 0.
+ */
+Datum thrift_decode_sliced(Datum datum, bool compact, int16 field_id, int8 type_id) {
+  Size size = toast_raw_datum_size(datum) - VARHDRSZ;
+  ThriftFieldTable* table = field_cache_table(DatumGetPointer(datum), size, compact);
+  Size window = THRIFT_SLICE_INITIAL_SIZE;
+  if (table->bytes != NULL) {
+    window = VARSIZE(table->bytes) - VARHDRSZ;
+  }
+  for (; window * THRIFT_SLICE_MAX_FRACTION <= size; window *= 2) {
+    if (table->bytes == NULL || VARSIZE(table->bytes) - VARHDRSZ < window) {
+      if (table->bytes != NULL) {
+        pfree(table->bytes);
+      }
+      table->bytes = DatumGetByteaPSlice(datum, 0, window);
+    }
+    uint8* data = (uint8*)VARDATA(table->bytes);
+    uint8* end = data + VARSIZE(table->bytes) - VARHDRSZ;
+    bool truncated = false;
+    ThriftFieldOffset* field = field_table_find(table, data, end - data, field_id, &truncated);
+    if (!truncated) {
+      if (field == NULL) {
+        elog(ERROR, compact ? "Invalid thrift compact format" : "Invalid thrift format");
+      }
+      uint8* value_end = compact ?
+        try_skip_compact_struct_field(data + field->offset, end, field->type_id) :
+        try_skip_binary_field(data + field->offset, end, field->type_id);
+      if (value_end != NULL) {
+        if (compact) {
+          return thrift_compact_decode_field(field, data, end, type_id);
+        }
+        return thrift_binary_decode_field(field, data, end, type_id);
+      }
+    }
+  }
+  uint8* data;
+  table = field_cache_datum(datum, compact, &data, &size);
+  if (compact) {
+    return thrift_compact_decode(table, data, size, field_id, type_id);
+  }
+  return thrift_binary_decode(table, data, size, field_id, type_id);
+}
+
+/*
+ * Field table of an accessor argument with its bytes. Values which are
+ * compressed or stored out of line are detoasted into the table, so all
+ * accessors called on the same datum share one copy.
+ */
+ThriftFieldTable* field_cache_datum(Datum datum, bool compact, uint8** data, Size* size) {
+  Pointer raw = DatumGetPointer(datum);
+  if (!VARATT_IS_EXTERNAL(raw) && !VARATT_IS_COMPRESSED(raw)) {
+    *data = (uint8*)VARDATA_ANY(raw);
+    *size = VARSIZE_ANY_EXHDR(raw);
+    return field_cache_table(raw, *size, compact);
+  }
+  *size = toast_raw_datum_size(datum) - VARHDRSZ;
+  ThriftFieldTable* table = field_cache_table(raw, *size, compact);
+  if (table->bytes == NULL || VARSIZE(table->bytes) - VARHDRSZ < *size) {
+    if (table->bytes != NULL) {
+      pfree(table->bytes);
+    }
+    table->bytes = DatumGetByteaP(datum);
+  }
+  *data = (uint8*)VARDATA(table->bytes);
+  return table;
+}
+
+// decode one field of a thrift value, as the accessors and the batch scan do
+Datum thrift_decode_datum(Datum datum, bool compact, int32 field_id, int8 type_id) {
+  if (thrift_datum_is_sliceable(DatumGetPointer(datum))) {
+    return thrift_decode_sliced(datum, compact, field_id, type_id);
+  }
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(datum, compact, &data, &size);
+  if (compact) {
+    return thrift_compact_decode(table, data, size, field_id, type_id);
+  }
+  return thrift_binary_decode(table, data, size, field_id, type_id);
+}
+
+Datum thrift_binary_get_field(FunctionCallInfo fcinfo, int8 type_id) {
+  return thrift_decode_datum(PG_GETARG_DATUM(0), false, PG_GETARG_INT32(1), type_id);
+}
+
+Datum thrift_compact_get_field(FunctionCallInfo fcinfo, int8 type_id) {
+  return thrift_decode_datum(PG_GETARG_DATUM(0), true, PG_GETARG_INT32(1), type_id);
+}
+
+Datum thrift_binary_get_bool(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_BOOL);
+}
+
+Datum thrift_compact_get_bool(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_BOOL);
+}
+
+Datum thrift_binary_get_byte(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_BYTE);
+}
+
+Datum thrift_compact_get_byte(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_BYTE);
+}
+
+Datum thrift_binary_get_double(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_DOUBLE);
+}
+
+Datum thrift_compact_get_double(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_DOUBLE);
+}
+
+Datum thrift_binary_get_int16(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_INT16);
+}
+
+Datum thrift_compact_get_int16(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_INT16);
 }
 
 Datum thrift_binary_get_int32(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_INT32);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_INT32);
 }
 
 Datum thrift_compact_get_int32(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_INT32);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_INT32);
 }
 
 Datum thrift_binary_get_int64(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_INT64);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_INT64);
 }
 
 Datum thrift_compact_get_int64(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_INT64);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_INT64);
 }
 
 Datum thrift_binary_get_string(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_STRING);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_STRING);
 }
 
 Datum thrift_compact_get_string(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_STRING);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_STRING);
 }
 
 Datum thrift_binary_get_struct_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_STRUCT);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_STRUCT);
 }
 
 Datum thrift_compact_get_struct_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_STRUCT);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_STRUCT);
 }
 
 Datum thrift_binary_get_list_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_LIST);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_LIST);
 }
 
 Datum thrift_compact_get_list_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_LIST);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_LIST);
 }
 
 Datum thrift_binary_get_set_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_SET);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_SET);
 }
 
 Datum thrift_compact_get_set_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_SET);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_SET);
 }
 
 Datum thrift_binary_get_map_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_binary_decode(data, size, field_id, PG_THRIFT_BINARY_MAP);
+  return thrift_binary_get_field(fcinfo, PG_THRIFT_BINARY_MAP);
 }
 
 Datum thrift_compact_get_map_bytea(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
-  int32 field_id = PG_GETARG_INT32(1);
-  uint8* data = (uint8*)VARDATA(thrift_bytea);
-  Size size = VARSIZE(thrift_bytea) - VARHDRSZ;
-  return thrift_compact_decode(data, size, field_id, PG_THRIFT_COMPACT_MAP);
+  return thrift_compact_get_field(fcinfo, PG_THRIFT_COMPACT_MAP);
 }
 
-uint8* encode_binary_bool(char* value) {
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + BOOL_LEN);
-  *ret = PG_THRIFT_BINARY_BOOL;
-  bool v = atoi(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &v, BOOL_LEN);
-  return ret;
+// typed list accessors detoast the whole value, lists are usually what
+// makes a struct large so slicing would rarely stop early
+Datum thrift_binary_get_list(FunctionCallInfo fcinfo, int8 type_id, Oid element_type) {
+  int32 field_id = PG_GETARG_INT32(1);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), false, &data, &size);
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  if (field == NULL || (field->type_id != PG_THRIFT_BINARY_LIST && field->type_id != PG_THRIFT_BINARY_SET)) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  return parse_thrift_binary_list_internal(data + field->offset, data + size, type_id, element_type);
 }
 
-uint8* encode_binary_int16(char* value) {
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + INT16_LEN);
-  *ret = PG_THRIFT_BINARY_INT16;
-  int16 v = atoi(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &v, INT16_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)(ret + PG_THRIFT_TYPE_LEN), INT16_LEN);
+Datum thrift_compact_get_list(FunctionCallInfo fcinfo, int8 type_id, Oid element_type) {
+  int32 field_id = PG_GETARG_INT32(1);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), true, &data, &size);
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  if (field == NULL || (field->type_id != PG_THRIFT_COMPACT_LIST && field->type_id != PG_THRIFT_COMPACT_SET)) {
+    elog(ERROR, "Invalid thrift compact format");
   }
-  return ret;
+  return parse_thrift_compact_list_internal(data + field->offset, data + size, type_id, element_type);
 }
 
-uint8* encode_binary_int32(char* value) {
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + INT32_LEN);
-  *ret = PG_THRIFT_BINARY_INT32;
-  int32 v = atoi(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &v, INT32_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)(ret + PG_THRIFT_TYPE_LEN), INT32_LEN);
-  }
-  return ret;
+Datum thrift_binary_get_list_bool(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_list(fcinfo, PG_THRIFT_BINARY_BOOL, BOOLOID);
 }
 
-uint8* encode_binary_int64(char* value) {
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + INT64_LEN);
-  *ret = PG_THRIFT_BINARY_INT64;
-  int64 v = atol(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &v, INT64_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)(ret + PG_THRIFT_TYPE_LEN), INT64_LEN);
-  }
-  return ret;
+Datum thrift_compact_get_list_bool(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_list(fcinfo, PG_THRIFT_BINARY_BOOL, BOOLOID);
 }
 
-uint8* encode_binary_double(char* value) {
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + DOUBLE_LEN);
-  *ret = PG_THRIFT_BINARY_DOUBLE;
-  float8 v = atof(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &v, DOUBLE_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)(ret + PG_THRIFT_TYPE_LEN), DOUBLE_LEN);
-  }
-  return ret;
+Datum thrift_binary_get_list_int16(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_list(fcinfo, PG_THRIFT_BINARY_INT16, INT2OID);
 }
 
-uint8* encode_binary_string(char* value) {
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + BYTE_LEN + strlen(value));
-  *ret = PG_THRIFT_BINARY_STRING;
-  int32 len = strlen(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &len, INT32_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)(ret + PG_THRIFT_TYPE_LEN), INT32_LEN);
-  }
-  memcpy(ret + PG_THRIFT_TYPE_LEN + BYTE_LEN, value, strlen(value));
-  return ret;
+Datum thrift_compact_get_list_int16(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_list(fcinfo, PG_THRIFT_BINARY_INT16, INT2OID);
 }
 
-uint8 char_to_int8(char c) {
-  if (c >= '0' && c <= '9') return c - '0';
-  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-  elog(ERROR, "Unable to parse invalid char");
+Datum thrift_binary_get_list_int32(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_list(fcinfo, PG_THRIFT_BINARY_INT32, INT4OID);
 }
 
-char convert_int8_to_char(uint8 value, bool first_half) {
-  uint8 half;
-  if (first_half) {
-    half = (value & 0xF0) >> 4;
-  } else {
-    half = value & 0x0F;
-  }
-  if (half >= 0 && half <= 9) return '0' + half;
-  return 'A' + half - 10;
+Datum thrift_compact_get_list_int32(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_list(fcinfo, PG_THRIFT_BINARY_INT32, INT4OID);
 }
 
-uint8* string_to_bytes(char* value) {
-  int32 bytes = strlen(value) / 2;
-  uint8* ret = palloc(bytes);
-  for (int i = 0; i < bytes; i++) {
-    ret[i] = (char_to_int8(value[2*i]) << 4) + char_to_int8(value[2*i + 1]);
-  }
-  return ret;
+Datum thrift_binary_get_list_int64(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_list(fcinfo, PG_THRIFT_BINARY_INT64, INT8OID);
 }
 
-char* bytes_to_string(uint8* start, int32 len) {
-  char* ret = palloc(2*len + 1);
-  memset(ret, 0, 2*len + 1);
-  for (int i = 0; i < 2*len; i++) {
-    ret[i] = convert_int8_to_char(*(start + i/2), i % 2 == 0);
-  }
-  return ret;
+Datum thrift_compact_get_list_int64(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_list(fcinfo, PG_THRIFT_BINARY_INT64, INT8OID);
 }
 
-uint8* encode_binary_byte(char* value) {
-  int32 bytes = strlen(value) / 2;
-  uint8* ret = palloc(PG_THRIFT_TYPE_LEN + BYTE_LEN + bytes);
-  *ret = PG_THRIFT_BINARY_BYTE;
-  memcpy(ret + PG_THRIFT_TYPE_LEN, &bytes, INT32_LEN);
-  if (!is_big_endian()) {
-    swap_bytes((char*)(ret + PG_THRIFT_TYPE_LEN), INT32_LEN);
-  }
-  uint8* data = string_to_bytes(value);
-  memcpy(ret + PG_THRIFT_TYPE_LEN + BYTE_LEN, data, bytes);
-  return ret;
+Datum thrift_binary_get_list_double(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_list(fcinfo, PG_THRIFT_BINARY_DOUBLE, FLOAT8OID);
 }
 
-Datum jsonb_to_thrift_binary_helper(char* type, JsonbValue jbv) {
-  int32 len = 0;
-  uint8* data = 0;
-  if (0 == strcmp(type, "bool")) {
-    if (jbv.type != jbvNumeric) {
-      elog(ERROR, "bool jsonb value should be numeric");
-    }
-    data = encode_binary_bool(numeric_normalize(jbv.val.numeric));
-    len = PG_THRIFT_TYPE_LEN + BOOL_LEN;
-  } else if (0 == strcmp(type, "int16")) {
-    if (jbv.type != jbvNumeric) {
-      elog(ERROR, "int16 jsonb value should be numeric");
-    }
-    data = encode_binary_int16(numeric_normalize(jbv.val.numeric));
-    len = PG_THRIFT_TYPE_LEN + INT16_LEN;
-  } else if (0 == strcmp(type, "int32")) {
-    if (jbv.type != jbvNumeric) {
-      elog(ERROR, "int32 jsonb value should be numeric");
-    }
-    data = encode_binary_int32(numeric_normalize(jbv.val.numeric));
-    len = PG_THRIFT_TYPE_LEN + INT32_LEN;
-  } else if (0 == strcmp(type, "int64")) {
-    if (jbv.type != jbvNumeric) {
-      elog(ERROR, "int64 jsonb value should be numberic");
-    }
-    data = encode_binary_int64(numeric_normalize(jbv.val.numeric));
-    len = PG_THRIFT_TYPE_LEN + INT64_LEN;
-  } else if (0 == strcmp(type, "double")) {
-    if (jbv.type != jbvNumeric) {
-      elog(ERROR, "double jsonb value should be numberic");
-    }
-    len = PG_THRIFT_TYPE_LEN + DOUBLE_LEN;
-    data = encode_binary_double(numeric_normalize(jbv.val.numeric));
-  } else if (0 == strcmp(type, "string")) {
-    if (jbv.type != jbvString) {
-      elog(ERROR, "string jsonb value should be string");
+Datum thrift_compact_get_list_double(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_list(fcinfo, PG_THRIFT_BINARY_DOUBLE, FLOAT8OID);
+}
+
+Datum thrift_binary_get_list_string(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_list(fcinfo, PG_THRIFT_BINARY_STRING, TEXTOID);
+}
+
+Datum thrift_compact_get_list_string(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_list(fcinfo, PG_THRIFT_BINARY_STRING, TEXTOID);
+}
+
+// detoasts the struct once for all calls of the set returning function
+// and leaves the cursor at the first element of the container field
+ThriftEachState* thrift_each_init(FunctionCallInfo fcinfo, bool compact, bool map, int64* len) {
+  int32 field_id = PG_GETARG_INT32(1);
+  bytea* thrift_bytea = PG_GETARG_BYTEA_PP(0);
+  uint8* data = (uint8*)VARDATA_ANY(thrift_bytea);
+  Size size = VARSIZE_ANY_EXHDR(thrift_bytea);
+  ThriftFieldTable* table = field_cache_table(PG_GETARG_POINTER(0), size, compact);
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  ThriftEachState* state = palloc0(sizeof(ThriftEachState));
+  state->compact = compact;
+  state->end = data + size;
+  if (!compact) {
+    if (field == NULL || (map ?
+        field->type_id != PG_THRIFT_BINARY_MAP :
+        field->type_id != PG_THRIFT_BINARY_LIST && field->type_id != PG_THRIFT_BINARY_SET)) {
+      elog(ERROR, "Invalid thrift format");
     }
-    len = PG_THRIFT_TYPE_LEN + BYTE_LEN + jbv.val.string.len;
-    char *tmp = (char*)palloc(jbv.val.string.len + 1);
-    memset(tmp, 0, jbv.val.string.len + 1);
-    memcpy(tmp, jbv.val.string.val, jbv.val.string.len);
-    data = encode_binary_string(tmp);
-  } else if (0 == strcmp(type, "byte")) {
-    if (jbv.type != jbvString) {
-      elog(ERROR, "byte jsonb value should be string");
+    uint8* start = data + field->offset;
+    if (map) {
+      *len = parse_int_helper(start + 2*PG_THRIFT_TYPE_LEN, state->end, INT32_LEN);
+      state->key_type_id = *start;
+      state->value_type_id = *(start + PG_THRIFT_TYPE_LEN);
+      state->curr = start + 2*PG_THRIFT_TYPE_LEN + INT32_LEN;
+    } else {
+      *len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, state->end, LIST_LEN);
+      state->value_type_id = *start;
+      state->curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
     }
-    if (jbv.val.string.len % 2 != 0) {
-      elog(ERROR, "Invalid byte format");
+    if (*len < 0 || *len > state->end - state->curr) {
+      elog(ERROR, "Invalid thrift format");
     }
-    len = PG_THRIFT_TYPE_LEN + BYTE_LEN + jbv.val.string.len / 2;
-    char *tmp = (char*)palloc(jbv.val.string.len + 1);
-    memset(tmp, 0, jbv.val.string.len + 1);
-    memcpy(tmp, jbv.val.string.val, jbv.val.string.len);
-    data = encode_binary_byte(tmp);
-  } else if (0 == strcmp(type, "list") || 0 == strcmp(type, "set")) {
-    if (jbv.type != jbvBinary) {
-      elog(ERROR, "array jsonb value must be binary");
+    return state;
+  }
+
+  if (field == NULL || (map ?
+      field->type_id != PG_THRIFT_COMPACT_MAP :
+      field->type_id != PG_THRIFT_COMPACT_LIST && field->type_id != PG_THRIFT_COMPACT_SET)) {
+    elog(ERROR, "Invalid thrift compact format");
+  }
+  uint8* start = data + field->offset;
+  int64 size_len = 0;
+  if (map) {
+    *len = parse_varint_helper(start, state->end, &size_len);
+    state->curr = start + size_len + PG_THRIFT_TYPE_LEN;
+    if (state->curr > state->end) {
+      elog(ERROR, "Invalid thrift compact format");
     }
-    Jsonb* jb = JsonbValueToJsonb(&jbv);
-    JsonbIterator* it = JsonbIteratorInit(&jb->root);
-    JsonbValue element;
-    int32 target_type = -1;
-    uint32 r, current_len = 2*PG_THRIFT_TYPE_LEN + LIST_LEN, size = 0;
-    uint8* list = (uint8*)palloc(current_len);
-    *list = (0 == strcmp(type, "list"))? PG_THRIFT_BINARY_LIST : PG_THRIFT_BINARY_SET;
-    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
-      if (r == WJB_BEGIN_ARRAY || r == WJB_END_ARRAY) continue;
-      size += 1;
-      JsonbValue element_copy = element;
-#if PG_VERSION_NUM < 110000
-      Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, JsonbGetDatum(JsonbValueToJsonb(&element_copy)));
-#else
-      Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, JsonbPGetDatum(JsonbValueToJsonb(&element_copy)));
-#endif
-      bytea* one_element_bytea = DatumGetByteaP(thrift_datum);
-      if (target_type == -1) {
-        *(list + PG_THRIFT_TYPE_LEN) = *VARDATA(one_element_bytea);
-      } else {
-        if (target_type != *VARDATA(one_element_bytea)) {
-          elog(ERROR, "type of list element must be the same");
-        }
-      }
-      int32 one_data_len = VARSIZE(one_element_bytea) - VARHDRSZ - PG_THRIFT_TYPE_LEN;
-      list = repalloc(list, current_len + one_data_len);
-      memcpy(list + current_len, VARDATA(one_element_bytea) + PG_THRIFT_TYPE_LEN, one_data_len);
-      current_len += one_data_len;
+    if (*len > 0) {
+      uint8 type_id = *(start + size_len);
+      state->key_type_id = compact_list_type_to_struct_type((type_id & 0xf0) >> 4);
+      state->value_type_id = compact_list_type_to_struct_type(type_id & 0x0f);
     }
-    memcpy(list + 2*PG_THRIFT_TYPE_LEN, &size, LIST_LEN);
-    if (!is_big_endian()) {
-      swap_bytes((char*)list + 2*PG_THRIFT_TYPE_LEN, LIST_LEN);
+  } else {
+    if (start >= state->end) {
+      elog(ERROR, "Invalid thrift compact format");
     }
-    len = current_len;
-    data = list;
-  } else if (0 == strcmp(type, "map")) {
-    if (jbv.type != jbvBinary) {
-      elog(ERROR, "array jsonb value must be binary");
+    uint8 size_type_id = *start;
+    *len = (size_type_id & 0xf0) >> 4;
+    state->curr = start + PG_THRIFT_TYPE_LEN;
+    if (*len == 0xf) {
+      *len = parse_varint_helper(state->curr, state->end, &size_len);
+      state->curr += size_len;
     }
-    Jsonb* jb = JsonbValueToJsonb(&jbv);
-    JsonbIterator* it = JsonbIteratorInit(&jb->root);
-    JsonbValue element;
-    uint32 r, current_len = 3*PG_THRIFT_TYPE_LEN + LIST_LEN, size = 0;
-    uint8* list = (uint8*)palloc(current_len);
-    *list = PG_THRIFT_BINARY_MAP;
-    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
-      if (r == WJB_BEGIN_ARRAY || r == WJB_END_ARRAY) continue;
-      size += 1;
-      JsonbValue element_copy = element;
-#if PG_VERSION_NUM < 110000
-      Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, JsonbGetDatum(JsonbValueToJsonb(&element_copy)));
-#else
-      Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, JsonbPGetDatum(JsonbValueToJsonb(&element_copy)));
-#endif
-      bytea* one_element_bytea = DatumGetByteaP(thrift_datum);
-      if (size == 1) {
-        *(list + PG_THRIFT_TYPE_LEN) = *VARDATA(one_element_bytea);
-      } else if (size == 2) {
-        *(list + 2*PG_THRIFT_TYPE_LEN) = *VARDATA(one_element_bytea);
-      } else if (size % 2 == 1) {
-        if (*(list + PG_THRIFT_TYPE_LEN) != *VARDATA(one_element_bytea)) {
-          elog(ERROR, "type of map key element must be the same");
-        }
-      } else if (size % 2 == 0) {
-        if (*(list + 2*PG_THRIFT_TYPE_LEN) != *VARDATA(one_element_bytea)) {
-          elog(ERROR, "type of map value element must be the same");
-        }
-      }
-      int32 one_data_len = VARSIZE(one_element_bytea) - VARHDRSZ - PG_THRIFT_TYPE_LEN;
-      list = repalloc(list, current_len + one_data_len);
-      memcpy(list + current_len, VARDATA(one_element_bytea) + PG_THRIFT_TYPE_LEN, one_data_len);
-      current_len += one_data_len;
+    if (*len > 0) {
+      state->value_type_id = compact_list_type_to_struct_type(size_type_id & 0x0f);
     }
-    if (size % 2 != 0) {
-      elog(ERROR, "map must have same number of key and value");
+  }
+  if (*len < 0 || *len > state->end - state->curr) {
+    elog(ERROR, "Invalid thrift compact format");
+  }
+  return state;
+}
+
+// copies the value at the cursor and moves the cursor past it
+bytea* thrift_each_value(ThriftEachState* state, uint8 type_id) {
+  uint8* next = state->compact ?
+    skip_compact_field(state->curr, state->end, type_id) :
+    skip_binary_field(state->curr, state->end, type_id);
+  bytea* ret = palloc(next - state->curr + VARHDRSZ);
+  memcpy(VARDATA(ret), state->curr, next - state->curr);
+  SET_VARSIZE(ret, next - state->curr + VARHDRSZ);
+  state->curr = next;
+  return ret;
+}
+
+// returns one element per call, so LIMIT stops decoding early and
+// only the current element is held in memory
+Datum thrift_each_list(FunctionCallInfo fcinfo, bool compact) {
+  FuncCallContext* funcctx;
+  if (SRF_IS_FIRSTCALL()) {
+    funcctx = SRF_FIRSTCALL_INIT();
+    MemoryContext old = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    int64 len = 0;
+    funcctx->user_fctx = thrift_each_init(fcinfo, compact, false, &len);
+    funcctx->max_calls = len;
+    MemoryContextSwitchTo(old);
+  }
+  funcctx = SRF_PERCALL_SETUP();
+  ThriftEachState* state = (ThriftEachState*)funcctx->user_fctx;
+  if (funcctx->call_cntr < funcctx->max_calls) {
+    SRF_RETURN_NEXT(funcctx, PointerGetDatum(thrift_each_value(state, state->value_type_id)));
+  }
+  SRF_RETURN_DONE(funcctx);
+}
+
+Datum thrift_each_map(FunctionCallInfo fcinfo, bool compact) {
+  FuncCallContext* funcctx;
+  if (SRF_IS_FIRSTCALL()) {
+    funcctx = SRF_FIRSTCALL_INIT();
+    MemoryContext old = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+      elog(ERROR, "Function returning record called in context that cannot accept type record");
+    }
+    funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+    int64 len = 0;
+    funcctx->user_fctx = thrift_each_init(fcinfo, compact, true, &len);
+    funcctx->max_calls = len;
+    MemoryContextSwitchTo(old);
+  }
+  funcctx = SRF_PERCALL_SETUP();
+  ThriftEachState* state = (ThriftEachState*)funcctx->user_fctx;
+  if (funcctx->call_cntr < funcctx->max_calls) {
+    Datum values[2];
+    bool nulls[2] = {false, false};
+    values[0] = PointerGetDatum(thrift_each_value(state, state->key_type_id));
+    values[1] = PointerGetDatum(thrift_each_value(state, state->value_type_id));
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc, values, nulls)));
+  }
+  SRF_RETURN_DONE(funcctx);
+}
+
+Datum thrift_binary_each_list(PG_FUNCTION_ARGS) {
+  return thrift_each_list(fcinfo, false);
+}
+
+Datum thrift_compact_each_list(PG_FUNCTION_ARGS) {
+  return thrift_each_list(fcinfo, true);
+}
+
+Datum thrift_binary_each_map(PG_FUNCTION_ARGS) {
+  return thrift_each_map(fcinfo, false);
+}
+
+Datum thrift_compact_each_map(PG_FUNCTION_ARGS) {
+  return thrift_each_map(fcinfo, true);
+}
+
+// copies the fields of the struct at start whose ids are in field_ids, in
+// the order of the struct, and returns the end of it. Compact field deltas
+// are taken again from the previous copied field.
+uint8* thrift_project_struct(uint8* start, uint8* end, bool compact, int16* field_ids, int nfields, StringInfo buf) {
+  uint8* curr = start;
+  int16 field_id = 0;
+  int16 last_field_id = 0;
+  while (true) {
+    if (curr >= end) {
+      elog(ERROR, compact ? "Invalid thrift compact format" : "Invalid thrift format");
     }
-    size /= 2;
-    memcpy(list + 3*PG_THRIFT_TYPE_LEN, &size, LIST_LEN);
-    if (!is_big_endian()) {
-      swap_bytes((char*)list + 3*PG_THRIFT_TYPE_LEN, LIST_LEN);
+    if (*curr == 0) {
+      appendStringInfoChar(buf, 0);
+      return curr + 1;
     }
-    len = current_len;
-    data = list;
-  } else if (0 == strcmp(type, "struct")) {
-    if (jbv.type != jbvBinary) {
-      elog(ERROR, "struct jsonb value must be binary");
+    uint8 type_id = compact ? *curr & 0x0f : *curr;
+    uint8* value;
+    if (compact && ((*curr >> 4) & 0x0f) != 0) {
+      field_id += (*curr >> 4) & 0x0f;
+      value = curr + PG_THRIFT_TYPE_LEN;
+    } else {
+      if (end - curr < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN) {
+        elog(ERROR, compact ? "Invalid thrift compact format" : "Invalid thrift format");
+      }
+      field_id = thrift_load_be16(curr + PG_THRIFT_TYPE_LEN);
+      value = curr + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
     }
-    Jsonb* jb = JsonbValueToJsonb(&jbv);
-    JsonbIterator* it = JsonbIteratorInit(&jb->root);
-    JsonbValue element;
-    uint32 r, current_len = 1;
-    uint16 field_id = 0;
-    uint8* pData = (uint8*) palloc(current_len);
-    *pData = PG_THRIFT_BINARY_STRUCT;
-    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
-      if (r == WJB_BEGIN_OBJECT || r == WJB_END_OBJECT) continue;
-      if (r == WJB_KEY) {
-        field_id += 1;
-      } else if (r == WJB_VALUE) {
-        JsonbValue element_copy = element;
-#if PG_VERSION_NUM < 110000
-        Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, JsonbGetDatum(JsonbValueToJsonb(&element_copy)));
-#else
-        Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, JsonbPGetDatum(JsonbValueToJsonb(&element_copy)));
-#endif
-        bytea* one_field = DatumGetByteaP(thrift_datum);
-        pData = repalloc(pData, current_len + VARSIZE(one_field) - VARHDRSZ + FIELD_LEN);
-        *(pData + current_len) = *VARDATA(one_field);
-        memcpy(pData + current_len + PG_THRIFT_TYPE_LEN, &field_id, FIELD_LEN);
-        if (!is_big_endian) {
-          swap_bytes((char*)pData + current_len + PG_THRIFT_TYPE_LEN, FIELD_LEN);
-        }
-        memcpy(pData + current_len + PG_THRIFT_TYPE_LEN + FIELD_LEN, VARDATA(one_field) + PG_THRIFT_TYPE_LEN, VARSIZE(one_field) - VARHDRSZ - PG_THRIFT_TYPE_LEN);
-        current_len += VARSIZE(one_field) - VARHDRSZ + FIELD_LEN;
+    uint8* next = compact ? skip_compact_struct_field(value, end, type_id) : skip_binary_field(value, end, type_id);
+    bool selected = false;
+    for (int i = 0; i < nfields && !selected; i++) {
+      selected = field_ids[i] == field_id;
+    }
+    if (selected && !compact) {
+      appendBinaryStringInfo(buf, curr, next - curr);
+    } else if (selected) {
+      if (field_id > last_field_id && field_id - last_field_id <= 0x0f) {
+        appendStringInfoChar(buf, ((field_id - last_field_id) << 4) | type_id);
+      } else {
+        uint8* header = thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN);
+        *header = type_id;
+        thrift_store_be16(header + PG_THRIFT_TYPE_LEN, field_id);
       }
+      appendBinaryStringInfo(buf, value, next - value);
+      last_field_id = field_id;
     }
-    pData = repalloc(pData, current_len + 1);
-    *(pData + current_len) = 0;
-    len = current_len + 1;
-    data = pData;
-  } else {
-    elog(ERROR, "Unsupported type for thrift binary");
+    curr = next;
   }
-  bytea* ret = palloc(len + VARHDRSZ);
-  memcpy(VARDATA(ret), data, len);
-  SET_VARSIZE(ret, len + VARHDRSZ);
-  PG_RETURN_BYTEA_P(ret);
 }
 
-Datum jsonb_to_thrift_binary(PG_FUNCTION_ARGS) {
-#if PG_VERSION_NUM < 110000
-  Jsonb* jsonb = PG_GETARG_JSONB(0);
+/*
+ * Checks the path like pg_read_binary_file does: relative paths are taken
+ * from the data directory and must stay below it, absolute ones outside of
+ * it need the privileges of pg_read_server_files.
+ */
+char* thrift_framed_path(text* arg) {
+  char* path = text_to_cstring(arg);
+  canonicalize_path(path);
+  if (is_absolute_path(path)) {
+#if PG_VERSION_NUM >= 140000
+    bool allowed = has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES);
+#elif PG_VERSION_NUM >= 110000
+    bool allowed = has_privs_of_role(GetUserId(), DEFAULT_ROLE_READ_SERVER_FILES);
 #else
-  Jsonb* jsonb = PG_GETARG_JSONB_P(0);
+    bool allowed = superuser();
 #endif
-  JsonbIterator* it = JsonbIteratorInit(&jsonb->root);
-  JsonbValue v, jbv;
-  int key_count = 0, value_count = 0;
-  uint32 r;
-  char* typebuf = (char*)palloc(16);
-  memset(typebuf, 0, 16);
-  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (!allowed && !path_is_prefix_of_path(DataDir, path)) {
+      ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), errmsg("absolute path not allowed")));
+    }
+  } else if (!path_is_relative_and_below_cwd(path)) {
+    ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), errmsg("path must be in or below the data directory")));
+  }
+  return path;
+}
+
+// closes the file when the scan ends or stops early, on errors fd.c
+// closes it at the end of the transaction
+void thrift_framed_reader_close(Datum arg) {
+  ThriftFramedReader* reader = (ThriftFramedReader*)DatumGetPointer(arg);
+  if (reader->fd >= 0) {
+    CloseTransientFile(reader->fd);
+    reader->fd = -1;
+  }
+}
+
+ThriftFramedReader* thrift_framed_reader_open(FunctionCallInfo fcinfo, bool compact) {
+  ReturnSetInfo* rsinfo = (ReturnSetInfo*)fcinfo->resultinfo;
+  ThriftFramedReader* reader = palloc0(sizeof(ThriftFramedReader));
+  struct stat st;
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo)) {
+    elog(ERROR, "Set-valued function called in context that cannot accept a set");
+  }
+  reader->context = CurrentMemoryContext;
+  reader->compact = compact;
+  reader->validate = PG_GETARG_BOOL(1);
+  reader->path = thrift_framed_path(PG_GETARG_TEXT_PP(0));
+  if (PG_NARGS() > 2) {
+    reader->field_ids = field_ids_from_array(PG_GETARG_ARRAYTYPE_P(2), &reader->nfields);
+  }
+#if PG_VERSION_NUM >= 110000
+  reader->fd = OpenTransientFile(reader->path, O_RDONLY | PG_BINARY);
+#else
+  reader->fd = OpenTransientFile(reader->path, O_RDONLY | PG_BINARY, 0);
+#endif
+  if (reader->fd < 0) {
+    elog(ERROR, "Could not open file \"%s\": %m", reader->path);
+  }
+  RegisterExprContextCallback(rsinfo->econtext, thrift_framed_reader_close, PointerGetDatum(reader));
+  if (fstat(reader->fd, &st) < 0) {
+    elog(ERROR, "Could not stat file \"%s\": %m", reader->path);
+  }
+  reader->file_size = st.st_size;
+  return reader;
+}
+
+/*
+ * Makes len bytes of the file from offset addressable. When they are not
+ * in the window, it is refilled from offset with one read of up to
+ * THRIFT_FRAMED_WINDOW_SIZE bytes, keeping the bytes it already holds.
+ * A file changing while it is read fails the read, unlike a mapping.
+ */
+uint8* thrift_framed_reader_map(ThriftFramedReader* reader, off_t offset, off_t len) {
+  if (offset >= reader->window_offset && offset + len <= reader->window_offset + (off_t)reader->window_len) {
+    return reader->window + (offset - reader->window_offset);
+  }
+  size_t kept = 0;
+  if (offset >= reader->window_offset && offset < reader->window_offset + (off_t)reader->window_len) {
+    kept = reader->window_offset + reader->window_len - offset;
+    memmove(reader->window, reader->window + (offset - reader->window_offset), kept);
+  }
+  size_t size = Min(Max(THRIFT_FRAMED_WINDOW_SIZE, len), reader->file_size - offset);
+  if (size > reader->window_size) {
+    reader->window =
+        reader->window == NULL ? MemoryContextAlloc(reader->context, size) : repalloc(reader->window, size);
+    reader->window_size = size;
+  }
+  reader->window_offset = offset;
+  reader->window_len = kept;
+  while (reader->window_len < size) {
+    ssize_t nread = pg_pread(reader->fd, reader->window + reader->window_len, size - reader->window_len,
+                            offset + reader->window_len);
+    if (nread < 0) {
+      elog(ERROR, "Could not read file \"%s\": %m", reader->path);
+    }
+    if (nread == 0) {
+      elog(ERROR, "Could not read file \"%s\": file was truncated", reader->path);
+    }
+    reader->window_len += nread;
+  }
+  return reader->window;
+}
+
+// returns NULL at the end of the file
+bytea* thrift_framed_reader_next(ThriftFramedReader* reader) {
+  off_t left = reader->file_size - reader->offset;
+  if (left <= 0) {
+    return NULL;
+  }
+  if (left < THRIFT_FRAME_HEADER_LEN) {
+    elog(ERROR, "Truncated thrift frame at offset %ld of \"%s\"", (int64)reader->offset, reader->path);
+  }
+  int32 len = thrift_load_be32(thrift_framed_reader_map(reader, reader->offset, THRIFT_FRAME_HEADER_LEN));
+  if (len < 0 || len > MaxAllocSize - VARHDRSZ || len > left - THRIFT_FRAME_HEADER_LEN) {
+    elog(ERROR, "Invalid thrift frame length %d at offset %ld of \"%s\"", len, (int64)reader->offset, reader->path);
+  }
+  uint8* start = thrift_framed_reader_map(reader, reader->offset, THRIFT_FRAME_HEADER_LEN + len) + THRIFT_FRAME_HEADER_LEN;
+  uint8* end = start + len;
+  if (reader->validate && !validate_struct(start, end, reader->compact)) {
+    elog(ERROR, "Invalid thrift format in frame at offset %ld of \"%s\"", (int64)reader->offset, reader->path);
+  }
+  bytea* frame;
+  if (reader->field_ids != NULL) {
+    StringInfoData buf;
+    initStringInfo(&buf);
+    enlargeStringInfo(&buf, VARHDRSZ + len);
+    thrift_buf_reserve(&buf, VARHDRSZ);
+    if (thrift_project_struct(start, end, reader->compact, reader->field_ids, reader->nfields, &buf) != end) {
+      elog(ERROR, "Invalid thrift format in frame at offset %ld of \"%s\"", (int64)reader->offset, reader->path);
+    }
+    SET_VARSIZE(buf.data, buf.len);
+    frame = (bytea*)buf.data;
+  } else {
+    frame = palloc(VARHDRSZ + len);
+    SET_VARSIZE(frame, VARHDRSZ + len);
+    memcpy(VARDATA(frame), start, len);
+  }
+  reader->offset += THRIFT_FRAME_HEADER_LEN + len;
+  return frame;
+}
+
+// returns one frame per call, the file is read a window at a time and
+// frames are copied out of it without a read per frame
+Datum thrift_read_framed(FunctionCallInfo fcinfo, bool compact) {
+  FuncCallContext* funcctx;
+  if (SRF_IS_FIRSTCALL()) {
+    funcctx = SRF_FIRSTCALL_INIT();
+    MemoryContext old = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    funcctx->user_fctx = thrift_framed_reader_open(fcinfo, compact);
+    MemoryContextSwitchTo(old);
+  }
+  funcctx = SRF_PERCALL_SETUP();
+  ThriftFramedReader* reader = (ThriftFramedReader*)funcctx->user_fctx;
+  bytea* frame = thrift_framed_reader_next(reader);
+  if (frame != NULL) {
+    SRF_RETURN_NEXT(funcctx, PointerGetDatum(frame));
+  }
+  // the reader goes away with the multi call context
+  UnregisterExprContextCallback(((ReturnSetInfo*)fcinfo->resultinfo)->econtext, thrift_framed_reader_close,
+                                PointerGetDatum(reader));
+  thrift_framed_reader_close(PointerGetDatum(reader));
+  SRF_RETURN_DONE(funcctx);
+}
+
+Datum thrift_binary_read_framed(PG_FUNCTION_ARGS) {
+  return thrift_read_framed(fcinfo, false);
+}
+
+Datum thrift_compact_read_framed(PG_FUNCTION_ARGS) {
+  return thrift_read_framed(fcinfo, true);
+}
+
+int16* field_ids_from_array(ArrayType* field_array, int* nfields) {
+  Datum* elements;
+  bool* nulls;
+  if (ARR_NDIM(field_array) > 1) {
+    elog(ERROR, "Field ids must be a one dimensional array");
+  }
+  deconstruct_array(field_array, INT4OID, sizeof(int32), true, 'i', &elements, &nulls, nfields);
+  int16* field_ids = palloc(sizeof(int16) * (*nfields + 1));
+  for (int i = 0; i < *nfields; i++) {
+    if (nulls[i]) {
+      elog(ERROR, "Field ids must not be null");
+    }
+    int32 field_id = DatumGetInt32(elements[i]);
+    if (field_id < PG_INT16_MIN || field_id > PG_INT16_MAX) {
+      elog(ERROR, "Thrift field id %d out of range", field_id);
+    }
+    field_ids[i] = field_id;
+  }
+  return field_ids;
+}
+
+// the record layout comes from the column definition list of the caller,
+// it is the same on every row so it is blessed once and kept in fn_extra
+TupleDesc fields_result_desc(FunctionCallInfo fcinfo, int nfields) {
+  TupleDesc tupdesc = (TupleDesc)fcinfo->flinfo->fn_extra;
+  if (tupdesc == NULL) {
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+      elog(ERROR, "Function returning record called in context that cannot accept type record");
+    }
+    MemoryContext old = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+    tupdesc = BlessTupleDesc(CreateTupleDescCopy(tupdesc));
+    MemoryContextSwitchTo(old);
+    fcinfo->flinfo->fn_extra = tupdesc;
+  }
+  if (tupdesc->natts != nfields) {
+    elog(ERROR, "Number of field ids must match number of result columns");
+  }
+  return tupdesc;
+}
+
+// type_id uses binary protocol type ids
+bool field_matches_column(uint8 type_id, Oid typid) {
+  if (typid == BOOLOID) {
+    return type_id == PG_THRIFT_BINARY_BOOL;
+  }
+
+  if (typid == INT2OID) {
+    return type_id == PG_THRIFT_BINARY_INT16;
+  }
+
+  if (typid == INT4OID) {
+    return type_id == PG_THRIFT_BINARY_INT16 || type_id == PG_THRIFT_BINARY_INT32;
+  }
+
+  if (typid == INT8OID) {
+    return type_id == PG_THRIFT_BINARY_INT16 || type_id == PG_THRIFT_BINARY_INT32 || type_id == PG_THRIFT_BINARY_INT64;
+  }
+
+  if (typid == FLOAT8OID) {
+    return type_id == PG_THRIFT_BINARY_DOUBLE;
+  }
+
+  if (typid == TEXTOID) {
+    return type_id == PG_THRIFT_BINARY_STRING || type_id == PG_THRIFT_BINARY_BYTE;
+  }
+
+  if (typid == BYTEAOID) {
+    return type_id == PG_THRIFT_BINARY_STRING || type_id == PG_THRIFT_BINARY_BYTE || type_id == PG_THRIFT_BINARY_STRUCT;
+  }
+
+  if (typid == BYTEAARRAYOID) {
+    return type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET || type_id == PG_THRIFT_BINARY_MAP;
+  }
+  elog(ERROR, "Unsupported column type for thrift field");
+}
+
+// value is what parse_binary_field or parse_compact_field returned,
+// only integers need to be widened, everything else is already in place
+Datum field_to_column(Datum value, uint8 type_id, Oid typid) {
+  if (typid == INT4OID && type_id == PG_THRIFT_BINARY_INT16) {
+    return Int32GetDatum(DatumGetInt16(value));
+  }
+
+  if (typid == INT8OID && type_id == PG_THRIFT_BINARY_INT16) {
+    return Int64GetDatum(DatumGetInt16(value));
+  }
+
+  if (typid == INT8OID && type_id == PG_THRIFT_BINARY_INT32) {
+    return Int64GetDatum(DatumGetInt32(value));
+  }
+  return value;
+}
+
+/*
+ * Decode several fields in a single walk over the struct. The expected
+ * type of every field comes from the column definition list, e.g.
+ * thrift_binary_get_fields(x, '{1,4}') AS t(id int, name text).
+ * Fields which are not present are returned as null.
+ */
+Datum thrift_binary_get_fields(PG_FUNCTION_ARGS) {
+  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
+  int nfields = 0;
+  int16* field_ids = field_ids_from_array(PG_GETARG_ARRAYTYPE_P(1), &nfields);
+  TupleDesc tupdesc = fields_result_desc(fcinfo, nfields);
+  Datum* values = palloc0(sizeof(Datum) * (nfields + 1));
+  bool* nulls = palloc(sizeof(bool) * (nfields + 1));
+  memset(nulls, true, sizeof(bool) * (nfields + 1));
+
+  uint8* start = (uint8*)VARDATA(thrift_bytea);
+  uint8* end = start + VARSIZE(thrift_bytea) - VARHDRSZ;
+  int found = 0;
+  while (found < nfields && start < end && *start != 0) {
+    int8 type_id = *start;
+    int16 parsed_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+    for (int i = 0; i < nfields; i++) {
+      if (field_ids[i] != parsed_field_id || !nulls[i]) continue;
+      Oid typid = TupleDescAttr(tupdesc, i)->atttypid;
+      if (!field_matches_column(type_id, typid)) {
+        elog(ERROR, "Type of thrift field %d does not match column type", parsed_field_id);
+      }
+      values[i] = field_to_column(parse_binary_field(start, end, type_id), type_id, typid);
+      nulls[i] = false;
+      found += 1;
+    }
+    start = skip_binary_field(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, type_id);
+  }
+  return HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+}
+
+Datum thrift_compact_get_fields(PG_FUNCTION_ARGS) {
+  bytea* thrift_bytea = PG_GETARG_BYTEA_P(0);
+  int nfields = 0;
+  int16* field_ids = field_ids_from_array(PG_GETARG_ARRAYTYPE_P(1), &nfields);
+  TupleDesc tupdesc = fields_result_desc(fcinfo, nfields);
+  Datum* values = palloc0(sizeof(Datum) * (nfields + 1));
+  bool* nulls = palloc(sizeof(bool) * (nfields + 1));
+  memset(nulls, true, sizeof(bool) * (nfields + 1));
+
+  uint8* start = (uint8*)VARDATA(thrift_bytea);
+  uint8* end = start + VARSIZE(thrift_bytea) - VARHDRSZ;
+  int16 current_field_id = 0;
+  int found = 0;
+  while (found < nfields && start < end && *start != 0) {
+    uint8 field_delta = (*start >> 4) & 0x0f;
+    uint8 parsed_type_id = *start & 0x0f;
+    if (field_delta != 0) {
+      current_field_id += field_delta;
+      start += PG_THRIFT_TYPE_LEN;
+    } else {
+      current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+      start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+    }
+    for (int i = 0; i < nfields; i++) {
+      if (field_ids[i] != current_field_id || !nulls[i]) continue;
+      Oid typid = TupleDescAttr(tupdesc, i)->atttypid;
+      uint8 type_id = compact_type_to_binary_type(parsed_type_id);
+      if (!field_matches_column(type_id, typid)) {
+        elog(ERROR, "Type of thrift field %d does not match column type", current_field_id);
+      }
+      if (type_id == PG_THRIFT_BINARY_BOOL) {
+        values[i] = BoolGetDatum(parsed_type_id == 1);
+      } else {
+        values[i] = field_to_column(parse_compact_field(start, end, parsed_type_id), type_id, typid);
+      }
+      nulls[i] = false;
+      found += 1;
+    }
+    start = skip_compact_struct_field(start, end, parsed_type_id);
+  }
+  return HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+}
+
+Datum thrift_field_cache_stats(PG_FUNCTION_ARGS) {
+  TupleDesc tupdesc;
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+    elog(ERROR, "Function returning record called in context that cannot accept type record");
+  }
+  Datum values[2];
+  bool nulls[2] = {false, false};
+  values[0] = Int64GetDatum(field_cache_hits);
+  values[1] = Int64GetDatum(field_cache_misses);
+  return HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls));
+}
+
+Datum thrift_field_cache_reset_stats(PG_FUNCTION_ARGS) {
+  field_cache_hits = 0;
+  field_cache_misses = 0;
+  PG_RETURN_VOID();
+}
+
+uint8 char_to_int8(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  elog(ERROR, "Unable to parse invalid char");
+}
+
+char convert_int8_to_char(uint8 value, bool first_half) {
+  uint8 half;
+  if (first_half) {
+    half = (value & 0xF0) >> 4;
+  } else {
+    half = value & 0x0F;
+  }
+  if (half >= 0 && half <= 9) return '0' + half;
+  return 'A' + half - 10;
+}
+
+char* bytes_to_string(uint8* start, int32 len) {
+  char* ret = palloc(2*len + 1);
+  memset(ret, 0, 2*len + 1);
+  for (int i = 0; i < 2*len; i++) {
+    ret[i] = convert_int8_to_char(*(start + i/2), i % 2 == 0);
+  }
+  return ret;
+}
+
+// json strings are text in the database encoding, and neither json nor
+// text can hold a NUL, which would cut the string short
+void check_json_string(uint8* start, int32 len) {
+  if (memchr(start, '\0', len) != NULL) {
+    elog(ERROR, "Thrift string with a NUL byte can not be converted to json");
+  }
+  pg_verify_mbstr(GetDatabaseEncoding(), (const char*)start, len, false);
+}
+
+// type names of the json form of thrift values
+static const struct {
+  const char* name;
+  int8 type_id;
+} thrift_type_names[] = {
+  {"bool", PG_THRIFT_BINARY_BOOL},
+  {"byte", PG_THRIFT_BINARY_BYTE},
+  {"int16", PG_THRIFT_BINARY_INT16},
+  {"int32", PG_THRIFT_BINARY_INT32},
+  {"int64", PG_THRIFT_BINARY_INT64},
+  {"double", PG_THRIFT_BINARY_DOUBLE},
+  {"string", PG_THRIFT_BINARY_STRING},
+  {"list", PG_THRIFT_BINARY_LIST},
+  {"set", PG_THRIFT_BINARY_SET},
+  {"map", PG_THRIFT_BINARY_MAP},
+  {"struct", PG_THRIFT_BINARY_STRUCT},
+};
+
+// thrift type id of a type name of the jsonb input
+int8 jsonb_thrift_type_id(JsonbValue* name) {
+  for (int i = 0; i < lengthof(thrift_type_names); i++) {
+    const char* type_name = thrift_type_names[i].name;
+    if (strlen(type_name) == name->val.string.len && memcmp(type_name, name->val.string.val, name->val.string.len) == 0) {
+      return thrift_type_names[i].type_id;
+    }
+  }
+  elog(ERROR, "Unsupported type for thrift binary");
+}
+
+const char* thrift_binary_type_name(int8 type_id) {
+  for (int i = 0; i < lengthof(thrift_type_names); i++) {
+    if (thrift_type_names[i].type_id == type_id) {
+      return thrift_type_names[i].name;
+    }
+  }
+  elog(ERROR, "Unsupported thrift binary type");
+}
+
+/*
+ * Type and value of an object like {"type": "int32", "value": 1}, the form
+ * of the whole input and of every element and field nested in it.
+ */
+void jsonb_thrift_typed_value(JsonbContainer* container, int8* type_id, JsonbValue* value) {
+  JsonbIterator* it = JsonbIteratorInit(container);
+  JsonbValue v;
+  int key_count = 0, value_count = 0;
+  uint32 r;
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
     if (r == WJB_KEY) {
       key_count += 1;
       if (key_count > 2) {
@@ -1279,266 +2747,5852 @@ Datum jsonb_to_thrift_binary(PG_FUNCTION_ARGS) {
         if (v.type != jbvString) {
           elog(ERROR, "First value must be string");
         }
-        snprintf(typebuf, v.val.string.len + 1, "%s", v.val.string.val);
+        *type_id = jsonb_thrift_type_id(&v);
       } else if (value_count == 2) {
-        jbv = v;
+        *value = v;
       }
     }
   }
-  return jsonb_to_thrift_binary_helper(typebuf, jbv);
+  if (value_count < 2) {
+    elog(ERROR, "Must have 2 values at top level");
+  }
 }
 
-/*
- * NOTE: format is first byte stores type, then comes data
- * otherwise hard to recover by just using raw bytes
- */
-Datum thrift_binary_in(PG_FUNCTION_ARGS) {
-  Datum string_datum = CStringGetDatum(PG_GETARG_CSTRING(0));
-  Datum jsonb_datum = DirectFunctionCall1(jsonb_in, string_datum);
-  Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, jsonb_datum);
-  PG_RETURN_BYTEA_P(DatumGetByteaP(thrift_datum));
+void jsonb_thrift_element(JsonbValue* element, int8* type_id, JsonbValue* value) {
+  if (element->type != jbvBinary) {
+    elog(ERROR, "Unsupported type for thrift binary");
+  }
+  jsonb_thrift_typed_value(element->val.binary.data, type_id, value);
 }
 
-Datum get_thrift_binary_type(PG_FUNCTION_ARGS) {
-  bytea* data = PG_GETARG_BYTEA_P(0);
-  int type = *VARDATA(data);
-  if (type == PG_THRIFT_BINARY_BOOL)
-    return CStringGetDatum("bool");
-  if (type == PG_THRIFT_BINARY_BYTE)
-    return CStringGetDatum("byte");
-  if (type == PG_THRIFT_BINARY_DOUBLE)
-    return CStringGetDatum("double");
-  if (type == PG_THRIFT_BINARY_INT16)
-    return CStringGetDatum("int16");
-  if (type == PG_THRIFT_BINARY_INT32)
-    return CStringGetDatum("int32");
-  if (type == PG_THRIFT_BINARY_INT64)
-    return CStringGetDatum("int64");
-  if (type == PG_THRIFT_BINARY_STRING)
-    return CStringGetDatum("string");
-  if (type == PG_THRIFT_BINARY_STRUCT)
-    return CStringGetDatum("struct");
-  if (type == PG_THRIFT_BINARY_MAP)
-    return CStringGetDatum("map");
-  if (type == PG_THRIFT_BINARY_SET)
-    return CStringGetDatum("set");
-  if (type == PG_THRIFT_BINARY_LIST)
-    return CStringGetDatum("list");
-  elog(ERROR, "Unsupported thrift binary type");
+// integers are read from the normalized text like atoi does, truncating
+char* jsonb_thrift_number(JsonbValue* value, const char* type) {
+  if (value->type != jbvNumeric) {
+    elog(ERROR, "%s jsonb value should be numeric", type);
+  }
+  return numeric_normalize(value->val.numeric);
 }
 
-Datum get_thrift_binary_value(PG_FUNCTION_ARGS) {
-  bytea* data = PG_GETARG_BYTEA_P(0);
-  int type = *VARDATA(data);
-  char* retStr = palloc(MAX_JSON_STRING_SIZE);
-  uint8* start = (uint8*)VARDATA(data) + 1;
-  uint8* end = (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ;
-  if (type == PG_THRIFT_BINARY_BOOL) {
-    int64 value = DatumGetBool(parse_thrift_binary_boolean_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%ld", value);
-  } else if (type == PG_THRIFT_BINARY_INT16) {
-    int16 value = DatumGetInt16(parse_thrift_binary_int16_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%hd", value);
-  } else if (type == PG_THRIFT_BINARY_INT32) {
-    int32 value = DatumGetInt32(parse_thrift_binary_int32_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%d", value);
-  } else if (type == PG_THRIFT_BINARY_INT64) {
-    int64 value = DatumGetInt64(parse_thrift_binary_int64_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%ld", value);
-  } else if (type == PG_THRIFT_BINARY_DOUBLE) {
-    float8 value = DatumGetFloat8(parse_thrift_binary_double_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%f", value);
-  } else if (type == PG_THRIFT_BINARY_STRING) {
-    char* value = DatumGetCString(parse_thrift_binary_string_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%s", value);
-  } else if (type == PG_THRIFT_BINARY_BYTE) {
-    bytea* value = DatumGetByteaP(parse_thrift_binary_bytes_internal(start, end));
-    char* tmp = bytes_to_string((uint8*)VARDATA(value), VARSIZE(value) - VARHDRSZ);
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "%s", tmp);
-  }
-  else {
-    elog(ERROR, "Unsupported thrift binary type");
+// a double is a number, or one of the strings NaN and infinities are
+// written as since json numbers are finite
+float8 jsonb_thrift_double(JsonbValue* value) {
+  if (value->type == jbvString) {
+    char* str = pnstrdup(value->val.string.val, value->val.string.len);
+    if (strcmp(str, "NaN") == 0) {
+      return get_float8_nan();
+    } else if (strcmp(str, "Infinity") == 0) {
+      return get_float8_infinity();
+    } else if (strcmp(str, "-Infinity") == 0) {
+      return -get_float8_infinity();
+    }
   }
-  return CStringGetDatum(retStr);
+  return atof(jsonb_thrift_number(value, "double"));
 }
 
-Datum thrift_binary_to_json(int type, uint8* start, uint8* end) {
-  char* typeStr;
-  char* retStr = palloc(MAX_JSON_STRING_SIZE);
-  if (type == PG_THRIFT_BINARY_BOOL) {
-    typeStr = "bool";
-    int64 value = DatumGetBool(parse_thrift_binary_boolean_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%ld}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_INT16) {
-    typeStr = "int16";
-    int16 value = DatumGetInt16(parse_thrift_binary_int16_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%hd}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_INT32) {
-    typeStr = "int32";
-    int32 value = DatumGetInt32(parse_thrift_binary_int32_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%d}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_INT64) {
-    typeStr = "int64";
-    int64 value = DatumGetInt64(parse_thrift_binary_int64_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%ld}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_DOUBLE) {
-    typeStr = "double";
-    float8 value = DatumGetFloat8(parse_thrift_binary_double_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%f}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_STRING) {
-    typeStr = "string";
-    char* value = DatumGetCString(parse_thrift_binary_string_internal(start, end));
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":\"%s\"}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_BYTE) {
-    typeStr = "byte";
-    bytea* value = DatumGetByteaP(parse_thrift_binary_bytes_internal(start, end));
-    char* tmp = bytes_to_string((uint8*)VARDATA(value), VARSIZE(value) - VARHDRSZ);
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":\"%s\"}", typeStr, tmp);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_LIST || type == PG_THRIFT_BINARY_SET) {
-    typeStr = (type == PG_THRIFT_BINARY_LIST)? "list" : "set";
-    Datum array_datum = parse_thrift_binary_list_bytea_internal(start, end), element;
-    ArrayType* parray = DatumGetArrayTypeP(array_datum);
-    bool is_null;
-#if PG_VERSION_NUM >= 90500
-    ArrayIterator iter = array_create_iterator(parray, 0, NULL);
-#else
-    ArrayIterator iter = array_create_iterator(parray, 0);
-#endif
-    int size = 0, current_size = 1024;
-    char value[current_size];
-    memset(value, 0, current_size);
-    int used = snprintf(value + strlen(value), current_size, "%s", "[");
-    if (used < 0 || used >= current_size) {
-      elog(ERROR, "Error when writing buffer");
-    }
-    current_size -= used;
-    while(array_iterate(iter, &element, &is_null)) {
-      bytea* element_bytea = DatumGetByteaP(element);
-      Datum string_datum = thrift_binary_to_json(*start, (uint8*)VARDATA(element_bytea), (uint8*)VARDATA(element_bytea) + VARSIZE(element_bytea) - VARHDRSZ);
-      char* one_element = DatumGetCString(string_datum);
-      if (size != 0) {
-        used = snprintf(value + strlen(value), current_size, "%s", ",");
-        if (used < 0 || used >= current_size) {
-          elog(ERROR, "Error when writing buffer");
-        }
-        current_size -= used;
-      }
-      used = snprintf(value + strlen(value), current_size, "%s", one_element);
-      if (used < 0 || used >= current_size) {
-        elog(ERROR, "Error when writing buffer");
-      }
-      current_size -= used;
-      size += 1;
+// room for len more bytes at the end of buf, written by the caller
+uint8* thrift_buf_reserve(StringInfo buf, int len) {
+  enlargeStringInfo(buf, len);
+  uint8* p = (uint8*)buf->data + buf->len;
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+  return p;
+}
+
+/*
+ * Appends a value without its type byte, which belongs to the header of the
+ * enclosing field or collection. Nested values are appended while their
+ * containers are walked, headers are filled in once the counts are known.
+ */
+void jsonb_to_thrift_binary_append(StringInfo buf, int8 type_id, JsonbValue* value) {
+  JsonbIterator* it;
+  JsonbValue element, inner;
+  int8 inner_type;
+  uint32 r;
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    *thrift_buf_reserve(buf, BOOL_LEN) = atoi(jsonb_thrift_number(value, "bool")) != 0;
+  } else if (type_id == PG_THRIFT_BINARY_INT16) {
+    thrift_store_be16(thrift_buf_reserve(buf, INT16_LEN), (int16)atoi(jsonb_thrift_number(value, "int16")));
+  } else if (type_id == PG_THRIFT_BINARY_INT32) {
+    thrift_store_be32(thrift_buf_reserve(buf, INT32_LEN), (int32)atoi(jsonb_thrift_number(value, "int32")));
+  } else if (type_id == PG_THRIFT_BINARY_INT64) {
+    thrift_store_be64(thrift_buf_reserve(buf, INT64_LEN), (int64)atol(jsonb_thrift_number(value, "int64")));
+  } else if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    thrift_store_be_double(thrift_buf_reserve(buf, DOUBLE_LEN), jsonb_thrift_double(value));
+  } else if (type_id == PG_THRIFT_BINARY_STRING) {
+    if (value->type != jbvString) {
+      elog(ERROR, "string jsonb value should be string");
     }
-    used = snprintf(value + strlen(value), current_size, "%s", "]");
-    if (used < 0 || used >= current_size) {
-      elog(ERROR, "Error when writting buffer");
+    thrift_store_be32(thrift_buf_reserve(buf, BYTE_LEN), value->val.string.len);
+    appendBinaryStringInfo(buf, value->val.string.val, value->val.string.len);
+  } else if (type_id == PG_THRIFT_BINARY_BYTE) {
+    if (value->type != jbvString) {
+      elog(ERROR, "byte jsonb value should be string");
     }
-    array_free_iterator(iter);
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%s}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_MAP) {
-    typeStr = "map";
-    Datum array_datum = parse_thrift_binary_map_bytea_internal(start, end), element;
-    ArrayType* parray = DatumGetArrayTypeP(array_datum);
-    bool is_null;
-#if PG_VERSION_NUM >= 90500
-    ArrayIterator iter = array_create_iterator(parray, 0, NULL);
-#else
-    ArrayIterator iter = array_create_iterator(parray, 0);
-#endif
-    int size = 0, current_size = 1024;
-    char value[current_size];
-    memset(value, 0, current_size);
-    int used = snprintf(value + strlen(value), current_size, "%s", "[");
-    if (used < 0 || used >= current_size) {
-      elog(ERROR, "Error when writing buffer");
-    }
-    current_size -= used;
-    while(array_iterate(iter, &element, &is_null)) {
-      bytea* element_bytea = DatumGetByteaP(element);
-      int type = (size % 2 == 0)? *start : *(start + PG_THRIFT_TYPE_LEN);
-      Datum string_datum = thrift_binary_to_json(type, (uint8*)VARDATA(element_bytea), (uint8*)VARDATA(element_bytea) + VARSIZE(element_bytea) - VARHDRSZ);
-      char* one_element = DatumGetCString(string_datum);
-      if (size != 0) {
-        used = snprintf(value + strlen(value), current_size, "%s", ",");
-        if (used < 0 || used >= current_size) {
-          elog(ERROR, "Error when writing buffer");
-        }
-        current_size -= used;
-      }
-      used = snprintf(value + strlen(value), current_size, "%s", one_element);
-      if (used < 0 || used >= current_size) {
-        elog(ERROR, "Error when writing buffer");
+    if (value->val.string.len % 2 != 0) {
+      elog(ERROR, "Invalid byte format");
+    }
+    int32 len = value->val.string.len / 2;
+    char* hex = value->val.string.val;
+    uint8* bytes = thrift_buf_reserve(buf, BYTE_LEN + len);
+    thrift_store_be32(bytes, len);
+    for (int32 i = 0; i < len; i++) {
+      bytes[BYTE_LEN + i] = (char_to_int8(hex[2*i]) << 4) + char_to_int8(hex[2*i + 1]);
+    }
+  } else if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET) {
+    if (value->type != jbvBinary) {
+      elog(ERROR, "array jsonb value must be binary");
+    }
+    // an empty collection has element type 0
+    int header = buf->len;
+    int8 element_type = 0;
+    int32 size = 0;
+    thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + LIST_LEN);
+    it = JsonbIteratorInit(value->val.binary.data);
+    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
+      if (r == WJB_BEGIN_ARRAY || r == WJB_END_ARRAY) continue;
+      jsonb_thrift_element(&element, &inner_type, &inner);
+      if (size > 0 && inner_type != element_type) {
+        elog(ERROR, "type of list element must be the same");
       }
-      current_size -= used;
+      element_type = inner_type;
+      jsonb_to_thrift_binary_append(buf, inner_type, &inner);
       size += 1;
     }
-    used = snprintf(value + strlen(value), current_size, "%s", "]");
-    if (used < 0 || used >= current_size) {
-      elog(ERROR, "Error when writing buffer");
+    buf->data[header] = element_type;
+    thrift_store_be32((uint8*)buf->data + header + PG_THRIFT_TYPE_LEN, size);
+  } else if (type_id == PG_THRIFT_BINARY_MAP) {
+    if (value->type != jbvBinary) {
+      elog(ERROR, "array jsonb value must be binary");
     }
-    array_free_iterator(iter);
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%s}", typeStr, value);
-    return CStringGetDatum(retStr);
-  }
-  if (type == PG_THRIFT_BINARY_STRUCT) {
-    typeStr = "struct";
-    uint8 element_type = *start;
-    uint8 field_id = 0;
-    char* value = palloc(MAX_JSON_STRING_SIZE);
-    memset(value, 0, MAX_JSON_STRING_SIZE);
-    int current_size = MAX_JSON_STRING_SIZE;
-    int used = snprintf(value + strlen(value), current_size, "%s", "{");
-    if (used < 0 || used >= current_size) {
-      elog(ERROR, "Error when writing buffer");
-    }
-    current_size -= used;
-    while (element_type != 0) {
-      field_id += 1;
-      uint8* next_start = skip_binary_field(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, element_type);
-      char* field_value = DatumGetCString(thrift_binary_to_json(element_type, start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end));
-      if (field_id == 1) {
-        used = snprintf(value + strlen(value), current_size, "\"%d\":%s", field_id, field_value);
+    // keys and values alternate in one array
+    int header = buf->len;
+    int8 key_type = 0, value_type = 0;
+    int32 count = 0;
+    thrift_buf_reserve(buf, 2*PG_THRIFT_TYPE_LEN + LIST_LEN);
+    it = JsonbIteratorInit(value->val.binary.data);
+    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
+      if (r == WJB_BEGIN_ARRAY || r == WJB_END_ARRAY) continue;
+      jsonb_thrift_element(&element, &inner_type, &inner);
+      if (count % 2 == 0) {
+        if (count > 0 && inner_type != key_type) {
+          elog(ERROR, "type of map key element must be the same");
+        }
+        key_type = inner_type;
       } else {
-        used = snprintf(value + strlen(value), current_size, ",\"%d\":%s", field_id, field_value);
-      }
-      if (used < 0 || used >= current_size) {
-        elog(ERROR, "Error when writing buffer");
+        if (count > 1 && inner_type != value_type) {
+          elog(ERROR, "type of map value element must be the same");
+        }
+        value_type = inner_type;
       }
-      current_size -= used;
-      start = next_start;
-      element_type = *start;
+      jsonb_to_thrift_binary_append(buf, inner_type, &inner);
+      count += 1;
+    }
+    if (count % 2 != 0) {
+      elog(ERROR, "map must have same number of key and value");
+    }
+    buf->data[header] = key_type;
+    buf->data[header + PG_THRIFT_TYPE_LEN] = value_type;
+    thrift_store_be32((uint8*)buf->data + header + 2*PG_THRIFT_TYPE_LEN, count / 2);
+  } else if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    if (value->type != jbvBinary) {
+      elog(ERROR, "struct jsonb value must be binary");
     }
-    used = snprintf(value + strlen(value), current_size, "%s", "}");
-    if (used < 0 || used >= current_size) {
-      elog(ERROR, "Error when writing buffer");
+    // fields are numbered in the order of their keys
+    uint16 field_id = 0;
+    it = JsonbIteratorInit(value->val.binary.data);
+    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
+      if (r == WJB_KEY) {
+        field_id += 1;
+      } else if (r == WJB_VALUE) {
+        jsonb_thrift_element(&element, &inner_type, &inner);
+        uint8* field = thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + FIELD_LEN);
+        *field = inner_type;
+        thrift_store_be16(field + PG_THRIFT_TYPE_LEN, field_id);
+        jsonb_to_thrift_binary_append(buf, inner_type, &inner);
+      }
     }
-    snprintf(retStr, MAX_JSON_STRING_SIZE, "{\"type\":\"%s\",\"value\":%s}", typeStr, value);
-    return CStringGetDatum(retStr);
+    appendStringInfoChar(buf, 0);
   }
-  elog(ERROR, "Unsupported type convert from binary to json");
 }
 
-Datum thrift_binary_out(PG_FUNCTION_ARGS) {
-  bytea* thrift_bytes = PG_GETARG_BYTEA_P(0);
-  uint8* data = (uint8*)VARDATA(thrift_bytes);
-  int size = VARSIZE(thrift_bytes);
-  int type = *data;
-  return thrift_binary_to_json(type, data + PG_THRIFT_TYPE_LEN, data + size);
-}
+Datum jsonb_to_thrift_binary(PG_FUNCTION_ARGS) {
+#if PG_VERSION_NUM < 110000
+  Jsonb* jsonb = PG_GETARG_JSONB(0);
+#else
+  Jsonb* jsonb = PG_GETARG_JSONB_P(0);
+#endif
+  int8 type_id;
+  JsonbValue value;
+  StringInfoData buf;
+  jsonb_thrift_typed_value(&jsonb->root, &type_id, &value);
+  // the buffer starts with room for the varlena header and is returned as is
+  initStringInfo(&buf);
+  thrift_buf_reserve(&buf, VARHDRSZ);
+  appendStringInfoChar(&buf, type_id);
+  jsonb_to_thrift_binary_append(&buf, type_id, &value);
+  SET_VARSIZE(buf.data, buf.len);
+  PG_RETURN_BYTEA_P((bytea*)buf.data);
+}
+
+// appends value as a zigzag varint, the form of every compact integer and length
+void thrift_buf_append_varint(StringInfo buf, int64 value) {
+  uint8* p = thrift_buf_reserve(buf, MAX_VARINT_LEN);
+  buf->len -= MAX_VARINT_LEN - thrift_varint_encode(p, thrift_zigzag_encode(value));
+  buf->data[buf->len] = '\0';
+}
+
+// writes a header of len bytes at offset, where reserved bytes were left
+// before the elements appended since, moving the elements when it differs
+void thrift_buf_put_header(StringInfo buf, int offset, int reserved, const uint8* header, int len) {
+  int elements = buf->len - offset - reserved;
+  if (len > reserved) {
+    thrift_buf_reserve(buf, len - reserved);
+  } else {
+    buf->len -= reserved - len;
+  }
+  memmove(buf->data + offset + len, buf->data + offset + reserved, elements);
+  memcpy(buf->data + offset, header, len);
+  buf->data[buf->len] = '\0';
+}
+
+/*
+ * Compact counterpart of jsonb_to_thrift_binary_append for the same input,
+ * laid out the way the compact readers above expect it: integers and
+ * lengths are zigzag varints, doubles stay big-endian, collections carry
+ * binary element type ids, struct fields use delta headers and bools live
+ * in the type nibble of their field.
+ */
+void jsonb_to_thrift_compact_append(StringInfo buf, int8 type_id, JsonbValue* value) {
+  JsonbIterator* it;
+  JsonbValue element, inner;
+  int8 inner_type;
+  uint32 r;
+  uint8 header[PG_THRIFT_TYPE_LEN + MAX_VARINT_LEN];
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    // bool elements take a whole byte, 1 is true and 2 is false
+    *thrift_buf_reserve(buf, BOOL_LEN) = atoi(jsonb_thrift_number(value, "bool")) != 0 ? 1 : 2;
+  } else if (type_id == PG_THRIFT_BINARY_INT16) {
+    thrift_buf_append_varint(buf, (int16)atoi(jsonb_thrift_number(value, "int16")));
+  } else if (type_id == PG_THRIFT_BINARY_INT32) {
+    thrift_buf_append_varint(buf, (int32)atoi(jsonb_thrift_number(value, "int32")));
+  } else if (type_id == PG_THRIFT_BINARY_INT64) {
+    thrift_buf_append_varint(buf, (int64)atol(jsonb_thrift_number(value, "int64")));
+  } else if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    thrift_store_be_double(thrift_buf_reserve(buf, DOUBLE_LEN), jsonb_thrift_double(value));
+  } else if (type_id == PG_THRIFT_BINARY_STRING) {
+    if (value->type != jbvString) {
+      elog(ERROR, "string jsonb value should be string");
+    }
+    thrift_buf_append_varint(buf, value->val.string.len);
+    appendBinaryStringInfo(buf, value->val.string.val, value->val.string.len);
+  } else if (type_id == PG_THRIFT_BINARY_BYTE) {
+    if (value->type != jbvString) {
+      elog(ERROR, "byte jsonb value should be string");
+    }
+    if (value->val.string.len % 2 != 0) {
+      elog(ERROR, "Invalid byte format");
+    }
+    int32 len = value->val.string.len / 2;
+    char* hex = value->val.string.val;
+    thrift_buf_append_varint(buf, len);
+    uint8* bytes = thrift_buf_reserve(buf, len);
+    for (int32 i = 0; i < len; i++) {
+      bytes[i] = (char_to_int8(hex[2*i]) << 4) + char_to_int8(hex[2*i + 1]);
+    }
+  } else if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET) {
+    if (value->type != jbvBinary) {
+      elog(ERROR, "array jsonb value must be binary");
+    }
+    // one header byte is kept, longer lists move their elements once. The
+    // compact readers map element types of empty collections too, so those
+    // get bool elements instead of type 0
+    int offset = buf->len;
+    int8 element_type = PG_THRIFT_BINARY_BOOL;
+    int32 size = 0;
+    thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN);
+    it = JsonbIteratorInit(value->val.binary.data);
+    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
+      if (r == WJB_BEGIN_ARRAY || r == WJB_END_ARRAY) continue;
+      jsonb_thrift_element(&element, &inner_type, &inner);
+      if (size > 0 && inner_type != element_type) {
+        elog(ERROR, "type of list element must be the same");
+      }
+      element_type = inner_type;
+      jsonb_to_thrift_compact_append(buf, inner_type, &inner);
+      size += 1;
+    }
+    int len = PG_THRIFT_TYPE_LEN;
+    if (size < 0x0f) {
+      header[0] = (size << 4) | element_type;
+    } else {
+      header[0] = 0xf0 | element_type;
+      len += thrift_varint_encode(header + PG_THRIFT_TYPE_LEN, thrift_zigzag_encode(size));
+    }
+    thrift_buf_put_header(buf, offset, PG_THRIFT_TYPE_LEN, header, len);
+  } else if (type_id == PG_THRIFT_BINARY_MAP) {
+    if (value->type != jbvBinary) {
+      elog(ERROR, "array jsonb value must be binary");
+    }
+    // keys and values alternate in one array, the header is the count and
+    // a byte of key and value types, two bytes for up to 63 entries
+    int offset = buf->len;
+    int8 key_type = PG_THRIFT_BINARY_BOOL, value_type = PG_THRIFT_BINARY_BOOL;
+    int32 count = 0;
+    thrift_buf_reserve(buf, 2*PG_THRIFT_TYPE_LEN);
+    it = JsonbIteratorInit(value->val.binary.data);
+    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
+      if (r == WJB_BEGIN_ARRAY || r == WJB_END_ARRAY) continue;
+      jsonb_thrift_element(&element, &inner_type, &inner);
+      if (count % 2 == 0) {
+        if (count > 0 && inner_type != key_type) {
+          elog(ERROR, "type of map key element must be the same");
+        }
+        key_type = inner_type;
+      } else {
+        if (count > 1 && inner_type != value_type) {
+          elog(ERROR, "type of map value element must be the same");
+        }
+        value_type = inner_type;
+      }
+      jsonb_to_thrift_compact_append(buf, inner_type, &inner);
+      count += 1;
+    }
+    if (count % 2 != 0) {
+      elog(ERROR, "map must have same number of key and value");
+    }
+    int len = thrift_varint_encode(header, thrift_zigzag_encode(count / 2));
+    header[len++] = (key_type << 4) | value_type;
+    thrift_buf_put_header(buf, offset, 2*PG_THRIFT_TYPE_LEN, header, len);
+  } else if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    if (value->type != jbvBinary) {
+      elog(ERROR, "struct jsonb value must be binary");
+    }
+    // fields are numbered in the order of their keys like the binary
+    // encoder does, so every field header is a single delta byte
+    uint16 field_id = 0, last_field_id = 0;
+    it = JsonbIteratorInit(value->val.binary.data);
+    while ((r = JsonbIteratorNext(&it, &element, true)) != WJB_DONE) {
+      if (r == WJB_KEY) {
+        field_id += 1;
+      } else if (r == WJB_VALUE) {
+        jsonb_thrift_element(&element, &inner_type, &inner);
+        uint8 compact_type = compact_list_type_to_struct_type(inner_type);
+        if (inner_type == PG_THRIFT_BINARY_BOOL && atoi(jsonb_thrift_number(&inner, "bool")) != 0) {
+          compact_type = 1;
+        }
+        if (field_id > last_field_id && field_id - last_field_id <= 0x0f) {
+          appendStringInfoChar(buf, ((field_id - last_field_id) << 4) | compact_type);
+        } else {
+          uint8* field = thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + FIELD_LEN);
+          *field = compact_type;
+          thrift_store_be16(field + PG_THRIFT_TYPE_LEN, field_id);
+        }
+        last_field_id = field_id;
+        if (inner_type != PG_THRIFT_BINARY_BOOL) {
+          jsonb_to_thrift_compact_append(buf, inner_type, &inner);
+        }
+      }
+    }
+    appendStringInfoChar(buf, 0);
+  }
+}
+
+// unlike jsonb_to_thrift_binary there is no leading type byte, a struct
+// comes out in the form thrift_compact_get_* and thrift_compact_indexed read
+Datum jsonb_to_thrift_compact(PG_FUNCTION_ARGS) {
+#if PG_VERSION_NUM < 110000
+  Jsonb* jsonb = PG_GETARG_JSONB(0);
+#else
+  Jsonb* jsonb = PG_GETARG_JSONB_P(0);
+#endif
+  int8 type_id;
+  JsonbValue value;
+  StringInfoData buf;
+  jsonb_thrift_typed_value(&jsonb->root, &type_id, &value);
+  initStringInfo(&buf);
+  thrift_buf_reserve(&buf, VARHDRSZ);
+  jsonb_to_thrift_compact_append(&buf, type_id, &value);
+  SET_VARSIZE(buf.data, buf.len);
+  PG_RETURN_BYTEA_P((bytea*)buf.data);
+}
+
+/*
+ * Transcoders walk the value once like skip_binary_field and
+ * skip_compact_field do and append it in the other protocol. Both take
+ * binary type ids, which are also the element types of compact
+ * collections, and return the pointer after the value. Bools of struct
+ * fields are handled by the struct loops, everywhere else they are a byte.
+ */
+uint8* binary_to_compact_value(uint8* start, uint8* end, int8 type_id, StringInfo buf) {
+  uint8 header[PG_THRIFT_TYPE_LEN + MAX_VARINT_LEN];
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    if (end - start < BOOL_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    appendStringInfoChar(buf, *start != 0 ? 1 : 2);
+    return start + BOOL_LEN;
+  }
+  int width = binary_fixed_width(type_id);
+  if (width > 0 && end - start < width) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  if (type_id == PG_THRIFT_BINARY_INT16) {
+    thrift_buf_append_varint(buf, (int16)thrift_load_be16(start));
+    return start + INT16_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_INT32) {
+    thrift_buf_append_varint(buf, (int32)thrift_load_be32(start));
+    return start + INT32_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_INT64) {
+    thrift_buf_append_varint(buf, (int64)thrift_load_be64(start));
+    return start + INT64_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    // double is same for binary and compact
+    appendBinaryStringInfo(buf, (char*)start, DOUBLE_LEN);
+    return start + DOUBLE_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_BYTE || type_id == PG_THRIFT_BINARY_STRING) {
+    if (end - start < BYTE_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    int32 len = thrift_load_be32(start);
+    if (len < 0 || len > end - start - BYTE_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    thrift_buf_append_varint(buf, len);
+    appendBinaryStringInfo(buf, (char*)start + BYTE_LEN, len);
+    return start + BYTE_LEN + len;
+  }
+  // only containers recurse
+  check_stack_depth();
+  if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET) {
+    if (end - start < PG_THRIFT_TYPE_LEN + LIST_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    uint8 element_type = *start;
+    int32 len = thrift_load_be32(start + PG_THRIFT_TYPE_LEN);
+    uint8* curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
+    if (len < 0 || len > end - curr) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    // compact readers map the element type of empty collections too
+    if (len == 0 && !is_binary_type(element_type)) {
+      element_type = PG_THRIFT_BINARY_BOOL;
+    }
+    if (len < 0x0f) {
+      appendStringInfoChar(buf, (len << 4) | element_type);
+    } else {
+      header[0] = 0xf0 | element_type;
+      appendBinaryStringInfo(buf, (char*)header, PG_THRIFT_TYPE_LEN);
+      thrift_buf_append_varint(buf, len);
+    }
+    for (int32 i = 0; i < len; i++) {
+      curr = binary_to_compact_value(curr, end, element_type, buf);
+    }
+    return curr;
+  }
+  if (type_id == PG_THRIFT_BINARY_MAP) {
+    if (end - start < 2*PG_THRIFT_TYPE_LEN + LIST_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    uint8 key_type = *start;
+    uint8 value_type = *(start + PG_THRIFT_TYPE_LEN);
+    int32 len = thrift_load_be32(start + 2*PG_THRIFT_TYPE_LEN);
+    uint8* curr = start + 2*PG_THRIFT_TYPE_LEN + LIST_LEN;
+    if (len < 0 || len > end - curr) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    if (len == 0 && (!is_binary_type(key_type) || !is_binary_type(value_type))) {
+      key_type = value_type = PG_THRIFT_BINARY_BOOL;
+    }
+    thrift_buf_append_varint(buf, len);
+    appendStringInfoChar(buf, (key_type << 4) | value_type);
+    for (int32 i = 0; i < len; i++) {
+      curr = binary_to_compact_value(curr, end, key_type, buf);
+      curr = binary_to_compact_value(curr, end, value_type, buf);
+    }
+    return curr;
+  }
+  if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    uint8* curr = start;
+    int16 last_field_id = 0;
+    while (true) {
+      if (curr >= end) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      if (*curr == 0) {
+        appendStringInfoChar(buf, 0);
+        return curr + 1;
+      }
+      if (end - curr < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN || !is_binary_type(*curr)) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      uint8 field_type = *curr;
+      int16 field_id = thrift_load_be16(curr + PG_THRIFT_TYPE_LEN);
+      curr += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+      uint8 compact_type = compact_list_type_to_struct_type(field_type);
+      if (field_type == PG_THRIFT_BINARY_BOOL) {
+        if (curr >= end) {
+          elog(ERROR, "Invalid thrift format");
+        }
+        compact_type = *curr != 0 ? 1 : PG_THRIFT_COMPACT_BOOL;
+      }
+      if (field_id > last_field_id && field_id - last_field_id <= 0x0f) {
+        appendStringInfoChar(buf, ((field_id - last_field_id) << 4) | compact_type);
+      } else {
+        uint8* field = thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + FIELD_LEN);
+        *field = compact_type;
+        thrift_store_be16(field + PG_THRIFT_TYPE_LEN, field_id);
+      }
+      last_field_id = field_id;
+      if (field_type == PG_THRIFT_BINARY_BOOL) {
+        curr += BOOL_LEN;
+      } else {
+        curr = binary_to_compact_value(curr, end, field_type, buf);
+      }
+    }
+  }
+  elog(ERROR, "Unsupported thrift binary type");
+}
+
+uint8* compact_to_binary_value(uint8* start, uint8* end, int8 type_id, StringInfo buf) {
+  uint64 value;
+  int len_length;
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    if (end - start < BOOL_LEN) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    appendStringInfoChar(buf, *start == 1);
+    return start + BOOL_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    if (end - start < DOUBLE_LEN) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    appendBinaryStringInfo(buf, (char*)start, DOUBLE_LEN);
+    return start + DOUBLE_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_INT16 || type_id == PG_THRIFT_BINARY_INT32 || type_id == PG_THRIFT_BINARY_INT64 ||
+      type_id == PG_THRIFT_BINARY_BYTE || type_id == PG_THRIFT_BINARY_STRING) {
+    len_length = thrift_varint_decode(start, end, &value);
+    if (len_length == 0) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    int64 number = thrift_zigzag_decode(value);
+    start += len_length;
+    if (type_id == PG_THRIFT_BINARY_INT16) {
+      thrift_store_be16(thrift_buf_reserve(buf, INT16_LEN), (int16)number);
+    } else if (type_id == PG_THRIFT_BINARY_INT32) {
+      thrift_store_be32(thrift_buf_reserve(buf, INT32_LEN), (int32)number);
+    } else if (type_id == PG_THRIFT_BINARY_INT64) {
+      thrift_store_be64(thrift_buf_reserve(buf, INT64_LEN), number);
+    } else {
+      if (number < 0 || number > end - start) {
+        elog(ERROR, "Invalid thrift compact format");
+      }
+      thrift_store_be32(thrift_buf_reserve(buf, BYTE_LEN), number);
+      appendBinaryStringInfo(buf, (char*)start, number);
+      start += number;
+    }
+    return start;
+  }
+  // only containers recurse
+  check_stack_depth();
+  if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET) {
+    if (start >= end) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    uint8 element_type = *start & 0x0f;
+    int64 len = (*start & 0xf0) >> 4;
+    uint8* curr = start + PG_THRIFT_TYPE_LEN;
+    if (len == 0x0f) {
+      len_length = thrift_varint_decode(curr, end, &value);
+      if (len_length == 0) {
+        elog(ERROR, "Invalid thrift compact format");
+      }
+      len = thrift_zigzag_decode(value);
+      curr += len_length;
+    }
+    if (len < 0 || len > end - curr) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    uint8* header = thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + LIST_LEN);
+    *header = element_type;
+    thrift_store_be32(header + PG_THRIFT_TYPE_LEN, len);
+    for (int64 i = 0; i < len; i++) {
+      curr = compact_to_binary_value(curr, end, element_type, buf);
+    }
+    return curr;
+  }
+  if (type_id == PG_THRIFT_BINARY_MAP) {
+    len_length = thrift_varint_decode(start, end, &value);
+    if (len_length == 0 || end - start < len_length + PG_THRIFT_TYPE_LEN) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    int64 len = thrift_zigzag_decode(value);
+    uint8 key_type = (start[len_length] & 0xf0) >> 4;
+    uint8 value_type = start[len_length] & 0x0f;
+    uint8* curr = start + len_length + PG_THRIFT_TYPE_LEN;
+    if (len < 0 || len > end - curr) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    uint8* header = thrift_buf_reserve(buf, 2*PG_THRIFT_TYPE_LEN + LIST_LEN);
+    header[0] = key_type;
+    header[1] = value_type;
+    thrift_store_be32(header + 2*PG_THRIFT_TYPE_LEN, len);
+    for (int64 i = 0; i < len; i++) {
+      curr = compact_to_binary_value(curr, end, key_type, buf);
+      curr = compact_to_binary_value(curr, end, value_type, buf);
+    }
+    return curr;
+  }
+  if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    uint8* curr = start;
+    int16 field_id = 0;
+    while (true) {
+      if (curr >= end) {
+        elog(ERROR, "Invalid thrift compact format");
+      }
+      if (*curr == 0) {
+        appendStringInfoChar(buf, 0);
+        return curr + 1;
+      }
+      uint8 field_delta = (*curr >> 4) & 0x0f;
+      uint8 compact_type = *curr & 0x0f;
+      if (field_delta != 0) {
+        field_id += field_delta;
+        curr += PG_THRIFT_TYPE_LEN;
+      } else {
+        if (end - curr < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN) {
+          elog(ERROR, "Invalid thrift compact format");
+        }
+        field_id = thrift_load_be16(curr + PG_THRIFT_TYPE_LEN);
+        curr += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+      }
+      uint8 field_type = compact_type_to_binary_type(compact_type);
+      uint8* field = thrift_buf_reserve(buf, PG_THRIFT_TYPE_LEN + FIELD_LEN);
+      *field = field_type;
+      thrift_store_be16(field + PG_THRIFT_TYPE_LEN, field_id);
+      if (field_type == PG_THRIFT_BINARY_BOOL) {
+        appendStringInfoChar(buf, compact_type == 1);
+      } else {
+        curr = compact_to_binary_value(curr, end, field_type, buf);
+      }
+    }
+  }
+  elog(ERROR, "Unsupported thrift compact type");
+}
+
+// both take and return struct bytes as the thrift_*_get_* accessors read
+// them, the output buffer is sized for the usual ratio of the encodings
+Datum thrift_binary_to_compact(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  uint8* end = start + VARSIZE_ANY_EXHDR(data);
+  StringInfoData buf;
+  initStringInfo(&buf);
+  enlargeStringInfo(&buf, VARHDRSZ + (end - start));
+  thrift_buf_reserve(&buf, VARHDRSZ);
+  if (binary_to_compact_value(start, end, PG_THRIFT_BINARY_STRUCT, &buf) != end) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  SET_VARSIZE(buf.data, buf.len);
+  PG_RETURN_BYTEA_P((bytea*)buf.data);
+}
+
+Datum thrift_compact_to_binary(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  uint8* end = start + VARSIZE_ANY_EXHDR(data);
+  StringInfoData buf;
+  initStringInfo(&buf);
+  enlargeStringInfo(&buf, Min(VARHDRSZ + 2*(Size)(end - start), MaxAllocSize - 1));
+  thrift_buf_reserve(&buf, VARHDRSZ);
+  if (compact_to_binary_value(start, end, PG_THRIFT_BINARY_STRUCT, &buf) != end) {
+    elog(ERROR, "Invalid thrift compact format");
+  }
+  SET_VARSIZE(buf.data, buf.len);
+  PG_RETURN_BYTEA_P((bytea*)buf.data);
+}
+
+/*
+ * NOTE: format is first byte stores type, then comes data
+ * otherwise hard to recover by just using raw bytes
+ */
+Datum thrift_binary_in(PG_FUNCTION_ARGS) {
+  Datum string_datum = CStringGetDatum(PG_GETARG_CSTRING(0));
+  Datum jsonb_datum = DirectFunctionCall1(jsonb_in, string_datum);
+  Datum thrift_datum = DirectFunctionCall1(jsonb_to_thrift_binary, jsonb_datum);
+  PG_RETURN_BYTEA_P(DatumGetByteaP(thrift_datum));
+}
+
+Datum get_thrift_binary_type(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_P(0);
+  return CStringGetDatum(thrift_binary_type_name(*VARDATA(data)));
+}
+
+Datum get_thrift_binary_value(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_P(0);
+  int type = *VARDATA(data);
+  uint8* start = (uint8*)VARDATA(data) + 1;
+  uint8* end = (uint8*)VARDATA(data) + VARSIZE(data) - VARHDRSZ;
+  if (type == PG_THRIFT_BINARY_BOOL) {
+    int64 value = DatumGetBool(parse_thrift_binary_boolean_internal(start, end));
+    return CStringGetDatum(psprintf("%ld", value));
+  } else if (type == PG_THRIFT_BINARY_INT16) {
+    int16 value = DatumGetInt16(parse_thrift_binary_int16_internal(start, end));
+    return CStringGetDatum(psprintf("%hd", value));
+  } else if (type == PG_THRIFT_BINARY_INT32) {
+    int32 value = DatumGetInt32(parse_thrift_binary_int32_internal(start, end));
+    return CStringGetDatum(psprintf("%d", value));
+  } else if (type == PG_THRIFT_BINARY_INT64) {
+    int64 value = DatumGetInt64(parse_thrift_binary_int64_internal(start, end));
+    return CStringGetDatum(psprintf("%ld", value));
+  } else if (type == PG_THRIFT_BINARY_DOUBLE) {
+    float8 value = DatumGetFloat8(parse_thrift_binary_double_internal(start, end));
+    return CStringGetDatum(psprintf("%f", value));
+  } else if (type == PG_THRIFT_BINARY_STRING) {
+    return parse_thrift_binary_string_internal(start, end);
+  } else if (type == PG_THRIFT_BINARY_BYTE) {
+    bytea* value = DatumGetByteaP(parse_thrift_binary_bytes_internal(start, end));
+    return CStringGetDatum(bytes_to_string((uint8*)VARDATA(value), VARSIZE(value) - VARHDRSZ));
+  }
+  elog(ERROR, "Unsupported thrift binary type");
+}
+
+/*
+ * Appends the json form of a binary value to buf and returns the pointer
+ * after the value. Containers are walked in place, so the output grows
+ * linearly with the value and has no size limit.
+ */
+uint8* binary_to_json_value(uint8* start, uint8* end, int8 type_id, StringInfo buf) {
+  appendStringInfo(buf, "{\"type\":\"%s\",\"value\":", thrift_binary_type_name(type_id));
+  int width = binary_fixed_width(type_id);
+  if (width > 0 && end - start < width) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    if (end - start < BOOL_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    appendStringInfoChar(buf, *start != 0 ? '1' : '0');
+    start += BOOL_LEN;
+  } else if (type_id == PG_THRIFT_BINARY_INT16) {
+    appendStringInfo(buf, "%hd", (int16)thrift_load_be16(start));
+    start += INT16_LEN;
+  } else if (type_id == PG_THRIFT_BINARY_INT32) {
+    appendStringInfo(buf, "%d", (int32)thrift_load_be32(start));
+    start += INT32_LEN;
+  } else if (type_id == PG_THRIFT_BINARY_INT64) {
+    appendStringInfo(buf, "%ld", (int64)thrift_load_be64(start));
+    start += INT64_LEN;
+  } else if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    float8 value = thrift_load_be_double(start);
+    // json numbers are finite, NaN and infinities are written as the
+    // strings thrift_binary_in reads back
+    if (isnan(value) || isinf(value)) {
+      appendStringInfoString(buf, isnan(value) ? "\"NaN\"" : value > 0 ? "\"Infinity\"" : "\"-Infinity\"");
+    } else {
+      appendStringInfoString(buf, DatumGetCString(DirectFunctionCall1(float8out, Float8GetDatum(value))));
+    }
+    start += DOUBLE_LEN;
+  } else if (type_id == PG_THRIFT_BINARY_STRING || type_id == PG_THRIFT_BINARY_BYTE) {
+    if (end - start < BYTE_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    int32 len = thrift_load_be32(start);
+    if (len < 0 || len > end - start - BYTE_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    start += BYTE_LEN;
+    if (type_id == PG_THRIFT_BINARY_STRING) {
+      check_json_string(start, len);
+      escape_json(buf, pnstrdup((char*)start, len));
+    } else {
+      char* hex = (char*)thrift_buf_reserve(buf, 2 + 2*len);
+      hex[0] = hex[2*len + 1] = '"';
+      for (int32 i = 0; i < len; i++) {
+        hex[1 + 2*i] = convert_int8_to_char(start[i], true);
+        hex[2 + 2*i] = convert_int8_to_char(start[i], false);
+      }
+    }
+    start += len;
+  } else if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET || type_id == PG_THRIFT_BINARY_MAP) {
+    // map keys and values alternate in one array, like in the input
+    bool map = type_id == PG_THRIFT_BINARY_MAP;
+    int header = map ? 2*PG_THRIFT_TYPE_LEN + LIST_LEN : PG_THRIFT_TYPE_LEN + LIST_LEN;
+    if (end - start < header) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    uint8 key_type = *start;
+    uint8 value_type = map ? *(start + PG_THRIFT_TYPE_LEN) : key_type;
+    int32 len = thrift_load_be32(start + header - LIST_LEN);
+    start += header;
+    if (len < 0 || len > end - start) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    check_stack_depth();
+    appendStringInfoChar(buf, '[');
+    for (int32 i = 0; i < len; i++) {
+      if (i > 0) {
+        appendStringInfoChar(buf, ',');
+      }
+      start = binary_to_json_value(start, end, key_type, buf);
+      if (map) {
+        appendStringInfoChar(buf, ',');
+        start = binary_to_json_value(start, end, value_type, buf);
+      }
+    }
+    appendStringInfoChar(buf, ']');
+  } else if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    check_stack_depth();
+    appendStringInfoChar(buf, '{');
+    for (bool first = true; ; first = false) {
+      if (start >= end) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      if (*start == 0) {
+        start += 1;
+        break;
+      }
+      if (end - start < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      appendStringInfo(buf, first ? "\"%d\":" : ",\"%d\":", (int16)thrift_load_be16(start + PG_THRIFT_TYPE_LEN));
+      start = binary_to_json_value(start + PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN, end, *start, buf);
+    }
+    appendStringInfoChar(buf, '}');
+  }
+  appendStringInfoChar(buf, '}');
+  return start;
+}
+
+Datum thrift_binary_out(PG_FUNCTION_ARGS) {
+  bytea* thrift_bytes = PG_GETARG_BYTEA_P(0);
+  uint8* data = (uint8*)VARDATA(thrift_bytes);
+  uint8* end = data + VARSIZE(thrift_bytes) - VARHDRSZ;
+  StringInfoData buf;
+  if (data >= end) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  initStringInfo(&buf);
+  binary_to_json_value(data + PG_THRIFT_TYPE_LEN, end, *data, &buf);
+  PG_RETURN_CSTRING(buf.data);
+}
+
+bool thrift_validate_recv = true;
+
+/*
+ * Binary I/O sends the stored bytes as they are, type byte first. Received
+ * values are checked like thrift_binary_validate unless
+ * pg_thrift.validate_recv is off for trusted loads.
+ */
+Datum thrift_binary_recv(PG_FUNCTION_ARGS) {
+  StringInfo buf = (StringInfo)PG_GETARG_POINTER(0);
+  int len = buf->len - buf->cursor;
+  bytea* result = (bytea*)palloc(len + VARHDRSZ);
+  SET_VARSIZE(result, len + VARHDRSZ);
+  pq_copymsgbytes(buf, VARDATA(result), len);
+  if (thrift_validate_recv) {
+    uint8* data = (uint8*)VARDATA(result);
+    uint8* end = data + len;
+    if (len < PG_THRIFT_TYPE_LEN || !is_binary_type(*data) ||
+        validate_binary_value(data + PG_THRIFT_TYPE_LEN, end, *data, 0) != end) {
+      elog(ERROR, "Invalid thrift binary value");
+    }
+  }
+  PG_RETURN_BYTEA_P(result);
+}
+
+Datum thrift_binary_send(PG_FUNCTION_ARGS) {
+  PG_RETURN_BYTEA_P(PG_GETARG_BYTEA_P_COPY(0));
+}
+
+// pushes {"type": ..., "value": value} of a scalar, containers push their
+// value themselves between the key and the end of the object
+void thrift_jsonb_push_typed(JsonbParseState** state, int8 type_id, JsonbValue* value) {
+  JsonbValue v;
+  pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+  v.type = jbvString;
+  v.val.string.val = "type";
+  v.val.string.len = strlen("type");
+  pushJsonbValue(state, WJB_KEY, &v);
+  v.val.string.val = (char*)thrift_binary_type_name(type_id);
+  v.val.string.len = strlen(v.val.string.val);
+  pushJsonbValue(state, WJB_VALUE, &v);
+  v.val.string.val = "value";
+  v.val.string.len = strlen("value");
+  pushJsonbValue(state, WJB_KEY, &v);
+  if (value != NULL) {
+    pushJsonbValue(state, WJB_VALUE, value);
+    pushJsonbValue(state, WJB_END_OBJECT, NULL);
+  }
+}
+
+/*
+ * Pushes the jsonb form of a binary or compact value, the same one
+ * thrift_binary_out prints, except that doubles keep their precision.
+ * type_id is the binary type id, compact containers use it too.
+ */
+uint8* thrift_to_jsonb_value(uint8* start, uint8* end, int8 type_id, bool compact, JsonbParseState** state) {
+  JsonbValue v;
+  uint64 varint;
+  int len_length;
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    if (end - start < BOOL_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    v.type = jbvNumeric;
+    v.val.numeric = DatumGetNumeric(DirectFunctionCall1(int8_numeric, Int64GetDatum(compact ? *start == 1 : *start != 0)));
+    thrift_jsonb_push_typed(state, type_id, &v);
+    return start + BOOL_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    if (end - start < DOUBLE_LEN) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    float8 value = thrift_load_be_double(start);
+    // jsonb numbers are finite, NaN and infinities are kept as strings
+    if (isnan(value) || isinf(value)) {
+      v.type = jbvString;
+      v.val.string.val = isnan(value) ? "NaN" : value > 0 ? "Infinity" : "-Infinity";
+      v.val.string.len = strlen(v.val.string.val);
+    } else {
+      v.type = jbvNumeric;
+      v.val.numeric = DatumGetNumeric(DirectFunctionCall1(float8_numeric, Float8GetDatum(value)));
+    }
+    thrift_jsonb_push_typed(state, type_id, &v);
+    return start + DOUBLE_LEN;
+  }
+  if (type_id == PG_THRIFT_BINARY_INT16 || type_id == PG_THRIFT_BINARY_INT32 || type_id == PG_THRIFT_BINARY_INT64) {
+    int64 value;
+    if (compact) {
+      len_length = thrift_varint_decode(start, end, &varint);
+      if (len_length == 0) {
+        elog(ERROR, "Invalid thrift compact format");
+      }
+      value = thrift_zigzag_decode(varint);
+      start += len_length;
+    } else {
+      int width = binary_fixed_width(type_id);
+      if (end - start < width) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      value = width == INT16_LEN ? (int16)thrift_load_be16(start) :
+        width == INT32_LEN ? (int32)thrift_load_be32(start) : (int64)thrift_load_be64(start);
+      start += width;
+    }
+    v.type = jbvNumeric;
+    v.val.numeric = DatumGetNumeric(DirectFunctionCall1(int8_numeric, Int64GetDatum(value)));
+    thrift_jsonb_push_typed(state, type_id, &v);
+    return start;
+  }
+  if (type_id == PG_THRIFT_BINARY_STRING || type_id == PG_THRIFT_BINARY_BYTE) {
+    int64 len;
+    if (compact) {
+      len_length = thrift_varint_decode(start, end, &varint);
+      len = len_length > 0 ? thrift_zigzag_decode(varint) : -1;
+      start += len_length;
+    } else {
+      len = end - start >= BYTE_LEN ? (int32)thrift_load_be32(start) : -1;
+      start += BYTE_LEN;
+    }
+    if (len < 0 || len > end - start) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    v.type = jbvString;
+    if (type_id == PG_THRIFT_BINARY_STRING) {
+      check_json_string(start, len);
+      v.val.string.val = (char*)start;
+      v.val.string.len = len;
+    } else {
+      v.val.string.val = bytes_to_string(start, len);
+      v.val.string.len = 2*len;
+    }
+    thrift_jsonb_push_typed(state, type_id, &v);
+    return start + len;
+  }
+  // only containers recurse
+  check_stack_depth();
+  if (type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_SET || type_id == PG_THRIFT_BINARY_MAP) {
+    bool map = type_id == PG_THRIFT_BINARY_MAP;
+    uint8 key_type, value_type;
+    int64 len;
+    if (compact && map) {
+      len_length = thrift_varint_decode(start, end, &varint);
+      if (len_length == 0 || end - start < len_length + PG_THRIFT_TYPE_LEN) {
+        elog(ERROR, "Invalid thrift compact format");
+      }
+      len = thrift_zigzag_decode(varint);
+      key_type = (start[len_length] & 0xf0) >> 4;
+      value_type = start[len_length] & 0x0f;
+      start += len_length + PG_THRIFT_TYPE_LEN;
+    } else if (compact) {
+      if (start >= end) {
+        elog(ERROR, "Invalid thrift compact format");
+      }
+      key_type = value_type = *start & 0x0f;
+      len = (*start & 0xf0) >> 4;
+      start += PG_THRIFT_TYPE_LEN;
+      if (len == 0x0f) {
+        len_length = thrift_varint_decode(start, end, &varint);
+        if (len_length == 0) {
+          elog(ERROR, "Invalid thrift compact format");
+        }
+        len = thrift_zigzag_decode(varint);
+        start += len_length;
+      }
+    } else {
+      int header = map ? 2*PG_THRIFT_TYPE_LEN + LIST_LEN : PG_THRIFT_TYPE_LEN + LIST_LEN;
+      if (end - start < header) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      key_type = *start;
+      value_type = map ? *(start + PG_THRIFT_TYPE_LEN) : key_type;
+      len = (int32)thrift_load_be32(start + header - LIST_LEN);
+      start += header;
+    }
+    if (len < 0 || len > end - start) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    thrift_jsonb_push_typed(state, type_id, NULL);
+    pushJsonbValue(state, WJB_BEGIN_ARRAY, NULL);
+    for (int64 i = 0; i < len; i++) {
+      start = thrift_to_jsonb_value(start, end, key_type, compact, state);
+      if (map) {
+        start = thrift_to_jsonb_value(start, end, value_type, compact, state);
+      }
+    }
+    pushJsonbValue(state, WJB_END_ARRAY, NULL);
+    pushJsonbValue(state, WJB_END_OBJECT, NULL);
+    return start;
+  }
+  if (type_id == PG_THRIFT_BINARY_STRUCT) {
+    int16 field_id = 0;
+    thrift_jsonb_push_typed(state, type_id, NULL);
+    pushJsonbValue(state, WJB_BEGIN_OBJECT, NULL);
+    while (true) {
+      if (start >= end) {
+        elog(ERROR, "Invalid thrift format");
+      }
+      if (*start == 0) {
+        break;
+      }
+      uint8 field_type;
+      if (compact) {
+        uint8 field_delta = (*start >> 4) & 0x0f;
+        uint8 compact_type = *start & 0x0f;
+        if (field_delta != 0) {
+          field_id += field_delta;
+          start += PG_THRIFT_TYPE_LEN;
+        } else {
+          if (end - start < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN) {
+            elog(ERROR, "Invalid thrift compact format");
+          }
+          field_id = thrift_load_be16(start + PG_THRIFT_TYPE_LEN);
+          start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+        }
+        field_type = compact_type_to_binary_type(compact_type);
+        v.type = jbvString;
+        v.val.string.val = psprintf("%d", field_id);
+        v.val.string.len = strlen(v.val.string.val);
+        pushJsonbValue(state, WJB_KEY, &v);
+        if (field_type == PG_THRIFT_BINARY_BOOL) {
+          // the value is the type nibble, 1 is true
+          v.type = jbvNumeric;
+          v.val.numeric = DatumGetNumeric(DirectFunctionCall1(int8_numeric, Int64GetDatum(compact_type == 1)));
+          thrift_jsonb_push_typed(state, field_type, &v);
+          continue;
+        }
+      } else {
+        if (end - start < PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN) {
+          elog(ERROR, "Invalid thrift format");
+        }
+        field_type = *start;
+        field_id = thrift_load_be16(start + PG_THRIFT_TYPE_LEN);
+        start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+        v.type = jbvString;
+        v.val.string.val = psprintf("%d", field_id);
+        v.val.string.len = strlen(v.val.string.val);
+        pushJsonbValue(state, WJB_KEY, &v);
+      }
+      start = thrift_to_jsonb_value(start, end, field_type, compact, state);
+    }
+    pushJsonbValue(state, WJB_END_OBJECT, NULL);
+    pushJsonbValue(state, WJB_END_OBJECT, NULL);
+    return start + 1;
+  }
+  elog(ERROR, "Unsupported thrift binary type");
+}
+
+// struct bytes as the thrift_*_get_* accessors read them, to the json form
+// of thrift_binary with field ids as keys. The struct is pushed into an
+// array, since pushJsonbValue only returns the tree when its outermost
+// container ends
+Jsonb* thrift_struct_to_jsonb(uint8* start, uint8* end, bool compact) {
+  JsonbParseState* state = NULL;
+  pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
+  if (thrift_to_jsonb_value(start, end, PG_THRIFT_BINARY_STRUCT, compact, &state) != end) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  JsonbValue* array = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
+  return JsonbValueToJsonb(&array->val.array.elems[0]);
+}
+
+Datum thrift_binary_to_jsonb(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  PG_RETURN_POINTER(thrift_struct_to_jsonb(start, start + VARSIZE_ANY_EXHDR(data), false));
+}
+
+Datum thrift_compact_to_jsonb(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  PG_RETURN_POINTER(thrift_struct_to_jsonb(start, start + VARSIZE_ANY_EXHDR(data), true));
+}
+
+int thrift_index_entry_cmp(const void* a, const void* b) {
+  const ThriftIndexEntry* x = (const ThriftIndexEntry*)a;
+  const ThriftIndexEntry* y = (const ThriftIndexEntry*)b;
+  if (x->field_id != y->field_id) {
+    return x->field_id < y->field_id ? -1 : 1;
+  }
+  if (x->offset != y->offset) {
+    return x->offset < y->offset ? -1 : 1;
+  }
+  return 0;
+}
+
+// walks the struct once and stores it together with its field index
+ThriftIndexed* build_thrift_indexed(uint8* data, Size size, uint8 protocol) {
+  uint8* start = data, *end = data + size;
+  int nfields = 0, capacity = THRIFT_FIELD_TABLE_INITIAL_SIZE;
+  ThriftIndexEntry* entries = palloc(sizeof(ThriftIndexEntry) * capacity);
+  int16 current_field_id = 0;
+  while (start < end && *start != 0) {
+    uint8 type_id;
+    if (protocol == PG_THRIFT_INDEXED_COMPACT) {
+      uint8 field_delta = (*start >> 4) & 0x0f;
+      type_id = *start & 0x0f;
+      if (field_delta != 0) {
+        current_field_id += field_delta;
+        start += PG_THRIFT_TYPE_LEN;
+      } else {
+        current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+        start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+      }
+    } else {
+      type_id = *start;
+      current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+      start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+    }
+    uint8* value = start;
+    if (protocol == PG_THRIFT_INDEXED_COMPACT) {
+      start = skip_compact_struct_field(start, end, type_id);
+    } else {
+      start = skip_binary_field(start, end, type_id);
+    }
+    if (start > end) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    if (nfields == capacity) {
+      capacity *= 2;
+      entries = repalloc(entries, sizeof(ThriftIndexEntry) * capacity);
+    }
+    entries[nfields].field_id = current_field_id;
+    entries[nfields].type_id = type_id;
+    entries[nfields].reserved = 0;
+    entries[nfields].offset = value - data;
+    entries[nfields].length = start - value;
+    nfields += 1;
+  }
+  if (nfields > PG_UINT16_MAX) {
+    elog(ERROR, "Too many fields in thrift struct for thrift_indexed");
+  }
+
+  // keep the first occurrence of a field id, this is what decoding does
+  if (nfields > 1) {
+    pg_qsort(entries, nfields, sizeof(ThriftIndexEntry), thrift_index_entry_cmp);
+    int unique = 1;
+    for (int i = 1; i < nfields; i++) {
+      if (entries[i].field_id != entries[unique - 1].field_id) {
+        entries[unique++] = entries[i];
+      }
+    }
+    nfields = unique;
+  }
+
+  Size index_size = THRIFT_INDEXED_HDRSZ + nfields * sizeof(ThriftIndexEntry);
+  ThriftIndexed* indexed = palloc0(index_size + size);
+  SET_VARSIZE(indexed, index_size + size);
+  indexed->protocol = protocol;
+  indexed->flags = validate_struct(data, data + size, protocol == PG_THRIFT_INDEXED_COMPACT) ? THRIFT_INDEXED_VALIDATED : 0;
+  indexed->nfields = nfields;
+  memcpy(indexed->entries, entries, nfields * sizeof(ThriftIndexEntry));
+  memcpy(THRIFT_INDEXED_PAYLOAD(indexed), data, size);
+  pfree(entries);
+  return indexed;
+}
+
+ThriftIndexEntry* thrift_indexed_find(ThriftIndexed* indexed, int16 field_id) {
+  int low = 0, high = indexed->nfields - 1;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    if (indexed->entries[mid].field_id == field_id) {
+      return &indexed->entries[mid];
+    }
+    if (indexed->entries[mid].field_id < field_id) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+bytea* thrift_indexed_payload_bytea(ThriftIndexed* indexed) {
+  Size size = THRIFT_INDEXED_PAYLOAD_SIZE(indexed);
+  bytea* ret = palloc(size + VARHDRSZ);
+  SET_VARSIZE(ret, size + VARHDRSZ);
+  memcpy(VARDATA(ret), THRIFT_INDEXED_PAYLOAD(indexed), size);
+  return ret;
+}
+
+/*
+ * NOTE: text format is protocol name and the struct bytes in bytea format,
+ * e.g. binary:\x0800010000007b00, or the protocol name and a struct in the
+ * jsonb form of jsonb_to_thrift_binary, e.g. compact:{"type": "struct", ...}
+ */
+Datum thrift_indexed_in(PG_FUNCTION_ARGS) {
+  char* str = PG_GETARG_CSTRING(0);
+  uint8 protocol;
+  if (0 == strncmp(str, "binary:", strlen("binary:"))) {
+    protocol = PG_THRIFT_INDEXED_BINARY;
+    str += strlen("binary:");
+  } else if (0 == strncmp(str, "compact:", strlen("compact:"))) {
+    protocol = PG_THRIFT_INDEXED_COMPACT;
+    str += strlen("compact:");
+  } else {
+    elog(ERROR, "Invalid thrift_indexed format, expected binary:<bytes> or compact:<bytes>");
+  }
+  if (*str == '{') {
+#if PG_VERSION_NUM < 110000
+    Jsonb* jsonb = DatumGetJsonb(DirectFunctionCall1(jsonb_in, CStringGetDatum(str)));
+#else
+    Jsonb* jsonb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(str)));
+#endif
+    int8 type_id;
+    JsonbValue value;
+    StringInfoData buf;
+    jsonb_thrift_typed_value(&jsonb->root, &type_id, &value);
+    if (type_id != PG_THRIFT_BINARY_STRUCT) {
+      elog(ERROR, "Only thrift struct can be converted to thrift_indexed");
+    }
+    initStringInfo(&buf);
+    if (protocol == PG_THRIFT_INDEXED_COMPACT) {
+      jsonb_to_thrift_compact_append(&buf, type_id, &value);
+    } else {
+      jsonb_to_thrift_binary_append(&buf, type_id, &value);
+    }
+    PG_RETURN_POINTER(build_thrift_indexed((uint8*)buf.data, buf.len, protocol));
+  }
+  bytea* data = DatumGetByteaP(DirectFunctionCall1(byteain, CStringGetDatum(str)));
+  ThriftIndexed* indexed = build_thrift_indexed((uint8*)VARDATA(data), VARSIZE(data) - VARHDRSZ, protocol);
+  PG_RETURN_POINTER(indexed);
+}
+
+Datum thrift_indexed_out(PG_FUNCTION_ARGS) {
+  ThriftIndexed* indexed = PG_GETARG_THRIFT_INDEXED_P(0);
+  bytea* data = thrift_indexed_payload_bytea(indexed);
+  char* bytes = DatumGetCString(DirectFunctionCall1(byteaout, PointerGetDatum(data)));
+  PG_RETURN_CSTRING(psprintf("%s:%s", indexed->protocol == PG_THRIFT_INDEXED_COMPACT ? "compact" : "binary", bytes));
+}
+
+Datum thrift_binary_indexed(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  PG_RETURN_POINTER(build_thrift_indexed((uint8*)VARDATA_ANY(data), VARSIZE_ANY_EXHDR(data), PG_THRIFT_INDEXED_BINARY));
+}
+
+Datum thrift_compact_indexed(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  PG_RETURN_POINTER(build_thrift_indexed((uint8*)VARDATA_ANY(data), VARSIZE_ANY_EXHDR(data), PG_THRIFT_INDEXED_COMPACT));
+}
+
+Datum thrift_indexed_bytea(PG_FUNCTION_ARGS) {
+  PG_RETURN_BYTEA_P(thrift_indexed_payload_bytea(PG_GETARG_THRIFT_INDEXED_P(0)));
+}
+
+Datum thrift_binary_to_indexed(PG_FUNCTION_ARGS) {
+  bytea* data = PG_GETARG_BYTEA_PP(0);
+  uint8* start = (uint8*)VARDATA_ANY(data);
+  Size size = VARSIZE_ANY_EXHDR(data);
+  if (size < PG_THRIFT_TYPE_LEN || *start != PG_THRIFT_BINARY_STRUCT) {
+    elog(ERROR, "Only thrift binary struct can be converted to thrift_indexed");
+  }
+  PG_RETURN_POINTER(build_thrift_indexed(start + PG_THRIFT_TYPE_LEN, size - PG_THRIFT_TYPE_LEN, PG_THRIFT_INDEXED_BINARY));
+}
+
+Datum thrift_indexed_to_binary(PG_FUNCTION_ARGS) {
+  ThriftIndexed* indexed = PG_GETARG_THRIFT_INDEXED_P(0);
+  if (indexed->protocol != PG_THRIFT_INDEXED_BINARY) {
+    elog(ERROR, "Only binary protocol thrift_indexed can be converted to thrift_binary");
+  }
+  Size size = THRIFT_INDEXED_PAYLOAD_SIZE(indexed);
+  bytea* ret = palloc(VARHDRSZ + PG_THRIFT_TYPE_LEN + size);
+  SET_VARSIZE(ret, VARHDRSZ + PG_THRIFT_TYPE_LEN + size);
+  *VARDATA(ret) = PG_THRIFT_BINARY_STRUCT;
+  memcpy(VARDATA(ret) + PG_THRIFT_TYPE_LEN, THRIFT_INDEXED_PAYLOAD(indexed), size);
+  PG_RETURN_BYTEA_P(ret);
+}
+
+/*
+ * Scalars, strings and structs of a validated payload, where start and
+ * length come from the index entry. Nothing is bounds checked here, so
+ * this must only be used with THRIFT_INDEXED_VALIDATED values.
+ */
+Datum parse_validated_binary_value(uint8* start, uint32 length, int8 type_id) {
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    PG_RETURN_BOOL(*start);
+  }
+
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    PG_RETURN_FLOAT8(thrift_load_be_double(start));
+  }
+
+  if (type_id == PG_THRIFT_BINARY_INT16) {
+    PG_RETURN_INT16((int16)thrift_load_be16(start));
+  }
+
+  if (type_id == PG_THRIFT_BINARY_INT32) {
+    PG_RETURN_INT32((int32)thrift_load_be32(start));
+  }
+
+  if (type_id == PG_THRIFT_BINARY_INT64) {
+    PG_RETURN_INT64((int64)thrift_load_be64(start));
+  }
+
+  if (type_id == PG_THRIFT_BINARY_BYTE || type_id == PG_THRIFT_BINARY_STRING) {
+    start += BYTE_LEN;
+    length -= BYTE_LEN;
+  }
+  bytea* ret = palloc(length + VARHDRSZ);
+  memcpy(VARDATA(ret), start, length);
+  SET_VARSIZE(ret, length + VARHDRSZ);
+  PG_RETURN_POINTER(ret);
+}
+
+Datum parse_validated_compact_value(uint8* start, uint32 length, int8 type_id) {
+  if (type_id == PG_THRIFT_COMPACT_DOUBLE) {
+    PG_RETURN_FLOAT8(thrift_load_be_double(start));
+  }
+
+  if (is_compact_varint_type(type_id)) {
+    uint64 value = 0;
+    thrift_varint_decode(start, start + length, &value);
+    if (type_id == PG_THRIFT_COMPACT_INT16) {
+      PG_RETURN_INT16(thrift_zigzag_decode(value));
+    }
+    if (type_id == PG_THRIFT_COMPACT_INT32) {
+      PG_RETURN_INT32(thrift_zigzag_decode(value));
+    }
+    PG_RETURN_INT64(thrift_zigzag_decode(value));
+  }
+
+  if (type_id == PG_THRIFT_COMPACT_BYTE || type_id == PG_THRIFT_COMPACT_STRING) {
+    uint64 value = 0;
+    int len_length = thrift_varint_decode(start, start + length, &value);
+    start += len_length;
+    length -= len_length;
+  }
+  bytea* ret = palloc(length + VARHDRSZ);
+  memcpy(VARDATA(ret), start, length);
+  SET_VARSIZE(ret, length + VARHDRSZ);
+  PG_RETURN_POINTER(ret);
+}
+
+Datum thrift_indexed_get_field(FunctionCallInfo fcinfo, int8 binary_type_id, int8 compact_type_id) {
+  ThriftIndexed* indexed = PG_GETARG_THRIFT_INDEXED_P(0);
+  int32 field_id = PG_GETARG_INT32(1);
+  ThriftIndexEntry* entry = thrift_indexed_find(indexed, field_id);
+  uint8* end = THRIFT_INDEXED_PAYLOAD(indexed) + THRIFT_INDEXED_PAYLOAD_SIZE(indexed);
+  // lists, sets and maps are split into elements by the checked parsers
+  bool validated = (indexed->flags & THRIFT_INDEXED_VALIDATED) &&
+    binary_type_id != PG_THRIFT_BINARY_LIST &&
+    binary_type_id != PG_THRIFT_BINARY_SET &&
+    binary_type_id != PG_THRIFT_BINARY_MAP;
+  if (indexed->protocol == PG_THRIFT_INDEXED_COMPACT) {
+    if (entry != NULL) {
+      uint8* start = THRIFT_INDEXED_PAYLOAD(indexed) + entry->offset;
+      if (compact_type_id == PG_THRIFT_COMPACT_BOOL) {
+        if (entry->type_id == 1) {
+          PG_RETURN_BOOL(1);
+        } else if (entry->type_id == 2) {
+          PG_RETURN_BOOL(0);
+        } else {
+          elog(ERROR, "Invalid parsed type id for compact bool");
+        }
+      }
+      if (entry->type_id == compact_type_id && validated) {
+        return parse_validated_compact_value(start, entry->length, compact_type_id);
+      }
+      if (entry->type_id == compact_type_id) {
+        return parse_compact_field(start, end, compact_type_id);
+      }
+    }
+    elog(ERROR, "Invalid thrift compact format");
+  }
+  if (entry != NULL && entry->type_id == binary_type_id) {
+    uint8* start = THRIFT_INDEXED_PAYLOAD(indexed) + entry->offset;
+    if (validated) {
+      return parse_validated_binary_value(start, entry->length, binary_type_id);
+    }
+    return parse_binary_value(start, end, binary_type_id);
+  }
+  elog(ERROR, "Invalid thrift format");
+}
+
+Datum thrift_indexed_get_bool(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_BOOL, PG_THRIFT_COMPACT_BOOL);
+}
+
+Datum thrift_indexed_get_byte(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_BYTE, PG_THRIFT_COMPACT_BYTE);
+}
+
+Datum thrift_indexed_get_double(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_DOUBLE, PG_THRIFT_COMPACT_DOUBLE);
+}
+
+Datum thrift_indexed_get_int16(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_INT16, PG_THRIFT_COMPACT_INT16);
+}
+
+Datum thrift_indexed_get_int32(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_INT32, PG_THRIFT_COMPACT_INT32);
+}
+
+Datum thrift_indexed_get_int64(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_INT64, PG_THRIFT_COMPACT_INT64);
+}
+
+Datum thrift_indexed_get_string(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_STRING, PG_THRIFT_COMPACT_STRING);
+}
+
+Datum thrift_indexed_get_struct_bytea(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_STRUCT, PG_THRIFT_COMPACT_STRUCT);
+}
+
+Datum thrift_indexed_get_list_bytea(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_LIST, PG_THRIFT_COMPACT_LIST);
+}
+
+Datum thrift_indexed_get_set_bytea(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_SET, PG_THRIFT_COMPACT_SET);
+}
+
+Datum thrift_indexed_get_map_bytea(PG_FUNCTION_ARGS) {
+  return thrift_indexed_get_field(fcinfo, PG_THRIFT_BINARY_MAP, PG_THRIFT_COMPACT_MAP);
+}
+
+int64 thrift_path_parse_int(char** p, char* str) {
+  char* endptr;
+  errno = 0;
+  int64 value = strtoll(*p, &endptr, 10);
+  if (endptr == *p || errno != 0) {
+    elog(ERROR, "Invalid thrift path \"%s\"", str);
+  }
+  *p = endptr;
+  return value;
+}
+
+/*
+ * NOTE: path is a list of steps, field ids are separated by dots,
+ * [i] is a 0 based list index and {key} a map key, e.g. 3.2[5].7{"US"}.
+ * With a resolver fields are given by name, e.g. user.tags[0]
+ */
+ThriftPath* thrift_path_parse(char* str, ThriftSchemaResolver* resolver) {
+  char* p = str;
+  int nsteps = 0, capacity = 8;
+  ThriftPathStep* steps = palloc0(sizeof(ThriftPathStep) * capacity);
+  StringInfoData keys;
+  initStringInfo(&keys);
+  while (*p != '\0') {
+    if (nsteps == capacity) {
+      capacity *= 2;
+      steps = repalloc(steps, sizeof(ThriftPathStep) * capacity);
+    }
+    ThriftPathStep* step = &steps[nsteps];
+    memset(step, 0, sizeof(ThriftPathStep));
+    if (*p == '[') {
+      p++;
+      step->kind = THRIFT_PATH_INDEX;
+      step->value = thrift_path_parse_int(&p, str);
+      if (resolver != NULL) {
+        thrift_schema_resolve_element(resolver, THRIFT_PATH_INDEX, str);
+      }
+      if (*p != ']') {
+        elog(ERROR, "Invalid thrift path \"%s\"", str);
+      }
+      p++;
+    } else if (*p == '{') {
+      p++;
+      if (*p == '"') {
+        p++;
+        step->kind = THRIFT_PATH_KEY_STRING;
+        step->value = keys.len;
+        while (*p != '"') {
+          if (*p == '\\' && (*(p + 1) == '"' || *(p + 1) == '\\')) {
+            p++;
+          }
+          if (*p == '\0') {
+            elog(ERROR, "Invalid thrift path \"%s\"", str);
+          }
+          appendStringInfoChar(&keys, *p);
+          p++;
+        }
+        p++;
+        step->key_len = keys.len - step->value;
+      } else {
+        step->kind = THRIFT_PATH_KEY_INT;
+        step->value = thrift_path_parse_int(&p, str);
+      }
+      if (*p != '}') {
+        elog(ERROR, "Invalid thrift path \"%s\"", str);
+      }
+      p++;
+      if (resolver != NULL) {
+        thrift_schema_resolve_element(resolver, step->kind, str);
+      }
+    } else {
+      if (nsteps > 0) {
+        if (*p != '.') {
+          elog(ERROR, "Invalid thrift path \"%s\"", str);
+        }
+        p++;
+      }
+      step->kind = THRIFT_PATH_FIELD;
+      if (resolver != NULL) {
+        step->value = thrift_schema_resolve_field(resolver, &p, str);
+      } else {
+        step->value = thrift_path_parse_int(&p, str);
+        if (step->value < PG_INT16_MIN || step->value > PG_INT16_MAX) {
+          elog(ERROR, "Thrift field id out of range in path \"%s\"", str);
+        }
+      }
+    }
+    nsteps += 1;
+  }
+
+  Size size = THRIFT_PATH_HDRSZ + nsteps * sizeof(ThriftPathStep) + keys.len;
+  ThriftPath* path = palloc0(size);
+  SET_VARSIZE(path, size);
+  path->nsteps = nsteps;
+  memcpy(path->steps, steps, nsteps * sizeof(ThriftPathStep));
+  memcpy(THRIFT_PATH_KEYS(path), keys.data, keys.len);
+  return path;
+}
+
+Datum thrift_path_in(PG_FUNCTION_ARGS) {
+  PG_RETURN_POINTER(thrift_path_parse(PG_GETARG_CSTRING(0), NULL));
+}
+
+Datum thrift_path_out(PG_FUNCTION_ARGS) {
+  ThriftPath* path = PG_GETARG_THRIFT_PATH_P(0);
+  StringInfoData buf;
+  initStringInfo(&buf);
+  for (int i = 0; i < path->nsteps; i++) {
+    ThriftPathStep* step = &path->steps[i];
+    if (step->kind == THRIFT_PATH_FIELD) {
+      appendStringInfo(&buf, i == 0 ? "%lld" : ".%lld", (long long)step->value);
+    } else if (step->kind == THRIFT_PATH_INDEX) {
+      appendStringInfo(&buf, "[%lld]", (long long)step->value);
+    } else if (step->kind == THRIFT_PATH_KEY_INT) {
+      appendStringInfo(&buf, "{%lld}", (long long)step->value);
+    } else {
+      char* key = THRIFT_PATH_KEYS(path) + step->value;
+      appendStringInfoString(&buf, "{\"");
+      for (uint32 j = 0; j < step->key_len; j++) {
+        if (key[j] == '"' || key[j] == '\\') {
+          appendStringInfoChar(&buf, '\\');
+        }
+        appendStringInfoChar(&buf, key[j]);
+      }
+      appendStringInfoString(&buf, "\"}");
+    }
+  }
+  PG_RETURN_CSTRING(buf.data);
+}
+
+ThriftPath* thrift_path_from_array(ArrayType* field_array) {
+  int nfields;
+  int16* field_ids = field_ids_from_array(field_array, &nfields);
+  Size size = THRIFT_PATH_HDRSZ + nfields * sizeof(ThriftPathStep);
+  ThriftPath* path = palloc0(size);
+  SET_VARSIZE(path, size);
+  path->nsteps = nfields;
+  for (int i = 0; i < nfields; i++) {
+    path->steps[i].kind = THRIFT_PATH_FIELD;
+    path->steps[i].value = field_ids[i];
+  }
+  return path;
+}
+
+// path is either int[] of nested field ids or thrift_path, the int[]
+// form is compiled once and reused while the same array is passed
+ThriftPath* thrift_path_argument(FunctionCallInfo fcinfo) {
+  Oid path_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+  if (path_type == InvalidOid) {
+    elog(ERROR, "Could not determine type of thrift path argument");
+  }
+  if (path_type != INT4ARRAYOID) {
+    return PG_GETARG_THRIFT_PATH_P(1);
+  }
+  struct varlena* field_array = PG_GETARG_VARLENA_P(1);
+  ThriftPathCache* cache = (ThriftPathCache*)fcinfo->flinfo->fn_extra;
+  if (cache != NULL && VARSIZE(cache->field_array) == VARSIZE(field_array) &&
+      memcmp(cache->field_array, field_array, VARSIZE(field_array)) == 0) {
+    return cache->path;
+  }
+  ThriftPath* path = thrift_path_from_array((ArrayType*)field_array);
+  if (cache == NULL) {
+    cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(ThriftPathCache));
+    fcinfo->flinfo->fn_extra = cache;
+  } else {
+    pfree(cache->field_array);
+    pfree(cache->path);
+  }
+  cache->field_array = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, VARSIZE(field_array));
+  memcpy(cache->field_array, field_array, VARSIZE(field_array));
+  cache->path = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, VARSIZE(path));
+  memcpy(cache->path, path, VARSIZE(path));
+  return cache->path;
+}
+
+bool thrift_binary_key_matches(ThriftPathStep* step, char* keys, uint8* start, uint8* end, uint8 key_type) {
+  if (step->kind == THRIFT_PATH_KEY_INT) {
+    if (key_type == PG_THRIFT_BINARY_INT16) {
+      return DatumGetInt16(parse_thrift_binary_int16_internal(start, end)) == step->value;
+    }
+    if (key_type == PG_THRIFT_BINARY_INT32) {
+      return DatumGetInt32(parse_thrift_binary_int32_internal(start, end)) == step->value;
+    }
+    if (key_type == PG_THRIFT_BINARY_INT64) {
+      return DatumGetInt64(parse_thrift_binary_int64_internal(start, end)) == step->value;
+    }
+  } else if (key_type == PG_THRIFT_BINARY_STRING || key_type == PG_THRIFT_BINARY_BYTE) {
+    int32 len = parse_int_helper(start, end, BYTE_LEN);
+    if (len != step->key_len || start + BYTE_LEN + len > end) {
+      return false;
+    }
+    return memcmp(start + BYTE_LEN, keys + step->value, len) == 0;
+  }
+  elog(ERROR, "Type of thrift map key does not match path");
+}
+
+bool thrift_compact_key_matches(ThriftPathStep* step, char* keys, uint8* start, uint8* end, uint8 key_type) {
+  int64 len_length = 0;
+  if (step->kind == THRIFT_PATH_KEY_INT) {
+    if (
+      key_type == PG_THRIFT_COMPACT_INT16 ||
+      key_type == PG_THRIFT_COMPACT_INT32 ||
+      key_type == PG_THRIFT_COMPACT_INT64
+    ) {
+      return parse_varint_helper(start, end, &len_length) == step->value;
+    }
+  } else if (key_type == PG_THRIFT_COMPACT_STRING || key_type == PG_THRIFT_COMPACT_BYTE) {
+    int32 len = parse_varint_helper(start, end, &len_length);
+    if (len != step->key_len || start + len_length + len > end) {
+      return false;
+    }
+    return memcmp(start + len_length, keys + step->value, len) == 0;
+  }
+  elog(ERROR, "Type of thrift map key does not match path");
+}
+
+// walks the path in place over the struct bytes, the first step goes
+// through the field offset cache, returns false when a step is missing
+bool thrift_binary_walk_path(ThriftPath* path, ThriftFieldTable* table, uint8* data, uint8* end, ThriftPathCursor* cursor) {
+  cursor->start = data;
+  cursor->type_id = PG_THRIFT_BINARY_STRUCT;
+  cursor->element = false;
+  for (int i = 0; i < path->nsteps; i++) {
+    ThriftPathStep* step = &path->steps[i];
+    uint8* start = cursor->start;
+    if (step->kind == THRIFT_PATH_FIELD) {
+      if (cursor->type_id != PG_THRIFT_BINARY_STRUCT) {
+        elog(ERROR, "Thrift path step %d expects a struct", i + 1);
+      }
+      if (i == 0) {
+        ThriftFieldOffset* field = field_table_find(table, data, end - data, step->value, NULL);
+        if (field == NULL) {
+          return false;
+        }
+        cursor->start = data + field->offset;
+        cursor->type_id = field->type_id;
+        continue;
+      }
+      bool found = false;
+      while (start < end && *start != 0) {
+        uint8 type_id = *start;
+        int16 field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+        start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+        if (field_id == step->value) {
+          cursor->start = start;
+          cursor->type_id = type_id;
+          cursor->element = false;
+          found = true;
+          break;
+        }
+        start = skip_binary_field(start, end, type_id);
+      }
+      if (!found) {
+        return false;
+      }
+    } else if (step->kind == THRIFT_PATH_INDEX) {
+      if (cursor->type_id != PG_THRIFT_BINARY_LIST && cursor->type_id != PG_THRIFT_BINARY_SET) {
+        elog(ERROR, "Thrift path step %d expects a list", i + 1);
+      }
+      uint8 type_id = parse_int_helper(start, end, PG_THRIFT_TYPE_LEN);
+      int32 len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, LIST_LEN);
+      if (step->value < 0 || step->value >= len) {
+        return false;
+      }
+      start += PG_THRIFT_TYPE_LEN + LIST_LEN;
+      for (int64 j = 0; j < step->value; j++) {
+        start = skip_binary_field(start, end, type_id);
+      }
+      cursor->start = start;
+      cursor->type_id = type_id;
+      cursor->element = true;
+    } else {
+      if (cursor->type_id != PG_THRIFT_BINARY_MAP) {
+        elog(ERROR, "Thrift path step %d expects a map", i + 1);
+      }
+      uint8 key_type = parse_int_helper(start, end, PG_THRIFT_TYPE_LEN);
+      uint8 value_type = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, PG_THRIFT_TYPE_LEN);
+      int32 len = parse_int_helper(start + 2*PG_THRIFT_TYPE_LEN, end, LIST_LEN);
+      start += 2*PG_THRIFT_TYPE_LEN + LIST_LEN;
+      bool found = false;
+      for (int32 j = 0; j < len && !found; j++) {
+        found = thrift_binary_key_matches(step, THRIFT_PATH_KEYS(path), start, end, key_type);
+        start = skip_binary_field(start, end, key_type);
+        if (!found) {
+          start = skip_binary_field(start, end, value_type);
+        }
+      }
+      if (!found) {
+        return false;
+      }
+      cursor->start = start;
+      cursor->type_id = value_type;
+      cursor->element = true;
+    }
+  }
+  return true;
+}
+
+bool thrift_compact_walk_path(ThriftPath* path, ThriftFieldTable* table, uint8* data, uint8* end, ThriftPathCursor* cursor) {
+  cursor->start = data;
+  cursor->type_id = PG_THRIFT_COMPACT_STRUCT;
+  cursor->element = false;
+  for (int i = 0; i < path->nsteps; i++) {
+    ThriftPathStep* step = &path->steps[i];
+    uint8* start = cursor->start;
+    if (step->kind == THRIFT_PATH_FIELD) {
+      if (cursor->type_id != PG_THRIFT_COMPACT_STRUCT) {
+        elog(ERROR, "Thrift path step %d expects a struct", i + 1);
+      }
+      if (i == 0) {
+        ThriftFieldOffset* field = field_table_find(table, data, end - data, step->value, NULL);
+        if (field == NULL) {
+          return false;
+        }
+        cursor->start = data + field->offset;
+        cursor->type_id = field->type_id;
+        continue;
+      }
+      bool found = false;
+      int16 current_field_id = 0;
+      while (start < end && *start != 0) {
+        uint8 field_delta = (*start >> 4) & 0x0f;
+        uint8 type_id = *start & 0x0f;
+        if (field_delta != 0) {
+          current_field_id += field_delta;
+          start += PG_THRIFT_TYPE_LEN;
+        } else {
+          current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+          start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+        }
+        if (current_field_id == step->value) {
+          cursor->start = start;
+          cursor->type_id = type_id;
+          cursor->element = false;
+          found = true;
+          break;
+        }
+        start = skip_compact_struct_field(start, end, type_id);
+      }
+      if (!found) {
+        return false;
+      }
+    } else if (step->kind == THRIFT_PATH_INDEX) {
+      if (cursor->type_id != PG_THRIFT_COMPACT_LIST && cursor->type_id != PG_THRIFT_COMPACT_SET) {
+        elog(ERROR, "Thrift path step %d expects a list", i + 1);
+      }
+      uint8 len_type_id = parse_int_helper(start, end, PG_THRIFT_TYPE_LEN);
+      uint32 len = (len_type_id & 0xf0) >> 4;
+      uint8 type_id = compact_list_type_to_struct_type(len_type_id & 0x0f);
+      if (len == 0x0f) {
+        int64 len_length = 0;
+        len = parse_varint_helper(start + PG_THRIFT_TYPE_LEN, end, &len_length);
+        start += PG_THRIFT_TYPE_LEN + len_length;
+      } else {
+        start += PG_THRIFT_TYPE_LEN;
+      }
+      if (step->value < 0 || step->value >= len) {
+        return false;
+      }
+      for (int64 j = 0; j < step->value; j++) {
+        start = skip_compact_field(start, end, type_id);
+      }
+      cursor->start = start;
+      cursor->type_id = type_id;
+      cursor->element = true;
+    } else {
+      if (cursor->type_id != PG_THRIFT_COMPACT_MAP) {
+        elog(ERROR, "Thrift path step %d expects a map", i + 1);
+      }
+      int64 len_length = 0;
+      int32 len = parse_varint_helper(start, end, &len_length);
+      if (len <= 0) {
+        return false;
+      }
+      uint8 key_value_type_id = parse_int_helper(start + len_length, end, PG_THRIFT_TYPE_LEN);
+      uint8 key_type = compact_list_type_to_struct_type((key_value_type_id & 0xf0) >> 4);
+      uint8 value_type = compact_list_type_to_struct_type(key_value_type_id & 0x0f);
+      start += len_length + PG_THRIFT_TYPE_LEN;
+      bool found = false;
+      for (int32 j = 0; j < len && !found; j++) {
+        found = thrift_compact_key_matches(step, THRIFT_PATH_KEYS(path), start, end, key_type);
+        start = skip_compact_field(start, end, key_type);
+        if (!found) {
+          start = skip_compact_field(start, end, value_type);
+        }
+      }
+      if (!found) {
+        return false;
+      }
+      cursor->start = start;
+      cursor->type_id = value_type;
+      cursor->element = true;
+    }
+  }
+  return true;
+}
+
+Datum thrift_binary_path_value(ThriftPathCursor* cursor, uint8* end, int8 type_id) {
+  if (cursor->type_id != type_id) {
+    elog(ERROR, "Invalid thrift format");
+  }
+  return parse_binary_value(cursor->start, end, type_id);
+}
+
+// struct bools are kept in the type nibble, list and map bools in a byte
+Datum thrift_compact_path_value(ThriftPathCursor* cursor, uint8* end, int8 type_id) {
+  if (type_id == PG_THRIFT_COMPACT_BOOL) {
+    if (cursor->element) {
+      if (cursor->type_id != PG_THRIFT_COMPACT_BOOL || cursor->start >= end) {
+        elog(ERROR, "Invalid parsed type id for compact bool");
+      }
+      PG_RETURN_BOOL(*cursor->start == 1);
+    }
+    if (cursor->type_id == 1) {
+      PG_RETURN_BOOL(1);
+    } else if (cursor->type_id == 2) {
+      PG_RETURN_BOOL(0);
+    }
+    elog(ERROR, "Invalid parsed type id for compact bool");
+  }
+  if (cursor->type_id != type_id) {
+    elog(ERROR, "Invalid thrift compact format");
+  }
+  return parse_compact_field(cursor->start, end, type_id);
+}
+
+Datum thrift_binary_get_path(FunctionCallInfo fcinfo, int8 type_id) {
+  ThriftPath* path = thrift_path_argument(fcinfo);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), false, &data, &size);
+  ThriftPathCursor cursor;
+  if (!thrift_binary_walk_path(path, table, data, data + size, &cursor)) {
+    PG_RETURN_NULL();
+  }
+  return thrift_binary_path_value(&cursor, data + size, type_id);
+}
+
+Datum thrift_compact_get_path(FunctionCallInfo fcinfo, int8 type_id) {
+  ThriftPath* path = thrift_path_argument(fcinfo);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), true, &data, &size);
+  ThriftPathCursor cursor;
+  if (!thrift_compact_walk_path(path, table, data, data + size, &cursor)) {
+    PG_RETURN_NULL();
+  }
+  return thrift_compact_path_value(&cursor, data + size, type_id);
+}
+
+Datum thrift_binary_get_path_bool(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_BOOL);
+}
+
+Datum thrift_compact_get_path_bool(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_BOOL);
+}
+
+Datum thrift_binary_get_path_byte(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_BYTE);
+}
+
+Datum thrift_compact_get_path_byte(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_BYTE);
+}
+
+Datum thrift_binary_get_path_double(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_DOUBLE);
+}
+
+Datum thrift_compact_get_path_double(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_DOUBLE);
+}
+
+Datum thrift_binary_get_path_int16(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_INT16);
+}
+
+Datum thrift_compact_get_path_int16(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_INT16);
+}
+
+Datum thrift_binary_get_path_int32(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_INT32);
+}
+
+Datum thrift_compact_get_path_int32(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_INT32);
+}
+
+Datum thrift_binary_get_path_int64(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_INT64);
+}
+
+Datum thrift_compact_get_path_int64(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_INT64);
+}
+
+Datum thrift_binary_get_path_string(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_STRING);
+}
+
+Datum thrift_compact_get_path_string(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_STRING);
+}
+
+Datum thrift_binary_get_path_struct_bytea(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_STRUCT);
+}
+
+Datum thrift_compact_get_path_struct_bytea(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_STRUCT);
+}
+
+Datum thrift_binary_get_path_list_bytea(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_LIST);
+}
+
+Datum thrift_compact_get_path_list_bytea(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_LIST);
+}
+
+Datum thrift_binary_get_path_set_bytea(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_SET);
+}
+
+Datum thrift_compact_get_path_set_bytea(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_SET);
+}
+
+Datum thrift_binary_get_path_map_bytea(PG_FUNCTION_ARGS) {
+  return thrift_binary_get_path(fcinfo, PG_THRIFT_BINARY_MAP);
+}
+
+Datum thrift_compact_get_path_map_bytea(PG_FUNCTION_ARGS) {
+  return thrift_compact_get_path(fcinfo, PG_THRIFT_COMPACT_MAP);
+}
+
+// key of the map lookup functions, declared with a bigint or a text key
+ThriftPathStep thrift_map_key_argument(FunctionCallInfo fcinfo, char** keys) {
+  ThriftPathStep step;
+  memset(&step, 0, sizeof(ThriftPathStep));
+  if (get_fn_expr_argtype(fcinfo->flinfo, 2) == TEXTOID) {
+    text* key = PG_GETARG_TEXT_PP(2);
+    step.kind = THRIFT_PATH_KEY_STRING;
+    step.key_len = VARSIZE_ANY_EXHDR(key);
+    *keys = VARDATA_ANY(key);
+  } else {
+    step.kind = THRIFT_PATH_KEY_INT;
+    step.value = PG_GETARG_INT64(2);
+    *keys = NULL;
+  }
+  return step;
+}
+
+// reads the map header at start, key and value types are returned as
+// taken by skip_binary_field or skip_compact_field
+uint8* thrift_map_header(bool compact, uint8* start, uint8* end, uint8* key_type, uint8* value_type, int64* len) {
+  uint8* ret;
+  if (compact) {
+    int64 len_length = 0;
+    *len = parse_varint_helper(start, end, &len_length);
+    ret = start + len_length + PG_THRIFT_TYPE_LEN;
+    if (ret > end) {
+      elog(ERROR, "Invalid thrift compact format for map");
+    }
+    if (*len > 0) {
+      uint8 key_value_type_id = *(start + len_length);
+      *key_type = compact_list_type_to_struct_type((key_value_type_id & 0xf0) >> 4);
+      *value_type = compact_list_type_to_struct_type(key_value_type_id & 0x0f);
+    }
+  } else {
+    *len = parse_int_helper(start + 2*PG_THRIFT_TYPE_LEN, end, INT32_LEN);
+    *key_type = *start;
+    *value_type = *(start + PG_THRIFT_TYPE_LEN);
+    ret = start + 2*PG_THRIFT_TYPE_LEN + INT32_LEN;
+  }
+  if (*len < 0 || *len > end - ret) {
+    elog(ERROR, compact ? "Invalid thrift compact format for map" : "Invalid thrift binary format for map");
+  }
+  return ret;
+}
+
+bool thrift_map_int_key(bool compact, uint8 key_type) {
+  if (compact) {
+    return key_type == PG_THRIFT_COMPACT_INT16 || key_type == PG_THRIFT_COMPACT_INT32 || key_type == PG_THRIFT_COMPACT_INT64;
+  }
+  return key_type == PG_THRIFT_BINARY_INT16 || key_type == PG_THRIFT_BINARY_INT32 || key_type == PG_THRIFT_BINARY_INT64;
+}
+
+// int keys are hashed as int64 whatever their width, so that they hash
+// like the bigint key of the lookup
+uint32 thrift_map_key_hash(bool compact, uint8* start, uint8* end, uint8 key_type) {
+  if (thrift_map_int_key(compact, key_type)) {
+    int64 value;
+    if (compact) {
+      int64 len_length = 0;
+      value = parse_varint_helper(start, end, &len_length);
+    } else if (key_type == PG_THRIFT_BINARY_INT16) {
+      value = DatumGetInt16(parse_thrift_binary_int16_internal(start, end));
+    } else if (key_type == PG_THRIFT_BINARY_INT32) {
+      value = DatumGetInt32(parse_thrift_binary_int32_internal(start, end));
+    } else {
+      value = DatumGetInt64(parse_thrift_binary_int64_internal(start, end));
+    }
+    return DatumGetUInt32(hash_any((unsigned char*)&value, sizeof(int64)));
+  }
+  int64 len_length = BYTE_LEN;
+  int64 len;
+  if (compact && (key_type == PG_THRIFT_COMPACT_STRING || key_type == PG_THRIFT_COMPACT_BYTE)) {
+    len = parse_varint_helper(start, end, &len_length);
+  } else if (!compact && (key_type == PG_THRIFT_BINARY_STRING || key_type == PG_THRIFT_BINARY_BYTE)) {
+    len = parse_int_helper(start, end, BYTE_LEN);
+  } else {
+    elog(ERROR, "Unsupported thrift map key type");
+  }
+  if (len < 0 || start + len_length + len > end) {
+    elog(ERROR, "Invalid thrift format for map key");
+  }
+  return DatumGetUInt32(hash_any(start + len_length, len));
+}
+
+uint32 thrift_map_step_hash(ThriftPathStep* step, char* keys) {
+  if (step->kind == THRIFT_PATH_KEY_INT) {
+    return DatumGetUInt32(hash_any((unsigned char*)&step->value, sizeof(int64)));
+  }
+  return DatumGetUInt32(hash_any((unsigned char*)keys, step->key_len));
+}
+
+// slots are kept at most half full, duplicate keys keep the first entry
+// as the in place scan does
+void thrift_map_index_build(ThriftMapIndex* index, bool compact, uint8* data, uint8* start, uint8* end, uint8 key_type, uint8 value_type, int64 len) {
+  uint32 nslots = THRIFT_MAP_INDEX_MIN_SLOTS;
+  while (nslots < 2 * len) {
+    nslots *= 2;
+  }
+  index->slots = MemoryContextAllocZero(field_cache->context, sizeof(ThriftMapIndexEntry) * nslots);
+  index->nslots = nslots;
+  for (int64 i = 0; i < len; i++) {
+    uint8* value = compact ? skip_compact_field(start, end, key_type) : skip_binary_field(start, end, key_type);
+    uint32 hash = thrift_map_key_hash(compact, start, end, key_type);
+    uint32 slot = hash & (nslots - 1);
+    ThriftMapIndexEntry* entry = &index->slots[slot];
+    while (entry->value_offset != 0) {
+      if (entry->hash == hash && entry->value_offset - entry->key_offset == value - start &&
+          memcmp(data + entry->key_offset, start, value - start) == 0) {
+        break;
+      }
+      slot = (slot + 1) & (nslots - 1);
+      entry = &index->slots[slot];
+    }
+    if (entry->value_offset == 0) {
+      entry->hash = hash;
+      entry->key_offset = start - data;
+      entry->value_offset = value - data;
+    }
+    start = compact ? skip_compact_field(value, end, value_type) : skip_binary_field(value, end, value_type);
+  }
+}
+
+ThriftMapIndex* thrift_map_index(ThriftFieldTable* table, int16 field_id) {
+  for (ThriftMapIndex* index = table->map_indexes; index != NULL; index = index->next) {
+    if (index->field_id == field_id) {
+      return index;
+    }
+  }
+  ThriftMapIndex* index = MemoryContextAllocZero(field_cache->context, sizeof(ThriftMapIndex));
+  index->field_id = field_id;
+  index->next = table->map_indexes;
+  table->map_indexes = index;
+  return index;
+}
+
+// looks the key up in the map field, keys are compared in place and
+// values skipped. Returns false when the map has no such key, otherwise
+// the cursor points to its value.
+bool thrift_map_lookup(ThriftFieldTable* table, ThriftFieldOffset* field, uint8* data, uint8* end, ThriftPathStep* step, char* keys, ThriftPathCursor* cursor) {
+  bool compact = table->compact;
+  uint8 key_type = 0;
+  uint8 value_type = 0;
+  int64 len = 0;
+  uint8* start = thrift_map_header(compact, data + field->offset, end, &key_type, &value_type, &len);
+  if (len == 0) {
+    return false;
+  }
+  cursor->type_id = value_type;
+  cursor->element = true;
+  ThriftMapIndex* index = thrift_map_index(table, field->field_id);
+  index->lookups += 1;
+  if (index->lookups == 1) {
+    for (int64 i = 0; i < len; i++) {
+      bool found = compact ?
+        thrift_compact_key_matches(step, keys, start, end, key_type) :
+        thrift_binary_key_matches(step, keys, start, end, key_type);
+      start = compact ? skip_compact_field(start, end, key_type) : skip_binary_field(start, end, key_type);
+      if (found) {
+        cursor->start = start;
+        return true;
+      }
+      start = compact ? skip_compact_field(start, end, value_type) : skip_binary_field(start, end, value_type);
+    }
+    return false;
+  }
+
+  if (thrift_map_int_key(compact, key_type) != (step->kind == THRIFT_PATH_KEY_INT)) {
+    elog(ERROR, "Type of thrift map key does not match path");
+  }
+  if (index->slots == NULL) {
+    thrift_map_index_build(index, compact, data, start, end, key_type, value_type, len);
+  }
+  uint32 hash = thrift_map_step_hash(step, keys);
+  uint32 slot = hash & (index->nslots - 1);
+  for (ThriftMapIndexEntry* entry = &index->slots[slot]; entry->value_offset != 0; entry = &index->slots[slot]) {
+    if (entry->hash == hash) {
+      bool found = compact ?
+        thrift_compact_key_matches(step, keys, data + entry->key_offset, end, key_type) :
+        thrift_binary_key_matches(step, keys, data + entry->key_offset, end, key_type);
+      if (found) {
+        cursor->start = data + entry->value_offset;
+        return true;
+      }
+    }
+    slot = (slot + 1) & (index->nslots - 1);
+  }
+  return false;
+}
+
+// a struct without the map field or a map without the key give NULL
+Datum thrift_map_get(FunctionCallInfo fcinfo, bool compact, int8 type_id) {
+  int32 field_id = PG_GETARG_INT32(1);
+  char* keys = NULL;
+  ThriftPathStep step = thrift_map_key_argument(fcinfo, &keys);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), compact, &data, &size);
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  if (field == NULL) {
+    PG_RETURN_NULL();
+  }
+  if (field->type_id != (compact ? PG_THRIFT_COMPACT_MAP : PG_THRIFT_BINARY_MAP)) {
+    elog(ERROR, compact ? "Invalid thrift compact format" : "Invalid thrift format");
+  }
+  ThriftPathCursor cursor;
+  if (!thrift_map_lookup(table, field, data, data + size, &step, keys, &cursor)) {
+    PG_RETURN_NULL();
+  }
+  if (compact) {
+    return thrift_compact_path_value(&cursor, data + size, type_id);
+  }
+  return thrift_binary_path_value(&cursor, data + size, type_id);
+}
+
+Datum thrift_binary_map_get_bool(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_BOOL);
+}
+
+Datum thrift_compact_map_get_bool(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_BOOL);
+}
+
+Datum thrift_binary_map_get_byte(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_BYTE);
+}
+
+Datum thrift_compact_map_get_byte(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_BYTE);
+}
+
+Datum thrift_binary_map_get_double(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_DOUBLE);
+}
+
+Datum thrift_compact_map_get_double(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_DOUBLE);
+}
+
+Datum thrift_binary_map_get_int16(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_INT16);
+}
+
+Datum thrift_compact_map_get_int16(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_INT16);
+}
+
+Datum thrift_binary_map_get_int32(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_INT32);
+}
+
+Datum thrift_compact_map_get_int32(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_INT32);
+}
+
+Datum thrift_binary_map_get_int64(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_INT64);
+}
+
+Datum thrift_compact_map_get_int64(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_INT64);
+}
+
+Datum thrift_binary_map_get_string(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_STRING);
+}
+
+Datum thrift_compact_map_get_string(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_STRING);
+}
+
+Datum thrift_binary_map_get_struct_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_STRUCT);
+}
+
+Datum thrift_compact_map_get_struct_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_STRUCT);
+}
+
+Datum thrift_binary_map_get_list_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_LIST);
+}
+
+Datum thrift_compact_map_get_list_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_LIST);
+}
+
+Datum thrift_binary_map_get_set_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_SET);
+}
+
+Datum thrift_compact_map_get_set_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_SET);
+}
+
+Datum thrift_binary_map_get_map_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, false, PG_THRIFT_BINARY_MAP);
+}
+
+Datum thrift_compact_map_get_map_bytea(PG_FUNCTION_ARGS) {
+  return thrift_map_get(fcinfo, true, PG_THRIFT_COMPACT_MAP);
+}
+
+// contains functions compare the needle with the list elements as they
+// are stored, fixed width elements are compared as big endian bytes and
+// compact int elements as varint bytes, so nothing is decoded.
+
+// big endian bytes of value in width bytes, false when it doesn't fit
+bool thrift_fixed_needle(int64 value, int width, uint8* needle) {
+  if (width == INT16_LEN && (value < PG_INT16_MIN || value > PG_INT16_MAX)) {
+    return false;
+  }
+  if (width == INT32_LEN && (value < PG_INT32_MIN || value > PG_INT32_MAX)) {
+    return false;
+  }
+  for (int i = width - 1; i >= 0; i--) {
+    needle[i] = value & 0xff;
+    value >>= 8;
+  }
+  return true;
+}
+
+// zigzag varint bytes of value, as read by parse_varint_helper
+int thrift_varint_needle(int64 value, uint8* needle) {
+  uint64 zigzag = ((uint64)value << 1) ^ (uint64)(value >> 63);
+  int len = 0;
+  do {
+    needle[len] = zigzag & 0x7f;
+    zigzag >>= 7;
+    if (zigzag != 0) {
+      needle[len] |= 0x80;
+    }
+    len += 1;
+  } while (zigzag != 0);
+  return len;
+}
+
+bool thrift_contains_fixed_scalar(const uint8* data, int64 n, int width, const uint8* needle) {
+  for (int64 i = 0; i < n; i++) {
+    if (memcmp(data + i * width, needle, width) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef PG_THRIFT_X86_SIMD
+// chunks start at element boundaries as width divides the vector size,
+// so a lane of width bytes is all ones only when one element matches
+__attribute__((target("sse2")))
+bool thrift_contains_fixed_sse2(const uint8* data, int64 n, int width, const uint8* needle) {
+  uint8 pattern[16];
+  for (int i = 0; i < 16; i++) {
+    pattern[i] = needle[i % width];
+  }
+  __m128i p = _mm_loadu_si128((const __m128i*)pattern);
+  int64 size = n * width;
+  int64 i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i eq;
+    if (width == INT16_LEN) {
+      eq = _mm_cmpeq_epi16(v, p);
+    } else if (width == INT32_LEN) {
+      eq = _mm_cmpeq_epi32(v, p);
+    } else {
+      // no 64 bit compare before SSE4.1, both halves have to match
+      eq = _mm_cmpeq_epi32(v, p);
+      eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+    if (_mm_movemask_epi8(eq) != 0) {
+      return true;
+    }
+  }
+  return thrift_contains_fixed_scalar(data + i, (size - i) / width, width, needle);
+}
+
+__attribute__((target("avx2")))
+bool thrift_contains_fixed_avx2(const uint8* data, int64 n, int width, const uint8* needle) {
+  uint8 pattern[32];
+  for (int i = 0; i < 32; i++) {
+    pattern[i] = needle[i % width];
+  }
+  __m256i p = _mm256_loadu_si256((const __m256i*)pattern);
+  int64 size = n * width;
+  int64 i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i eq;
+    if (width == INT16_LEN) {
+      eq = _mm256_cmpeq_epi16(v, p);
+    } else if (width == INT32_LEN) {
+      eq = _mm256_cmpeq_epi32(v, p);
+    } else {
+      eq = _mm256_cmpeq_epi64(v, p);
+    }
+    if (_mm256_movemask_epi8(eq) != 0) {
+      return true;
+    }
+  }
+  return thrift_contains_fixed_scalar(data + i, (size - i) / width, width, needle);
+}
+#endif
+
+bool thrift_contains_fixed_choose(const uint8* data, int64 n, int width, const uint8* needle);
+
+// chosen by the CPU on first use, like the popcount functions of postgres
+static bool (*thrift_contains_fixed)(const uint8* data, int64 n, int width, const uint8* needle) = thrift_contains_fixed_choose;
+
+bool thrift_contains_fixed_choose(const uint8* data, int64 n, int width, const uint8* needle) {
+#ifdef PG_THRIFT_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) {
+    thrift_contains_fixed = thrift_contains_fixed_avx2;
+  } else {
+    thrift_contains_fixed = thrift_contains_fixed_sse2;
+  }
+#else
+  thrift_contains_fixed = thrift_contains_fixed_scalar;
+#endif
+  return thrift_contains_fixed(data, n, width, needle);
+}
+
+// 0 and -0 or NaNs with different payloads are equal without being the
+// same bytes, so such needles are compared as float8 like = does
+bool thrift_contains_double_scalar(const uint8* data, int64 n, float8 value) {
+  for (int64 i = 0; i < n; i++) {
+    float8 element = thrift_load_be_double(data + i * DOUBLE_LEN);
+    if (element == value || (isnan(element) && isnan(value))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// compact int elements are varints, only elements of the needle length
+// are compared
+bool thrift_contains_varint(uint8* curr, uint8* end, int64 n, const uint8* needle, int needle_len) {
+  for (int64 i = 0; i < n; i++) {
+    uint8* p = curr;
+    while (p < end && (*p & 0x80)) {
+      p++;
+    }
+    if (p >= end) {
+      elog(ERROR, "Invalid thrift compact format for list");
+    }
+    p++;
+    if (p - curr == needle_len && memcmp(curr, needle, needle_len) == 0) {
+      return true;
+    }
+    curr = p;
+  }
+  return false;
+}
+
+bool thrift_contains_string(bool compact, uint8* curr, uint8* end, int64 n, const char* needle, int needle_len) {
+  for (int64 i = 0; i < n; i++) {
+    int64 len_length = BYTE_LEN;
+    int64 len = compact ? parse_varint_helper(curr, end, &len_length) : parse_int_helper(curr, end, BYTE_LEN);
+    if (len < 0 || curr + len_length + len > end) {
+      elog(ERROR, compact ? "Invalid thrift compact format for list" : "Invalid thrift binary format for list");
+    }
+    if (len == needle_len && memcmp(curr + len_length, needle, len) == 0) {
+      return true;
+    }
+    curr += len_length + len;
+  }
+  return false;
+}
+
+// the needle is a bigint, double precision or text depending on the
+// declaration that was called. NULL when the struct has no such field.
+Datum thrift_list_contains(FunctionCallInfo fcinfo, bool compact) {
+  int32 field_id = PG_GETARG_INT32(1);
+  Oid needle_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), compact, &data, &size);
+  uint8* end = data + size;
+  ThriftFieldOffset* field = field_table_find(table, data, size, field_id, NULL);
+  if (field == NULL) {
+    PG_RETURN_NULL();
+  }
+
+  uint8* start = data + field->offset;
+  uint8* curr;
+  uint8 type_id;
+  int64 len;
+  if (compact) {
+    if (field->type_id != PG_THRIFT_COMPACT_LIST && field->type_id != PG_THRIFT_COMPACT_SET) {
+      elog(ERROR, "Invalid thrift compact format");
+    }
+    if (start >= end) {
+      elog(ERROR, "Invalid thrift compact format for list");
+    }
+    type_id = *start & 0x0f;
+    len = (*start & 0xf0) >> 4;
+    curr = start + PG_THRIFT_TYPE_LEN;
+    if (len == 0xf) {
+      int64 size_len = 0;
+      len = parse_varint_helper(curr, end, &size_len);
+      curr += size_len;
+    }
+  } else {
+    if (field->type_id != PG_THRIFT_BINARY_LIST && field->type_id != PG_THRIFT_BINARY_SET) {
+      elog(ERROR, "Invalid thrift format");
+    }
+    len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, LIST_LEN);
+    type_id = *start;
+    curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
+  }
+  if (len < 0 || len > end - curr) {
+    elog(ERROR, compact ? "Invalid thrift compact format for list" : "Invalid thrift binary format for list");
+  }
+  if (len == 0) {
+    PG_RETURN_BOOL(false);
+  }
+
+  // element type ids of compact lists are the binary ones
+  if (needle_type == TEXTOID) {
+    if (type_id != PG_THRIFT_BINARY_STRING) {
+      elog(ERROR, compact ? "Invalid thrift compact element type for list" : "Invalid thrift binary element type for list");
+    }
+    text* needle = PG_GETARG_TEXT_PP(2);
+    PG_RETURN_BOOL(thrift_contains_string(compact, curr, end, len, VARDATA_ANY(needle), VARSIZE_ANY_EXHDR(needle)));
+  }
+
+  // an integer constant resolves to the double precision declaration,
+  // so numbers are compared by value whichever declaration was called
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    float8 value = needle_type == FLOAT8OID ? PG_GETARG_FLOAT8(2) : (float8)PG_GETARG_INT64(2);
+    if (len > (end - curr) / DOUBLE_LEN) {
+      elog(ERROR, compact ? "Invalid thrift compact format for list" : "Invalid thrift binary format for list");
+    }
+    if (value == 0 || isnan(value)) {
+      PG_RETURN_BOOL(thrift_contains_double_scalar(curr, len, value));
+    }
+    uint8 needle[DOUBLE_LEN];
+    thrift_store_be_double(needle, value);
+    PG_RETURN_BOOL(thrift_contains_fixed(curr, len, DOUBLE_LEN, needle));
+  }
+
+  if (type_id != PG_THRIFT_BINARY_INT16 && type_id != PG_THRIFT_BINARY_INT32 && type_id != PG_THRIFT_BINARY_INT64) {
+    elog(ERROR, compact ? "Invalid thrift compact element type for list" : "Invalid thrift binary element type for list");
+  }
+  int64 value;
+  if (needle_type == FLOAT8OID) {
+    float8 needle = PG_GETARG_FLOAT8(2);
+    if (needle != rint(needle) || !FLOAT8_FITS_IN_INT64(needle)) {
+      PG_RETURN_BOOL(false);
+    }
+    value = (int64)needle;
+  } else {
+    value = PG_GETARG_INT64(2);
+  }
+  int width = binary_fixed_width(type_id);
+  uint8 needle[MAX_VARINT_LEN];
+  if (compact) {
+    // the varint of an out of range value can't be in the list anyway
+    int needle_len = thrift_varint_needle(value, needle);
+    PG_RETURN_BOOL(thrift_contains_varint(curr, end, len, needle, needle_len));
+  }
+  if (len > (end - curr) / width) {
+    elog(ERROR, "Invalid thrift binary format for list");
+  }
+  if (!thrift_fixed_needle(value, width, needle)) {
+    PG_RETURN_BOOL(false);
+  }
+  PG_RETURN_BOOL(thrift_contains_fixed(curr, len, width, needle));
+}
+
+Datum thrift_binary_list_contains(PG_FUNCTION_ARGS) {
+  return thrift_list_contains(fcinfo, false);
+}
+
+Datum thrift_compact_list_contains(PG_FUNCTION_ARGS) {
+  return thrift_list_contains(fcinfo, true);
+}
+
+// returns the next token of the IDL without consuming it, or NULL at
+// its end. Tokens are names, numbers, quoted strings and punctuation
+char* thrift_idl_peek(ThriftIdlParser* parser) {
+  if (parser->token != NULL) {
+    return parser->token;
+  }
+  char* p = parser->p;
+  while (true) {
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == '#' || (*p == '/' && *(p + 1) == '/')) {
+      while (*p != '\0' && *p != '\n') {
+        p++;
+      }
+    } else if (*p == '/' && *(p + 1) == '*') {
+      char* close = strstr(p + 2, "*/");
+      if (close == NULL) {
+        elog(ERROR, "Unterminated comment in thrift IDL");
+      }
+      p = close + 2;
+    } else {
+      break;
+    }
+  }
+  if (*p == '\0') {
+    parser->p = p;
+    return NULL;
+  }
+
+  char* start = p;
+  if (*p == '"' || *p == '\'') {
+    char quote = *p++;
+    while (*p != quote) {
+      if (*p == '\0') {
+        elog(ERROR, "Unterminated string in thrift IDL");
+      }
+      if (*p == '\\' && *(p + 1) != '\0') {
+        p++;
+      }
+      p++;
+    }
+    p++;
+  } else if (isalnum((unsigned char)*p) || *p == '_' || ((*p == '-' || *p == '+') && isdigit((unsigned char)*(p + 1)))) {
+    bool number = !isalpha((unsigned char)*p) && *p != '_';
+    p++;
+    while (isalnum((unsigned char)*p) || *p == '_' || *p == '.' ||
+           (number && (*p == '-' || *p == '+') && (*(p - 1) == 'e' || *(p - 1) == 'E'))) {
+      p++;
+    }
+  } else {
+    p++;
+  }
+  parser->token = pnstrdup(start, p - start);
+  parser->p = p;
+  return parser->token;
+}
+
+char* thrift_idl_next(ThriftIdlParser* parser) {
+  char* token = thrift_idl_peek(parser);
+  parser->token = NULL;
+  return token;
+}
+
+bool thrift_idl_accept(ThriftIdlParser* parser, const char* token) {
+  char* next = thrift_idl_peek(parser);
+  if (next == NULL || strcmp(next, token) != 0) {
+    return false;
+  }
+  parser->token = NULL;
+  return true;
+}
+
+void thrift_idl_expect(ThriftIdlParser* parser, const char* token) {
+  char* next = thrift_idl_next(parser);
+  if (next == NULL || strcmp(next, token) != 0) {
+    elog(ERROR, "Invalid thrift IDL, expected \"%s\" at \"%s\"", token, next == NULL ? "end of input" : next);
+  }
+}
+
+char* thrift_idl_name(ThriftIdlParser* parser) {
+  char* name = thrift_idl_next(parser);
+  if (name == NULL || !(isalpha((unsigned char)*name) || *name == '_')) {
+    elog(ERROR, "Invalid thrift IDL, expected a name at \"%s\"", name == NULL ? "end of input" : name);
+  }
+  return name;
+}
+
+// skips a balanced block starting with open, e.g. the body of an enum
+void thrift_idl_skip_block(ThriftIdlParser* parser, const char* open, const char* close) {
+  thrift_idl_expect(parser, open);
+  int depth = 1;
+  while (depth > 0) {
+    char* token = thrift_idl_next(parser);
+    if (token == NULL) {
+      elog(ERROR, "Invalid thrift IDL, expected \"%s\" at \"end of input\"", close);
+    }
+    if (strcmp(token, open) == 0) {
+      depth++;
+    } else if (strcmp(token, close) == 0) {
+      depth--;
+    }
+  }
+}
+
+void thrift_idl_skip_annotations(ThriftIdlParser* parser) {
+  char* token = thrift_idl_peek(parser);
+  if (token != NULL && strcmp(token, "(") == 0) {
+    thrift_idl_skip_block(parser, "(", ")");
+  }
+}
+
+// list, set and map types are spelled without spaces, typedefs and
+// enums are replaced by the type they stand for
+char* thrift_idl_parse_type(ThriftIdlParser* parser) {
+  char* name = thrift_idl_name(parser);
+  if (strcmp(name, "list") == 0 || strcmp(name, "set") == 0 || strcmp(name, "map") == 0) {
+    if (thrift_idl_accept(parser, "cpp_type")) {
+      thrift_idl_next(parser);
+    }
+    thrift_idl_expect(parser, "<");
+    char* type = thrift_idl_parse_type(parser);
+    if (strcmp(name, "map") == 0) {
+      thrift_idl_expect(parser, ",");
+      type = psprintf("%s,%s", type, thrift_idl_parse_type(parser));
+    }
+    thrift_idl_expect(parser, ">");
+    if (thrift_idl_accept(parser, "cpp_type")) {
+      thrift_idl_next(parser);
+    }
+    return psprintf("%s<%s>", name, type);
+  }
+  if (strcmp(name, "i8") == 0) {
+    return "byte";
+  }
+  char* type = thrift_idl_names_find(&parser->typedefs, name);
+  return type == NULL ? name : type;
+}
+
+// a string constant is returned without its quotes, a list or map
+// constant as its tokens without spaces
+char* thrift_idl_parse_const(ThriftIdlParser* parser) {
+  char* token = thrift_idl_next(parser);
+  if (token == NULL) {
+    elog(ERROR, "Invalid thrift IDL, expected a constant at \"end of input\"");
+  }
+  if (*token == '"' || *token == '\'') {
+    StringInfoData buf;
+    initStringInfo(&buf);
+    for (char* p = token + 1; *(p + 1) != '\0'; p++) {
+      if (*p == '\\' && *(p + 2) != '\0') {
+        p++;
+      }
+      appendStringInfoChar(&buf, *p);
+    }
+    return buf.data;
+  }
+  if (strcmp(token, "[") == 0 || strcmp(token, "{") == 0) {
+    StringInfoData buf;
+    initStringInfo(&buf);
+    appendStringInfoString(&buf, token);
+    int depth = 1;
+    while (depth > 0) {
+      token = thrift_idl_next(parser);
+      if (token == NULL) {
+        elog(ERROR, "Invalid thrift IDL, unterminated constant at \"end of input\"");
+      }
+      if (strcmp(token, "[") == 0 || strcmp(token, "{") == 0) {
+        depth++;
+      } else if (strcmp(token, "]") == 0 || strcmp(token, "}") == 0) {
+        depth--;
+      }
+      appendStringInfoString(&buf, token);
+    }
+    return buf.data;
+  }
+  char* value = thrift_idl_names_find(&parser->constants, token);
+  return value == NULL ? token : value;
+}
+
+void thrift_idl_names_add(ThriftIdlNames* names, char* name, char* value) {
+  if (names->n == names->capacity) {
+    names->capacity = names->capacity == 0 ? 16 : names->capacity * 2;
+    names->names = names->n == 0 ? palloc(sizeof(char*) * names->capacity) : repalloc(names->names, sizeof(char*) * names->capacity);
+    names->values = names->n == 0 ? palloc(sizeof(char*) * names->capacity) : repalloc(names->values, sizeof(char*) * names->capacity);
+  }
+  names->names[names->n] = name;
+  names->values[names->n] = value;
+  names->n++;
+}
+
+char* thrift_idl_names_find(ThriftIdlNames* names, char* name) {
+  for (int i = 0; i < names->n; i++) {
+    if (strcmp(names->names[i], name) == 0) {
+      return names->values[i];
+    }
+  }
+  return NULL;
+}
+
+// enum values are numbered from 0 or from the last explicit value
+void thrift_idl_parse_enum(ThriftIdlParser* parser) {
+  char* enum_name = thrift_idl_name(parser);
+  thrift_idl_names_add(&parser->typedefs, enum_name, "i32");
+  thrift_idl_expect(parser, "{");
+  int64 value = 0;
+  while (!thrift_idl_accept(parser, "}")) {
+    char* name = thrift_idl_name(parser);
+    if (thrift_idl_accept(parser, "=")) {
+      char* token = thrift_idl_next(parser);
+      char* endptr;
+      errno = 0;
+      value = token == NULL ? 0 : strtoll(token, &endptr, 0);
+      if (token == NULL || *endptr != '\0' || errno != 0) {
+        elog(ERROR, "Invalid thrift IDL, bad value of %s.%s", enum_name, name);
+      }
+    }
+    thrift_idl_names_add(&parser->constants, psprintf("%s.%s", enum_name, name), psprintf("%lld", (long long)value));
+    value++;
+    thrift_idl_skip_annotations(parser);
+    if (!thrift_idl_accept(parser, ",")) {
+      thrift_idl_accept(parser, ";");
+    }
+  }
+}
+
+/*
+ * NOTE: fields are [id:] [required|optional] type name [= const], fields
+ * without an id get -1, -2, ... like the thrift compiler gives them
+ */
+void thrift_idl_parse_struct(ThriftIdlParser* parser) {
+  char* struct_name = thrift_idl_name(parser);
+  int16 auto_id = -1;
+  thrift_idl_accept(parser, "xsd_all");
+  thrift_idl_expect(parser, "{");
+  while (!thrift_idl_accept(parser, "}")) {
+    char* token = thrift_idl_peek(parser);
+    if (token == NULL) {
+      elog(ERROR, "Invalid thrift IDL, unterminated struct %s", struct_name);
+    }
+    if (parser->nfields == parser->fields_capacity) {
+      parser->fields_capacity *= 2;
+      parser->fields = repalloc(parser->fields, sizeof(ThriftIdlField) * parser->fields_capacity);
+    }
+    ThriftIdlField* field = &parser->fields[parser->nfields];
+    memset(field, 0, sizeof(ThriftIdlField));
+    field->struct_name = struct_name;
+    if (isdigit((unsigned char)*token) || *token == '-' || *token == '+') {
+      char* endptr;
+      errno = 0;
+      long field_id = strtol(thrift_idl_next(parser), &endptr, 10);
+      if (*endptr != '\0' || errno != 0 || field_id < PG_INT16_MIN || field_id > PG_INT16_MAX) {
+        elog(ERROR, "Invalid thrift IDL, bad field id \"%s\" in struct %s", token, struct_name);
+      }
+      thrift_idl_expect(parser, ":");
+      field->field_id = field_id;
+    } else {
+      field->field_id = auto_id--;
+    }
+    if (!thrift_idl_accept(parser, "required")) {
+      thrift_idl_accept(parser, "optional");
+    }
+    field->field_type = thrift_idl_parse_type(parser);
+    thrift_idl_skip_annotations(parser);
+    field->field_name = thrift_idl_name(parser);
+    if (thrift_idl_accept(parser, "=")) {
+      field->default_value = thrift_idl_parse_const(parser);
+    }
+    thrift_idl_accept(parser, "xsd_optional");
+    thrift_idl_accept(parser, "xsd_nillable");
+    if (thrift_idl_accept(parser, "xsd_attrs")) {
+      thrift_idl_skip_block(parser, "{", "}");
+    }
+    thrift_idl_skip_annotations(parser);
+    if (!thrift_idl_accept(parser, ",")) {
+      thrift_idl_accept(parser, ";");
+    }
+    parser->nfields++;
+  }
+  thrift_idl_skip_annotations(parser);
+}
+
+// collects the fields of all structs, unions and exceptions of the IDL,
+// other definitions are only read to resolve types or skipped
+void thrift_idl_parse(ThriftIdlParser* parser, char* idl) {
+  memset(parser, 0, sizeof(ThriftIdlParser));
+  parser->p = idl;
+  parser->fields_capacity = 16;
+  parser->fields = palloc(sizeof(ThriftIdlField) * parser->fields_capacity);
+
+  char* token;
+  while ((token = thrift_idl_next(parser)) != NULL) {
+    if (strcmp(token, "namespace") == 0) {
+      thrift_idl_next(parser);
+      thrift_idl_next(parser);
+    } else if (strcmp(token, "include") == 0 || strcmp(token, "cpp_include") == 0) {
+      thrift_idl_next(parser);
+    } else if (strcmp(token, "typedef") == 0) {
+      char* type = thrift_idl_parse_type(parser);
+      thrift_idl_skip_annotations(parser);
+      thrift_idl_names_add(&parser->typedefs, thrift_idl_name(parser), type);
+      thrift_idl_skip_annotations(parser);
+    } else if (strcmp(token, "const") == 0) {
+      thrift_idl_parse_type(parser);
+      char* name = thrift_idl_name(parser);
+      thrift_idl_expect(parser, "=");
+      thrift_idl_names_add(&parser->constants, name, thrift_idl_parse_const(parser));
+    } else if (strcmp(token, "enum") == 0) {
+      thrift_idl_parse_enum(parser);
+      thrift_idl_skip_annotations(parser);
+    } else if (strcmp(token, "senum") == 0) {
+      thrift_idl_names_add(&parser->typedefs, thrift_idl_name(parser), "string");
+      thrift_idl_skip_block(parser, "{", "}");
+    } else if (strcmp(token, "service") == 0) {
+      thrift_idl_name(parser);
+      if (thrift_idl_accept(parser, "extends")) {
+        thrift_idl_name(parser);
+      }
+      thrift_idl_skip_block(parser, "{", "}");
+      thrift_idl_skip_annotations(parser);
+    } else if (strcmp(token, "struct") == 0 || strcmp(token, "union") == 0 || strcmp(token, "exception") == 0) {
+      thrift_idl_parse_struct(parser);
+    } else {
+      elog(ERROR, "Invalid thrift IDL at \"%s\"", token);
+    }
+    if (!thrift_idl_accept(parser, ",")) {
+      thrift_idl_accept(parser, ";");
+    }
+  }
+}
+
+Datum thrift_parse_idl(PG_FUNCTION_ARGS) {
+  FuncCallContext* funcctx;
+  if (SRF_IS_FIRSTCALL()) {
+    funcctx = SRF_FIRSTCALL_INIT();
+    MemoryContext old = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    TupleDesc tupdesc;
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+      elog(ERROR, "Function returning record called in context that cannot accept type record");
+    }
+    funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+    ThriftIdlParser* parser = palloc(sizeof(ThriftIdlParser));
+    thrift_idl_parse(parser, text_to_cstring(PG_GETARG_TEXT_PP(0)));
+    funcctx->user_fctx = parser;
+    funcctx->max_calls = parser->nfields;
+    MemoryContextSwitchTo(old);
+  }
+
+  funcctx = SRF_PERCALL_SETUP();
+  if (funcctx->call_cntr < funcctx->max_calls) {
+    ThriftIdlParser* parser = (ThriftIdlParser*)funcctx->user_fctx;
+    ThriftIdlField* field = &parser->fields[funcctx->call_cntr];
+    Datum values[5];
+    bool nulls[5] = {false, false, false, false, field->default_value == NULL};
+    values[0] = CStringGetTextDatum(field->struct_name);
+    values[1] = CStringGetTextDatum(field->field_name);
+    values[2] = Int16GetDatum(field->field_id);
+    values[3] = CStringGetTextDatum(field->field_type);
+    values[4] = nulls[4] ? (Datum)0 : CStringGetTextDatum(field->default_value);
+    HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+  }
+  SRF_RETURN_DONE(funcctx);
+}
+
+// the registry tables are created with the extension, so they are in the
+// schema of the calling function wherever the extension was installed
+char* thrift_schema_table(FunctionCallInfo fcinfo, const char* table) {
+  char* schema = get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid));
+  return quote_qualified_identifier(schema, table);
+}
+
+// replaces the structs registered under name by the ones of the IDL,
+// returns the number of fields registered
+Datum thrift_register_schema(PG_FUNCTION_ARGS) {
+  Datum name = PG_GETARG_DATUM(0);
+  text* idl = PG_GETARG_TEXT_PP(1);
+  ThriftIdlParser parser;
+  thrift_idl_parse(&parser, text_to_cstring(idl));
+  char* schema_table = thrift_schema_table(fcinfo, "thrift_schema");
+  char* field_table = thrift_schema_table(fcinfo, "thrift_schema_field");
+
+  if (SPI_connect() != SPI_OK_CONNECT) {
+    elog(ERROR, "Could not connect to SPI");
+  }
+  Oid argtypes[6] = {TEXTOID, TEXTOID, TEXTOID, INT2OID, TEXTOID, TEXTOID};
+  Datum values[6] = {name, PointerGetDatum(idl)};
+  char nulls[6] = {' ', ' ', ' ', ' ', ' ', ' '};
+  int ret = SPI_execute_with_args(psprintf("DELETE FROM %s WHERE name = $1", schema_table), 1, argtypes, values, nulls, false, 0);
+  if (ret != SPI_OK_DELETE) {
+    elog(ERROR, "Could not delete thrift schema: %s", SPI_result_code_string(ret));
+  }
+  ret = SPI_execute_with_args(psprintf("INSERT INTO %s (name, idl) VALUES ($1, $2)", schema_table), 2, argtypes, values, nulls, false, 0);
+  if (ret != SPI_OK_INSERT) {
+    elog(ERROR, "Could not insert thrift schema: %s", SPI_result_code_string(ret));
+  }
+  SPIPlanPtr insert = SPI_prepare(
+    psprintf("INSERT INTO %s (schema_name, struct_name, field_name, field_id, field_type, default_value) "
+             "VALUES ($1, $2, $3, $4, $5, $6)", field_table),
+    6, argtypes);
+  if (insert == NULL) {
+    elog(ERROR, "Could not prepare thrift schema insert: %s", SPI_result_code_string(SPI_result));
+  }
+  for (int i = 0; i < parser.nfields; i++) {
+    ThriftIdlField* field = &parser.fields[i];
+    values[1] = CStringGetTextDatum(field->struct_name);
+    values[2] = CStringGetTextDatum(field->field_name);
+    values[3] = Int16GetDatum(field->field_id);
+    values[4] = CStringGetTextDatum(field->field_type);
+    values[5] = field->default_value == NULL ? (Datum)0 : CStringGetTextDatum(field->default_value);
+    nulls[5] = field->default_value == NULL ? 'n' : ' ';
+    ret = SPI_execute_plan(insert, values, nulls, false, 0);
+    if (ret != SPI_OK_INSERT) {
+      elog(ERROR, "Could not insert thrift schema field: %s", SPI_result_code_string(ret));
+    }
+  }
+  SPI_finish();
+  registry_generation++;
+  thrift_record_cache_reset();
+  // other backends drop their mappings when this transaction commits
+  Oid field_relid = get_relname_relid("thrift_schema_field", get_func_namespace(fcinfo->flinfo->fn_oid));
+  if (OidIsValid(field_relid)) {
+    CacheInvalidateRelcacheByRelid(field_relid);
+  }
+  PG_RETURN_INT32(parser.nfields);
+}
+
+bool thrift_idl_is_base_type(char* type) {
+  return strcmp(type, "bool") == 0 || strcmp(type, "byte") == 0 || strcmp(type, "i16") == 0 ||
+    strcmp(type, "i32") == 0 || strcmp(type, "i64") == 0 || strcmp(type, "double") == 0 ||
+    strcmp(type, "string") == 0 || strcmp(type, "binary") == 0;
+}
+
+// element type of list<T> or set<T>, value type of map<K,V>
+char* thrift_idl_element_type(char* type) {
+  char* start = strchr(type, '<') + 1;
+  char* stop = type + strlen(type) - 1;
+  if (strncmp(type, "map<", 4) == 0) {
+    int depth = 0;
+    for (char* p = start; p < stop; p++) {
+      if (*p == '<') {
+        depth++;
+      } else if (*p == '>') {
+        depth--;
+      } else if (*p == ',' && depth == 0) {
+        start = p + 1;
+        break;
+      }
+    }
+  }
+  return pnstrdup(start, stop - start);
+}
+
+/*
+ * Parses the field name at *p and looks it up in the struct reached so
+ * far. Structs of other schemas are named schema.Struct in field types,
+ * the root struct may be given either way and must be unique when not.
+ */
+int16 thrift_schema_resolve_field(ThriftSchemaResolver* resolver, char** p, char* str) {
+  char* name = *p;
+  while (isalnum((unsigned char)**p) || **p == '_') {
+    (*p)++;
+  }
+  if (*p == name) {
+    elog(ERROR, "Invalid thrift path \"%s\"", str);
+  }
+  name = pnstrdup(name, *p - name);
+  char* type = resolver->type;
+  if (thrift_idl_is_base_type(type) || strchr(type, '<') != NULL) {
+    elog(ERROR, "Thrift path \"%s\" expects a struct at %s, found %s", str, name, type);
+  }
+  char* schema_name = resolver->schema_name;
+  char* struct_name = type;
+  char* dot = strrchr(type, '.');
+  if (dot != NULL) {
+    schema_name = pnstrdup(type, dot - type);
+    struct_name = dot + 1;
+  }
+
+  Oid argtypes[3] = {TEXTOID, TEXTOID, TEXTOID};
+  Datum values[3] = {
+    schema_name == NULL ? (Datum)0 : CStringGetTextDatum(schema_name),
+    CStringGetTextDatum(struct_name),
+    CStringGetTextDatum(name)
+  };
+  char nulls[3] = {schema_name == NULL ? 'n' : ' ', ' ', ' '};
+  char* sql = psprintf(
+    "SELECT schema_name, field_id, field_type, default_value FROM %s "
+    "WHERE ($1 IS NULL OR schema_name = $1) AND struct_name = $2 AND field_name = $3",
+    resolver->table);
+  if (SPI_execute_with_args(sql, 3, argtypes, values, nulls, true, 0) != SPI_OK_SELECT) {
+    elog(ERROR, "Could not look up thrift field %s.%s", type, name);
+  }
+  if (SPI_processed == 0) {
+    elog(ERROR, "Thrift struct %s has no field %s", type, name);
+  }
+  if (SPI_processed > 1) {
+    elog(ERROR, "Thrift struct %s is registered in several schemas, qualify it as schema.%s", struct_name, struct_name);
+  }
+  HeapTuple tuple = SPI_tuptable->vals[0];
+  TupleDesc tupdesc = SPI_tuptable->tupdesc;
+  resolver->schema_name = SPI_getvalue(tuple, tupdesc, 1);
+  int16 field_id = atoi(SPI_getvalue(tuple, tupdesc, 2));
+  resolver->type = SPI_getvalue(tuple, tupdesc, 3);
+  resolver->default_value = SPI_getvalue(tuple, tupdesc, 4);
+  return field_id;
+}
+
+// moves to the element of a list or set, or to the value of a map
+void thrift_schema_resolve_element(ThriftSchemaResolver* resolver, uint8 kind, char* str) {
+  char* type = resolver->type;
+  bool list = strncmp(type, "list<", 5) == 0 || strncmp(type, "set<", 4) == 0;
+  bool map = strncmp(type, "map<", 4) == 0;
+  if (kind == THRIFT_PATH_INDEX ? !list : !map) {
+    elog(ERROR, "Thrift path \"%s\" expects a %s, found %s", str, kind == THRIFT_PATH_INDEX ? "list" : "map", type);
+  }
+  resolver->type = thrift_idl_element_type(type);
+  resolver->default_value = NULL;
+}
+
+ThriftPath* thrift_path_prefix(ThriftPath* path, int nsteps) {
+  Size keys_len = VARSIZE(path) - THRIFT_PATH_HDRSZ - path->nsteps * sizeof(ThriftPathStep);
+  Size size = THRIFT_PATH_HDRSZ + nsteps * sizeof(ThriftPathStep) + keys_len;
+  ThriftPath* prefix = palloc0(size);
+  SET_VARSIZE(prefix, size);
+  prefix->nsteps = nsteps;
+  memcpy(prefix->steps, path->steps, nsteps * sizeof(ThriftPathStep));
+  memcpy(THRIFT_PATH_KEYS(prefix), THRIFT_PATH_KEYS(path), keys_len);
+  return prefix;
+}
+
+/*
+ * Compiles the struct name and name path at argno and argno + 1, the plan
+ * is kept in fn_extra and rebuilt when they change or a schema has been
+ * registered since. Plans live in a context of their own so rebuilding
+ * one doesn't leak the previous one.
+ */
+ThriftSchemaPlan* thrift_schema_plan(FunctionCallInfo fcinfo, int argno) {
+  text* struct_name = PG_GETARG_TEXT_PP(argno);
+  text* name_path = PG_GETARG_TEXT_PP(argno + 1);
+  ThriftSchemaPlan* plan = (ThriftSchemaPlan*)fcinfo->flinfo->fn_extra;
+  if (plan != NULL && plan->generation == registry_generation &&
+      VARSIZE_ANY_EXHDR(plan->struct_name) == VARSIZE_ANY_EXHDR(struct_name) &&
+      VARSIZE_ANY_EXHDR(plan->name_path) == VARSIZE_ANY_EXHDR(name_path) &&
+      memcmp(VARDATA_ANY(plan->struct_name), VARDATA_ANY(struct_name), VARSIZE_ANY_EXHDR(struct_name)) == 0 &&
+      memcmp(VARDATA_ANY(plan->name_path), VARDATA_ANY(name_path), VARSIZE_ANY_EXHDR(name_path)) == 0) {
+    return plan;
+  }
+  if (plan != NULL) {
+    fcinfo->flinfo->fn_extra = NULL;
+    MemoryContextDelete(plan->context);
+  }
+
+  ThriftSchemaResolver resolver;
+  memset(&resolver, 0, sizeof(ThriftSchemaResolver));
+  resolver.table = thrift_schema_table(fcinfo, "thrift_schema_field");
+  resolver.type = text_to_cstring(struct_name);
+  char* str = text_to_cstring(name_path);
+  if (*str == '\0') {
+    elog(ERROR, "Invalid thrift path \"%s\"", str);
+  }
+
+  MemoryContext context = AllocSetContextCreate(fcinfo->flinfo->fn_mcxt, "pg_thrift schema plan", ALLOCSET_SMALL_SIZES);
+  thrift_registry_watch(fcinfo);
+  uint64 generation = registry_generation;
+  if (SPI_connect() != SPI_OK_CONNECT) {
+    elog(ERROR, "Could not connect to SPI");
+  }
+  ThriftPath* path = thrift_path_parse(str, &resolver);
+  MemoryContext old = MemoryContextSwitchTo(context);
+  plan = palloc0(sizeof(ThriftSchemaPlan));
+  plan->context = context;
+  plan->generation = generation;
+  plan->struct_name = palloc(VARSIZE_ANY(struct_name));
+  memcpy(plan->struct_name, struct_name, VARSIZE_ANY(struct_name));
+  plan->name_path = palloc(VARSIZE_ANY(name_path));
+  memcpy(plan->name_path, name_path, VARSIZE_ANY(name_path));
+  plan->path = palloc(VARSIZE(path));
+  memcpy(plan->path, path, VARSIZE(path));
+  plan->type = pstrdup(resolver.type);
+  if (resolver.default_value != NULL) {
+    plan->default_value = pstrdup(resolver.default_value);
+    plan->parent = thrift_path_prefix(path, path->nsteps - 1);
+  }
+  MemoryContextSwitchTo(old);
+  SPI_finish();
+
+  // type ids the value is expected to have in either protocol
+  char* type = plan->type;
+  if (strcmp(type, "bool") == 0) {
+    plan->value_type = BOOLOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_BOOL;
+    plan->compact_type_id = PG_THRIFT_COMPACT_BOOL;
+  } else if (strcmp(type, "byte") == 0) {
+    plan->value_type = BYTEAOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_BYTE;
+    plan->compact_type_id = PG_THRIFT_COMPACT_BYTE;
+  } else if (strcmp(type, "i16") == 0) {
+    plan->value_type = INT2OID;
+    plan->binary_type_id = PG_THRIFT_BINARY_INT16;
+    plan->compact_type_id = PG_THRIFT_COMPACT_INT16;
+  } else if (strcmp(type, "i32") == 0) {
+    plan->value_type = INT4OID;
+    plan->binary_type_id = PG_THRIFT_BINARY_INT32;
+    plan->compact_type_id = PG_THRIFT_COMPACT_INT32;
+  } else if (strcmp(type, "i64") == 0) {
+    plan->value_type = INT8OID;
+    plan->binary_type_id = PG_THRIFT_BINARY_INT64;
+    plan->compact_type_id = PG_THRIFT_COMPACT_INT64;
+  } else if (strcmp(type, "double") == 0) {
+    plan->value_type = FLOAT8OID;
+    plan->binary_type_id = PG_THRIFT_BINARY_DOUBLE;
+    plan->compact_type_id = PG_THRIFT_COMPACT_DOUBLE;
+  } else if (strcmp(type, "string") == 0 || strcmp(type, "binary") == 0) {
+    plan->value_type = strcmp(type, "string") == 0 ? TEXTOID : BYTEAOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_STRING;
+    plan->compact_type_id = PG_THRIFT_COMPACT_STRING;
+  } else if (strncmp(type, "list<", 5) == 0) {
+    plan->value_type = BYTEAOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_LIST;
+    plan->compact_type_id = PG_THRIFT_COMPACT_LIST;
+    plan->raw = true;
+  } else if (strncmp(type, "set<", 4) == 0) {
+    plan->value_type = BYTEAOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_SET;
+    plan->compact_type_id = PG_THRIFT_COMPACT_SET;
+    plan->raw = true;
+  } else if (strncmp(type, "map<", 4) == 0) {
+    plan->value_type = BYTEAOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_MAP;
+    plan->compact_type_id = PG_THRIFT_COMPACT_MAP;
+    plan->raw = true;
+  } else {
+    plan->value_type = BYTEAOID;
+    plan->binary_type_id = PG_THRIFT_BINARY_STRUCT;
+    plan->compact_type_id = PG_THRIFT_COMPACT_STRUCT;
+    plan->raw = true;
+  }
+  Oid output;
+  bool is_varlena;
+  getTypeOutputInfo(plan->value_type, &output, &is_varlena);
+  fmgr_info_cxt(output, &plan->output, context);
+  fcinfo->flinfo->fn_extra = plan;
+  return plan;
+}
+
+Datum thrift_schema_path(PG_FUNCTION_ARGS) {
+  ThriftSchemaPlan* plan = thrift_schema_plan(fcinfo, 0);
+  PG_RETURN_POINTER(plan->path);
+}
+
+// a missing field with a default gives the default when its parent is
+// there, other missing steps give NULL
+Datum thrift_schema_get(FunctionCallInfo fcinfo, bool compact) {
+  ThriftSchemaPlan* plan = thrift_schema_plan(fcinfo, 1);
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(0), compact, &data, &size);
+  uint8* end = data + size;
+  ThriftPathCursor cursor;
+  bool found = compact ?
+    thrift_compact_walk_path(plan->path, table, data, end, &cursor) :
+    thrift_binary_walk_path(plan->path, table, data, end, &cursor);
+  if (!found) {
+    if (plan->default_value == NULL) {
+      PG_RETURN_NULL();
+    }
+    found = compact ?
+      thrift_compact_walk_path(plan->parent, table, data, end, &cursor) :
+      thrift_binary_walk_path(plan->parent, table, data, end, &cursor);
+    if (!found) {
+      PG_RETURN_NULL();
+    }
+    PG_RETURN_TEXT_P(cstring_to_text(plan->default_value));
+  }
+
+  int8 type_id = compact ? plan->compact_type_id : plan->binary_type_id;
+  Datum value;
+  if (plan->raw) {
+    if (cursor.type_id != type_id) {
+      elog(ERROR, compact ? "Invalid thrift compact format" : "Invalid thrift format");
+    }
+    uint8* next = compact ? skip_compact_field(cursor.start, end, type_id) : skip_binary_field(cursor.start, end, type_id);
+    bytea* raw = palloc(next - cursor.start + VARHDRSZ);
+    SET_VARSIZE(raw, next - cursor.start + VARHDRSZ);
+    memcpy(VARDATA(raw), cursor.start, next - cursor.start);
+    value = PointerGetDatum(raw);
+  } else {
+    value = compact ?
+      thrift_compact_path_value(&cursor, end, type_id) :
+      thrift_binary_path_value(&cursor, end, type_id);
+  }
+  // strings are decoded as bytes, which share the varlena layout of text
+  if (plan->value_type == TEXTOID) {
+    PG_RETURN_DATUM(value);
+  }
+  PG_RETURN_TEXT_P(cstring_to_text(OutputFunctionCall(&plan->output, value)));
+}
+
+Datum thrift_binary_get(PG_FUNCTION_ARGS) {
+  return thrift_schema_get(fcinfo, false);
+}
+
+Datum thrift_compact_get(PG_FUNCTION_ARGS) {
+  return thrift_schema_get(fcinfo, true);
+}
+
+// binary type id of the list elements an array column is filled from,
+// bytea[] keeps taking the elements of any container as bytes
+uint8 thrift_array_element_type(Oid element_type) {
+  if (element_type == BOOLOID) {
+    return PG_THRIFT_BINARY_BOOL;
+  }
+
+  if (element_type == INT2OID) {
+    return PG_THRIFT_BINARY_INT16;
+  }
+
+  if (element_type == INT4OID) {
+    return PG_THRIFT_BINARY_INT32;
+  }
+
+  if (element_type == INT8OID) {
+    return PG_THRIFT_BINARY_INT64;
+  }
+
+  if (element_type == FLOAT8OID) {
+    return PG_THRIFT_BINARY_DOUBLE;
+  }
+
+  if (element_type == TEXTOID) {
+    return PG_THRIFT_BINARY_STRING;
+  }
+
+  if (type_is_rowtype(element_type)) {
+    return PG_THRIFT_BINARY_STRUCT;
+  }
+  elog(ERROR, "Unsupported column type for thrift field");
+}
+
+int thrift_record_column_cmp(const void* a, const void* b) {
+  return ((ThriftRecordColumn*)a)->field_id - ((ThriftRecordColumn*)b)->field_id;
+}
+
+// registering a schema can change the field ids of columns mapped by name
+void thrift_record_cache_reset(void) {
+  if (record_cache == NULL) {
+    return;
+  }
+  HASH_SEQ_STATUS status;
+  hash_seq_init(&status, record_cache);
+  ThriftRecordInfo* info;
+  while ((info = (ThriftRecordInfo*)hash_seq_search(&status)) != NULL) {
+    info->tupdesc_id = 0;
+  }
+}
+
+// registering a schema in another backend invalidates the relcache entry
+// of the registry table
+void thrift_registry_relcache_callback(Datum arg, Oid relid) {
+  if (relid == InvalidOid || relid == registry_relid) {
+    registry_generation++;
+    thrift_record_cache_reset();
+  }
+}
+
+// called before reading the registry, so later changes to it are seen
+void thrift_registry_watch(FunctionCallInfo fcinfo) {
+  static bool registered = false;
+  if (!registered) {
+    CacheRegisterRelcacheCallback(thrift_registry_relcache_callback, (Datum)0);
+    registered = true;
+  }
+  registry_relid = get_relname_relid("thrift_schema_field", get_func_namespace(fcinfo->flinfo->fn_oid));
+}
+
+// COMMENT ON COLUMN sends no invalidation, so the comments of a cached
+// type are checked again in each transaction that uses it
+void thrift_record_cache_xact_callback(XactEvent event, void* arg) {
+  record_cache_xact++;
+}
+
+// field id given by the comment of a column, if it is an integer
+bool thrift_record_comment_id(const char* comment, int16* field_id) {
+  char* endptr;
+  errno = 0;
+  long id = strtol(comment, &endptr, 10);
+  if (endptr != comment && *endptr == '\0' && errno == 0 && id >= PG_INT16_MIN && id <= PG_INT16_MAX) {
+    *field_id = id;
+    return true;
+  }
+  return false;
+}
+
+// field ids of the columns of a relation whose comments are integers,
+// indexed by attribute number less one, read in one scan of pg_description
+bool* thrift_record_comment_ids(Oid relid, int natts, int16* field_ids) {
+  bool* commented = palloc0(sizeof(bool) * (natts + 1));
+  ScanKeyData keys[2];
+  ScanKeyInit(&keys[0], Anum_pg_description_objoid, BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relid));
+  ScanKeyInit(&keys[1], Anum_pg_description_classoid, BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(RelationRelationId));
+#if PG_VERSION_NUM >= 120000
+  Relation description = table_open(DescriptionRelationId, AccessShareLock);
+#else
+  Relation description = heap_open(DescriptionRelationId, AccessShareLock);
+#endif
+  SysScanDesc scan = systable_beginscan(description, DescriptionObjIndexId, true, NULL, 2, keys);
+  HeapTuple tuple;
+  while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+    int32 attnum = ((Form_pg_description)GETSTRUCT(tuple))->objsubid;
+    bool isnull;
+    Datum comment = heap_getattr(tuple, Anum_pg_description_description, RelationGetDescr(description), &isnull);
+    if (attnum >= 1 && attnum <= natts && !isnull) {
+      commented[attnum - 1] = thrift_record_comment_id(TextDatumGetCString(comment), &field_ids[attnum - 1]);
+    }
+  }
+  systable_endscan(scan);
+#if PG_VERSION_NUM >= 120000
+  table_close(description, AccessShareLock);
+#else
+  heap_close(description, AccessShareLock);
+#endif
+  return commented;
+}
+
+bool thrift_record_comments_changed(ThriftRecordInfo* info, Oid relid) {
+  int natts = info->tupdesc->natts;
+  int16* field_ids = palloc(sizeof(int16) * (natts + 1));
+  bool* commented = thrift_record_comment_ids(relid, natts, field_ids);
+  bool changed = false;
+  for (int i = 0; i < info->ncolumns && !changed; i++) {
+    ThriftRecordColumn* column = &info->columns[i];
+    int attno = column->attno;
+    changed = commented[attno] != column->commented || (commented[attno] && field_ids[attno] != column->field_id);
+  }
+  pfree(commented);
+  pfree(field_ids);
+  return changed;
+}
+
+/*
+ * Field id of every column of a composite type. A column comment which is
+ * an integer gives the field id, other columns take the id of the field
+ * of the same name in the struct registered under the name of the type.
+ * Names are compared case insensitively since unquoted SQL names are
+ * folded to lower case.
+ */
+ThriftRecordInfo* thrift_record_info(FunctionCallInfo fcinfo, Oid typid) {
+  TypeCacheEntry* typentry = lookup_type_cache(typid, TYPECACHE_TUPDESC);
+  if (typentry->tupDesc == NULL) {
+    elog(ERROR, "Type %s is not a composite type", format_type_be(typid));
+  }
+  if (record_cache == NULL) {
+    HASHCTL ctl;
+    memset(&ctl, 0, sizeof(HASHCTL));
+    ctl.keysize = sizeof(Oid);
+    ctl.entrysize = sizeof(ThriftRecordInfo);
+    ctl.hcxt = CacheMemoryContext;
+    record_cache = hash_create("pg_thrift record cache", 16, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    RegisterXactCallback(thrift_record_cache_xact_callback, NULL);
+  }
+  Oid relid = get_typ_typrelid(typid);
+  bool found;
+  ThriftRecordInfo* info = (ThriftRecordInfo*)hash_search(record_cache, &typid, HASH_ENTER, &found);
+  if (found && info->tupdesc_id != 0 && info->tupdesc_id == typentry->tupDesc_identifier) {
+    if (info->checked_xact == record_cache_xact) {
+      return info;
+    }
+    if (!thrift_record_comments_changed(info, relid)) {
+      info->checked_xact = record_cache_xact;
+      return info;
+    }
+  }
+  if (found && info->columns != NULL) {
+    pfree(info->columns);
+    FreeTupleDesc(info->tupdesc);
+  }
+  info->tupdesc_id = 0;
+  info->tupdesc = NULL;
+  info->columns = NULL;
+  info->ncolumns = 0;
+
+  TupleDesc tupdesc = typentry->tupDesc;
+  ThriftRecordColumn* columns = palloc0(sizeof(ThriftRecordColumn) * (tupdesc->natts + 1));
+  int ncolumns = 0;
+  int nnames = -1;
+  char** names = NULL;
+  int16* name_ids = NULL;
+  int16* comment_ids = palloc(sizeof(int16) * (tupdesc->natts + 1));
+  bool* commented = thrift_record_comment_ids(relid, tupdesc->natts, comment_ids);
+  for (int i = 0; i < tupdesc->natts; i++) {
+    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+    if (attr->attisdropped) {
+      continue;
+    }
+    ThriftRecordColumn* column = &columns[ncolumns++];
+    column->attno = i;
+    column->typid = attr->atttypid;
+    column->element_type = get_element_type(attr->atttypid);
+    if (type_is_rowtype(attr->atttypid)) {
+      column->record_type = attr->atttypid;
+    } else if (column->element_type != InvalidOid && column->typid != BYTEAARRAYOID) {
+      column->element_type_id = thrift_array_element_type(column->element_type);
+      if (column->element_type_id == PG_THRIFT_BINARY_STRUCT) {
+        column->record_type = column->element_type;
+      }
+    }
+
+    if (commented[i]) {
+      column->field_id = comment_ids[i];
+      column->commented = true;
+      continue;
+    }
+
+    if (nnames < 0) {
+      // fields of the struct named like the type, read once per type
+      char* table = thrift_schema_table(fcinfo, "thrift_schema_field");
+      thrift_registry_watch(fcinfo);
+      MemoryContext caller = CurrentMemoryContext;
+      if (SPI_connect() != SPI_OK_CONNECT) {
+        elog(ERROR, "Could not connect to SPI");
+      }
+      Oid argtypes[1] = {TEXTOID};
+      Datum values[1] = {CStringGetTextDatum(get_rel_name(relid))};
+      char* sql = psprintf("SELECT field_name, field_id FROM %s WHERE lower(struct_name) = lower($1)", table);
+      if (SPI_execute_with_args(sql, 1, argtypes, values, NULL, true, 0) != SPI_OK_SELECT) {
+        elog(ERROR, "Could not look up thrift fields of %s", format_type_be(typid));
+      }
+      nnames = SPI_processed;
+      names = MemoryContextAlloc(caller, sizeof(char*) * (nnames + 1));
+      name_ids = MemoryContextAlloc(caller, sizeof(int16) * (nnames + 1));
+      for (int j = 0; j < nnames; j++) {
+        names[j] = MemoryContextStrdup(caller, SPI_getvalue(SPI_tuptable->vals[j], SPI_tuptable->tupdesc, 1));
+        name_ids[j] = atoi(SPI_getvalue(SPI_tuptable->vals[j], SPI_tuptable->tupdesc, 2));
+      }
+      SPI_finish();
+    }
+    bool named = false;
+    for (int j = 0; j < nnames; j++) {
+      if (pg_strcasecmp(names[j], NameStr(attr->attname)) != 0) {
+        continue;
+      }
+      if (named && column->field_id != name_ids[j]) {
+        elog(ERROR, "Thrift field %s of %s has different ids in several schemas, set the id as column comment",
+             NameStr(attr->attname), format_type_be(typid));
+      }
+      column->field_id = name_ids[j];
+      named = true;
+    }
+    if (!named) {
+      elog(ERROR, "No thrift field id for column %s of %s, set it as column comment or register a struct named %s",
+           NameStr(attr->attname), format_type_be(typid), get_rel_name(relid));
+    }
+  }
+
+  qsort(columns, ncolumns, sizeof(ThriftRecordColumn), thrift_record_column_cmp);
+  for (int i = 1; i < ncolumns; i++) {
+    if (columns[i].field_id == columns[i - 1].field_id) {
+      elog(ERROR, "Thrift field %d is mapped to several columns of %s", columns[i].field_id, format_type_be(typid));
+    }
+  }
+  MemoryContext old = MemoryContextSwitchTo(CacheMemoryContext);
+  info->tupdesc = CreateTupleDescCopy(tupdesc);
+  info->columns = palloc(sizeof(ThriftRecordColumn) * (ncolumns + 1));
+  memcpy(info->columns, columns, sizeof(ThriftRecordColumn) * ncolumns);
+  MemoryContextSwitchTo(old);
+  info->ncolumns = ncolumns;
+  info->tupdesc_id = typentry->tupDesc_identifier;
+  info->checked_xact = record_cache_xact;
+  return info;
+}
+
+/*
+ * Fills the columns of typid from the fields of the struct at start in a
+ * single walk. Columns without a field keep their value from base, or
+ * are null without one.
+ */
+Datum thrift_populate_struct(FunctionCallInfo fcinfo, Oid typid, bool compact, uint8* start, uint8* end, HeapTupleHeader base) {
+  ThriftRecordInfo* info = thrift_record_info(fcinfo, typid);
+  TupleDesc tupdesc = info->tupdesc;
+  Datum* values = palloc0(sizeof(Datum) * (tupdesc->natts + 1));
+  bool* nulls = palloc(sizeof(bool) * (tupdesc->natts + 1));
+  memset(nulls, true, sizeof(bool) * (tupdesc->natts + 1));
+  if (base != NULL) {
+    HeapTupleData tuple;
+    tuple.t_len = HeapTupleHeaderGetDatumLength(base);
+    ItemPointerSetInvalid(&tuple.t_self);
+    tuple.t_tableOid = InvalidOid;
+    tuple.t_data = base;
+    heap_deform_tuple(&tuple, tupdesc, values, nulls);
+  }
+
+  int16 current_field_id = 0;
+  while (start < end && *start != 0) {
+    uint8 type_id;
+    uint8 parsed_type_id = 0;
+    if (compact) {
+      uint8 field_delta = (*start >> 4) & 0x0f;
+      parsed_type_id = *start & 0x0f;
+      if (field_delta != 0) {
+        current_field_id += field_delta;
+        start += PG_THRIFT_TYPE_LEN;
+      } else {
+        current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+        start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+      }
+      type_id = compact_type_to_binary_type(parsed_type_id);
+    } else {
+      type_id = *start;
+      current_field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, FIELD_LEN);
+      start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+    }
+    ThriftRecordColumn key;
+    key.field_id = current_field_id;
+    ThriftRecordColumn* column = bsearch(&key, info->columns, info->ncolumns, sizeof(ThriftRecordColumn), thrift_record_column_cmp);
+    if (column != NULL) {
+      values[column->attno] = thrift_populate_value(fcinfo, column, compact, start, end, type_id, parsed_type_id);
+      nulls[column->attno] = false;
+    }
+    start = compact ? skip_compact_struct_field(start, end, parsed_type_id) : skip_binary_field(start, end, type_id);
+  }
+  return HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+}
+
+// type_id uses binary type ids, parsed_type_id is the compact one
+Datum thrift_populate_value(FunctionCallInfo fcinfo, ThriftRecordColumn* column, bool compact, uint8* start, uint8* end, uint8 type_id, uint8 parsed_type_id) {
+  if (column->record_type != InvalidOid && column->element_type == InvalidOid) {
+    if (type_id != PG_THRIFT_BINARY_STRUCT) {
+      elog(ERROR, "Type of thrift field %d does not match column type", column->field_id);
+    }
+    return thrift_populate_struct(fcinfo, column->record_type, compact, start, end, NULL);
+  }
+  if (column->element_type_id != 0) {
+    if (type_id != PG_THRIFT_BINARY_LIST && type_id != PG_THRIFT_BINARY_SET) {
+      elog(ERROR, "Type of thrift field %d does not match column type", column->field_id);
+    }
+    return thrift_populate_list(fcinfo, column, compact, start, end);
+  }
+  if (!field_matches_column(type_id, column->typid)) {
+    elog(ERROR, "Type of thrift field %d does not match column type", column->field_id);
+  }
+  if (compact && type_id == PG_THRIFT_BINARY_BOOL) {
+    return BoolGetDatum(parsed_type_id == 1);
+  }
+  Datum value = compact ? parse_compact_field(start, end, parsed_type_id) : parse_binary_value(start, end, type_id);
+  return field_to_column(value, type_id, column->typid);
+}
+
+// lists of scalars go through the list decoders, lists of structs are
+// filled element by element
+Datum thrift_populate_list(FunctionCallInfo fcinfo, ThriftRecordColumn* column, bool compact, uint8* start, uint8* end) {
+  if (column->record_type == InvalidOid) {
+    if (compact) {
+      return parse_thrift_compact_list_internal(start, end, column->element_type_id, column->element_type);
+    }
+    return parse_thrift_binary_list_internal(start, end, column->element_type_id, column->element_type);
+  }
+
+  uint8 element_type_id;
+  int64 len;
+  uint8* curr;
+  if (compact) {
+    if (start >= end) {
+      elog(ERROR, "Invalid thrift compact format for list");
+    }
+    element_type_id = *start & 0x0f;
+    len = (*start & 0xf0) >> 4;
+    curr = start + PG_THRIFT_TYPE_LEN;
+    if (len == 0xf) {
+      int64 size_len = 0;
+      len = parse_varint_helper(curr, end, &size_len);
+      curr += size_len;
+    }
+  } else {
+    if (start + PG_THRIFT_TYPE_LEN + LIST_LEN - 1 >= end) {
+      elog(ERROR, "Invalid thrift binary format for list");
+    }
+    element_type_id = *start;
+    len = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, LIST_LEN);
+    curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
+  }
+  if (len < 0 || len > end - curr) {
+    elog(ERROR, compact ? "Invalid thrift compact format for list" : "Invalid thrift binary format for list");
+  }
+  if (len > 0 && element_type_id != PG_THRIFT_BINARY_STRUCT) {
+    elog(ERROR, "Type of thrift field %d does not match column type", column->field_id);
+  }
+  Datum* elements = palloc(sizeof(Datum) * (len + 1));
+  for (int64 i = 0; i < len; i++) {
+    elements[i] = thrift_populate_struct(fcinfo, column->record_type, compact, curr, end, NULL);
+    curr = compact ? skip_compact_field(curr, end, PG_THRIFT_COMPACT_STRUCT) : skip_binary_field(curr, end, PG_THRIFT_BINARY_STRUCT);
+  }
+  return element_array(elements, len, column->element_type);
+}
+
+/*
+ * NOTE: like jsonb_populate_record the first argument only gives the row
+ * type when it is null, e.g. thrift_binary_populate_record(null::event, x),
+ * otherwise fields missing from the struct keep its column values
+ */
+Datum thrift_populate_record(FunctionCallInfo fcinfo, bool compact) {
+  Oid typid = get_fn_expr_argtype(fcinfo->flinfo, 0);
+  if (PG_ARGISNULL(1)) {
+    if (PG_ARGISNULL(0)) {
+      PG_RETURN_NULL();
+    }
+    PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+  }
+  HeapTupleHeader base = PG_ARGISNULL(0) ? NULL : PG_GETARG_HEAPTUPLEHEADER(0);
+  bytea* thrift_bytea = PG_GETARG_BYTEA_PP(1);
+  uint8* data = (uint8*)VARDATA_ANY(thrift_bytea);
+  return thrift_populate_struct(fcinfo, typid, compact, data, data + VARSIZE_ANY_EXHDR(thrift_bytea), base);
+}
+
+Datum thrift_binary_populate_record(PG_FUNCTION_ARGS) {
+  return thrift_populate_record(fcinfo, false);
+}
+
+Datum thrift_compact_populate_record(PG_FUNCTION_ARGS) {
+  return thrift_populate_record(fcinfo, true);
+}
+
+// containers are walked member by member, sets like lists, scalars are 0
+uint8 thrift_value_kind(bool compact, ThriftPathCursor* value) {
+  uint8 type_id = compact ? compact_type_to_binary_type(value->type_id) : value->type_id;
+  if (type_id == PG_THRIFT_BINARY_SET) {
+    return PG_THRIFT_BINARY_LIST;
+  }
+  if (type_id == PG_THRIFT_BINARY_STRUCT || type_id == PG_THRIFT_BINARY_LIST || type_id == PG_THRIFT_BINARY_MAP) {
+    return type_id;
+  }
+  return 0;
+}
+
+bool thrift_members_init(ThriftMemberIterator* it, bool compact, ThriftPathCursor* value, uint8* end) {
+  it->compact = compact;
+  it->kind = thrift_value_kind(compact, value);
+  it->curr = value->start;
+  it->end = end;
+  it->remaining = 0;
+  it->field_id = 0;
+  if (it->kind == PG_THRIFT_BINARY_LIST) {
+    uint8* start = value->start;
+    if (start >= end) {
+      elog(ERROR, compact ? "Invalid thrift compact format for list" : "Invalid thrift binary format for list");
+    }
+    if (compact) {
+      it->remaining = (*start & 0xf0) >> 4;
+      it->curr = start + PG_THRIFT_TYPE_LEN;
+      if (it->remaining == 0x0f) {
+        int64 len_length = 0;
+        it->remaining = parse_varint_helper(it->curr, end, &len_length);
+        it->curr += len_length;
+      }
+      if (it->remaining > 0) {
+        it->value_type = compact_list_type_to_struct_type(*start & 0x0f);
+      }
+    } else {
+      it->value_type = *start;
+      it->remaining = parse_int_helper(start + PG_THRIFT_TYPE_LEN, end, LIST_LEN);
+      it->curr = start + PG_THRIFT_TYPE_LEN + LIST_LEN;
+    }
+    if (it->remaining < 0 || it->remaining > end - it->curr) {
+      elog(ERROR, compact ? "Invalid thrift compact format for list" : "Invalid thrift binary format for list");
+    }
+  } else if (it->kind == PG_THRIFT_BINARY_MAP) {
+    it->curr = thrift_map_header(compact, value->start, end, &it->key_type, &it->value_type, &it->remaining);
+  }
+  return it->kind != 0;
+}
+
+// step gets the field id of a struct member or the key of a map member
+bool thrift_members_next(ThriftMemberIterator* it, ThriftPathCursor* member, StringInfo step) {
+  resetStringInfo(step);
+  if (it->kind == PG_THRIFT_BINARY_STRUCT) {
+    uint8* start = it->curr;
+    if (start >= it->end || *start == 0) {
+      return false;
+    }
+    uint8 type_id;
+    if (it->compact) {
+      uint8 field_delta = (*start >> 4) & 0x0f;
+      type_id = *start & 0x0f;
+      if (field_delta != 0) {
+        it->field_id += field_delta;
+        start += PG_THRIFT_TYPE_LEN;
+      } else {
+        it->field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, it->end, FIELD_LEN);
+        start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+      }
+    } else {
+      type_id = *start;
+      it->field_id = parse_int_helper(start + PG_THRIFT_TYPE_LEN, it->end, FIELD_LEN);
+      start += PG_THRIFT_TYPE_LEN + PG_THRIFT_FIELD_LEN;
+    }
+    member->start = start;
+    member->type_id = type_id;
+    member->element = false;
+    appendStringInfo(step, "%d", it->field_id);
+    it->curr = it->compact ? skip_compact_struct_field(start, it->end, type_id) : skip_binary_field(start, it->end, type_id);
+    return true;
+  }
+
+  if (it->remaining <= 0) {
+    return false;
+  }
+  it->remaining -= 1;
+  if (it->kind == PG_THRIFT_BINARY_MAP) {
+    ThriftPathCursor key;
+    key.start = it->curr;
+    key.type_id = it->key_type;
+    key.element = true;
+    thrift_scalar_text(it->compact, &key, it->end, false, step);
+    it->curr = it->compact ? skip_compact_field(it->curr, it->end, it->key_type) : skip_binary_field(it->curr, it->end, it->key_type);
+  }
+  member->start = it->curr;
+  member->type_id = it->value_type;
+  member->element = true;
+  it->curr = it->compact ? skip_compact_field(it->curr, it->end, it->value_type) : skip_binary_field(it->curr, it->end, it->value_type);
+  return true;
+}
+
+// integral doubles print like integers, so that 2, 2.0 and a double 2
+// compare equal the way jsonb numbers do
+void thrift_number_text(StringInfo buf, float8 value) {
+  if (!isinf(value) && !isnan(value) && value == floor(value) && fabs(value) < 9.2e18) {
+    appendStringInfo(buf, "%lld", (long long)value);
+  } else {
+    appendStringInfo(buf, "%.17g", value);
+  }
+}
+
+/*
+ * Canonical text of a scalar for containment and GIN keys. With tag it
+ * starts with the kind of the scalar, so that 1, "1" and true differ.
+ * Returns false for structs and containers.
+ */
+bool thrift_scalar_text(bool compact, ThriftPathCursor* value, uint8* end, bool tag, StringInfo buf) {
+  uint8* start = value->start;
+  uint8 type_id = compact ? compact_type_to_binary_type(value->type_id) : value->type_id;
+  if (type_id == PG_THRIFT_BINARY_BOOL) {
+    bool b;
+    if (compact && !value->element) {
+      b = value->type_id == 1;
+    } else if (compact) {
+      if (start >= end) {
+        elog(ERROR, "Invalid thrift compact format for bool");
+      }
+      b = *start == 1;
+    } else {
+      b = DatumGetBool(parse_thrift_binary_boolean_internal(start, end));
+    }
+    appendStringInfoString(buf, tag ? (b ? "btrue" : "bfalse") : (b ? "true" : "false"));
+    return true;
+  }
+
+  ThriftNumber number;
+  if (thrift_value_number(compact, value, end, &number)) {
+    if (tag) {
+      appendStringInfoChar(buf, 'n');
+    }
+    if (number.is_double) {
+      thrift_number_text(buf, number.d);
+    } else {
+      appendStringInfo(buf, "%lld", (long long)number.i);
+    }
+    return true;
+  }
+
+  if (type_id == PG_THRIFT_BINARY_STRING || type_id == PG_THRIFT_BINARY_BYTE) {
+    bytea* bytes = DatumGetByteaPP(compact ? parse_compact_field(start, end, value->type_id) : parse_binary_value(start, end, type_id));
+    if (tag) {
+      appendStringInfoChar(buf, 's');
+    }
+    appendBinaryStringInfo(buf, VARDATA_ANY(bytes), VARSIZE_ANY_EXHDR(bytes));
+    return true;
+  }
+  return false;
+}
+
+void thrift_jsonb_scalar_text(JsonbValue* value, bool tag, StringInfo buf) {
+  if (value->type == jbvBool) {
+    appendStringInfoString(buf, tag ? (value->val.boolean ? "btrue" : "bfalse") : (value->val.boolean ? "true" : "false"));
+  } else if (value->type == jbvString) {
+    if (tag) {
+      appendStringInfoChar(buf, 's');
+    }
+    appendBinaryStringInfo(buf, value->val.string.val, value->val.string.len);
+  } else if (value->type == jbvNumeric) {
+    if (tag) {
+      appendStringInfoChar(buf, 'n');
+    }
+    char* number = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(value->val.numeric)));
+    if (strpbrk(number, ".eE") == NULL) {
+      appendStringInfoString(buf, number);
+    } else {
+      thrift_number_text(buf, DatumGetFloat8(DirectFunctionCall1(numeric_float8, NumericGetDatum(value->val.numeric))));
+    }
+  } else {
+    // thrift has no nulls, a null never matches
+    appendStringInfoString(buf, tag ? "z" : "null");
+  }
+}
+
+/*
+ * Whether the value contains the query, both thrift values: structs
+ * and maps contain the members of the query, lists and sets have every
+ * query element contained by one of theirs, and scalars are equal.
+ */
+bool thrift_contains_thrift(bool compact, ThriftPathCursor* value, uint8* end, bool query_compact, ThriftPathCursor* query, uint8* query_end) {
+  ThriftMemberIterator query_members;
+  if (!thrift_members_init(&query_members, query_compact, query, query_end)) {
+    StringInfoData text, query_text;
+    initStringInfo(&text);
+    initStringInfo(&query_text);
+    return thrift_scalar_text(compact, value, end, true, &text) &&
+      thrift_scalar_text(query_compact, query, query_end, true, &query_text) &&
+      text.len == query_text.len && memcmp(text.data, query_text.data, text.len) == 0;
+  }
+  ThriftMemberIterator members;
+  if (!thrift_members_init(&members, compact, value, end) || members.kind != query_members.kind) {
+    return false;
+  }
+  ThriftPathCursor member, query_member;
+  StringInfoData step, query_step;
+  initStringInfo(&step);
+  initStringInfo(&query_step);
+  while (thrift_members_next(&query_members, &query_member, &query_step)) {
+    bool found = false;
+    thrift_members_init(&members, compact, value, end);
+    while (!found && thrift_members_next(&members, &member, &step)) {
+      if (members.kind != PG_THRIFT_BINARY_LIST && (step.len != query_step.len || memcmp(step.data, query_step.data, step.len) != 0)) {
+        continue;
+      }
+      found = thrift_contains_thrift(compact, &member, end, query_compact, &query_member, query_end);
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Same as thrift_contains_thrift with a jsonb query. Object keys are
+ * field ids for structs and keys for maps, arrays match lists and sets.
+ */
+bool thrift_contains_jsonb(bool compact, ThriftPathCursor* value, uint8* end, JsonbValue* query) {
+  if (query->type != jbvBinary) {
+    StringInfoData text, query_text;
+    initStringInfo(&text);
+    initStringInfo(&query_text);
+    thrift_jsonb_scalar_text(query, true, &query_text);
+    return thrift_scalar_text(compact, value, end, true, &text) &&
+      text.len == query_text.len && memcmp(text.data, query_text.data, text.len) == 0;
+  }
+  ThriftMemberIterator members;
+  if (!thrift_members_init(&members, compact, value, end)) {
+    return false;
+  }
+  JsonbIterator* it = JsonbIteratorInit(query->val.binary.data);
+  JsonbValue v, key;
+  JsonbIteratorToken r = JsonbIteratorNext(&it, &v, true);
+  if ((r == WJB_BEGIN_OBJECT) == (members.kind == PG_THRIFT_BINARY_LIST)) {
+    return false;
+  }
+  ThriftPathCursor member;
+  StringInfoData step;
+  initStringInfo(&step);
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r == WJB_KEY) {
+      key = v;
+      continue;
+    }
+    if (r != WJB_VALUE && r != WJB_ELEM) {
+      continue;
+    }
+    bool found = false;
+    thrift_members_init(&members, compact, value, end);
+    while (!found && thrift_members_next(&members, &member, &step)) {
+      if (r == WJB_VALUE && (step.len != key.val.string.len || memcmp(step.data, key.val.string.val, step.len) != 0)) {
+        continue;
+      }
+      found = thrift_contains_jsonb(compact, &member, end, &v);
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// top level value of a thrift_binary (type byte first) or thrift_indexed
+bool thrift_datum_root(Datum datum, bool indexed, bool* compact, ThriftPathCursor* root, uint8** end) {
+  root->element = false;
+  if (indexed) {
+    ThriftIndexed* value = DatumGetThriftIndexedP(datum);
+    *compact = value->protocol == PG_THRIFT_INDEXED_COMPACT;
+    root->start = THRIFT_INDEXED_PAYLOAD(value);
+    root->type_id = PG_THRIFT_BINARY_STRUCT;
+    *end = root->start + THRIFT_INDEXED_PAYLOAD_SIZE(value);
+    return true;
+  }
+  bytea* value = DatumGetByteaPP(datum);
+  uint8* start = (uint8*)VARDATA_ANY(value);
+  *compact = false;
+  *end = start + VARSIZE_ANY_EXHDR(value);
+  if (start >= *end) {
+    return false;
+  }
+  root->start = start + PG_THRIFT_TYPE_LEN;
+  root->type_id = *start;
+  return true;
+}
+
+void thrift_jsonb_root(Jsonb* jsonb, JsonbValue* root) {
+  root->type = jbvBinary;
+  root->val.binary.data = &jsonb->root;
+  root->val.binary.len = VARSIZE(jsonb) - VARHDRSZ;
+}
+
+Datum thrift_binary_contains(PG_FUNCTION_ARGS) {
+  bool compact, query_compact;
+  ThriftPathCursor value, query;
+  uint8 *end, *query_end;
+  if (!thrift_datum_root(PG_GETARG_DATUM(1), false, &query_compact, &query, &query_end)) {
+    PG_RETURN_BOOL(true);
+  }
+  if (!thrift_datum_root(PG_GETARG_DATUM(0), false, &compact, &value, &end)) {
+    PG_RETURN_BOOL(false);
+  }
+  PG_RETURN_BOOL(thrift_contains_thrift(compact, &value, end, query_compact, &query, query_end));
+}
+
+Datum thrift_binary_contains_jsonb(PG_FUNCTION_ARGS) {
+  bool compact;
+  ThriftPathCursor value;
+  uint8* end;
+  JsonbValue query;
+#if PG_VERSION_NUM < 110000
+  thrift_jsonb_root(PG_GETARG_JSONB(1), &query);
+#else
+  thrift_jsonb_root(PG_GETARG_JSONB_P(1), &query);
+#endif
+  if (!thrift_datum_root(PG_GETARG_DATUM(0), false, &compact, &value, &end)) {
+    PG_RETURN_BOOL(false);
+  }
+  PG_RETURN_BOOL(thrift_contains_jsonb(compact, &value, end, &query));
+}
+
+Datum thrift_indexed_contains(PG_FUNCTION_ARGS) {
+  bool compact, query_compact;
+  ThriftPathCursor value, query;
+  uint8 *end, *query_end;
+  thrift_datum_root(PG_GETARG_DATUM(0), true, &compact, &value, &end);
+  thrift_datum_root(PG_GETARG_DATUM(1), true, &query_compact, &query, &query_end);
+  PG_RETURN_BOOL(thrift_contains_thrift(compact, &value, end, query_compact, &query, query_end));
+}
+
+Datum thrift_indexed_contains_jsonb(PG_FUNCTION_ARGS) {
+  bool compact;
+  ThriftPathCursor value;
+  uint8* end;
+  JsonbValue query;
+#if PG_VERSION_NUM < 110000
+  thrift_jsonb_root(PG_GETARG_JSONB(1), &query);
+#else
+  thrift_jsonb_root(PG_GETARG_JSONB_P(1), &query);
+#endif
+  thrift_datum_root(PG_GETARG_DATUM(0), true, &compact, &value, &end);
+  PG_RETURN_BOOL(thrift_contains_jsonb(compact, &value, end, &query));
+}
+
+// like jsonb_path_ops, list and set elements add nothing to the path
+uint32 thrift_gin_hash(uint32 hash, const char* data, int len) {
+  hash = (hash << 1) | (hash >> 31);
+  return hash ^ DatumGetUInt32(hash_any((const unsigned char*)data, len));
+}
+
+void thrift_gin_add_key(ThriftGinKeys* keys, uint32 hash) {
+  if (keys->n == keys->capacity) {
+    keys->capacity = keys->capacity == 0 ? 16 : keys->capacity * 2;
+    keys->keys = keys->keys == NULL ? palloc(sizeof(Datum) * keys->capacity) : repalloc(keys->keys, sizeof(Datum) * keys->capacity);
+  }
+  keys->keys[keys->n++] = UInt32GetDatum(hash);
+}
+
+void thrift_gin_extract(bool compact, ThriftPathCursor* value, uint8* end, uint32 hash, ThriftGinKeys* keys) {
+  ThriftMemberIterator members;
+  StringInfoData buf;
+  initStringInfo(&buf);
+  if (!thrift_members_init(&members, compact, value, end)) {
+    if (thrift_scalar_text(compact, value, end, true, &buf)) {
+      thrift_gin_add_key(keys, thrift_gin_hash(hash, buf.data, buf.len));
+    }
+    return;
+  }
+  ThriftPathCursor member;
+  while (thrift_members_next(&members, &member, &buf)) {
+    uint32 member_hash = members.kind == PG_THRIFT_BINARY_LIST ? hash : thrift_gin_hash(hash, buf.data, buf.len);
+    thrift_gin_extract(compact, &member, end, member_hash, keys);
+  }
+}
+
+void thrift_gin_extract_jsonb(JsonbValue* query, uint32 hash, ThriftGinKeys* keys) {
+  if (query->type != jbvBinary) {
+    StringInfoData buf;
+    initStringInfo(&buf);
+    thrift_jsonb_scalar_text(query, true, &buf);
+    thrift_gin_add_key(keys, thrift_gin_hash(hash, buf.data, buf.len));
+    return;
+  }
+  JsonbIterator* it = JsonbIteratorInit(query->val.binary.data);
+  JsonbValue v, key;
+  JsonbIteratorToken r;
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r == WJB_KEY) {
+      key = v;
+    } else if (r == WJB_VALUE) {
+      thrift_gin_extract_jsonb(&v, thrift_gin_hash(hash, key.val.string.val, key.val.string.len), keys);
+    } else if (r == WJB_ELEM) {
+      thrift_gin_extract_jsonb(&v, hash, keys);
+    }
+  }
+}
+
+Datum thrift_binary_gin_extract_value(PG_FUNCTION_ARGS) {
+  int32* nentries = (int32*)PG_GETARG_POINTER(1);
+  bool compact;
+  ThriftPathCursor value;
+  uint8* end;
+  ThriftGinKeys keys = {NULL, 0, 0};
+  if (thrift_datum_root(PG_GETARG_DATUM(0), false, &compact, &value, &end)) {
+    thrift_gin_extract(compact, &value, end, 0, &keys);
+  }
+  *nentries = keys.n;
+  PG_RETURN_POINTER(keys.keys);
+}
+
+Datum thrift_indexed_gin_extract_value(PG_FUNCTION_ARGS) {
+  int32* nentries = (int32*)PG_GETARG_POINTER(1);
+  bool compact;
+  ThriftPathCursor value;
+  uint8* end;
+  ThriftGinKeys keys = {NULL, 0, 0};
+  thrift_datum_root(PG_GETARG_DATUM(0), true, &compact, &value, &end);
+  thrift_gin_extract(compact, &value, end, 0, &keys);
+  *nentries = keys.n;
+  PG_RETURN_POINTER(keys.keys);
+}
+
+// a query without scalars, like {}, is contained by every value
+Datum thrift_gin_extract_query(FunctionCallInfo fcinfo, bool indexed) {
+  int32* nentries = (int32*)PG_GETARG_POINTER(1);
+  StrategyNumber strategy = PG_GETARG_UINT16(2);
+  int32* search_mode = (int32*)PG_GETARG_POINTER(6);
+  ThriftGinKeys keys = {NULL, 0, 0};
+  if (strategy == THRIFT_GIN_CONTAINS_JSONB_STRATEGY) {
+    JsonbValue query;
+#if PG_VERSION_NUM < 110000
+    thrift_jsonb_root(PG_GETARG_JSONB(0), &query);
+#else
+    thrift_jsonb_root(PG_GETARG_JSONB_P(0), &query);
+#endif
+    thrift_gin_extract_jsonb(&query, 0, &keys);
+  } else if (strategy == THRIFT_GIN_CONTAINS_STRATEGY) {
+    bool compact;
+    ThriftPathCursor query;
+    uint8* end;
+    if (thrift_datum_root(PG_GETARG_DATUM(0), indexed, &compact, &query, &end)) {
+      thrift_gin_extract(compact, &query, end, 0, &keys);
+    }
+  } else {
+    elog(ERROR, "Unrecognized thrift GIN strategy number: %d", strategy);
+  }
+  *nentries = keys.n;
+  if (keys.n == 0) {
+    *search_mode = GIN_SEARCH_MODE_ALL;
+  }
+  PG_RETURN_POINTER(keys.keys);
+}
+
+Datum thrift_binary_gin_extract_query(PG_FUNCTION_ARGS) {
+  return thrift_gin_extract_query(fcinfo, false);
+}
+
+Datum thrift_indexed_gin_extract_query(PG_FUNCTION_ARGS) {
+  return thrift_gin_extract_query(fcinfo, true);
+}
+
+// keys are hashes, a row having all of them is only a candidate
+Datum thrift_gin_consistent(PG_FUNCTION_ARGS) {
+  bool* check = (bool*)PG_GETARG_POINTER(0);
+  int32 nkeys = PG_GETARG_INT32(3);
+  bool* recheck = (bool*)PG_GETARG_POINTER(5);
+  *recheck = true;
+  for (int32 i = 0; i < nkeys; i++) {
+    if (!check[i]) {
+      PG_RETURN_BOOL(false);
+    }
+  }
+  PG_RETURN_BOOL(true);
+}
+
+Datum thrift_gin_triconsistent(PG_FUNCTION_ARGS) {
+  GinTernaryValue* check = (GinTernaryValue*)PG_GETARG_POINTER(0);
+  int32 nkeys = PG_GETARG_INT32(3);
+  for (int32 i = 0; i < nkeys; i++) {
+    if (check[i] == GIN_FALSE) {
+      PG_RETURN_GIN_TERNARY_VALUE(GIN_FALSE);
+    }
+  }
+  PG_RETURN_GIN_TERNARY_VALUE(GIN_MAYBE);
+}
+
+// integer or double scalar, false for other types, doubles may be NaN
+bool thrift_value_number(bool compact, ThriftPathCursor* value, uint8* end, ThriftNumber* number) {
+  uint8* start = value->start;
+  uint8 type_id = compact ? compact_type_to_binary_type(value->type_id) : value->type_id;
+  number->is_double = false;
+  number->i = 0;
+  number->d = 0;
+  if (type_id == PG_THRIFT_BINARY_INT16 || type_id == PG_THRIFT_BINARY_INT32 || type_id == PG_THRIFT_BINARY_INT64) {
+    if (compact) {
+      int64 len_length = 0;
+      number->i = parse_varint_helper(start, end, &len_length);
+      if (start + len_length > end) {
+        elog(ERROR, "Invalid thrift compact format for int");
+      }
+    } else if (type_id == PG_THRIFT_BINARY_INT16) {
+      number->i = DatumGetInt16(parse_thrift_binary_int16_internal(start, end));
+    } else if (type_id == PG_THRIFT_BINARY_INT32) {
+      number->i = DatumGetInt32(parse_thrift_binary_int32_internal(start, end));
+    } else {
+      number->i = DatumGetInt64(parse_thrift_binary_int64_internal(start, end));
+    }
+    return true;
+  }
+  if (type_id == PG_THRIFT_BINARY_DOUBLE) {
+    number->is_double = true;
+    number->d = DatumGetFloat8(parse_thrift_binary_double_internal(start, end));
+    return true;
+  }
+  return false;
+}
+
+// integers compare exactly, an integer and a double compare as doubles
+int thrift_number_cmp(ThriftNumber* a, ThriftNumber* b) {
+  if (!a->is_double && !b->is_double) {
+    return (a->i > b->i) - (a->i < b->i);
+  }
+  float8 x = a->is_double ? a->d : (float8)a->i;
+  float8 y = b->is_double ? b->d : (float8)b->i;
+  return (x > y) - (x < y);
+}
+
+bool thrift_range_above_low(ThriftFieldRange* range, ThriftNumber* number) {
+  if (range->flags & THRIFT_RANGE_LOW_INF) {
+    return true;
+  }
+  int cmp = thrift_number_cmp(number, &range->low);
+  return cmp > 0 || (cmp == 0 && !(range->flags & THRIFT_RANGE_LOW_EXCLUSIVE));
+}
+
+bool thrift_range_below_high(ThriftFieldRange* range, ThriftNumber* number) {
+  if (range->flags & THRIFT_RANGE_HIGH_INF) {
+    return true;
+  }
+  int cmp = thrift_number_cmp(number, &range->high);
+  return cmp < 0 || (cmp == 0 && !(range->flags & THRIFT_RANGE_HIGH_EXCLUSIVE));
+}
+
+// an empty bound is unbounded, numbers without . or exponent are int64
+void thrift_range_parse_bound(char* bound, char* str, ThriftNumber* number, bool* inf) {
+  char* endptr;
+  while (isspace((unsigned char)*bound)) {
+    bound++;
+  }
+  int len = strlen(bound);
+  while (len > 0 && isspace((unsigned char)bound[len - 1])) {
+    bound[--len] = '\0';
+  }
+  number->is_double = false;
+  number->i = 0;
+  number->d = 0;
+  *inf = len == 0;
+  if (*inf) {
+    return;
+  }
+  errno = 0;
+  number->i = strtoll(bound, &endptr, 10);
+  if (*endptr == '\0' && errno == 0) {
+    return;
+  }
+  errno = 0;
+  number->is_double = true;
+  number->d = strtod(bound, &endptr);
+  if (*endptr != '\0' || isnan(number->d)) {
+    elog(ERROR, "Invalid thrift_field_range \"%s\"", str);
+  }
+}
+
+/*
+ * NOTE: range is a field id and an interval of its values, e.g. 5:[100,200)
+ * or 7:(,1.5], brackets include the bound and an empty bound is unbounded.
+ */
+Datum thrift_field_range_in(PG_FUNCTION_ARGS) {
+  char* str = PG_GETARG_CSTRING(0);
+  char* p = str;
+  ThriftFieldRange* range = palloc0(sizeof(ThriftFieldRange));
+  SET_VARSIZE(range, sizeof(ThriftFieldRange));
+  int64 field_id = thrift_path_parse_int(&p, str);
+  if (field_id < PG_INT16_MIN || field_id > PG_INT16_MAX) {
+    elog(ERROR, "Thrift field id out of range in thrift_field_range \"%s\"", str);
+  }
+  range->field_id = field_id;
+  if (*p++ != ':' || (*p != '[' && *p != '(')) {
+    elog(ERROR, "Invalid thrift_field_range \"%s\"", str);
+  }
+  if (*p++ == '(') {
+    range->flags |= THRIFT_RANGE_LOW_EXCLUSIVE;
+  }
+  char* comma = strchr(p, ',');
+  int len = strlen(p);
+  if (comma == NULL || len < 1 || (p[len - 1] != ']' && p[len - 1] != ')')) {
+    elog(ERROR, "Invalid thrift_field_range \"%s\"", str);
+  }
+  if (p[len - 1] == ')') {
+    range->flags |= THRIFT_RANGE_HIGH_EXCLUSIVE;
+  }
+  bool inf;
+  thrift_range_parse_bound(pnstrdup(p, comma - p), str, &range->low, &inf);
+  if (inf) {
+    range->flags |= THRIFT_RANGE_LOW_INF;
+  }
+  thrift_range_parse_bound(pnstrdup(comma + 1, p + len - 1 - (comma + 1)), str, &range->high, &inf);
+  if (inf) {
+    range->flags |= THRIFT_RANGE_HIGH_INF;
+  }
+  PG_RETURN_POINTER(range);
+}
+
+void thrift_range_bound_out(StringInfo buf, ThriftNumber* number) {
+  if (number->is_double) {
+    appendStringInfoString(buf, DatumGetCString(DirectFunctionCall1(float8out, Float8GetDatum(number->d))));
+  } else {
+    appendStringInfo(buf, "%lld", (long long)number->i);
+  }
+}
+
+Datum thrift_field_range_out(PG_FUNCTION_ARGS) {
+  ThriftFieldRange* range = PG_GETARG_THRIFT_FIELD_RANGE_P(0);
+  StringInfoData buf;
+  initStringInfo(&buf);
+  appendStringInfo(&buf, "%d:%c", range->field_id, (range->flags & THRIFT_RANGE_LOW_EXCLUSIVE) ? '(' : '[');
+  if (!(range->flags & THRIFT_RANGE_LOW_INF)) {
+    thrift_range_bound_out(&buf, &range->low);
+  }
+  appendStringInfoChar(&buf, ',');
+  if (!(range->flags & THRIFT_RANGE_HIGH_INF)) {
+    thrift_range_bound_out(&buf, &range->high);
+  }
+  appendStringInfoChar(&buf, (range->flags & THRIFT_RANGE_HIGH_EXCLUSIVE) ? ')' : ']');
+  PG_RETURN_CSTRING(buf.data);
+}
+
+// bounds are inclusive, a NULL bound is unbounded
+Datum thrift_field_range_make(FunctionCallInfo fcinfo, bool is_double) {
+  if (PG_ARGISNULL(0)) {
+    PG_RETURN_NULL();
+  }
+  int32 field_id = PG_GETARG_INT32(0);
+  if (field_id < PG_INT16_MIN || field_id > PG_INT16_MAX) {
+    elog(ERROR, "Thrift field id %d out of range", field_id);
+  }
+  ThriftFieldRange* range = palloc0(sizeof(ThriftFieldRange));
+  SET_VARSIZE(range, sizeof(ThriftFieldRange));
+  range->field_id = field_id;
+  range->low.is_double = range->high.is_double = is_double;
+  if (PG_ARGISNULL(1)) {
+    range->flags |= THRIFT_RANGE_LOW_INF;
+  } else if (is_double) {
+    range->low.d = PG_GETARG_FLOAT8(1);
+  } else {
+    range->low.i = PG_GETARG_INT64(1);
+  }
+  if (PG_ARGISNULL(2)) {
+    range->flags |= THRIFT_RANGE_HIGH_INF;
+  } else if (is_double) {
+    range->high.d = PG_GETARG_FLOAT8(2);
+  } else {
+    range->high.i = PG_GETARG_INT64(2);
+  }
+  if ((is_double && !(range->flags & THRIFT_RANGE_LOW_INF) && isnan(range->low.d)) ||
+      (is_double && !(range->flags & THRIFT_RANGE_HIGH_INF) && isnan(range->high.d))) {
+    elog(ERROR, "Bound of thrift_field_range must not be NaN");
+  }
+  PG_RETURN_POINTER(range);
+}
+
+Datum thrift_field_range_int(PG_FUNCTION_ARGS) {
+  return thrift_field_range_make(fcinfo, false);
+}
+
+Datum thrift_field_range_double(PG_FUNCTION_ARGS) {
+  return thrift_field_range_make(fcinfo, true);
+}
+
+// top level field of a thrift_binary struct or thrift_indexed value
+bool thrift_datum_field(Datum datum, bool indexed, int16 field_id, bool* compact, ThriftPathCursor* field, uint8** end) {
+  if (indexed) {
+    ThriftIndexed* value = DatumGetThriftIndexedP(datum);
+    ThriftIndexEntry* entry = thrift_indexed_find(value, field_id);
+    if (entry == NULL) {
+      return false;
+    }
+    *compact = value->protocol == PG_THRIFT_INDEXED_COMPACT;
+    field->start = THRIFT_INDEXED_PAYLOAD(value) + entry->offset;
+    field->type_id = entry->type_id;
+    field->element = false;
+    *end = THRIFT_INDEXED_PAYLOAD(value) + THRIFT_INDEXED_PAYLOAD_SIZE(value);
+    return true;
+  }
+  ThriftPathCursor root;
+  ThriftMemberIterator members;
+  StringInfoData step;
+  if (!thrift_datum_root(datum, false, compact, &root, end) || root.type_id != PG_THRIFT_BINARY_STRUCT) {
+    return false;
+  }
+  initStringInfo(&step);
+  thrift_members_init(&members, *compact, &root, *end);
+  while (thrift_members_next(&members, field, &step)) {
+    if (members.field_id == field_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// a missing field, a field of another type and NaN are never in range
+Datum thrift_in_range(FunctionCallInfo fcinfo, bool indexed) {
+  ThriftFieldRange* range = PG_GETARG_THRIFT_FIELD_RANGE_P(1);
+  bool compact;
+  ThriftPathCursor field;
+  uint8* end;
+  ThriftNumber number;
+  if (!thrift_datum_field(PG_GETARG_DATUM(0), indexed, range->field_id, &compact, &field, &end) ||
+      !thrift_value_number(compact, &field, end, &number) ||
+      (number.is_double && isnan(number.d))) {
+    PG_RETURN_BOOL(false);
+  }
+  PG_RETURN_BOOL(thrift_range_above_low(range, &number) && thrift_range_below_high(range, &number));
+}
+
+Datum thrift_binary_in_range(PG_FUNCTION_ARGS) {
+  return thrift_in_range(fcinfo, false);
+}
+
+Datum thrift_indexed_in_range(PG_FUNCTION_ARGS) {
+  return thrift_in_range(fcinfo, true);
+}
+
+int thrift_field_id_cmp(const void* a, const void* b) {
+  return *(const int16*)a - *(const int16*)b;
+}
+
+#if PG_VERSION_NUM >= 90500
+// sorted distinct field ids of the fields option, e.g. '1, 5'
+int thrift_brin_parse_fields(const char* value, int16* field_ids) {
+  char* p = (char*)value;
+  int nfields = 0;
+  while (*p != '\0') {
+    char* endptr;
+    errno = 0;
+    long field_id = strtol(p, &endptr, 10);
+    if (endptr == p || errno != 0 || field_id < PG_INT16_MIN || field_id > PG_INT16_MAX) {
+      elog(ERROR, "Invalid thrift field ids \"%s\"", value);
+    }
+    if (nfields == THRIFT_BRIN_MAX_FIELDS) {
+      elog(ERROR, "At most %d thrift fields can be summarized", THRIFT_BRIN_MAX_FIELDS);
+    }
+    field_ids[nfields++] = field_id;
+    p = endptr;
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == ',') {
+      p++;
+    } else if (*p != '\0') {
+      elog(ERROR, "Invalid thrift field ids \"%s\"", value);
+    }
+  }
+  qsort(field_ids, nfields, sizeof(int16), thrift_field_id_cmp);
+  int n = 0;
+  for (int i = 0; i < nfields; i++) {
+    if (n == 0 || field_ids[n - 1] != field_ids[i]) {
+      field_ids[n++] = field_ids[i];
+    }
+  }
+  return n;
+}
+
+void thrift_brin_validate_fields(const char* value) {
+  int16 field_ids[THRIFT_BRIN_MAX_FIELDS];
+  if (value != NULL) {
+    thrift_brin_parse_fields(value, field_ids);
+  }
+}
+
+// field ids given by the opclass options, -1 to summarize every field
+int thrift_brin_fields(FunctionCallInfo fcinfo, int16* field_ids) {
+#if PG_VERSION_NUM >= 130000
+  if (PG_HAS_OPCLASS_OPTIONS()) {
+    ThriftBrinOptions* options = (ThriftBrinOptions*)PG_GET_OPCLASS_OPTIONS();
+    char* fields = GET_STRING_RELOPTION(options, fields);
+    if (fields != NULL) {
+      return thrift_brin_parse_fields(fields, field_ids);
+    }
+  }
+#endif
+  return -1;
+}
+
+ThriftBrinField* thrift_brin_find(ThriftBrinSummary* summary, int16 field_id, int* pos) {
+  int low = 0, high = summary->nfields - 1;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    if (summary->fields[mid].field_id == field_id) {
+      *pos = mid;
+      return &summary->fields[mid];
+    }
+    if (summary->fields[mid].field_id < field_id) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  *pos = low;
+  return NULL;
+}
+
+/*
+ * Widens the bounds of a field of the summary to min and max. A new field
+ * makes the summary grow, past THRIFT_BRIN_MAX_FIELDS it is marked
+ * incomplete instead and the field is left out.
+ */
+ThriftBrinSummary* thrift_brin_summary_add(ThriftBrinSummary* summary, int16 field_id, ThriftNumber* min, ThriftNumber* max, bool* changed) {
+  int pos;
+  ThriftBrinField* field = thrift_brin_find(summary, field_id, &pos);
+  if (field != NULL) {
+    if (thrift_number_cmp(min, &field->min) < 0) {
+      field->min = *min;
+      *changed = true;
+    }
+    if (thrift_number_cmp(max, &field->max) > 0) {
+      field->max = *max;
+      *changed = true;
+    }
+    return summary;
+  }
+  if (summary->nfields == THRIFT_BRIN_MAX_FIELDS) {
+    if (!(summary->flags & THRIFT_BRIN_INCOMPLETE)) {
+      summary->flags |= THRIFT_BRIN_INCOMPLETE;
+      *changed = true;
+    }
+    return summary;
+  }
+  summary = repalloc(summary, THRIFT_BRIN_SUMMARY_SIZE(summary->nfields + 1));
+  SET_VARSIZE(summary, THRIFT_BRIN_SUMMARY_SIZE(summary->nfields + 1));
+  memmove(&summary->fields[pos + 1], &summary->fields[pos], (summary->nfields - pos) * sizeof(ThriftBrinField));
+  summary->fields[pos].field_id = field_id;
+  summary->fields[pos].min = *min;
+  summary->fields[pos].max = *max;
+  summary->nfields += 1;
+  *changed = true;
+  return summary;
+}
+
+// summary of the column as a palloc'd chunk which may be resized
+ThriftBrinSummary* thrift_brin_summary(BrinValues* column) {
+  if (column->bv_allnulls) {
+    ThriftBrinSummary* summary = palloc0(THRIFT_BRIN_SUMMARY_SIZE(0));
+    SET_VARSIZE(summary, THRIFT_BRIN_SUMMARY_SIZE(0));
+    column->bv_allnulls = false;
+    return summary;
+  }
+  Pointer stored = DatumGetPointer(column->bv_values[0]);
+  ThriftBrinSummary* summary = (ThriftBrinSummary*)PG_DETOAST_DATUM(column->bv_values[0]);
+  if ((Pointer)summary != stored) {
+    pfree(stored);
+  }
+  return summary;
+}
+
+Datum thrift_brin_opcinfo(PG_FUNCTION_ARGS) {
+  BrinOpcInfo* result = palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+  result->oi_nstored = 1;
+  result->oi_typcache[0] = lookup_type_cache(BYTEAOID, 0);
+  PG_RETURN_POINTER(result);
+}
+
+// the summary of a new range starts empty, rows without any of the
+// summarized fields leave it that way
+Datum thrift_brin_add_value(FunctionCallInfo fcinfo, bool indexed) {
+  BrinValues* column = (BrinValues*)PG_GETARG_POINTER(1);
+  Datum newval = PG_GETARG_DATUM(2);
+  bool isnull = PG_GETARG_BOOL(3);
+  if (isnull) {
+    if (column->bv_hasnulls) {
+      PG_RETURN_BOOL(false);
+    }
+    column->bv_hasnulls = true;
+    PG_RETURN_BOOL(true);
+  }
+
+  int16 field_ids[THRIFT_BRIN_MAX_FIELDS];
+  int nfields = thrift_brin_fields(fcinfo, field_ids);
+  bool changed = column->bv_allnulls;
+  ThriftBrinSummary* summary = thrift_brin_summary(column);
+  bool compact;
+  ThriftPathCursor root, field;
+  uint8* end;
+  ThriftMemberIterator members;
+  StringInfoData step;
+  ThriftNumber number;
+  initStringInfo(&step);
+  if (thrift_datum_root(newval, indexed, &compact, &root, &end) && root.type_id == PG_THRIFT_BINARY_STRUCT) {
+    thrift_members_init(&members, compact, &root, end);
+    while (thrift_members_next(&members, &field, &step)) {
+      if (nfields >= 0 && bsearch(&members.field_id, field_ids, nfields, sizeof(int16), thrift_field_id_cmp) == NULL) {
+        continue;
+      }
+      if (thrift_value_number(compact, &field, end, &number) && !(number.is_double && isnan(number.d))) {
+        summary = thrift_brin_summary_add(summary, members.field_id, &number, &number, &changed);
+      }
+    }
+  }
+  column->bv_values[0] = PointerGetDatum(summary);
+  PG_RETURN_BOOL(changed);
+}
+
+Datum thrift_binary_brin_add_value(PG_FUNCTION_ARGS) {
+  return thrift_brin_add_value(fcinfo, false);
+}
+
+Datum thrift_indexed_brin_add_value(PG_FUNCTION_ARGS) {
+  return thrift_brin_add_value(fcinfo, true);
+}
+
+/*
+ * A range can match when the bounds of the field overlap the query. A
+ * field missing from the summary was not seen in the range, unless it is
+ * not summarized at all or the summary is incomplete.
+ */
+Datum thrift_brin_consistent(PG_FUNCTION_ARGS) {
+  BrinValues* column = (BrinValues*)PG_GETARG_POINTER(1);
+  ScanKey key = (ScanKey)PG_GETARG_POINTER(2);
+  if (key->sk_flags & SK_ISNULL) {
+    if (key->sk_flags & SK_SEARCHNULL) {
+      PG_RETURN_BOOL(column->bv_allnulls || column->bv_hasnulls);
+    }
+    if (key->sk_flags & SK_SEARCHNOTNULL) {
+      PG_RETURN_BOOL(!column->bv_allnulls);
+    }
+    PG_RETURN_BOOL(false);
+  }
+  if (column->bv_allnulls) {
+    PG_RETURN_BOOL(false);
+  }
+  if (key->sk_strategy != THRIFT_BRIN_RANGE_STRATEGY) {
+    elog(ERROR, "Unrecognized thrift BRIN strategy number: %d", key->sk_strategy);
+  }
+
+  ThriftFieldRange* range = DatumGetThriftFieldRangeP(key->sk_argument);
+  ThriftBrinSummary* summary = (ThriftBrinSummary*)PG_DETOAST_DATUM(column->bv_values[0]);
+  int pos;
+  ThriftBrinField* field = thrift_brin_find(summary, range->field_id, &pos);
+  if (field == NULL) {
+    int16 field_ids[THRIFT_BRIN_MAX_FIELDS];
+    int nfields = thrift_brin_fields(fcinfo, field_ids);
+    if (summary->flags & THRIFT_BRIN_INCOMPLETE) {
+      PG_RETURN_BOOL(true);
+    }
+    PG_RETURN_BOOL(nfields >= 0 && bsearch(&range->field_id, field_ids, nfields, sizeof(int16), thrift_field_id_cmp) == NULL);
+  }
+  PG_RETURN_BOOL(thrift_range_above_low(range, &field->max) && thrift_range_below_high(range, &field->min));
+}
+
+Datum thrift_brin_union(PG_FUNCTION_ARGS) {
+  BrinValues* col_a = (BrinValues*)PG_GETARG_POINTER(1);
+  BrinValues* col_b = (BrinValues*)PG_GETARG_POINTER(2);
+  bool changed = false;
+  if (col_b->bv_hasnulls) {
+    col_a->bv_hasnulls = true;
+  }
+  if (col_b->bv_allnulls) {
+    PG_RETURN_VOID();
+  }
+  ThriftBrinSummary* summary = thrift_brin_summary(col_a);
+  ThriftBrinSummary* other = (ThriftBrinSummary*)PG_DETOAST_DATUM(col_b->bv_values[0]);
+  summary->flags |= other->flags;
+  for (int i = 0; i < other->nfields; i++) {
+    summary = thrift_brin_summary_add(summary, other->fields[i].field_id, &other->fields[i].min, &other->fields[i].max, &changed);
+  }
+  col_a->bv_values[0] = PointerGetDatum(summary);
+  PG_RETURN_VOID();
+}
+
+// fields = '1,5' limits the summary to those fields, needs PostgreSQL 13
+Datum thrift_brin_options(PG_FUNCTION_ARGS) {
+#if PG_VERSION_NUM >= 130000
+  local_relopts* relopts = (local_relopts*)PG_GETARG_POINTER(0);
+  init_local_reloptions(relopts, sizeof(ThriftBrinOptions));
+  add_local_string_reloption(relopts, "fields", "comma separated ids of the thrift fields to summarize",
+                             NULL, thrift_brin_validate_fields, NULL, offsetof(ThriftBrinOptions, fields));
+#else
+  elog(ERROR, "Options of thrift BRIN opclasses need PostgreSQL 13 or later");
+#endif
+  PG_RETURN_VOID();
+}
+#endif
+
+// top level field of the value in argument 1, false when either is missing
+bool thrift_agg_field(FunctionCallInfo fcinfo, bool compact, ThriftPathCursor* field, uint8** end) {
+  if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+    return false;
+  }
+  int32 field_id = PG_GETARG_INT32(2);
+  if (field_id < PG_INT16_MIN || field_id > PG_INT16_MAX) {
+    elog(ERROR, "Thrift field id %d out of range", field_id);
+  }
+  uint8* data;
+  Size size;
+  ThriftFieldTable* table = field_cache_datum(PG_GETARG_DATUM(1), compact, &data, &size);
+  ThriftFieldOffset* offset = field_table_find(table, data, size, field_id, NULL);
+  if (offset == NULL) {
+    return false;
+  }
+  field->start = data + offset->offset;
+  field->type_id = offset->type_id;
+  field->element = false;
+  *end = data + size;
+  return true;
+}
+
+/*
+ * Transition state in argument 0, updated in place. A new one is made in
+ * the per row context, the executor copies it into the aggregate context.
+ */
+void* thrift_agg_state(FunctionCallInfo fcinfo, Size size) {
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "Thrift aggregate function called in non-aggregate context");
+  }
+  if (PG_ARGISNULL(0)) {
+    bytea* state = palloc0(size);
+    SET_VARSIZE(state, size);
+    return state;
+  }
+  return PG_GETARG_BYTEA_P(0);
+}
+
+// the same state pointer tells the executor nothing changed
+Datum thrift_agg_keep(FunctionCallInfo fcinfo) {
+  if (PG_ARGISNULL(0)) {
+    PG_RETURN_NULL();
+  }
+  PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+}
+
+int64 thrift_agg_add(int64 a, int64 b) {
+  if ((b > 0 && a > PG_INT64_MAX - b) || (b < 0 && a < PG_INT64_MIN - b)) {
+    elog(ERROR, "bigint out of range");
+  }
+  return a + b;
+}
+
+void thrift_agg_minmax_add(ThriftAggState* state, ThriftNumber* min, ThriftNumber* max) {
+  if (!state->has_number || thrift_number_cmp(min, &state->min) < 0) {
+    state->min = *min;
+  }
+  if (!state->has_number || thrift_number_cmp(max, &state->max) > 0) {
+    state->max = *max;
+  }
+  state->has_number = true;
+}
+
+Datum thrift_count_present_trans(FunctionCallInfo fcinfo, bool compact) {
+  ThriftPathCursor field;
+  uint8* end;
+  if (!thrift_agg_field(fcinfo, compact, &field, &end)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  ThriftAggState* state = thrift_agg_state(fcinfo, sizeof(ThriftAggState));
+  state->field_id = PG_GETARG_INT32(2);
+  state->count += 1;
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_binary_count_present_trans(PG_FUNCTION_ARGS) {
+  return thrift_count_present_trans(fcinfo, false);
+}
+
+Datum thrift_compact_count_present_trans(PG_FUNCTION_ARGS) {
+  return thrift_count_present_trans(fcinfo, true);
+}
+
+Datum thrift_sum_int64_trans(FunctionCallInfo fcinfo, bool compact) {
+  ThriftPathCursor field;
+  uint8* end;
+  ThriftNumber number;
+  if (!thrift_agg_field(fcinfo, compact, &field, &end)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  if (!thrift_value_number(compact, &field, end, &number) || number.is_double) {
+    elog(ERROR, "Thrift field %d is not an integer", PG_GETARG_INT32(2));
+  }
+  ThriftAggState* state = thrift_agg_state(fcinfo, sizeof(ThriftAggState));
+  state->field_id = PG_GETARG_INT32(2);
+  state->count += 1;
+  state->sum = thrift_agg_add(state->sum, number.i);
+  state->has_number = true;
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_binary_sum_int64_trans(PG_FUNCTION_ARGS) {
+  return thrift_sum_int64_trans(fcinfo, false);
+}
+
+Datum thrift_compact_sum_int64_trans(PG_FUNCTION_ARGS) {
+  return thrift_sum_int64_trans(fcinfo, true);
+}
+
+// NaN is left out, as the BRIN summaries do
+Datum thrift_minmax_trans(FunctionCallInfo fcinfo, bool compact) {
+  ThriftPathCursor field;
+  uint8* end;
+  ThriftNumber number;
+  if (!thrift_agg_field(fcinfo, compact, &field, &end)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  if (!thrift_value_number(compact, &field, end, &number)) {
+    elog(ERROR, "Thrift field %d is not a number", PG_GETARG_INT32(2));
+  }
+  if (number.is_double && isnan(number.d)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  ThriftAggState* state = thrift_agg_state(fcinfo, sizeof(ThriftAggState));
+  state->field_id = PG_GETARG_INT32(2);
+  state->count += 1;
+  thrift_agg_minmax_add(state, &number, &number);
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_binary_minmax_trans(PG_FUNCTION_ARGS) {
+  return thrift_minmax_trans(fcinfo, false);
+}
+
+Datum thrift_compact_minmax_trans(PG_FUNCTION_ARGS) {
+  return thrift_minmax_trans(fcinfo, true);
+}
+
+// partial states of parallel workers are copied, a tuple only aligns them to int
+Datum thrift_agg_combine(PG_FUNCTION_ARGS) {
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "Thrift aggregate function called in non-aggregate context");
+  }
+  ThriftAggState* state = (ThriftAggState*)PG_GETARG_BYTEA_P(0);
+  ThriftAggState* other = (ThriftAggState*)PG_GETARG_BYTEA_P_COPY(1);
+  state->count += other->count;
+  state->sum = thrift_agg_add(state->sum, other->sum);
+  if (other->has_number) {
+    thrift_agg_minmax_add(state, &other->min, &other->max);
+  }
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_agg_count_final(PG_FUNCTION_ARGS) {
+  if (PG_ARGISNULL(0)) {
+    PG_RETURN_INT64(0);
+  }
+  ThriftAggState* state = (ThriftAggState*)PG_GETARG_BYTEA_P(0);
+  PG_RETURN_INT64(state->count);
+}
+
+Datum thrift_agg_sum_final(PG_FUNCTION_ARGS) {
+  ThriftAggState* state = (ThriftAggState*)PG_GETARG_BYTEA_P(0);
+  if (!state->has_number) {
+    PG_RETURN_NULL();
+  }
+  PG_RETURN_INT64(state->sum);
+}
+
+Datum thrift_agg_minmax_final(PG_FUNCTION_ARGS) {
+  ThriftAggState* state = (ThriftAggState*)PG_GETARG_BYTEA_P(0);
+  if (!state->has_number) {
+    PG_RETURN_NULL();
+  }
+  ThriftFieldRange* range = palloc0(sizeof(ThriftFieldRange));
+  SET_VARSIZE(range, sizeof(ThriftFieldRange));
+  range->field_id = state->field_id;
+  range->low = state->min;
+  range->high = state->max;
+  PG_RETURN_POINTER(range);
+}
+
+// numbers are bucketed as doubles like width_bucket does, NaN is left out
+Datum thrift_histogram_trans(FunctionCallInfo fcinfo, bool compact) {
+  if (PG_ARGISNULL(1)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  if (PG_ARGISNULL(3) || PG_ARGISNULL(4) || PG_ARGISNULL(5)) {
+    elog(ERROR, "Histogram bounds and bucket count must not be NULL");
+  }
+  float8 lower = PG_GETARG_FLOAT8(3);
+  float8 upper = PG_GETARG_FLOAT8(4);
+  int32 nbuckets = PG_GETARG_INT32(5);
+  if (nbuckets < 1 || nbuckets > THRIFT_HISTOGRAM_MAX_BUCKETS) {
+    elog(ERROR, "Histogram bucket count must be between 1 and %d", THRIFT_HISTOGRAM_MAX_BUCKETS);
+  }
+  if (isinf(lower) || isinf(upper) || !(lower < upper)) {
+    elog(ERROR, "Histogram lower bound must be finite and less than the upper bound");
+  }
+  ThriftPathCursor field;
+  uint8* end;
+  ThriftNumber number;
+  if (!thrift_agg_field(fcinfo, compact, &field, &end)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  if (!thrift_value_number(compact, &field, end, &number)) {
+    elog(ERROR, "Thrift field %d is not a number", PG_GETARG_INT32(2));
+  }
+  float8 value = number.is_double ? number.d : (float8)number.i;
+  if (isnan(value)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  ThriftHistogramState* state = thrift_agg_state(fcinfo, THRIFT_HISTOGRAM_STATE_SIZE(nbuckets));
+  if (PG_ARGISNULL(0)) {
+    state->nbuckets = nbuckets;
+    state->lower = lower;
+    state->upper = upper;
+  } else if (state->nbuckets != nbuckets || state->lower != lower || state->upper != upper) {
+    elog(ERROR, "Histogram bounds and bucket count must not change within a group");
+  }
+  int32 bucket;
+  if (value < lower) {
+    bucket = 0;
+  } else if (value >= upper) {
+    bucket = nbuckets + 1;
+  } else {
+    bucket = Min((int32)((value - lower) / (upper - lower) * nbuckets) + 1, nbuckets);
+  }
+  state->counts[bucket] += 1;
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_binary_histogram_trans(PG_FUNCTION_ARGS) {
+  return thrift_histogram_trans(fcinfo, false);
+}
+
+Datum thrift_compact_histogram_trans(PG_FUNCTION_ARGS) {
+  return thrift_histogram_trans(fcinfo, true);
+}
+
+Datum thrift_histogram_combine(PG_FUNCTION_ARGS) {
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "Thrift aggregate function called in non-aggregate context");
+  }
+  ThriftHistogramState* state = (ThriftHistogramState*)PG_GETARG_BYTEA_P(0);
+  ThriftHistogramState* other = (ThriftHistogramState*)PG_GETARG_BYTEA_P_COPY(1);
+  if (state->nbuckets != other->nbuckets || state->lower != other->lower || state->upper != other->upper) {
+    elog(ERROR, "Histogram bounds and bucket count must not change within a group");
+  }
+  for (int32 i = 0; i < state->nbuckets + 2; i++) {
+    state->counts[i] += other->counts[i];
+  }
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_histogram_final(PG_FUNCTION_ARGS) {
+  ThriftHistogramState* state = (ThriftHistogramState*)PG_GETARG_BYTEA_P(0);
+  Datum* counts = palloc(sizeof(Datum) * (state->nbuckets + 2));
+  for (int32 i = 0; i < state->nbuckets + 2; i++) {
+    counts[i] = Int64GetDatum(state->counts[i]);
+  }
+  PG_RETURN_POINTER(construct_array(counts, state->nbuckets + 2, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+}
+
+// hash of the encoded value, its type keeps compact booleans apart
+uint32 thrift_value_hash(bool compact, ThriftPathCursor* value, uint8* end) {
+  uint8* next = compact ? skip_compact_struct_field(value->start, end, value->type_id) : skip_binary_field(value->start, end, value->type_id);
+  uint32 hash = DatumGetUInt32(hash_any(value->start, next - value->start));
+  return DatumGetUInt32(hash_uint32(hash ^ value->type_id));
+}
+
+/*
+ * The leading bits of the hash pick a register, which keeps the highest
+ * position of the first set bit among the rest of the hashes it is given.
+ */
+Datum thrift_approx_distinct_trans(FunctionCallInfo fcinfo, bool compact) {
+  ThriftPathCursor field;
+  uint8* end;
+  if (!thrift_agg_field(fcinfo, compact, &field, &end)) {
+    return thrift_agg_keep(fcinfo);
+  }
+  uint32 hash = thrift_value_hash(compact, &field, end);
+  ThriftDistinctState* state = thrift_agg_state(fcinfo, sizeof(ThriftDistinctState));
+  uint32 rest = hash << THRIFT_HLL_BITS;
+  uint8 rank = 1;
+  while (rank <= 32 - THRIFT_HLL_BITS && !(rest & 0x80000000)) {
+    rank++;
+    rest <<= 1;
+  }
+  uint8* reg = &state->registers[hash >> (32 - THRIFT_HLL_BITS)];
+  if (*reg < rank) {
+    *reg = rank;
+  }
+  PG_RETURN_POINTER(state);
+}
+
+Datum thrift_binary_approx_distinct_trans(PG_FUNCTION_ARGS) {
+  return thrift_approx_distinct_trans(fcinfo, false);
+}
+
+Datum thrift_compact_approx_distinct_trans(PG_FUNCTION_ARGS) {
+  return thrift_approx_distinct_trans(fcinfo, true);
+}
+
+Datum thrift_approx_distinct_combine(PG_FUNCTION_ARGS) {
+  if (!AggCheckCallContext(fcinfo, NULL)) {
+    elog(ERROR, "Thrift aggregate function called in non-aggregate context");
+  }
+  ThriftDistinctState* state = (ThriftDistinctState*)PG_GETARG_BYTEA_P(0);
+  ThriftDistinctState* other = (ThriftDistinctState*)PG_GETARG_BYTEA_P(1);
+  for (int i = 0; i < THRIFT_HLL_REGISTERS; i++) {
+    state->registers[i] = Max(state->registers[i], other->registers[i]);
+  }
+  PG_RETURN_POINTER(state);
+}
+
+// HyperLogLog estimate, linear counting while registers are still empty
+Datum thrift_approx_distinct_final(PG_FUNCTION_ARGS) {
+  if (PG_ARGISNULL(0)) {
+    PG_RETURN_INT64(0);
+  }
+  ThriftDistinctState* state = (ThriftDistinctState*)PG_GETARG_BYTEA_P(0);
+  float8 m = THRIFT_HLL_REGISTERS;
+  float8 sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < THRIFT_HLL_REGISTERS; i++) {
+    sum += ldexp(1.0, -state->registers[i]);
+    zeros += state->registers[i] == 0;
+  }
+  float8 estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (estimate <= 2.5 * m && zeros > 0) {
+    estimate = m * log(m / zeros);
+  } else if (estimate > 4294967296.0 / 30 && estimate < 4294967296.0) {
+    estimate = -4294967296.0 * log(1 - estimate / 4294967296.0);
+  }
+  PG_RETURN_INT64((int64)rint(estimate));
+}
+
+#if PG_VERSION_NUM >= 120000
+// average width of the thrift value an accessor call is given
+int32 thrift_accessor_width(PlannerInfo* root, Node* node) {
+  Node* arg = NULL;
+  if (node != NULL && IsA(node, FuncExpr) && list_length(((FuncExpr*)node)->args) > 0) {
+    arg = (Node*)linitial(((FuncExpr*)node)->args);
+  }
+  if (arg == NULL) {
+    return get_typavgwidth(BYTEAOID, -1);
+  }
+  while (IsA(arg, RelabelType)) {
+    arg = (Node*)((RelabelType*)arg)->arg;
+  }
+  if (IsA(arg, Const) && !((Const*)arg)->constisnull) {
+    return toast_raw_datum_size(((Const*)arg)->constvalue) - VARHDRSZ;
+  }
+  if (IsA(arg, Var) && root != NULL) {
+    Var* var = (Var*)arg;
+    if (var->varlevelsup == 0 && var->varno > 0 && var->varno <= list_length(root->parse->rtable)) {
+      RangeTblEntry* rte = planner_rt_fetch(var->varno, root);
+      int32 width = rte->rtekind == RTE_RELATION ? get_attavgwidth(rte->relid, var->varattno) : 0;
+      if (width > 0) {
+        return width;
+      }
+    }
+  }
+  return get_typavgwidth(exprType(arg), exprTypmod(arg));
+}
+#endif
+
+/*
+ * Planner support of the accessors. A call walks the struct up to the
+ * field, so its cost grows with the width of the value, taken from the
+ * column statistics when the argument is a column.
+ */
+Datum thrift_accessor_support(PG_FUNCTION_ARGS) {
+#if PG_VERSION_NUM >= 120000
+  Node* rawreq = (Node*)PG_GETARG_POINTER(0);
+  if (IsA(rawreq, SupportRequestCost)) {
+    SupportRequestCost* req = (SupportRequestCost*)rawreq;
+    int32 width = thrift_accessor_width(req->root, req->node);
+    req->startup = 0;
+    req->per_tuple = cpu_operator_cost * (1 + (double)width / THRIFT_COST_BYTES_PER_OPERATOR);
+    PG_RETURN_POINTER(req);
+  }
+#endif
+  PG_RETURN_POINTER(NULL);
+}
+
+#if PG_VERSION_NUM >= 120000
+bool thrift_batch_scan_enabled = false;
+int thrift_batch_size = THRIFT_BATCH_SIZE_DEFAULT;
+set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+const ThriftBatchAccessor thrift_batch_accessors[] = {
+  {"thrift_binary_get_bool", thrift_binary_get_bool, false, PG_THRIFT_BINARY_BOOL},
+  {"thrift_binary_get_byte", thrift_binary_get_byte, false, PG_THRIFT_BINARY_BYTE},
+  {"thrift_binary_get_double", thrift_binary_get_double, false, PG_THRIFT_BINARY_DOUBLE},
+  {"thrift_binary_get_int16", thrift_binary_get_int16, false, PG_THRIFT_BINARY_INT16},
+  {"thrift_binary_get_int32", thrift_binary_get_int32, false, PG_THRIFT_BINARY_INT32},
+  {"thrift_binary_get_int64", thrift_binary_get_int64, false, PG_THRIFT_BINARY_INT64},
+  {"thrift_binary_get_string", thrift_binary_get_string, false, PG_THRIFT_BINARY_STRING},
+  {"thrift_binary_get_struct_bytea", thrift_binary_get_struct_bytea, false, PG_THRIFT_BINARY_STRUCT},
+  {"thrift_binary_get_list_bytea", thrift_binary_get_list_bytea, false, PG_THRIFT_BINARY_LIST},
+  {"thrift_binary_get_set_bytea", thrift_binary_get_set_bytea, false, PG_THRIFT_BINARY_SET},
+  {"thrift_binary_get_map_bytea", thrift_binary_get_map_bytea, false, PG_THRIFT_BINARY_MAP},
+  {"thrift_compact_get_bool", thrift_compact_get_bool, true, PG_THRIFT_COMPACT_BOOL},
+  {"thrift_compact_get_byte", thrift_compact_get_byte, true, PG_THRIFT_COMPACT_BYTE},
+  {"thrift_compact_get_double", thrift_compact_get_double, true, PG_THRIFT_COMPACT_DOUBLE},
+  {"thrift_compact_get_int16", thrift_compact_get_int16, true, PG_THRIFT_COMPACT_INT16},
+  {"thrift_compact_get_int32", thrift_compact_get_int32, true, PG_THRIFT_COMPACT_INT32},
+  {"thrift_compact_get_int64", thrift_compact_get_int64, true, PG_THRIFT_COMPACT_INT64},
+  {"thrift_compact_get_string", thrift_compact_get_string, true, PG_THRIFT_COMPACT_STRING},
+  {"thrift_compact_get_struct_bytea", thrift_compact_get_struct_bytea, true, PG_THRIFT_COMPACT_STRUCT},
+  {"thrift_compact_get_list_bytea", thrift_compact_get_list_bytea, true, PG_THRIFT_COMPACT_LIST},
+  {"thrift_compact_get_set_bytea", thrift_compact_get_set_bytea, true, PG_THRIFT_COMPACT_SET},
+  {"thrift_compact_get_map_bytea", thrift_compact_get_map_bytea, true, PG_THRIFT_COMPACT_MAP},
+};
+Oid thrift_batch_accessor_oids[lengthof(thrift_batch_accessors)];
+bool thrift_batch_accessors_resolved = false;
+
+CustomPathMethods thrift_batch_path_methods = {
+  .CustomName = THRIFT_BATCH_SCAN_NAME,
+  .PlanCustomPath = thrift_batch_plan_path,
+};
+
+CustomScanMethods thrift_batch_scan_methods = {
+  .CustomName = THRIFT_BATCH_SCAN_NAME,
+  .CreateCustomScanState = thrift_batch_create_state,
+};
+
+CustomExecMethods thrift_batch_exec_methods = {
+  .CustomName = THRIFT_BATCH_SCAN_NAME,
+  .BeginCustomScan = thrift_batch_begin,
+  .ExecCustomScan = thrift_batch_exec,
+  .EndCustomScan = thrift_batch_end,
+  .ReScanCustomScan = thrift_batch_rescan,
+  .ExplainCustomScan = thrift_batch_explain,
+};
+#endif
+
+void _PG_init(void) {
+  DefineCustomBoolVariable("pg_thrift.validate_recv", "Validates thrift_binary values received in binary format.",
+                           NULL, &thrift_validate_recv, true, PGC_SUSET, 0, NULL, NULL, NULL);
+#if PG_VERSION_NUM >= 120000
+  DefineCustomBoolVariable("pg_thrift.enable_batch_scan",
+                           "Enables the batch scan decoding thrift fields of many rows at once.", NULL,
+                           &thrift_batch_scan_enabled, false, PGC_USERSET, 0, NULL, NULL, NULL);
+  DefineCustomIntVariable("pg_thrift.batch_size", "Rows decoded together by the thrift batch scan.", NULL,
+                          &thrift_batch_size, THRIFT_BATCH_SIZE_DEFAULT, 1, THRIFT_BATCH_SIZE_MAX,
+                          PGC_USERSET, 0, NULL, NULL, NULL);
+#endif
+#if PG_VERSION_NUM >= 150000
+  MarkGUCPrefixReserved("pg_thrift");
+#else
+  EmitWarningsOnPlaceholders("pg_thrift");
+#endif
+#if PG_VERSION_NUM >= 120000
+  RegisterCustomScanMethods(&thrift_batch_scan_methods);
+  CacheRegisterSyscacheCallback(PROCOID, thrift_batch_accessors_reset, (Datum)0);
+  prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+  set_rel_pathlist_hook = thrift_batch_set_rel_pathlist;
+#endif
+}
+
+#if PG_VERSION_NUM >= 120000
+// functions created or dropped, as with the extension itself, make the
+// accessors be looked up again
+void thrift_batch_accessors_reset(Datum arg, int cacheid, uint32 hashvalue) {
+  thrift_batch_accessors_resolved = false;
+}
+
+// oids of the SQL functions behind the accessors, by name in any schema
+void thrift_batch_resolve_accessors(void) {
+  if (thrift_batch_accessors_resolved) {
+    return;
+  }
+  // an invalidation while looking them up clears it again
+  thrift_batch_accessors_resolved = true;
+  for (int i = 0; i < lengthof(thrift_batch_accessors); i++) {
+    CatCList* candidates = SearchSysCacheList1(PROCNAMEARGSNSP, CStringGetDatum(thrift_batch_accessors[i].name));
+    thrift_batch_accessor_oids[i] = InvalidOid;
+    for (int j = 0; j < candidates->n_members && !OidIsValid(thrift_batch_accessor_oids[i]); j++) {
+      Oid funcid = ((Form_pg_proc)GETSTRUCT(&candidates->members[j]->tuple))->oid;
+      FmgrInfo finfo;
+      fmgr_info(funcid, &finfo);
+      if (finfo.fn_addr == thrift_batch_accessors[i].function) {
+        thrift_batch_accessor_oids[i] = funcid;
+      }
+    }
+    ReleaseSysCacheList(candidates);
+  }
+}
+
+/*
+ * Whether node is an accessor call the batch scan can decode: a thrift
+ * accessor on a column of relation relid with a constant field id. The
+ * column, when given, is filled in to decode it.
+ */
+bool thrift_batch_field(Node* node, Index relid, ThriftBatchColumn* column) {
+  if (node == NULL || !IsA(node, FuncExpr) || list_length(((FuncExpr*)node)->args) != 2) {
+    return false;
+  }
+  FuncExpr* expr = (FuncExpr*)node;
+  Node* arg = (Node*)linitial(expr->args);
+  Node* field = (Node*)lsecond(expr->args);
+  if (!IsA(arg, Var) || ((Var*)arg)->varno != relid || ((Var*)arg)->varlevelsup != 0 ||
+      ((Var*)arg)->varattno <= 0 || !IsA(field, Const) || ((Const*)field)->constisnull ||
+      ((Const*)field)->consttype != INT4OID) {
+    return false;
+  }
+
+  thrift_batch_resolve_accessors();
+  for (int i = 0; i < lengthof(thrift_batch_accessors); i++) {
+    if (thrift_batch_accessor_oids[i] != expr->funcid) continue;
+    if (column != NULL) {
+      column->attno = ((Var*)arg)->varattno;
+      column->decode = true;
+      column->compact = thrift_batch_accessors[i].compact;
+      column->type_id = thrift_batch_accessors[i].type_id;
+      column->field_id = DatumGetInt32(((Const*)field)->constvalue);
+    }
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Collect the distinct accessor calls the batch scan can decode, from
+ * expressions walked in the order the scan evaluates them. A call the
+ * expression might skip, under a CASE, COALESCE, AND or OR, is left to the
+ * accessor when it is not decoded already, as decoding it could fail on a
+ * missing field where the expression would not.
+ */
+bool thrift_batch_collect(Node* node, ThriftBatchCollect* collect) {
+  if (node == NULL) {
+    return false;
+  }
+  if (thrift_batch_field(node, collect->relid, NULL)) {
+    if (collect->conditional && !list_member(collect->fields, node)) {
+      collect->skipped = list_append_unique(collect->skipped, node);
+    } else if (!collect->conditional && !list_member(collect->skipped, node)) {
+      collect->fields = list_append_unique(collect->fields, node);
+    }
+    return false;
+  }
+  // aggregate arguments are evaluated above the scan
+  if (IsA(node, Aggref) || IsA(node, WindowFunc)) {
+    return false;
+  }
+  if (IsA(node, CaseExpr) || IsA(node, CoalesceExpr) || IsA(node, BoolExpr) || IsA(node, SubPlan) ||
+      IsA(node, AlternativeSubPlan)) {
+    bool conditional = collect->conditional;
+    collect->conditional = true;
+    bool result = expression_tree_walker(node, thrift_batch_collect, (void*)collect);
+    collect->conditional = conditional;
+    return result;
+  }
+  return expression_tree_walker(node, thrift_batch_collect, (void*)collect);
+}
+
+// a strict, non volatile operator comparing a decodable accessor call with a constant
+bool thrift_batch_filter_clause(Expr* clause, Index relid) {
+  if (!IsA(clause, OpExpr) || list_length(((OpExpr*)clause)->args) != 2) {
+    return false;
+  }
+  OpExpr* op = (OpExpr*)clause;
+  Node* left = (Node*)linitial(op->args);
+  Node* right = (Node*)lsecond(op->args);
+  if (IsA(left, Const)) {
+    Node* swap = left;
+    left = right;
+    right = swap;
+  }
+  if (!IsA(right, Const) || ((Const*)right)->constisnull || !thrift_batch_field(left, relid, NULL)) {
+    return false;
+  }
+  set_opfuncid(op);
+  return op_strict(op->opno) && func_volatile(op->opfuncid) != PROVOLATILE_VOLATILE;
+}
+
+/*
+ * Split the clauses of the scan into vector filters and the quals run a
+ * row at a time, and collect the fields to decode. The clauses are taken
+ * in the order order_qual_clauses puts them in the plan, cheapest first,
+ * and only filter clauses ahead of every other qual become vector filters,
+ * so a field is decoded for the rows a sequential scan evaluates it on.
+ */
+void thrift_batch_split(PlannerInfo* root, List* clauses, ThriftBatchCollect* collect, List** filters, List** quals) {
+  RestrictInfo** items = palloc(sizeof(RestrictInfo*) * (list_length(clauses) + 1));
+  Cost* costs = palloc(sizeof(Cost) * (list_length(clauses) + 1));
+  int nitems = 0;
+  ListCell* lc;
+  // stable insertion sort by cost per tuple, security quals never get here
+  foreach(lc, clauses) {
+    RestrictInfo* rinfo = lfirst_node(RestrictInfo, lc);
+    if (rinfo->pseudoconstant) continue;
+    QualCost cost;
+    cost_qual_eval_node(&cost, (Node*)rinfo, root);
+    int i = nitems++;
+    for (; i > 0 && costs[i - 1] > cost.per_tuple; i--) {
+      items[i] = items[i - 1];
+      costs[i] = costs[i - 1];
+    }
+    items[i] = rinfo;
+    costs[i] = cost.per_tuple;
+  }
+  *filters = NIL;
+  *quals = NIL;
+  for (int i = 0; i < nitems; i++) {
+    Expr* clause = items[i]->clause;
+    if (*quals == NIL && thrift_batch_filter_clause(clause, collect->relid)) {
+      *filters = lappend(*filters, clause);
+    } else {
+      *quals = lappend(*quals, clause);
+    }
+    thrift_batch_collect((Node*)clause, collect);
+  }
+  thrift_batch_collect((Node*)root->processed_tlist, collect);
+}
+
+// the quals with the decoded accessor calls replaced by columns, to cost them
+Node* thrift_batch_strip_fields(Node* node, ThriftBatchCollect* collect) {
+  if (node == NULL) {
+    return NULL;
+  }
+  if (list_member(collect->fields, node)) {
+    FuncExpr* expr = (FuncExpr*)node;
+    Var* arg = (Var*)linitial(expr->args);
+    return (Node*)makeVar(arg->varno, arg->varattno, expr->funcresulttype, -1, expr->funccollid, 0);
+  }
+  return expression_tree_mutator(node, thrift_batch_strip_fields, (void*)collect);
+}
+
+/*
+ * Offer the batch scan for a table read by a plain SELECT when it decodes
+ * thrift fields, whether in the target list or the quals. It is costed as a
+ * sequential scan which walks each thrift value once for all its fields
+ * and without a function call per field, with the quals costed over the
+ * decoded values.
+ */
+void thrift_batch_set_rel_pathlist(PlannerInfo* root, RelOptInfo* rel, Index rti, RangeTblEntry* rte) {
+  if (prev_set_rel_pathlist_hook != NULL) {
+    prev_set_rel_pathlist_hook(root, rel, rti, rte);
+  }
+  if (!thrift_batch_scan_enabled || rel->reloptkind != RELOPT_BASEREL || rte->rtekind != RTE_RELATION ||
+      rte->relkind != RELKIND_RELATION || rte->inh || rte->tablesample != NULL || rte->securityQuals != NIL ||
+      rel->lateral_relids != NULL) {
+    return;
+  }
+  // the scan computes the target list itself and never rechecks a locked row
+  if (root->parse->commandType != CMD_SELECT || root->parse->rowMarks != NIL ||
+      bms_membership(root->all_baserels) != BMS_SINGLETON) {
+    return;
+  }
+
+  ThriftBatchCollect collect = {rti, NIL, NIL, false};
+  List* filters;
+  List* quals;
+  thrift_batch_split(root, rel->baserestrictinfo, &collect, &filters, &quals);
+  List* vars = pull_var_clause((Node*)rel->reltarget->exprs, 0);
+  ListCell* lc;
+  foreach(lc, rel->baserestrictinfo) {
+    vars = list_concat(vars, pull_var_clause((Node*)lfirst_node(RestrictInfo, lc)->clause, 0));
+  }
+  if (collect.fields == NIL) {
+    return;
+  }
+  // system columns and whole row references are left to the plain scans
+  int32 width = 0;
+  Bitmapset* columns = NULL;
+  foreach(lc, vars) {
+    Var* var = (Var*)lfirst(lc);
+    if (var->varattno <= 0) {
+      return;
+    }
+  }
+  foreach(lc, collect.fields) {
+    AttrNumber attno = ((Var*)linitial(((FuncExpr*)lfirst(lc))->args))->varattno;
+    if (!bms_is_member(attno, columns)) {
+      columns = bms_add_member(columns, attno);
+      width += Max(get_attavgwidth(rte->relid, attno), 0);
+    }
+  }
+
+  double spc_seq_page_cost;
+  QualCost qual_cost;
+  get_tablespace_page_costs(rel->reltablespace, NULL, &spc_seq_page_cost);
+  cost_qual_eval(&qual_cost, (List*)thrift_batch_strip_fields((Node*)quals, &collect), root);
+  Cost per_tuple = cpu_tuple_cost +
+                   cpu_operator_cost * ((double)width / THRIFT_COST_BYTES_PER_OPERATOR + list_length(filters)) +
+                   qual_cost.per_tuple;
+
+  CustomPath* cpath = makeNode(CustomPath);
+  cpath->path.pathtype = T_CustomScan;
+  cpath->path.parent = rel;
+  cpath->path.pathtarget = rel->reltarget;
+  cpath->path.param_info = NULL;
+  cpath->path.parallel_aware = false;
+  cpath->path.parallel_safe = false;
+  cpath->path.parallel_workers = 0;
+  cpath->path.rows = rel->rows;
+  cpath->path.startup_cost = qual_cost.startup + rel->reltarget->cost.startup;
+  cpath->path.total_cost = cpath->path.startup_cost + spc_seq_page_cost * rel->pages + rel->tuples * per_tuple +
+                           rel->rows * rel->reltarget->cost.per_tuple;
+  cpath->path.pathkeys = NIL;
+#ifdef CUSTOMPATH_SUPPORT_PROJECTION
+  cpath->flags = CUSTOMPATH_SUPPORT_PROJECTION;
+#endif
+  cpath->methods = &thrift_batch_path_methods;
+  add_path(rel, &cpath->path);
+}
+
+/*
+ * The scan tuple holds the columns the target list and quals need followed
+ * by the decodable accessor calls, so that setrefs turns those calls above
+ * the scan into references to the decoded values. Filter clauses go to
+ * custom_exprs, the other quals stay on the plan in the order given.
+ */
+Plan* thrift_batch_plan_path(PlannerInfo* root, RelOptInfo* rel, CustomPath* best_path, List* tlist, List* clauses,
+                             List* custom_plans) {
+  ThriftBatchCollect collect = {rel->relid, NIL, NIL, false};
+  List* filters;
+  List* quals;
+  thrift_batch_split(root, clauses, &collect, &filters, &quals);
+
+  List* scan_tlist = add_to_flat_tlist(NIL, pull_var_clause((Node*)tlist, 0));
+  scan_tlist = add_to_flat_tlist(scan_tlist, pull_var_clause((Node*)rel->reltarget->exprs, 0));
+  scan_tlist = add_to_flat_tlist(scan_tlist, pull_var_clause((Node*)quals, 0));
+  scan_tlist = add_to_flat_tlist(scan_tlist, collect.fields);
+
+  CustomScan* cscan = makeNode(CustomScan);
+  cscan->scan.plan.targetlist = tlist;
+  cscan->scan.plan.qual = quals;
+  cscan->scan.scanrelid = rel->relid;
+  cscan->flags = best_path->flags;
+  cscan->custom_plans = NIL;
+  cscan->custom_exprs = filters;
+  cscan->custom_private = NIL;
+  cscan->custom_scan_tlist = scan_tlist;
+  cscan->methods = &thrift_batch_scan_methods;
+  return &cscan->scan.plan;
+}
+
+Node* thrift_batch_create_state(CustomScan* cscan) {
+  ThriftBatchScanState* state = (ThriftBatchScanState*)newNode(sizeof(ThriftBatchScanState), T_CustomScanState);
+  state->css.methods = &thrift_batch_exec_methods;
+  return (Node*)state;
+}
+
+bool thrift_batch_is_int(Oid typid) {
+  return typid == INT2OID || typid == INT4OID || typid == INT8OID || typid == BOOLOID;
+}
+
+int64 thrift_batch_int(Datum value, Oid typid) {
+  switch (typid) {
+    case INT2OID:
+      return DatumGetInt16(value);
+    case INT4OID:
+      return DatumGetInt32(value);
+    case BOOLOID:
+      return DatumGetBool(value);
+    default:
+      return DatumGetInt64(value);
+  }
+}
+
+// set up a filter from a clause of custom_exprs, whose column is an INDEX_VAR after setrefs
+void thrift_batch_filter_init(ThriftBatchScanState* state, ThriftBatchFilter* filter, OpExpr* op) {
+  Node* left = (Node*)linitial(op->args);
+  filter->const_left = IsA(left, Const);
+  Var* var = (Var*)(filter->const_left ? lsecond(op->args) : left);
+  Const* value = (Const*)(filter->const_left ? left : lsecond(op->args));
+  if (!IsA(var, Var) || var->varno != INDEX_VAR || var->varattno <= 0 || var->varattno > state->ncolumns) {
+    elog(ERROR, "Invalid thrift batch scan filter");
+  }
+  filter->column = var->varattno - 1;
+  filter->value = value->constvalue;
+  filter->collation = op->inputcollid;
+  fmgr_info(op->opfuncid, &filter->function);
+
+  filter->compare = THRIFT_BATCH_COMPARE_FUNCTION;
+  TypeCacheEntry* typentry = lookup_type_cache(var->vartype, TYPECACHE_BTREE_OPFAMILY);
+  int strategy = OidIsValid(typentry->btree_opf) ? get_op_opfamily_strategy(op->opno, typentry->btree_opf) : 0;
+  if (strategy == 0) {
+    return;
+  }
+  // constant op column becomes column op' constant
+  filter->strategy = filter->const_left ? BTMaxStrategyNumber + 1 - strategy : strategy;
+  if (thrift_batch_is_int(var->vartype) && thrift_batch_is_int(value->consttype)) {
+    filter->compare = THRIFT_BATCH_COMPARE_INT;
+    filter->int_value = thrift_batch_int(value->constvalue, value->consttype);
+  } else if (var->vartype == FLOAT8OID && (value->consttype == FLOAT8OID || value->consttype == FLOAT4OID)) {
+    filter->compare = THRIFT_BATCH_COMPARE_FLOAT;
+    filter->float_value =
+        value->consttype == FLOAT8OID ? DatumGetFloat8(value->constvalue) : DatumGetFloat4(value->constvalue);
+  }
+}
+
+void thrift_batch_begin(CustomScanState* node, EState* estate, int eflags) {
+  ThriftBatchScanState* state = (ThriftBatchScanState*)node;
+  CustomScan* cscan = (CustomScan*)node->ss.ps.plan;
+  Relation rel = node->ss.ss_currentRelation;
+  Bitmapset* needed = NULL;
+  Bitmapset* filter_columns = NULL;
+  Bitmapset* qual_columns = NULL;
+  Bitmapset* later_columns = NULL;
+  pull_varattnos((Node*)cscan->scan.plan.targetlist, INDEX_VAR, &later_columns);
+  pull_varattnos((Node*)cscan->scan.plan.qual, INDEX_VAR, &qual_columns);
+  pull_varattnos((Node*)cscan->custom_exprs, INDEX_VAR, &filter_columns);
+  // columns used after the first filter, copied for the rows passing it
+  later_columns = bms_add_members(later_columns, qual_columns);
+  if (list_length(cscan->custom_exprs) > 1) {
+    pull_varattnos((Node*)list_copy_tail(cscan->custom_exprs, 1), INDEX_VAR, &later_columns);
+  }
+  needed = bms_union(later_columns, filter_columns);
+
+  state->batch_size = thrift_batch_size;
+  state->ncolumns = list_length(cscan->custom_scan_tlist);
+  state->columns = palloc0(sizeof(ThriftBatchColumn) * state->ncolumns);
+  state->nfilters = list_length(cscan->custom_exprs);
+  state->filters = palloc0(sizeof(ThriftBatchFilter) * Max(state->nfilters, 1));
+  ListCell* lc;
+  int i = 0;
+  foreach(lc, cscan->custom_exprs) {
+    thrift_batch_filter_init(state, &state->filters[i++], lfirst_node(OpExpr, lc));
+  }
+  i = 0;
+  foreach(lc, cscan->custom_scan_tlist) {
+    ThriftBatchColumn* column = &state->columns[i++];
+    Node* expr = (Node*)lfirst_node(TargetEntry, lc)->expr;
+    if (!thrift_batch_field(expr, cscan->scan.scanrelid, column)) {
+      if (!IsA(expr, Var)) {
+        elog(ERROR, "Invalid thrift batch scan column");
+      }
+      column->attno = ((Var*)expr)->varattno;
+    }
+    int member = i - FirstLowInvalidHeapAttributeNumber;
+    column->needed = bms_is_member(member, needed);
+    column->keep = bms_is_member(member, later_columns);
+    column->stage = THRIFT_BATCH_STAGE_FETCH;
+    column->qual = -1;
+    if (column->decode && state->nfilters > 0 && state->filters[0].column == i - 1) {
+      column->stage = THRIFT_BATCH_STAGE_FETCH;
+    } else if (column->decode && bms_is_member(member, filter_columns)) {
+      column->stage = THRIFT_BATCH_STAGE_FILTER;
+    } else if (column->decode) {
+      column->stage = bms_is_member(member, qual_columns) ? THRIFT_BATCH_STAGE_QUAL : THRIFT_BATCH_STAGE_OUTPUT;
+    }
+    column->typid = exprType(expr);
+    get_typlenbyval(column->typid, &column->typlen, &column->typbyval);
+    column->values = palloc(sizeof(Datum) * state->batch_size);
+    column->nulls = palloc(sizeof(bool) * state->batch_size);
+  }
+  // fields decoded after the fetch need their thrift value kept for the batch
+  for (i = 0; i < state->ncolumns; i++) {
+    ThriftBatchColumn* column = &state->columns[i];
+    if (!column->needed || column->stage == THRIFT_BATCH_STAGE_FETCH) continue;
+    column->source = -1;
+    for (int j = 0; j < state->ncolumns && column->source < 0; j++) {
+      if (!state->columns[j].decode && state->columns[j].attno == column->attno) {
+        column->source = j;
+        state->columns[j].needed = true;
+        state->columns[j].keep = true;
+      }
+    }
+    if (column->source < 0) {
+      elog(ERROR, "Invalid thrift batch scan column");
+    }
+  }
+  // the quals are run one at a time, each after decoding the fields it
+  // is the first to use, and before the output fields are decoded
+  state->nquals = list_length(cscan->scan.plan.qual);
+  state->quals = palloc(sizeof(ExprState*) * Max(state->nquals, 1));
+  i = 0;
+  foreach(lc, cscan->scan.plan.qual) {
+    Bitmapset* columns = NULL;
+    pull_varattnos((Node*)lfirst(lc), INDEX_VAR, &columns);
+    for (int j = 0; j < state->ncolumns; j++) {
+      ThriftBatchColumn* column = &state->columns[j];
+      if (column->stage == THRIFT_BATCH_STAGE_QUAL && column->qual < 0 &&
+          bms_is_member(j + 1 - FirstLowInvalidHeapAttributeNumber, columns)) {
+        column->qual = i;
+      }
+    }
+    state->quals[i++] = ExecInitQual(list_make1(lfirst(lc)), &node->ss.ps);
+  }
+  node->ss.ps.qual = NULL;
+
+  for (i = 0; i < state->nfilters; i++) {
+    ThriftBatchFilter* filter = &state->filters[i];
+    filter->decode = state->columns[filter->column].stage == THRIFT_BATCH_STAGE_FILTER;
+    for (int j = 0; j < i && filter->decode; j++) {
+      filter->decode = state->filters[j].column != filter->column;
+    }
+  }
+
+  state->selected = palloc(sizeof(int) * state->batch_size);
+  state->batch_context = AllocSetContextCreate(estate->es_query_cxt, "thrift batch", ALLOCSET_DEFAULT_SIZES);
+  state->row_context = AllocSetContextCreate(estate->es_query_cxt, "thrift batch row", ALLOCSET_DEFAULT_SIZES);
+  state->heap_slot = table_slot_create(rel, NULL);
+  state->scan = table_beginscan(rel, estate->es_snapshot, 0, NULL);
+}
+
+bool thrift_batch_test(int cmp, StrategyNumber strategy) {
+  switch (strategy) {
+    case BTLessStrategyNumber:
+      return cmp < 0;
+    case BTLessEqualStrategyNumber:
+      return cmp <= 0;
+    case BTEqualStrategyNumber:
+      return cmp == 0;
+    case BTGreaterEqualStrategyNumber:
+      return cmp >= 0;
+    case BTGreaterStrategyNumber:
+      return cmp > 0;
+    default:
+      return false;
+  }
+}
+
+// narrow the selected rows down to those passing the filter, returns how many are left
+int thrift_batch_filter(ThriftBatchScanState* state, ThriftBatchFilter* filter, int* selected, int nselected) {
+  ThriftBatchColumn* column = &state->columns[filter->column];
+  int kept = 0;
+  switch (filter->compare) {
+    case THRIFT_BATCH_COMPARE_INT:
+      for (int i = 0; i < nselected; i++) {
+        int row = selected[i];
+        if (column->nulls[row]) continue;
+        int64 value = thrift_batch_int(column->values[row], column->typid);
+        if (thrift_batch_test((value > filter->int_value) - (value < filter->int_value), filter->strategy)) {
+          selected[kept++] = row;
+        }
+      }
+      break;
+    case THRIFT_BATCH_COMPARE_FLOAT:
+      for (int i = 0; i < nselected; i++) {
+        int row = selected[i];
+        if (column->nulls[row]) continue;
+        int cmp = float8_cmp_internal(DatumGetFloat8(column->values[row]), filter->float_value);
+        if (thrift_batch_test(cmp, filter->strategy)) {
+          selected[kept++] = row;
+        }
+      }
+      break;
+    default:
+      for (int i = 0; i < nselected; i++) {
+        int row = selected[i];
+        if (column->nulls[row]) continue;
+        Datum left = filter->const_left ? filter->value : column->values[row];
+        Datum right = filter->const_left ? column->values[row] : filter->value;
+        if (DatumGetBool(FunctionCall2Coll(&filter->function, filter->collation, left, right))) {
+          selected[kept++] = row;
+        }
+      }
+      break;
+  }
+  return kept;
+}
+
+// decode a column for the selected rows from the thrift values kept for the batch
+void thrift_batch_decode_column(ThriftBatchScanState* state, int index) {
+  ThriftBatchColumn* column = &state->columns[index];
+  ThriftBatchColumn* source = &state->columns[column->source];
+  for (int i = 0; i < state->nselected; i++) {
+    int row = state->selected[i];
+    column->nulls[row] = source->nulls[row];
+    if (source->nulls[row]) continue;
+    MemoryContext old_context = MemoryContextSwitchTo(state->row_context);
+    Datum value = thrift_decode_datum(source->values[row], column->compact, column->field_id, column->type_id);
+    state->fields_decoded++;
+    if (!column->typbyval) {
+      MemoryContextSwitchTo(state->batch_context);
+      value = datumCopy(value, false, column->typlen);
+    }
+    column->values[row] = value;
+    MemoryContextSwitchTo(old_context);
+    MemoryContextReset(state->row_context);
+  }
+}
+
+/*
+ * Read the next batch of rows, decode the field of the first vector filter
+ * and check it as each row is read, and copy the columns later stages need
+ * for the rows passing it. The other filters then select the qualifying
+ * rows in turn, the field of each decoded for the rows still selected.
+ * Each row is decoded in a context of its own, as the field table is keyed
+ * by the address of the datum, and its values copied out to the batch
+ * context.
+ */
+int thrift_batch_fill(ThriftBatchScanState* state) {
+  MemoryContextReset(state->batch_context);
+  TupleTableSlot* slot = state->heap_slot;
+  int rows = 0;
+  int nselected = 0;
+  while (rows < state->batch_size && table_scan_getnextslot(state->scan, ForwardScanDirection, slot)) {
+    MemoryContext old_context = MemoryContextSwitchTo(state->row_context);
+    for (int i = 0; i < state->ncolumns; i++) {
+      ThriftBatchColumn* column = &state->columns[i];
+      if (column->stage != THRIFT_BATCH_STAGE_FETCH) continue;
+      bool isnull = true;
+      Datum value = 0;
+      if (column->decode || column->keep) {
+        value = slot_getattr(slot, column->attno, &isnull);
+      }
+      if (!isnull && column->decode) {
+        value = thrift_decode_datum(value, column->compact, column->field_id, column->type_id);
+        state->fields_decoded++;
+      }
+      column->values[rows] = value;
+      column->nulls[rows] = isnull;
+    }
+    state->selected[nselected] = rows;
+    if (state->nfilters == 0 || thrift_batch_filter(state, &state->filters[0], &state->selected[nselected], 1) > 0) {
+      MemoryContextSwitchTo(state->batch_context);
+      for (int i = 0; i < state->ncolumns; i++) {
+        ThriftBatchColumn* column = &state->columns[i];
+        if (column->stage != THRIFT_BATCH_STAGE_FETCH || !column->keep || column->nulls[rows] || column->typbyval) {
+          continue;
+        }
+        column->values[rows] = datumCopy(column->values[rows], false, column->typlen);
+      }
+      nselected++;
+    }
+    MemoryContextSwitchTo(old_context);
+    MemoryContextReset(state->row_context);
+    rows++;
+  }
+
+  state->nselected = nselected;
+  for (int i = 1; i < state->nfilters && state->nselected > 0; i++) {
+    if (state->filters[i].decode) {
+      thrift_batch_decode_column(state, state->filters[i].column);
+    }
+    state->nselected = thrift_batch_filter(state, &state->filters[i], state->selected, state->nselected);
+  }
+  state->next = 0;
+  state->done = rows < state->batch_size;
+  if (rows > 0) {
+    state->batches++;
+  }
+  state->rows_decoded += rows;
+  state->rows_filtered += rows - state->nselected;
+  return rows;
+}
+
+// decode the fields of a row which are due at stage, or before qual, into the scan tuple
+void thrift_batch_decode_row(ThriftBatchScanState* state, TupleTableSlot* slot, int row, int stage, int qual) {
+  MemoryContext old_context = MemoryContextSwitchTo(state->row_context);
+  for (int i = 0; i < state->ncolumns; i++) {
+    ThriftBatchColumn* column = &state->columns[i];
+    if (!column->needed || column->stage != stage || column->qual != qual) continue;
+    ThriftBatchColumn* source = &state->columns[column->source];
+    slot->tts_isnull[i] = source->nulls[row];
+    if (!source->nulls[row]) {
+      slot->tts_values[i] = thrift_decode_datum(source->values[row], column->compact, column->field_id, column->type_id);
+      state->fields_decoded++;
+    }
+  }
+  MemoryContextSwitchTo(old_context);
+}
+
+/*
+ * Next row of the current batch passing the vector filters and the quals,
+ * as a virtual scan tuple. Its output fields are decoded last, for rows
+ * which are returned.
+ */
+TupleTableSlot* thrift_batch_next(ScanState* node) {
+  ThriftBatchScanState* state = (ThriftBatchScanState*)node;
+  TupleTableSlot* slot = node->ss_ScanTupleSlot;
+  ExprContext* econtext = node->ps.ps_ExprContext;
+  for (;;) {
+    ExecClearTuple(slot);
+    MemoryContextReset(state->row_context);
+    while (state->next >= state->nselected) {
+      if (state->done) {
+        return slot;
+      }
+      thrift_batch_fill(state);
+    }
+    int row = state->selected[state->next++];
+    for (int i = 0; i < state->ncolumns; i++) {
+      ThriftBatchColumn* column = &state->columns[i];
+      bool fetched = column->stage == THRIFT_BATCH_STAGE_FILTER || (column->stage == THRIFT_BATCH_STAGE_FETCH && column->keep);
+      slot->tts_values[i] = fetched ? column->values[row] : (Datum)0;
+      slot->tts_isnull[i] = fetched ? column->nulls[row] : true;
+    }
+    ExecStoreVirtualTuple(slot);
+    bool passed = true;
+    for (int i = 0; i < state->nquals && passed; i++) {
+      thrift_batch_decode_row(state, slot, row, THRIFT_BATCH_STAGE_QUAL, i);
+      ResetExprContext(econtext);
+      econtext->ecxt_scantuple = slot;
+      passed = ExecQual(state->quals[i], econtext);
+    }
+    if (!passed) {
+      InstrCountFiltered1(node, 1);
+      continue;
+    }
+    thrift_batch_decode_row(state, slot, row, THRIFT_BATCH_STAGE_OUTPUT, -1);
+    return slot;
+  }
+}
+
+// only plain SELECTs get the batch scan, so no row is ever rechecked
+bool thrift_batch_recheck(ScanState* node, TupleTableSlot* slot) {
+  return true;
+}
+
+TupleTableSlot* thrift_batch_exec(CustomScanState* node) {
+  return ExecScan(&node->ss, thrift_batch_next, thrift_batch_recheck);
+}
+
+void thrift_batch_end(CustomScanState* node) {
+  ThriftBatchScanState* state = (ThriftBatchScanState*)node;
+  table_endscan(state->scan);
+  ExecDropSingleTupleTableSlot(state->heap_slot);
+  MemoryContextDelete(state->batch_context);
+  MemoryContextDelete(state->row_context);
+}
+
+void thrift_batch_rescan(CustomScanState* node) {
+  ThriftBatchScanState* state = (ThriftBatchScanState*)node;
+  table_rescan(state->scan, NULL);
+  ExecScanReScan(&node->ss);
+  state->nselected = 0;
+  state->next = 0;
+  state->done = false;
+}
+
+void thrift_batch_explain(CustomScanState* node, List* ancestors, ExplainState* es) {
+  ThriftBatchScanState* state = (ThriftBatchScanState*)node;
+  CustomScan* cscan = (CustomScan*)node->ss.ps.plan;
+#if PG_VERSION_NUM >= 130000
+  List* context = set_deparse_context_plan(es->deparse_cxt, node->ss.ps.plan, ancestors);
+#else
+  List* context = set_deparse_context_planstate(es->deparse_cxt, (Node*)node, ancestors);
+#endif
+  bool useprefix = list_length(es->rtable) > 1 || es->verbose;
+  List* fields = NIL;
+  ListCell* lc;
+  int i = 0;
+  foreach(lc, cscan->custom_scan_tlist) {
+    ThriftBatchColumn* column = &state->columns[i++];
+    if (column->decode && column->needed) {
+      fields = lappend(fields, deparse_expression((Node*)lfirst_node(TargetEntry, lc)->expr, context, useprefix, false));
+    }
+  }
+  ExplainPropertyList("Decoded Fields", fields, es);
+  if (cscan->custom_exprs != NIL) {
+    ExplainPropertyText("Vector Filter",
+                        deparse_expression((Node*)make_ands_explicit(cscan->custom_exprs), context, useprefix, false),
+                        es);
+  }
+  ExplainPropertyInteger("Batch Size", NULL, state->batch_size, es);
+  if (es->analyze) {
+    ExplainPropertyInteger("Batches", NULL, state->batches, es);
+    ExplainPropertyInteger("Rows Decoded", NULL, state->rows_decoded, es);
+    ExplainPropertyInteger("Fields Decoded", NULL, state->fields_decoded, es);
+    ExplainPropertyInteger("Rows Removed by Vector Filter", NULL, state->rows_filtered, es);
+  }
+}
+#endif
@@ -3,10 +3,15 @@
 
 #include <postgres.h>
 #include <port.h>
+#include <fmgr.h>
+#include <access/tupdesc.h>
+#if PG_VERSION_NUM >= 120000
+#include <access/relscan.h>
+#include <access/stratnum.h>
+#include <nodes/extensible.h>
+#endif
 
 
-#define THRIFT_RESULT_MAX_FIELDS 256
-
 #define PG_THRIFT_BINARY_BOOL 2
 #define PG_THRIFT_BINARY_BYTE 3
 #define PG_THRIFT_BINARY_DOUBLE 4
@@ -41,6 +46,597 @@
 #define LIST_LEN 4
 #define BOOL_LEN 1
 #define FIELD_LEN 2
-#define MAX_JSON_STRING_SIZE 1024
+
+#define THRIFT_FIELD_CACHE_SLOTS 4
+#define THRIFT_FIELD_TABLE_INITIAL_SIZE 16
+#define THRIFT_SLICE_INITIAL_SIZE 1024
+// slices grow up to this fraction of the raw size, past it the value is
+// detoasted whole, so at most half its size is fetched twice
+#define THRIFT_SLICE_MAX_FRACTION 4
+#define THRIFT_MAP_INDEX_MIN_SLOTS 8
+
+// bytes of a value an accessor walks for the cost of one operator
+#define THRIFT_COST_BYTES_PER_OPERATOR 64
+
+/*
+ * Location of one top level struct field, offset is relative to the
+ * start of the struct and points to the value right after the header.
+ * type_id is the type as found in the header of the field.
+ */
+typedef struct ThriftFieldOffset {
+  int16 field_id;
+  uint8 type_id;
+  uint32 offset;
+} ThriftFieldOffset;
+
+/*
+ * Slot of the hashed key index of a map, offsets are relative to the
+ * start of the struct and value_offset is 0 for empty slots.
+ */
+typedef struct ThriftMapIndexEntry {
+  uint32 hash;
+  uint32 key_offset;
+  uint32 value_offset;
+} ThriftMapIndexEntry;
+
+/*
+ * Keys of one map field of a struct datum. The first lookup scans the
+ * map in place, the slots are built by the second one so that repeated
+ * lookups into the same map don't scan it again.
+ */
+typedef struct ThriftMapIndex {
+  struct ThriftMapIndex* next;
+  int16 field_id;
+  int lookups;
+  uint32 nslots;
+  ThriftMapIndexEntry* slots;
+} ThriftMapIndex;
+
+/*
+ * Fields discovered so far while walking one struct datum. Walking is
+ * resumed from scan_offset when a field which has not been seen yet is
+ * requested, so the struct is walked at most once per datum. bytes is the
+ * detoasted value, or the largest slice fetched so far, of a compressed
+ * or out of line datum, so that it is detoasted once for all accessors.
+ * key_head and key_tail are the first and last 8 bytes of the datum at
+ * key, so a key reused for another value of the same size is told apart.
+ */
+typedef struct ThriftFieldTable {
+  Pointer key;
+  Size size;
+  uint64 key_head;
+  uint64 key_tail;
+  bytea* bytes;
+  bool compact;
+  bool complete;
+  bool scan_pending;
+  uint32 scan_offset;
+  int16 scan_field_id;
+  int nfields;
+  int capacity;
+  ThriftFieldOffset* fields;
+  ThriftMapIndex* map_indexes;
+} ThriftFieldTable;
+
+/*
+ * Field tables of the datums seen in the current memory context. The
+ * cache goes away together with the context, which for accessors called
+ * by the executor is the per tuple context, so datum addresses are never
+ * reused while an entry for them still exists.
+ */
+typedef struct ThriftFieldCache {
+  MemoryContext context;
+  MemoryContextCallback callback;
+  int next_slot;
+  ThriftFieldTable slots[THRIFT_FIELD_CACHE_SLOTS];
+} ThriftFieldCache;
+
+#define PG_THRIFT_INDEXED_BINARY 0
+#define PG_THRIFT_INDEXED_COMPACT 1
+
+// thrift_indexed flags, a validated payload is read without bounds checks
+#define THRIFT_INDEXED_VALIDATED 0x01
+
+// deepest nesting of structs and containers a valid value may have
+#define THRIFT_MAX_DEPTH 64
+
+/*
+ * Index entry of one top level field of a thrift_indexed value. offset
+ * points to the value right after the field header and is relative to
+ * the payload, length is the size of the value in bytes.
+ */
+typedef struct ThriftIndexEntry {
+  int16 field_id;
+  uint8 type_id;
+  uint8 reserved;
+  uint32 offset;
+  uint32 length;
+} ThriftIndexEntry;
+
+/*
+ * thrift_indexed stores the struct bytes untouched right after an index
+ * of its top level fields, sorted by field id.
+ */
+typedef struct ThriftIndexed {
+  int32 vl_len_;
+  uint8 protocol;
+  uint8 flags;
+  uint16 nfields;
+  ThriftIndexEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} ThriftIndexed;
+
+#define THRIFT_INDEXED_HDRSZ offsetof(ThriftIndexed, entries)
+#define THRIFT_INDEXED_PAYLOAD(x) ((uint8*)&(x)->entries[(x)->nfields])
+#define THRIFT_INDEXED_PAYLOAD_SIZE(x) \
+  (VARSIZE(x) - THRIFT_INDEXED_HDRSZ - (x)->nfields * sizeof(ThriftIndexEntry))
+#define DatumGetThriftIndexedP(x) ((ThriftIndexed*)PG_DETOAST_DATUM(x))
+#define PG_GETARG_THRIFT_INDEXED_P(n) DatumGetThriftIndexedP(PG_GETARG_DATUM(n))
+
+#define THRIFT_PATH_FIELD 0
+#define THRIFT_PATH_INDEX 1
+#define THRIFT_PATH_KEY_INT 2
+#define THRIFT_PATH_KEY_STRING 3
+
+/*
+ * One step of a thrift_path: a struct field id, a list (set) index or a
+ * map key. String keys are stored after the steps, value is the offset
+ * of the key there.
+ */
+typedef struct ThriftPathStep {
+  uint8 kind;
+  uint8 reserved[3];
+  uint32 key_len;
+  int64 value;
+} ThriftPathStep;
+
+/*
+ * Compiled form of a path like 3.2[5].7{"US"}, kept as a varlena so a
+ * constant path is parsed only once.
+ */
+typedef struct ThriftPath {
+  int32 vl_len_;
+  int32 nsteps;
+  ThriftPathStep steps[FLEXIBLE_ARRAY_MEMBER];
+} ThriftPath;
+
+#define THRIFT_PATH_HDRSZ offsetof(ThriftPath, steps)
+#define THRIFT_PATH_KEYS(x) ((char*)&(x)->steps[(x)->nsteps])
+#define DatumGetThriftPathP(x) ((ThriftPath*)PG_DETOAST_DATUM(x))
+#define PG_GETARG_THRIFT_PATH_P(n) DatumGetThriftPathP(PG_GETARG_DATUM(n))
+
+/*
+ * Position reached while walking a path. type_id uses the type ids of
+ * struct fields of the protocol, element is set for list, set and map
+ * members, compact bools take one byte there instead of the type nibble.
+ */
+typedef struct ThriftPathCursor {
+  uint8* start;
+  uint8 type_id;
+  bool element;
+} ThriftPathCursor;
+
+/*
+ * Path given as int[] compiled on the previous call, kept in fn_extra.
+ */
+typedef struct ThriftPathCache {
+  struct varlena* field_array;
+  ThriftPath* path;
+} ThriftPathCache;
+
+/*
+ * Cursor of the thrift_*_each_* set returning functions. curr points to
+ * the next element (key) of the container, type ids are the ones taken
+ * by skip_binary_field or skip_compact_field.
+ */
+typedef struct ThriftEachState {
+  bool compact;
+  uint8* curr;
+  uint8* end;
+  uint8 key_type_id;
+  uint8 value_type_id;
+} ThriftEachState;
+
+/*
+ * Struct field declared in thrift IDL. field_type is normalized with
+ * typedefs and enums resolved, e.g. list<i32> or map<string,User>, and
+ * default_value is the constant after = with the quotes of a string
+ * removed, or NULL.
+ */
+typedef struct ThriftIdlField {
+  char* struct_name;
+  char* field_name;
+  int16 field_id;
+  char* field_type;
+  char* default_value;
+} ThriftIdlField;
+
+/*
+ * Names declared in thrift IDL with what they stand for, a type for
+ * typedefs and a value for constants.
+ */
+typedef struct ThriftIdlNames {
+  char** names;
+  char** values;
+  int n;
+  int capacity;
+} ThriftIdlNames;
+
+/*
+ * State of the IDL parser: the lookahead token and the fields, typedefs
+ * and constants seen so far. Enums are kept as typedefs of i32 and their
+ * values as constants named Enum.VALUE.
+ */
+typedef struct ThriftIdlParser {
+  char* p;
+  char* token;
+  ThriftIdlField* fields;
+  int nfields;
+  int fields_capacity;
+  ThriftIdlNames typedefs;
+  ThriftIdlNames constants;
+} ThriftIdlParser;
+
+/*
+ * Resolves the field names of a path against thrift_schema_field. type is
+ * the IDL type reached by the steps so far and schema_name the schema its
+ * struct was found in, NULL until the first step.
+ */
+typedef struct ThriftSchemaResolver {
+  char* table;
+  char* schema_name;
+  char* type;
+  char* default_value;
+} ThriftSchemaResolver;
+
+/*
+ * Path of field names compiled to a thrift_path, kept in fn_extra with
+ * the struct name and path it was compiled from. parent is the path
+ * without its last step when that step is a field with a default value,
+ * raw is set for structs and containers, which are returned as bytes.
+ * generation is the count of registry changes the plan was compiled at.
+ */
+typedef struct ThriftSchemaPlan {
+  MemoryContext context;
+  uint64 generation;
+  text* struct_name;
+  text* name_path;
+  ThriftPath* path;
+  ThriftPath* parent;
+  char* type;
+  char* default_value;
+  Oid value_type;
+  int8 binary_type_id;
+  int8 compact_type_id;
+  bool raw;
+  FmgrInfo output;
+} ThriftSchemaPlan;
+
+/*
+ * Column of a composite type filled by thrift_*_populate_record. attno is
+ * 0 based, record_type is the composite type of the column or of its
+ * elements and element_type_id the binary type id list elements must have.
+ * commented tells the field id was set as column comment.
+ */
+typedef struct ThriftRecordColumn {
+  int16 field_id;
+  int attno;
+  Oid typid;
+  Oid element_type;
+  uint8 element_type_id;
+  Oid record_type;
+  bool commented;
+} ThriftRecordColumn;
+
+/*
+ * Field ids of the columns of a composite type, sorted by field id. Kept
+ * per type for the life of the backend and rebuilt when the row type
+ * changes, which tupdesc_id of the type cache tells, when a schema is
+ * registered in any backend, or when a column comment has changed since
+ * the transaction checked_xact.
+ */
+typedef struct ThriftRecordInfo {
+  Oid typid;
+  uint64 tupdesc_id;
+  uint64 checked_xact;
+  TupleDesc tupdesc;
+  int ncolumns;
+  ThriftRecordColumn* columns;
+} ThriftRecordInfo;
+
+// strategies of the GIN opclasses, @> with a jsonb and with a thrift query
+#define THRIFT_GIN_CONTAINS_JSONB_STRATEGY 7
+#define THRIFT_GIN_CONTAINS_STRATEGY 8
+
+/*
+ * Members of a struct, list, set or map value, walked by the containment
+ * operators and the GIN opclasses. kind is the binary type id of the
+ * value with sets taken as lists, key_type and value_type are the types
+ * of list elements and map entries as skip_binary_field or
+ * skip_compact_field take them.
+ */
+typedef struct ThriftMemberIterator {
+  bool compact;
+  uint8 kind;
+  uint8* curr;
+  uint8* end;
+  int64 remaining;
+  int16 field_id;
+  uint8 key_type;
+  uint8 value_type;
+} ThriftMemberIterator;
+
+/*
+ * GIN keys of a value, one per scalar: the hash of the field ids and map
+ * keys leading to the scalar combined with the scalar itself.
+ */
+typedef struct ThriftGinKeys {
+  Datum* keys;
+  int32 n;
+  int32 capacity;
+} ThriftGinKeys;
+
+// strategy of the BRIN opclasses, @@ with a thrift_field_range
+#define THRIFT_BRIN_RANGE_STRATEGY 1
+
+// most fields one BRIN summary keeps
+#define THRIFT_BRIN_MAX_FIELDS 32
+
+/*
+ * Integer or double scalar. Integers stay int64 so that large timestamps
+ * compare exactly, an integer and a double compare as doubles.
+ */
+typedef struct ThriftNumber {
+  bool is_double;
+  int64 i;
+  float8 d;
+} ThriftNumber;
+
+// thrift_field_range flags, the number of an unbounded side is ignored
+#define THRIFT_RANGE_LOW_INF 0x01
+#define THRIFT_RANGE_HIGH_INF 0x02
+#define THRIFT_RANGE_LOW_EXCLUSIVE 0x04
+#define THRIFT_RANGE_HIGH_EXCLUSIVE 0x08
+
+/*
+ * Interval of the values of one top level integer or double field, like
+ * 5:[100,200), taken by the @@ operators and the BRIN opclasses.
+ */
+typedef struct ThriftFieldRange {
+  int32 vl_len_;
+  int16 field_id;
+  uint8 flags;
+  uint8 reserved;
+  ThriftNumber low;
+  ThriftNumber high;
+} ThriftFieldRange;
+
+#define DatumGetThriftFieldRangeP(x) ((ThriftFieldRange*)PG_DETOAST_DATUM(x))
+#define PG_GETARG_THRIFT_FIELD_RANGE_P(n) DatumGetThriftFieldRangeP(PG_GETARG_DATUM(n))
+
+/*
+ * Smallest and largest value of one field within a block range.
+ */
+typedef struct ThriftBrinField {
+  int16 field_id;
+  ThriftNumber min;
+  ThriftNumber max;
+} ThriftBrinField;
+
+// BRIN summary flags, an incomplete summary left out fields past the limit
+#define THRIFT_BRIN_INCOMPLETE 0x01
+
+/*
+ * BRIN summary of a block range, stored as bytea: bounds of each summarized
+ * field seen in the range, sorted by field id.
+ */
+typedef struct ThriftBrinSummary {
+  int32 vl_len_;
+  uint16 nfields;
+  uint8 flags;
+  uint8 reserved;
+  ThriftBrinField fields[FLEXIBLE_ARRAY_MEMBER];
+} ThriftBrinSummary;
+
+#define THRIFT_BRIN_SUMMARY_SIZE(n) (offsetof(ThriftBrinSummary, fields) + (n) * sizeof(ThriftBrinField))
+
+#if PG_VERSION_NUM >= 130000
+/*
+ * Options of the BRIN opclasses, fields is the offset of the list of
+ * field ids to summarize or 0 when every numeric field is summarized.
+ */
+typedef struct ThriftBrinOptions {
+  int32 vl_len_;
+  int fields;
+} ThriftBrinOptions;
+#endif
+
+/*
+ * Transition state of the count, sum and minmax aggregates over one field,
+ * stored as bytea so partial states pass between parallel workers as they
+ * are and the transition functions update it in place.
+ */
+typedef struct ThriftAggState {
+  int32 vl_len_;
+  int16 field_id;
+  bool has_number;  // sum or min and max are set
+  int64 count;
+  int64 sum;
+  ThriftNumber min;
+  ThriftNumber max;
+} ThriftAggState;
+
+// most buckets of a histogram aggregate, besides the two outer ones
+#define THRIFT_HISTOGRAM_MAX_BUCKETS 10000
+
+/*
+ * Transition state of the histogram aggregates, counts[0] holds the values
+ * below lower and counts[nbuckets + 1] the ones from upper on, like
+ * width_bucket numbers them.
+ */
+typedef struct ThriftHistogramState {
+  int32 vl_len_;
+  int32 nbuckets;
+  float8 lower;
+  float8 upper;
+  int64 counts[FLEXIBLE_ARRAY_MEMBER];
+} ThriftHistogramState;
+
+#define THRIFT_HISTOGRAM_STATE_SIZE(n) (offsetof(ThriftHistogramState, counts) + ((n) + 2) * sizeof(int64))
+
+// the approx_distinct aggregates keep a HyperLogLog of 2^bits registers
+#define THRIFT_HLL_BITS 10
+#define THRIFT_HLL_REGISTERS (1 << THRIFT_HLL_BITS)
+
+/*
+ * Transition state of the approx_distinct aggregates, each register keeps
+ * the longest run of leading zeros seen among the hashes of its values.
+ */
+typedef struct ThriftDistinctState {
+  int32 vl_len_;
+  uint8 registers[THRIFT_HLL_REGISTERS];
+} ThriftDistinctState;
+
+// a frame is a big-endian int32 length followed by that many bytes
+#define THRIFT_FRAME_HEADER_LEN 4
+// bytes of a framed file read at a time, larger frames get a window of their own
+#define THRIFT_FRAMED_WINDOW_SIZE (64 * 1024 * 1024)
+
+/*
+ * Cursor of the thrift_*_read_framed set returning functions. window
+ * holds window_len bytes of the file from window_offset in a buffer of
+ * window_size bytes, and offset is where the header of the next frame
+ * starts. field_ids is NULL unless the frames are projected to those
+ * fields. The window lives in context, which outlives the calls of the
+ * scan unlike the memory each call runs in.
+ */
+typedef struct ThriftFramedReader {
+  MemoryContext context;
+  bool compact;
+  bool validate;
+  char* path;
+  int fd;
+  off_t file_size;
+  off_t offset;
+  off_t window_offset;
+  size_t window_len;
+  size_t window_size;
+  uint8* window;
+  int16* field_ids;
+  int nfields;
+} ThriftFramedReader;
+
+#if PG_VERSION_NUM >= 120000
+#define THRIFT_BATCH_SCAN_NAME "ThriftBatchScan"
+#define THRIFT_BATCH_SIZE_DEFAULT 1024
+#define THRIFT_BATCH_SIZE_MAX 65536
+
+/*
+ * Accessor the batch scan decodes itself. Calls are recognized by the oid
+ * of the SQL function, looked up by name and checked to be the C function.
+ */
+typedef struct ThriftBatchAccessor {
+  const char* name;
+  PGFunction function;
+  bool compact;
+  int8 type_id;
+} ThriftBatchAccessor;
+
+// when the batch scan decodes a field, a missing field is an error so
+// fields are decoded for the rows a sequential scan would evaluate them on
+#define THRIFT_BATCH_STAGE_FETCH 0   // as the row is read, for the first vector filter
+#define THRIFT_BATCH_STAGE_FILTER 1  // for rows passing the vector filters before its own
+#define THRIFT_BATCH_STAGE_QUAL 2    // for rows passing the quals before the first one using it
+#define THRIFT_BATCH_STAGE_OUTPUT 3  // for rows passing all quals
+
+/*
+ * Column of the batch scan tuple: a column of the relation, or an accessor
+ * call with a constant field id on one. The field of the first vector
+ * filter is decoded for every row of a batch, and columns are copied when
+ * keep is set, for the rows passing that filter. Fields decoded later are
+ * taken from the source column of the thrift value, those of the quals
+ * before qual. Columns nothing above the scan refers to are left null.
+ */
+typedef struct ThriftBatchColumn {
+  AttrNumber attno;
+  bool decode;
+  bool compact;
+  int8 type_id;
+  int16 field_id;
+  int stage;
+  int qual;
+  int source;
+  bool needed;
+  bool keep;
+  Oid typid;
+  int16 typlen;
+  bool typbyval;
+  Datum* values;
+  bool* nulls;
+} ThriftBatchColumn;
+
+// how a vector filter compares a decoded column with its constant
+typedef enum ThriftBatchCompare {
+  THRIFT_BATCH_COMPARE_INT,
+  THRIFT_BATCH_COMPARE_FLOAT,
+  THRIFT_BATCH_COMPARE_FUNCTION
+} ThriftBatchCompare;
+
+/*
+ * Comparison of a decoded column with a constant, applied to a whole batch.
+ * Btree comparisons of integers and doubles are done inline with strategy
+ * taken as column op constant, anything else calls the operator. decode
+ * is set on the first filter of a column decoded at the filter stage.
+ */
+typedef struct ThriftBatchFilter {
+  int column;
+  bool decode;
+  ThriftBatchCompare compare;
+  StrategyNumber strategy;
+  int64 int_value;
+  float8 float_value;
+  Datum value;
+  bool const_left;
+  Oid collation;
+  FmgrInfo function;
+} ThriftBatchFilter;
+
+// accessor calls found in expressions, see thrift_batch_collect
+typedef struct ThriftBatchCollect {
+  Index relid;
+  List* fields;
+  List* skipped;
+  bool conditional;
+} ThriftBatchCollect;
+
+/*
+ * State of the batch scan. Rows are pulled from the heap a batch at a time,
+ * their columns decoded into vectors, the vector filters narrow selected
+ * down to the qualifying rows. Those are checked against the other quals,
+ * taken over from the scan and run one at a time in plan order, and
+ * returned one by one.
+ */
+typedef struct ThriftBatchScanState {
+  CustomScanState css;
+  TableScanDesc scan;
+  TupleTableSlot* heap_slot;
+  MemoryContext batch_context;
+  MemoryContext row_context;
+  int batch_size;
+  int ncolumns;
+  ThriftBatchColumn* columns;
+  int nfilters;
+  ThriftBatchFilter* filters;
+  int nquals;
+  ExprState** quals;
+  int* selected;
+  int nselected;
+  int next;
+  bool done;
+  int64 batches;
+  int64 rows_decoded;
+  int64 fields_decoded;
+  int64 rows_filtered;
+} ThriftBatchScanState;
+#endif
 
 #endif // _PG_THRIFT_H_
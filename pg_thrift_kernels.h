@@ -0,0 +1,361 @@
+#ifndef _PG_THRIFT_KERNELS_H_
+#define _PG_THRIFT_KERNELS_H_
+
+/*
+ * Decoding kernels shared by pg_thrift.c and bench/thrift_bench.c. Only
+ * c.h types are used, so the header works for backend and frontend code.
+ */
+
+#include <port/pg_bswap.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PG_THRIFT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define MAX_VARINT_LEN 10
+#define THRIFT_VARINT_BLOCK 16
+
+static inline int64 thrift_zigzag_decode(uint64 value) {
+  return (int64)(value >> 1) ^ -(int64)(value & 1);
+}
+
+static inline uint64 thrift_zigzag_encode(int64 value) {
+  return ((uint64)value << 1) ^ (uint64)(value >> 63);
+}
+
+// writes value as a varint of at most MAX_VARINT_LEN bytes, returns its length
+static inline int thrift_varint_encode(uint8* p, uint64 value) {
+  int len = 0;
+  while (value >= 0x80) {
+    p[len++] = (uint8)(value | 0x80);
+    value >>= 7;
+  }
+  p[len++] = (uint8)value;
+  return len;
+}
+
+// decodes one varint, returns its length or 0 when it doesn't end
+// before end (or within MAX_VARINT_LEN bytes)
+static inline int thrift_varint_decode(const uint8* p, const uint8* end, uint64* value) {
+  uint64 result = 0;
+  for (int i = 0; i < MAX_VARINT_LEN && p + i < end; i++) {
+    result |= (uint64)(p[i] & 0x7f) << (7 * i);
+    if ((p[i] & 0x80) == 0) {
+      *value = result;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// bit i is set when byte i of the block has its continuation bit set
+static inline uint32 thrift_varint_block_mask(const uint8* p) {
+#ifdef PG_THRIFT_X86_SIMD
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+#else
+  uint32 mask = 0;
+  for (int i = 0; i < THRIFT_VARINT_BLOCK; i++) {
+    mask |= (uint32)(p[i] >> 7) << i;
+  }
+  return mask;
+#endif
+}
+
+static inline int thrift_popcount32(uint32 word) {
+#ifdef __GNUC__
+  return __builtin_popcount(word);
+#else
+  int count = 0;
+  for (; word != 0; word &= word - 1) {
+    count++;
+  }
+  return count;
+#endif
+}
+
+static inline int thrift_rightmost_one32(uint32 word) {
+#ifdef __GNUC__
+  return __builtin_ctz(word);
+#else
+  int pos = 0;
+  while ((word & 1) == 0) {
+    word >>= 1;
+    pos++;
+  }
+  return pos;
+#endif
+}
+
+static inline int thrift_leftmost_one32(uint32 word) {
+#ifdef __GNUC__
+  return 31 - __builtin_clz(word);
+#else
+  int pos = 31;
+  while ((word & 0x80000000) == 0) {
+    word <<= 1;
+    pos--;
+  }
+  return pos;
+#endif
+}
+
+/*
+ * Whether a varint continued by the bits set in more, after run
+ * continuation bytes before the block, is longer than MAX_VARINT_LEN
+ * bytes, i.e. has a run of MAX_VARINT_LEN continuation bits.
+ */
+static inline bool thrift_varint_block_overlong(uint32 more, int run) {
+  uint32 ends = ~more & 0xffff;
+  if (run + (ends == 0 ? THRIFT_VARINT_BLOCK : thrift_rightmost_one32(ends)) >= MAX_VARINT_LEN) {
+    return true;
+  }
+  uint32 runs = more;
+  for (int i = 1; i < MAX_VARINT_LEN; i++) {
+    runs &= more >> i;
+  }
+  return runs != 0;
+}
+
+/*
+ * Returns the pointer after n varints, or NULL when they don't all end
+ * before end or one is longer than MAX_VARINT_LEN bytes, like
+ * thrift_varint_decode rejects them. A varint ends at the first byte with
+ * the continuation bit clear, so the varints ending in a block of 16
+ * bytes are counted from the mask of its continuation bits, without
+ * walking the bytes.
+ */
+static inline const uint8* thrift_varint_skip_n(const uint8* p, const uint8* end, int64 n) {
+  int run = 0;  // continuation bytes before p of the current varint
+  while (n > 0 && end - p >= THRIFT_VARINT_BLOCK) {
+    uint32 more = thrift_varint_block_mask(p);
+    uint32 ends = ~more & 0xffff;
+    int count = thrift_popcount32(ends);
+    if (count < n) {
+      if (thrift_varint_block_overlong(more, run)) {
+        return NULL;
+      }
+      n -= count;
+      p += THRIFT_VARINT_BLOCK;
+      run = THRIFT_VARINT_BLOCK - 1 - thrift_leftmost_one32(ends);
+      continue;
+    }
+    for (int64 i = 1; i < n; i++) {
+      ends &= ends - 1;
+    }
+    int len = thrift_rightmost_one32(ends) + 1;
+    // bytes after the last varint are not part of it
+    if (thrift_varint_block_overlong(more & ((1u << len) - 1), run)) {
+      return NULL;
+    }
+    return p + len;
+  }
+  for (; n > 0; n--) {
+    while (p < end && (*p & 0x80)) {
+      p++;
+      if (++run >= MAX_VARINT_LEN) {
+        return NULL;
+      }
+    }
+    if (p >= end) {
+      return NULL;
+    }
+    p++;
+    run = 0;
+  }
+  return p;
+}
+
+#ifndef WORDS_BIGENDIAN
+/*
+ * Value of the varint of len (at most 8) bytes at p, from one 8 byte
+ * load. The 7 bit groups are packed pairwise into 14, 28 and 56 bits.
+ * At least 8 bytes must be readable at p.
+ */
+static inline uint64 thrift_varint_swar(const uint8* p, int len) {
+  uint64 x;
+  memcpy(&x, p, sizeof(x));
+  if (len < 8) {
+    x &= ((uint64)1 << (8 * len)) - 1;
+  }
+  x &= UINT64CONST(0x7f7f7f7f7f7f7f7f);
+  x = ((x & UINT64CONST(0x7f007f007f007f00)) >> 1) | (x & UINT64CONST(0x007f007f007f007f));
+  x = ((x & UINT64CONST(0x3fff00003fff0000)) >> 2) | (x & UINT64CONST(0x00003fff00003fff));
+  x = ((x & UINT64CONST(0x0fffffff00000000)) >> 4) | (x & UINT64CONST(0x000000000fffffff));
+  return x;
+}
+#endif
+
+/*
+ * Decodes n zigzag varints into values, returns the pointer after them
+ * or NULL when they don't all end before end. Varint boundaries are taken
+ * from the continuation bit mask of 16 byte blocks: a block of one byte
+ * varints, which is what lists of small ints are made of, is decoded
+ * without any per byte check, and longer varints with one 8 byte load.
+ */
+static inline const uint8* thrift_varint_decode_n(const uint8* p, const uint8* end, int64* values, int64 n) {
+  int64 i = 0;
+  while (i < n) {
+    if (end - p >= THRIFT_VARINT_BLOCK) {
+      uint32 ends = ~thrift_varint_block_mask(p) & 0xffff;
+      if (ends == 0xffff && n - i >= THRIFT_VARINT_BLOCK) {
+        for (int j = 0; j < THRIFT_VARINT_BLOCK; j++) {
+          values[i + j] = (int64)(p[j] >> 1) ^ -(int64)(p[j] & 1);
+        }
+        i += THRIFT_VARINT_BLOCK;
+        p += THRIFT_VARINT_BLOCK;
+        continue;
+      }
+      int pos = 0;
+      for (; ends != 0 && i < n; ends &= ends - 1) {
+        int last = thrift_rightmost_one32(ends);
+        int len = last + 1 - pos;
+        uint64 value = 0;
+#ifndef WORDS_BIGENDIAN
+        if (len <= 8 && end - (p + pos) >= 8) {
+          value = thrift_varint_swar(p + pos, len);
+        } else
+#endif
+        if (thrift_varint_decode(p + pos, end, &value) != len) {
+          return NULL;
+        }
+        values[i++] = thrift_zigzag_decode(value);
+        pos = last + 1;
+      }
+      if (pos > 0) {
+        p += pos;
+        continue;
+      }
+    }
+    uint64 value;
+    int len = thrift_varint_decode(p, end, &value);
+    if (len == 0) {
+      return NULL;
+    }
+    values[i++] = thrift_zigzag_decode(value);
+    p += len;
+  }
+  return p;
+}
+
+/*
+ * Thrift binary ints and doubles are big-endian. The loads and stores
+ * below go through memcpy and pg_bswap, which compile to a plain unaligned
+ * move and a bswap instruction.
+ */
+static inline uint16 thrift_load_be16(const uint8* p) {
+  uint16 value;
+  memcpy(&value, p, sizeof(value));
+  return pg_ntoh16(value);
+}
+
+static inline uint32 thrift_load_be32(const uint8* p) {
+  uint32 value;
+  memcpy(&value, p, sizeof(value));
+  return pg_ntoh32(value);
+}
+
+static inline uint64 thrift_load_be64(const uint8* p) {
+  uint64 value;
+  memcpy(&value, p, sizeof(value));
+  return pg_ntoh64(value);
+}
+
+static inline float8 thrift_load_be_double(const uint8* p) {
+  uint64 bits = thrift_load_be64(p);
+  float8 value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static inline void thrift_store_be16(uint8* p, uint16 value) {
+  value = pg_hton16(value);
+  memcpy(p, &value, sizeof(value));
+}
+
+static inline void thrift_store_be32(uint8* p, uint32 value) {
+  value = pg_hton32(value);
+  memcpy(p, &value, sizeof(value));
+}
+
+static inline void thrift_store_be64(uint8* p, uint64 value) {
+  value = pg_hton64(value);
+  memcpy(p, &value, sizeof(value));
+}
+
+static inline void thrift_store_be_double(uint8* p, float8 value) {
+  uint64 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  thrift_store_be64(p, bits);
+}
+
+#ifdef PG_THRIFT_X86_SIMD
+// reverses the bytes of each width wide element of a 16 byte block
+static inline __m128i thrift_bswap_mask(int width) {
+  if (width == 2) {
+    return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  }
+  if (width == 4) {
+    return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  }
+  return _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+}
+
+__attribute__((target("ssse3")))
+static inline int64 thrift_bswap_blocks_ssse3(const uint8* src, uint8* dst, int64 bytes, int width) {
+  __m128i mask = thrift_bswap_mask(width);
+  int64 i = 0;
+  for (; i + 16 <= bytes; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(block, mask));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static inline int64 thrift_bswap_blocks_avx2(const uint8* src, uint8* dst, int64 bytes, int width) {
+  __m256i mask = _mm256_broadcastsi128_si256(thrift_bswap_mask(width));
+  int64 i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i*)(src + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(block, mask));
+  }
+  return i;
+}
+#endif
+
+/*
+ * Converts n big-endian elements of width 2, 4 or 8 bytes at src to
+ * native order at dst, which doesn't have to be aligned. Whole blocks are
+ * byte-swapped with one shuffle, the rest one element at a time.
+ */
+static inline void thrift_load_be_n(const uint8* src, void* dst, int64 n, int width) {
+  int64 bytes = n * width;
+  uint8* out = (uint8*)dst;
+#ifdef WORDS_BIGENDIAN
+  memcpy(out, src, bytes);
+#else
+  int64 i = 0;
+#ifdef PG_THRIFT_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) {
+    i = thrift_bswap_blocks_avx2(src, out, bytes, width);
+  } else if (__builtin_cpu_supports("ssse3")) {
+    i = thrift_bswap_blocks_ssse3(src, out, bytes, width);
+  }
+#endif
+  for (; i < bytes; i += width) {
+    if (width == 2) {
+      uint16 value = thrift_load_be16(src + i);
+      memcpy(out + i, &value, sizeof(value));
+    } else if (width == 4) {
+      uint32 value = thrift_load_be32(src + i);
+      memcpy(out + i, &value, sizeof(value));
+    } else {
+      uint64 value = thrift_load_be64(src + i);
+      memcpy(out + i, &value, sizeof(value));
+    }
+  }
+#endif
+}
+
+#endif
@@ -76,6 +76,8 @@ SELECT thrift_binary_in('{"type" : "int32", "value" : 123}');
 SELECT thrift_binary_in('{"type" : "int64", "value" : 123456789}');
 
 SELECT thrift_binary_in('{"type":"double", "value" :123456.789}');
+SELECT thrift_binary_in('{"type": "double", "value": 1e-7}') AS tiny, thrift_binary_in('{"type": "double", "value": "NaN"}') AS nan, thrift_binary_in('{"type": "double", "value": "-Infinity"}') AS neg_inf;
+SELECT v :: text :: thrift_binary :: text = v :: text AS same FROM (SELECT thrift_binary_in('{"type": "list", "value": [{"type": "double", "value": 1e-7}, {"type": "double", "value": "Infinity"}, {"type": "double", "value": 0.1}]}') AS v) AS input;
 
 SELECT thrift_binary_in('{"type": "string", "value" : "hello world!"}');
 
@@ -93,4 +95,483 @@ SELECT get_thrift_binary_type(thrift_binary_in('{"type" : "int32", "value" : 123
 
 SELECT get_thrift_binary_value(thrift_binary_in('{"type" : "bool", "value" : 1}'));
 
+-- struct (id = 123, phones=["123456", "abcdef"])
+SELECT * FROM thrift_binary_get_fields(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea, ARRAY[2, 1]) AS t(phones bytea[], id int);
+
+SELECT * FROM thrift_binary_get_fields(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea, ARRAY[1, 7]) AS t(id bigint, missing text);
+
+SELECT * FROM thrift_binary_get_fields(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea, ARRAY[1]) AS t(id text);
+SELECT * FROM thrift_binary_get_fields(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea, ARRAY[65537]) AS t(id int);
+
+-- struct(id=123, phones=["123456", "abcdef"])
+SELECT * FROM thrift_compact_get_fields(E'\\x15f601192b0c3132333435360c61626364656600' :: bytea, ARRAY[1, 2]) AS t(id int, phones bytea[]);
+
+CREATE TABLE thrift_cache_test (data bytea);
+
+-- struct (id = 123, phones=["123456", "abcdef"])
+INSERT INTO thrift_cache_test VALUES (E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600');
+
+SELECT thrift_field_cache_reset_stats();
+
+SELECT thrift_binary_get_int32(data, 1) AS id, thrift_binary_get_list_bytea(data, 2) AS phones, thrift_binary_get_int32(data, 1) AS id2 FROM thrift_cache_test;
+
+SELECT * FROM thrift_field_cache_stats();
+
+DROP TABLE thrift_cache_test;
+
+-- struct (id = 123, phones=["123456", "abcdef"])
+SELECT thrift_binary_indexed(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea);
+
+SELECT thrift_indexed_get_int32((E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea) :: thrift_indexed, 1);
+
+SELECT thrift_indexed_get_list_bytea((E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea) :: thrift_indexed, 2);
+
+SELECT thrift_indexed_get_int32((E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea) :: thrift_indexed, 3);
+
+SELECT thrift_indexed_get_string('binary:\x0b000200000003616263080001000000070000' :: thrift_indexed, 2);
+
+SELECT thrift_indexed_bytea('binary:\x0800010000007b00' :: thrift_indexed);
+
+-- struct(id=123, phones=["123456", "abcdef"])
+SELECT thrift_indexed_get_int32(thrift_compact_indexed(E'\\x15f601192b0c3132333435360c61626364656600' :: bytea), 1);
+
+SELECT parse_thrift_compact_string(UNNEST(thrift_indexed_get_list_bytea('compact:\x15f601192b0c3132333435360c61626364656600' :: thrift_indexed, 2)));
+
+-- struct (id = true)
+SELECT thrift_indexed_get_bool('compact:\x1100' :: thrift_indexed, 1);
+
+SELECT '3.2[5].7{"US"}{-1}' :: thrift_path;
+
+SELECT '3..2' :: thrift_path;
+
+-- struct1 (id = 123, phones=["123456", "abcdef"])
+-- struct2 (id = 123, phones=["123456", "abcdef"])
+-- struct (id = 123, phones=[struct1, struct2])
+SELECT thrift_binary_get_path_string(E'\\x0800010000007b0f00020c000000020800010000007b0f00020b000000020000000631323334353600000006616263646566000800010000007b0f00020b0000000200000006313233343536000000066162636465660000' :: bytea, '2[1].2[0]' :: thrift_path);
+
+SELECT thrift_binary_get_path_int32(E'\\x0800010000007b0f00020c000000020800010000007b0f00020b000000020000000631323334353600000006616263646566000800010000007b0f00020b0000000200000006313233343536000000066162636465660000' :: bytea, '2[5].1' :: thrift_path);
+
+SELECT thrift_binary_get_path_int32(E'\\x0800010000007b0f00020c000000020800010000007b0f00020b000000020000000631323334353600000006616263646566000800010000007b0f00020b0000000200000006313233343536000000066162636465660000' :: bytea, ARRAY[1]);
+
+-- struct (inner = struct (value = 5))
+SELECT thrift_binary_get_path_int64(E'\\x0c00010a000200000000000000050000' :: bytea, ARRAY[1, 2]);
+
+-- struct (counts = {'a' : 1, 'US' : 7})
+SELECT thrift_binary_get_path_int32(E'\\x0d00010b08000000020000000161000000010000000255530000000700' :: bytea, '1{"US"}' :: thrift_path);
+
+SELECT thrift_binary_get_path_int32(E'\\x0d00010b08000000020000000161000000010000000255530000000700' :: bytea, '1{3}' :: thrift_path);
+
+-- struct(id=123, phones=["123456", "abcdef"])
+SELECT thrift_compact_get_path_string(E'\\x15f601192b0c3132333435360c61626364656600' :: bytea, '2[1]' :: thrift_path);
+
+-- {'a' : 2}
+SELECT thrift_compact_get_path_int16(E'\\x1b02b602610400' :: bytea, '1{"a"}' :: thrift_path);
+
+CREATE TABLE thrift_toast_test (data bytea);
+
+ALTER TABLE thrift_toast_test ALTER COLUMN data SET STORAGE EXTERNAL;
+
+-- struct (id = 123, name = 'x' * 1000000, code = 7)
+INSERT INTO thrift_toast_test VALUES (E'\\x0800010000007b0b0002000f4240' :: bytea || convert_to(repeat('x', 1000000), 'UTF8') || E'\\x0800030000000700' :: bytea);
+
+SELECT thrift_binary_get_int32(data, 1) AS id, length(thrift_binary_get_string(data, 2)) AS name_length, thrift_binary_get_int32(data, 3) AS code FROM thrift_toast_test;
+
+DROP TABLE thrift_toast_test;
+
+-- struct(ids=[1, 2, -1])
+SELECT thrift_binary_get_list_int64(E'\\x0f00010a0000000300000000000000010000000000000002ffffffffffffffff00' :: bytea, 1);
+
+-- struct(names=["abc", ""])
+SELECT thrift_binary_get_list_string(E'\\x0f00020b00000002000000036162630000000000' :: bytea, 2);
+
+SELECT thrift_binary_get_list_int32(E'\\x0f00010a0000000300000000000000010000000000000002ffffffffffffffff00' :: bytea, 1);
+
+-- struct(id=[1, 2, 3, 4, 5]) as set
+SELECT thrift_compact_get_list_int32(E'\\x1a58020406080a00' :: bytea, 1);
+
+-- struct(flags=[true, false, true])
+SELECT thrift_compact_get_list_bool(E'\\x193201020100' :: bytea, 1);
+
+-- struct(ids=[1] * 300)
+SELECT array_length(thrift_compact_get_list_int32(E'\\x19f8d804' :: bytea || decode(repeat('02', 300), 'hex') || E'\\x00' :: bytea, 1), 1) AS typed, array_length(thrift_compact_get_list_bytea(E'\\x19f8d804' :: bytea || decode(repeat('02', 300), 'hex') || E'\\x00' :: bytea, 1), 1) AS bytea;
+
+-- struct(ids=[1, 2, 3])
+SELECT parse_thrift_binary_int32(thrift_binary_each_list(E'\\x0f0001080000000300000001000000020000000300' :: bytea, 1));
+
+-- struct(id=[1, 2, 3, 4, 5]) as set, decoding stops after the second element
+SELECT parse_thrift_compact_int32(thrift_compact_each_list(E'\\x1a58020406080a00' :: bytea, 1)) LIMIT 2;
+
+-- struct(counts={"a": 1, "b": 2})
+SELECT parse_thrift_binary_string(key) AS key, parse_thrift_binary_int32(value) AS value FROM thrift_binary_each_map(E'\\x0d00010b08000000020000000161000000010000000162000000020000' :: bytea, 1);
+
+-- struct(names={1: "a", 2: "b"})
+SELECT parse_thrift_compact_int32(key) AS key, parse_thrift_compact_string(value) AS value FROM thrift_compact_each_map(E'\\x1b048b02026104026200' :: bytea, 1);
+
+CREATE TABLE thrift_map_test (data bytea);
+
+-- struct(counts={"a": 1, "b": 2})
+INSERT INTO thrift_map_test VALUES (E'\\x0d00010b080000000200000001610000000100000001620000000200' :: bytea);
+
+-- lookups after the first one into the map of a row use its hashed keys
+SELECT thrift_binary_map_get_int32(data, 1, 'b') AS b, thrift_binary_map_get_int32(data, 1, 'a') AS a, thrift_binary_map_get_int32(data, 1, 'c') AS c, thrift_binary_map_get_int32(data, 2, 'a') AS missing_field FROM thrift_map_test;
+
+SELECT thrift_binary_map_get_int32(data, 1, 5) FROM thrift_map_test;
+
+DROP TABLE thrift_map_test;
+
+-- struct(names={1: "a", 2: "b"})
+SELECT thrift_compact_map_get_string(E'\\x1b048b02026104026200' :: bytea, 1, 2);
+
+-- struct(ids=[1, 2, 3])
+SELECT thrift_binary_list_contains(E'\\x0f0001080000000300000001000000020000000300' :: bytea, 1, 2) AS has_2, thrift_binary_list_contains(E'\\x0f0001080000000300000001000000020000000300' :: bytea, 1, 4) AS has_4, thrift_binary_list_contains(E'\\x0f0001080000000300000001000000020000000300' :: bytea, 2, 2) AS missing_field;
+
+-- struct(ids=[1 .. 40]) as i64
+SELECT thrift_binary_list_contains(x, 1, 37) AS has_37, thrift_binary_list_contains(x, 1, 41) AS has_41 FROM (SELECT E'\\x0f00010a00000028' :: bytea || decode(string_agg(lpad(to_hex(i), 16, '0'), '' ORDER BY i), 'hex') || E'\\x00' :: bytea FROM generate_series(1, 40) AS i) AS t(x);
+
+-- struct(values=[1.5, -0.0]), 0 = -0 as for float8
+SELECT thrift_binary_list_contains(E'\\x0f000104000000023ff8000000000000800000000000000000' :: bytea, 1, 1.5) AS has_1_5, thrift_binary_list_contains(E'\\x0f000104000000023ff8000000000000800000000000000000' :: bytea, 1, 0.0) AS has_0;
+
+SELECT thrift_binary_list_contains(E'\\x0f0001080000000300000001000000020000000300' :: bytea, 1, 'abc');
+
+-- struct(id=[1, 2, 3, 4, 5]) as set
+SELECT thrift_compact_list_contains(E'\\x1a58020406080a00' :: bytea, 1, 5) AS has_5, thrift_compact_list_contains(E'\\x1a58020406080a00' :: bytea, 1, -5) AS has_minus_5;
+
+-- struct(names=["abc", "xyz"])
+SELECT thrift_compact_list_contains(E'\\x192b066162630678797a00' :: bytea, 1, 'xyz') AS has_xyz, thrift_compact_list_contains(E'\\x192b066162630678797a00' :: bytea, 1, 'xy') AS has_xy;
+
+-- struct(ids=[0, 1, ..., 15, -300, 2^40], code=7)
+SELECT thrift_compact_get_list_int64(E'\\x19fa2400020406080a0c0e10121416181a1c1ed704808080808040150e00' :: bytea, 1) AS ids, thrift_compact_get_int32(E'\\x19fa2400020406080a0c0e10121416181a1c1ed704808080808040150e00' :: bytea, 2) AS code;
+
+-- field ids of encoded structs are big-endian
+SELECT jsonb_to_thrift_binary('{"type": "struct", "value": {"1": {"type": "int32", "value": 7}, "2": {"type": "string", "value": "ab"}}}');
+
+SELECT jsonb_to_thrift_binary('{"type": "map", "value": [{"type": "string", "value": "k"}, {"type": "list", "value": []}]}');
+
+SELECT jsonb_to_thrift_binary('{"type": "list", "value": [{"type": "int32", "value": 1}, {"type": "int64", "value": 2}]}');
+SELECT jsonb_to_thrift_compact('{"type": "struct", "value": {"1": {"type": "int32", "value": 7}, "2": {"type": "string", "value": "ab"}}}');
+SELECT jsonb_to_thrift_compact('{"type": "struct", "value": {"1": {"type": "int32", "value": 7}, "2": {"type": "string", "value": "ab"}, "3": {"type": "bool", "value": 1}, "4": {"type": "list", "value": [{"type": "int64", "value": -1}, {"type": "int64", "value": 300}]}, "5": {"type": "double", "value": 2.5}}}');
+SELECT thrift_compact_get_int32(c, 1) AS i, thrift_compact_get_string(c, 2) AS s, thrift_compact_get_bool(c, 3) AS b, thrift_compact_get_list_int64(c, 4) AS l, thrift_compact_get_double(c, 5) AS d, octet_length(c) AS compact, octet_length(jsonb_to_thrift_binary(j)) AS binary FROM (SELECT j, jsonb_to_thrift_compact(j) AS c FROM (SELECT '{"type": "struct", "value": {"1": {"type": "int32", "value": 7}, "2": {"type": "string", "value": "ab"}, "3": {"type": "bool", "value": 1}, "4": {"type": "list", "value": [{"type": "int64", "value": -1}, {"type": "int64", "value": 300}]}, "5": {"type": "double", "value": 2.5}}}' :: jsonb AS j) AS input) AS encoded;
+SELECT jsonb_to_thrift_compact('{"type": "map", "value": [{"type": "string", "value": "k"}, {"type": "list", "value": []}]}');
+SELECT jsonb_to_thrift_compact('{"type": "list", "value": [{"type": "int32", "value": 1}, {"type": "int64", "value": 2}]}');
+SELECT 'compact:{"type": "struct", "value": {"1": {"type": "int32", "value": 7}, "2": {"type": "string", "value": "ab"}}}' :: thrift_indexed;
+SELECT 'binary:{"type": "struct", "value": {"1": {"type": "int32", "value": 7}, "2": {"type": "string", "value": "ab"}}}' :: thrift_indexed;
+SELECT 'compact:{"type": "int32", "value": 1}' :: thrift_indexed;
+SELECT thrift_binary_to_compact(E'\\x080001000000070b000200000002616200' :: bytea);
+SELECT thrift_compact_to_binary(E'\\x150e1804616211192a01d80417400400000000000000' :: bytea);
+-- field ids 1, 100, -5 and 3 need long and short field headers
+SELECT thrift_binary_to_compact(b) AS compact, thrift_compact_to_binary(thrift_binary_to_compact(b)) = b AS same FROM (SELECT E'\\x080001000000010800640000000208fffb000000030200030100' :: bytea AS b) AS input;
+SELECT thrift_binary_to_compact(E'\\x08000100000001' :: bytea);
+SELECT thrift_compact_to_binary(E'\\x1d00' :: bytea);
+SELECT length(('{"type": "string", "value": "' || repeat('a', 5000) || '"}') :: thrift_binary :: text);
+SELECT '{"type": "string", "value": "say \"hi\""}' :: thrift_binary;
+SELECT thrift_binary_to_jsonb(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea);
+SELECT thrift_compact_to_jsonb(thrift_binary_to_compact(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea)) = thrift_binary_to_jsonb(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea) AS same;
+SELECT jsonb_to_thrift_compact(thrift_compact_to_jsonb(c)) = c AS same FROM (SELECT E'\\x150e1804616211192a01d80417400400000000000000' :: bytea AS c) AS input;
+SELECT thrift_binary_to_jsonb(E'\\x04000140091eb851eb851f00' :: bytea);
+SELECT thrift_binary_to_jsonb(E'\\x0800010000007b' :: bytea);
+SELECT thrift_binary_to_jsonb(E'\\x0b00010000000361006200' :: bytea);
+SELECT thrift_binary_send(thrift_binary_in('{"type" : "int32", "value" : 123}'));
+
+-- struct(ids=[1, -1, 2, -2, 300, -300, 70000, -70000, 2^31 - 1, -2^31])
+SELECT thrift_binary_get_list_int32(E'\\x0f0001080000000a00000001ffffffff00000002fffffffe0000012cfffffed400011170fffeee907fffffff8000000000' :: bytea, 1);
+
+-- struct(scores=[1.5, -2.25, 0, 1e100, -3])
+SELECT thrift_binary_get_list_double(E'\\x0f000104000000053ff8000000000000c002000000000000000000000000000054b249ad2594c37dc00800000000000000' :: bytea, 1);
+
+-- struct(id=123, phones=["123456", "abcdef"]), cut off, and with a negative string length
+SELECT thrift_binary_validate(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: bytea) AS valid, thrift_binary_validate(E'\\x0800010000007b0f00020b00000002000000063132' :: bytea) AS truncated, thrift_binary_validate(E'\\x0b0001ffffffff00' :: bytea) AS negative_length;
+
+-- compact struct, and a field with unknown type id 13
+SELECT thrift_compact_validate(E'\\x15f601192b0c3132333435360c61626364656600' :: bytea) AS valid, thrift_compact_validate(E'\\x1d00' :: bytea) AS unknown_type;
+-- list<i64> with a 10 byte varint, and with 11 byte ones read a byte and a block at a time
+SELECT thrift_compact_validate(E'\\x191a8080808080808080800100' :: bytea) AS ten_bytes, thrift_compact_validate(E'\\x191a808080808080808080800100' :: bytea) AS eleven_bytes, thrift_compact_validate(E'\\x197a020202020202808080808080808080800100' :: bytea) AS eleven_bytes_block;
+
+CREATE DOMAIN thrift_event AS bytea CHECK (thrift_binary_validate(VALUE));
+
+SELECT thrift_binary_get_int32(E'\\x0800010000007b0f00020b00000002000000063132333435360000000661626364656600' :: thrift_event, 1);
+
+SELECT E'\\x0800010000007b' :: thrift_event;
+
+DROP DOMAIN thrift_event;
+
+SELECT thrift_register_schema('app', $$
+typedef i64 UserId
+enum Kind { A = 1, B }
+
+struct User {
+  1: required UserId id,
+  2: optional string name = "anon",
+  3: list<string> tags,
+  4: map<string, i32> scores,
+  5: Kind kind = Kind.B
+}
+
+// fields 2 and 3 may be missing
+struct Event {
+  1: User user
+  2: i32 count = 7
+  3: list<User> others
+  4: double ratio
+}
+$$);
+
+SELECT struct_name, field_name, field_id, field_type, default_value FROM thrift_schema_field ORDER BY struct_name, field_id;
+
+-- struct(user=User(id=42, tags=["x", "y"], scores={"a": 5}), ratio=1.5, others=[User(name="bob")])
+SELECT thrift_binary_get(p, 'Event', 'user.id') AS id, thrift_binary_get(p, 'Event', 'user.name') AS name, thrift_binary_get(p, 'Event', 'user.tags[1]') AS tag, thrift_binary_get(p, 'Event', 'user.scores{"a"}') AS score, thrift_binary_get(p, 'Event', 'user.kind') AS kind FROM (SELECT E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea AS p) t;
+
+SELECT thrift_binary_get(p, 'Event', 'others[0].name') AS name, thrift_binary_get(p, 'Event', 'others[0].id') AS id, thrift_binary_get(p, 'Event', 'others[1].name') AS missing, thrift_binary_get(p, 'Event', 'count') AS count, thrift_binary_get(p, 'Event', 'ratio') :: double precision AS ratio FROM (SELECT E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea AS p) t;
+
+SELECT thrift_binary_get(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, 'Event', 'user.tags') :: bytea AS tags;
+
+SELECT thrift_schema_path('Event', 'others[0].name') AS path, thrift_binary_get_path_string(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, thrift_schema_path('Event', 'user.tags[0]')) AS tag;
+
+-- compact struct(user=User(id=42), ratio=1.5)
+SELECT thrift_compact_get(p, 'Event', 'user.id') AS id, thrift_compact_get(p, 'Event', 'ratio') AS ratio, thrift_compact_get(p, 'Event', 'count') AS count FROM (SELECT E'\\x1c165400373ff800000000000000' :: bytea AS p) t;
+
+SELECT thrift_binary_get(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, 'Event', 'user.nickname');
+
+SELECT thrift_binary_get(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, 'Event', 'ratio[0]');
+
+SELECT thrift_register_schema('other', 'struct Event { 2: i32 count = 3 }');
+
+SELECT thrift_binary_get(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, 'Event', 'count');
+
+SELECT thrift_binary_get(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, 'other.Event', 'count') AS other, thrift_binary_get(E'\\x0c00010a0001000000000000002a0f00030b00000002000000017800000001790d00040b0800000001000000016100000005000400043ff80000000000000f00030c000000010b000200000003626f620000' :: bytea, 'app.Event', 'count') AS app;
+
+SELECT * FROM thrift_parse_idl('struct S { 1: i32 a = 5; list<map<string, i32>> b } (final)');
+
+DELETE FROM thrift_schema;
+
+SELECT thrift_register_schema('rec', 'struct Item { 1: i32 a, 2: string b }');
+
+CREATE TYPE item AS (a integer, b text);
+
+CREATE TYPE event AS (id bigint, item item, nums integer[], items item[], flag boolean, note text);
+
+COMMENT ON COLUMN event.id IS '1';
+
+COMMENT ON COLUMN event.item IS '2';
+
+COMMENT ON COLUMN event.nums IS '3';
+
+COMMENT ON COLUMN event.items IS '4';
+
+COMMENT ON COLUMN event.flag IS '5';
+
+COMMENT ON COLUMN event.note IS '9';
+
+-- struct(id=7, item=Item(a=5, b="hi"), nums=[1, 2], items=[Item(a=11), Item(b="x")], flag=true, 7: 99)
+SELECT * FROM thrift_binary_populate_record(null::event, E'\\x0a000100000000000000070c0002080001000000050b0002000000026869000f0003080000000200000001000000020f00040c000000020800010000000b000b0002000000017800020005010800070000006300' :: bytea);
+
+SELECT * FROM thrift_compact_populate_record(null::event, E'\\x160e1c150a180468690019280204192c151600280278001125c60100' :: bytea);
+
+SELECT * FROM thrift_binary_populate_record(ROW(1, NULL, NULL, NULL, false, 'kept') :: event, E'\\x0a0001000000000000002a00' :: bytea);
+
+SELECT * FROM thrift_binary_populate_record(ROW(1, NULL, NULL, NULL, false, 'kept') :: event, NULL);
+
+SELECT * FROM thrift_binary_populate_record(null::event, E'\\x0b0001000000016100' :: bytea);
+
+CREATE TYPE loose AS (x integer);
+
+SELECT * FROM thrift_binary_populate_record(null::loose, E'\\x00' :: bytea);
+
+SELECT thrift_binary_populate_record(null::integer, E'\\x00' :: bytea);
+
+COMMENT ON COLUMN loose.x IS '3';
+
+SELECT * FROM thrift_binary_populate_record(null::loose, E'\\x0800030000000700' :: bytea);
+
+COMMENT ON COLUMN loose.x IS '4';
+
+SELECT * FROM thrift_binary_populate_record(null::loose, E'\\x0800040000000800' :: bytea);
+
+COMMENT ON COLUMN loose.x IS NULL;
+
+SELECT thrift_register_schema('loose', 'struct Loose { 5: i32 x }');
+
+SELECT * FROM thrift_binary_populate_record(null::loose, E'\\x0800050000000900' :: bytea);
+
+SELECT thrift_register_schema('loose', 'struct Loose { 6: i32 x }');
+
+SELECT * FROM thrift_binary_populate_record(null::loose, E'\\x0800060000000a00' :: bytea);
+
+DROP TYPE loose;
+
+DROP TYPE event;
+
+DROP TYPE item;
+
+DELETE FROM thrift_schema;
+
+CREATE TABLE thrift_gin_test (id integer, data thrift_binary);
+
+INSERT INTO thrift_gin_test SELECT i, ('{"type": "struct", "value": {"1": {"type": "int32", "value": ' || i || '}, "2": {"type": "string", "value": "' || CASE WHEN i % 2 = 0 THEN 'US' ELSE 'UK' END || '"}, "3": {"type": "list", "value": [{"type": "int64", "value": ' || i % 5 || '}, {"type": "int64", "value": 42}]}}}') :: thrift_binary FROM generate_series(1, 20) i;
+
+CREATE INDEX thrift_gin_test_idx ON thrift_gin_test USING gin (data);
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT id FROM thrift_gin_test WHERE data @> '{"2": "US", "3": [3]}' :: jsonb;
+
+SELECT id FROM thrift_gin_test WHERE data @> '{"2": "US", "3": [3]}' :: jsonb ORDER BY id;
+
+SELECT count(*) FROM thrift_gin_test WHERE data @> '{"3": [42]}' :: jsonb;
+
+SELECT id FROM thrift_gin_test WHERE data @> '{"1": 7.0}' :: jsonb;
+
+SELECT id FROM thrift_gin_test WHERE data @> '{"1": "7"}' :: jsonb;
+
+SELECT id FROM thrift_gin_test WHERE data @> '{"type": "struct", "value": {"1": {"type": "int32", "value": 5}}}' :: thrift_binary;
+
+SELECT count(*) FROM thrift_gin_test WHERE data @> '{}' :: jsonb;
+
+RESET enable_seqscan;
+
+DROP TABLE thrift_gin_test;
+
+-- compact struct(1: 5, 3: [42, 7], 4: {"a": 1}, 5: 2.0, 6: struct(1: true), 7: "US")
+SELECT 'compact:\x150a292a540e1b02b80261021740000000000000001c11001804555300' :: thrift_indexed @> '{"3": [7, 42], "4": {"a": 1}, "5": 2, "6": {"1": true}}' :: jsonb AS contained, 'compact:\x150a292a540e1b02b80261021740000000000000001c11001804555300' :: thrift_indexed @> '{"4": {"a": 2}}' :: jsonb AS other_value;
+
+SELECT 'compact:\x150a292a540e1b02b80261021740000000000000001c11001804555300' :: thrift_indexed @> 'binary:\x0b00070000000255530800010000000500' :: thrift_indexed AS contained;
+
+SELECT '5:[100,200)' :: thrift_field_range AS closed_open, '7:(,1.5]' :: thrift_field_range AS unbounded, thrift_field_range(5, 1700000000000000001, NULL) AS from_int, thrift_field_range(5, 0.5, 2.5) AS from_double;
+
+SELECT '5:[1,' :: thrift_field_range;
+
+-- compact struct(1: 1000L, 2: 5, 3: 2.5, 4: "hi")
+SELECT 'compact:\x16d00f150a1740040000000000001804686900' :: thrift_indexed @@ '1:[1000,1000]' AS exact, 'compact:\x16d00f150a1740040000000000001804686900' :: thrift_indexed @@ '1:(1000,]' AS above, 'compact:\x16d00f150a1740040000000000001804686900' :: thrift_indexed @@ '3:(2,3)' AS double_field, 'compact:\x16d00f150a1740040000000000001804686900' :: thrift_indexed @@ '4:[,]' AS string_field, 'compact:\x16d00f150a1740040000000000001804686900' :: thrift_indexed @@ '9:[,]' AS missing;
+
+SELECT '{"type": "struct", "value": {"1": {"type": "int64", "value": 1000}}}' :: thrift_binary @@ '1:[999.5,1000.5]' AS in_range;
+
+CREATE TABLE thrift_brin_test (id integer, data thrift_indexed);
+
+INSERT INTO thrift_brin_test SELECT i, ('{"type": "struct", "value": {"1": {"type": "int64", "value": ' || 1600000000000 + i * 1000 || '}, "2": {"type": "double", "value": ' || i / 4.0 || '}, "3": {"type": "string", "value": "event"}}}') :: thrift_binary :: thrift_indexed FROM generate_series(1, 1000) i;
+
+CREATE INDEX thrift_brin_test_idx ON thrift_brin_test USING brin (data) WITH (pages_per_range = 1);
+
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF) SELECT id FROM thrift_brin_test WHERE data @@ '1:[1600000500000,1600000505000]';
+
+SELECT min(id), max(id), count(*) FROM thrift_brin_test WHERE data @@ '1:[1600000500000,1600000505000]';
+
+SELECT array_agg(id ORDER BY id) FROM thrift_brin_test WHERE data @@ thrift_field_range(2, 10.0, 10.5);
+
+SELECT array_agg(id ORDER BY id) FROM thrift_brin_test WHERE data @@ '2:(249,]';
+
+SELECT count(*) FROM thrift_brin_test WHERE data @@ '3:[,]' OR data @@ '9:[,]';
+
+DROP INDEX thrift_brin_test_idx;
+
+-- only field 1 is summarized, ranges are kept for every other field
+CREATE INDEX thrift_brin_test_idx ON thrift_brin_test USING brin (data thrift_indexed_minmax_ops (fields = '1')) WITH (pages_per_range = 1);
+
+SELECT min(id), max(id), count(*) FROM thrift_brin_test WHERE data @@ '1:[1600000500000,1600000505000]';
+
+SELECT array_agg(id ORDER BY id) FROM thrift_brin_test WHERE data @@ '2:(249,]';
+
+CREATE INDEX ON thrift_brin_test USING brin (data thrift_indexed_minmax_ops (fields = '1,x'));
+
+RESET enable_seqscan;
+
+DROP TABLE thrift_brin_test;
+
+SELECT count(*) FROM pg_proc WHERE prosupport = 'thrift_accessor_support' :: regproc;
+
+CREATE TABLE thrift_cost_test (name text, data bytea);
+
+-- accessors cost more than lower(), so they are evaluated last
+EXPLAIN (COSTS OFF) SELECT * FROM thrift_cost_test WHERE thrift_binary_get_int32(data, 1) = 5 AND lower(name) = 'x';
+
+DROP TABLE thrift_cost_test;
+
+CREATE TABLE thrift_batch_test (id integer, data bytea);
+
+-- field 2 is only set from row 901 on, row 500 has no thrift value
+INSERT INTO thrift_batch_test SELECT i, CASE WHEN i <> 500 THEN '\x080001' :: bytea || int4send(i) || '\x040004' :: bytea || float8send(i / 4.0) || CASE WHEN i > 900 THEN '\x0b000200000004' :: bytea || convert_to(lpad(i :: text, 4, '0'), 'UTF8') ELSE '' :: bytea END || '\x00' :: bytea END FROM generate_series(1, 1000) i;
+
+ANALYZE thrift_batch_test;
+
+SET pg_thrift.enable_batch_scan = on;
+
+SET pg_thrift.batch_size = 100;
+
+-- the condition on id costs less than the comparisons of fields and runs first
+EXPLAIN (COSTS OFF) SELECT id, thrift_binary_get_string(data, 2) FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) > 990 AND thrift_binary_get_double(data, 4) <= 249.5 AND id % 2 = 0;
+
+SELECT id, thrift_binary_get_string(data, 2) FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) > 990 AND thrift_binary_get_double(data, 4) <= 249.5 AND id % 2 = 0;
+
+-- one costing more runs after them, so they are checked on the batch
+EXPLAIN (COSTS OFF) SELECT id, thrift_binary_get_string(data, 2) FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) > 990 AND thrift_binary_get_double(data, 4) <= 249.5 AND abs(id) % 2 = 0;
+
+SELECT id, thrift_binary_get_string(data, 2) FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) > 990 AND thrift_binary_get_double(data, 4) <= 249.5 AND abs(id) % 2 = 0;
+
+SELECT count(*), sum(thrift_binary_get_int32(data, 1)) FROM thrift_batch_test WHERE thrift_binary_get_double(data, 4) BETWEEN 10 AND 20;
+
+SELECT count(*) FROM thrift_batch_test WHERE 995 < thrift_binary_get_int32(data, 1);
+
+SELECT id FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) = 7 :: bigint;
+
+-- field 2 is decoded for rows passing the filter on field 1 only
+SELECT array_agg(id ORDER BY id) FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) > 900 AND thrift_binary_get_string(data, 2) LIKE '%5';
+
+-- field 2 is only read for rows passing the cheaper condition on id, as rows up to 900 lack it
+EXPLAIN (COSTS OFF) SELECT id, thrift_binary_get_string(data, 2) FROM thrift_batch_test WHERE id > 995 AND thrift_binary_get_string(data, 2) LIKE '%9';
+
+SELECT id, thrift_binary_get_string(data, 2) FROM thrift_batch_test WHERE id > 995 AND thrift_binary_get_string(data, 2) LIKE '%9';
+
+-- a field the CASE may skip is left to the accessor
+EXPLAIN (COSTS OFF) SELECT id, CASE WHEN id > 900 THEN thrift_binary_get_string(data, 2) END FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) BETWEEN 899 AND 902;
+
+SELECT id, CASE WHEN id > 900 THEN thrift_binary_get_string(data, 2) END FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) BETWEEN 899 AND 902;
+
+-- ten batches, field 1 decoded for all rows but the NULL one
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF) SELECT id, CASE WHEN id > 900 THEN thrift_binary_get_string(data, 2) END FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) BETWEEN 899 AND 902;
+
+SET pg_thrift.enable_batch_scan = off;
+
+EXPLAIN (COSTS OFF) SELECT id FROM thrift_batch_test WHERE thrift_binary_get_int32(data, 1) = 7;
+
+RESET pg_thrift.batch_size;
+
+-- aggregates combine the partial states of parallel workers
+SET parallel_setup_cost = 0;
+
+SET parallel_tuple_cost = 0;
+
+SET min_parallel_table_scan_size = 0;
+
+SET max_parallel_workers_per_gather = 2;
+
+EXPLAIN (COSTS OFF) SELECT thrift_binary_sum_int64(data, 1), thrift_binary_minmax(data, 4) FROM thrift_batch_test;
+
+SELECT thrift_binary_count_present(data, 2), thrift_binary_sum_int64(data, 1), thrift_binary_minmax(data, 1), thrift_binary_minmax(data, 4) FROM thrift_batch_test;
+
+SELECT id % 2 AS odd, thrift_binary_count_present(data, 2), thrift_binary_sum_int64(data, 1) FROM thrift_batch_test GROUP BY 1 ORDER BY 1;
+
+-- buckets below 0, four of width 250 and from 1000 on
+SELECT thrift_binary_histogram(data, 1, 0, 1000, 4) FROM thrift_batch_test;
+
+SELECT abs(thrift_binary_approx_distinct(data, 1) - 999) < 50 AS field_1, abs(thrift_binary_approx_distinct(data, 2) - 100) < 5 AS field_2 FROM thrift_batch_test;
+
+SELECT thrift_binary_count_present(data, 1), thrift_binary_sum_int64(data, 1), thrift_binary_histogram(data, 1, 0, 1, 1), thrift_binary_approx_distinct(data, 1) FROM thrift_batch_test WHERE id < 0;
+
+RESET max_parallel_workers_per_gather;
+
+RESET min_parallel_table_scan_size;
+
+RESET parallel_tuple_cost;
+
+RESET parallel_setup_cost;
+
+SELECT thrift_binary_sum_int64(data, 4) FROM thrift_batch_test;
+
+SELECT thrift_binary_histogram(data, 1, 10, 0, 4) FROM thrift_batch_test;
+
+-- compact booleans true, false, true
+SELECT thrift_compact_sum_int64(data, 1), thrift_compact_minmax(data, 1), thrift_compact_count_present(data, 2), thrift_compact_approx_distinct(data, 2) FROM (VALUES ('\x15051100' :: bytea), ('\x150e1200'), ('\x15c8011100'), (NULL)) AS t (data);
+
+DROP TABLE thrift_batch_test;
+
 DROP EXTENSION pg_thrift;
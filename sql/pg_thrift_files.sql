@@ -0,0 +1,68 @@
+CREATE EXTENSION pg_thrift;
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set thrift_recv_file :abs_builddir '/results/pg_thrift_recv.bin'
+CREATE TABLE thrift_recv_test (id integer, data thrift_binary);
+CREATE TABLE thrift_recv_raw (id integer, data bytea);
+INSERT INTO thrift_recv_test VALUES (1, '{"type": "int32", "value": 123}'), (2, '{"type": "list", "value": [{"type": "string", "value": "ab"}]}');
+COPY thrift_recv_test TO :'thrift_recv_file' (FORMAT binary);
+COPY thrift_recv_raw FROM :'thrift_recv_file' (FORMAT binary);
+SELECT id, data FROM thrift_recv_raw ORDER BY id;
+TRUNCATE thrift_recv_test;
+COPY thrift_recv_test FROM :'thrift_recv_file' (FORMAT binary);
+SELECT id, data FROM thrift_recv_test ORDER BY id;
+INSERT INTO thrift_recv_raw VALUES (3, E'\\x0800010000007b');
+COPY thrift_recv_raw TO :'thrift_recv_file' (FORMAT binary);
+COPY thrift_recv_test FROM :'thrift_recv_file' (FORMAT binary);
+SET pg_thrift.validate_recv = off;
+COPY thrift_recv_test FROM :'thrift_recv_file' (FORMAT binary);
+SELECT count(*) FROM thrift_recv_test;
+RESET pg_thrift.validate_recv;
+CREATE ROLE regress_thrift_recv_user;
+SET ROLE regress_thrift_recv_user;
+SET pg_thrift.validate_recv = off;
+RESET ROLE;
+DROP ROLE regress_thrift_recv_user;
+DROP TABLE thrift_recv_test;
+DROP TABLE thrift_recv_raw;
+
+\set thrift_binary_frames :abs_builddir '/results/pg_thrift_binary_frames.bin'
+\set thrift_compact_frames :abs_builddir '/results/pg_thrift_compact_frames.bin'
+SELECT lo_from_bytea(0, E'\\x000000110800010000007b0b0002000000026162000000000c080001000000070200030100') AS frames \gset
+SELECT lo_export(:frames, :'thrift_binary_frames');
+SELECT lo_unlink(:frames);
+SELECT * FROM thrift_binary_read_framed(:'thrift_binary_frames', true);
+SELECT thrift_binary_get_int32(frame, 1) AS id, frame FROM thrift_binary_read_framed(:'thrift_binary_frames', true, ARRAY[1]) AS frame;
+\set VERBOSITY sqlstate
+SELECT * FROM thrift_compact_read_framed(:'thrift_binary_frames', true);
+\set VERBOSITY default
+SELECT lo_from_bytea(0, E'\\x0000000815f601180461620000000004150e2100') AS frames \gset
+SELECT lo_export(:frames, :'thrift_compact_frames');
+SELECT lo_unlink(:frames);
+SELECT * FROM thrift_compact_read_framed(:'thrift_compact_frames', true, ARRAY[3]);
+SELECT count(*) FROM thrift_binary_read_framed(:'thrift_compact_frames', false);
+\set VERBOSITY sqlstate
+SELECT count(*) FROM thrift_binary_read_framed(:'thrift_compact_frames', true);
+\set VERBOSITY default
+CREATE ROLE regress_thrift_framed_user;
+GRANT EXECUTE ON FUNCTION thrift_binary_read_framed(text, boolean) TO regress_thrift_framed_user;
+SET ROLE regress_thrift_framed_user;
+SELECT count(*) FROM thrift_binary_read_framed(:'thrift_binary_frames', true);
+SELECT count(*) FROM thrift_binary_read_framed('../pg_thrift_binary_frames.bin', true);
+RESET ROLE;
+REVOKE EXECUTE ON FUNCTION thrift_binary_read_framed(text, boolean) FROM regress_thrift_framed_user;
+DROP ROLE regress_thrift_framed_user;
+
+-- three frames with a 32MB string each, reading them refills the 64MB window twice
+CREATE FUNCTION thrift_big_frame(i integer) RETURNS bytea AS $$ SELECT E'\\x0b0001' :: bytea || int4send(33554432) || convert_to(repeat(chr(96 + i), 33554432), 'UTF8') || E'\\x00' :: bytea $$ LANGUAGE sql;
+\set thrift_big_frames :abs_builddir '/results/pg_thrift_big_frames.bin'
+SELECT lo_from_bytea(0, string_agg(int4send(33554440) || thrift_big_frame(i), '' ORDER BY i)) AS frames FROM generate_series(1, 3) AS i \gset
+SELECT lo_export(:frames, :'thrift_big_frames');
+SELECT lo_unlink(:frames);
+SELECT i, length(frame), frame = thrift_big_frame(i :: integer) AS same FROM thrift_binary_read_framed(:'thrift_big_frames', true) WITH ORDINALITY AS f (frame, i);
+SELECT lo_from_bytea(0, '') AS frames \gset
+SELECT lo_export(:frames, :'thrift_big_frames');
+SELECT lo_unlink(:frames);
+SELECT count(*) FROM thrift_binary_read_framed(:'thrift_big_frames', true);
+DROP FUNCTION thrift_big_frame(integer);
+
+DROP EXTENSION pg_thrift;